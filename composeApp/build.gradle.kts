@@ -253,6 +253,7 @@ kotlin {
         }
         val desktopTest by getting {
             dependencies {
+                implementation(libs.kotlin.testJunit)
                 implementation(libs.sqldelight.sqlite.driver)
             }
         }
@@ -1,5 +1,6 @@
 package id.homebase.homebasekmppoc
 
+import android.content.ComponentCallbacks2
 import android.content.Intent
 import android.os.Bundle
 import androidx.activity.ComponentActivity
@@ -14,6 +15,7 @@ import id.homebase.homebasekmppoc.lib.storage.SharedPreferences
 import id.homebase.homebasekmppoc.lib.youauth.YouAuthFlowManager
 import id.homebase.homebasekmppoc.prototype.lib.database.DatabaseDriverFactory
 import id.homebase.homebasekmppoc.prototype.lib.database.DatabaseManager
+import id.homebase.homebasekmppoc.prototype.ui.chat.ImageBitmapCache
 import io.github.vinceglb.filekit.FileKit
 import io.github.vinceglb.filekit.dialogs.init
 import kotlinx.coroutines.launch
@@ -60,6 +62,16 @@ class MainActivity : ComponentActivity() {
         }
     }
 
+    override fun onTrimMemory(level: Int) {
+        super.onTrimMemory(level)
+        // Decoded previews are cheap to rebuild; give them up before anything else
+        val cache = ImageBitmapCache.shared
+        when {
+            level >= ComponentCallbacks2.TRIM_MEMORY_BACKGROUND -> cache.clear()
+            level >= ComponentCallbacks2.TRIM_MEMORY_UI_HIDDEN -> cache.trimToSize(cache.maxBytes / 4)
+        }
+    }
+
     override fun onResume() {
         super.onResume()
         // Update ActivityProvider reference on resume
@@ -52,6 +52,29 @@ actual fun ByteArray.toImageBitmap(): ImageBitmap? {
     }
 }
 
+/**
+ * Android implementation of DecodedImage backed by a Bitmap
+ */
+actual class DecodedImage internal constructor(private val bitmap: Bitmap) : AutoCloseable {
+    actual val width: Int get() = bitmap.width
+    actual val height: Int get() = bitmap.height
+
+    actual fun scale(width: Int, height: Int): DecodedImage {
+        // createScaledBitmap hands back the same instance for an unchanged size
+        if (width == bitmap.width && height == bitmap.height)
+            return DecodedImage(bitmap.copy(Bitmap.Config.ARGB_8888, false))
+        return DecodedImage(bitmap.scale(width, height, filter = true))
+    }
+
+    @RequiresApi(Build.VERSION_CODES.R)
+    actual fun encode(format: ImageFormat, quality: Int): ByteArray =
+        ImageUtils.encodeBitmap(bitmap, format, quality)
+
+    actual override fun close() {
+        bitmap.recycle()
+    }
+}
+
 /**
  * Android implementation of ImageUtils using Android Bitmap APIs
  */
@@ -67,7 +90,7 @@ actual object ImageUtils {
     }
 
     @RequiresApi(Build.VERSION_CODES.R)
-    private fun encodeBitmap(bitmap: Bitmap, format: ImageFormat, quality: Int): ByteArray {
+    internal fun encodeBitmap(bitmap: Bitmap, format: ImageFormat, quality: Int): ByteArray {
         val compressFormat = when (format) {
             ImageFormat.JPEG -> Bitmap.CompressFormat.JPEG
             ImageFormat.PNG -> Bitmap.CompressFormat.PNG
@@ -206,5 +229,24 @@ actual object ImageUtils {
         BitmapFactory.decodeByteArray(srcBytes, 0, srcBytes.size, options)
         return ImageSize(options.outWidth, options.outHeight)
     }
+
+    actual fun decode(srcBytes: ByteArray, maxDimension: Int): DecodedImage {
+        if (maxDimension <= 0) return DecodedImage(decodeBitmap(srcBytes))
+
+        // inSampleSize reduces during decode (DCT scaling for JPEG); keep the result at or above the target
+        val natural = getNaturalSize(srcBytes)
+        val (targetW, targetH) = calculateTargetDimensions(natural.pixelWidth, natural.pixelHeight, maxDimension, maxDimension)
+        var sampleSize = 1
+        while (natural.pixelWidth / (sampleSize * 2) >= targetW && natural.pixelHeight / (sampleSize * 2) >= targetH) {
+            sampleSize *= 2
+        }
+        val options = BitmapFactory.Options().apply {
+            inPreferredConfig = Bitmap.Config.ARGB_8888
+            inSampleSize = sampleSize
+        }
+        val bitmap = BitmapFactory.decodeByteArray(srcBytes, 0, srcBytes.size, options)
+            ?: throw IllegalArgumentException("Failed to decode image bytes")
+        return DecodedImage(bitmap)
+    }
 }
 
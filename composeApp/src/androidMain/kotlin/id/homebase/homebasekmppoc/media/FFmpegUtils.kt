@@ -9,15 +9,17 @@ import java.io.File
 import java.util.UUID
 import kotlinx.coroutines.Dispatchers
 import kotlinx.coroutines.withContext
+import kotlinx.io.RawSource
+import kotlinx.io.files.Path
 import org.json.JSONObject
 
 actual object FFmpegUtils {
     private const val TAG = "FFmpegUtils"
 
     actual fun getUniqueId(filePath: String): String {
-        val file = File(filePath)
-        // Simple deterministic ID generation based on file props
-        return UUID.nameUUIDFromBytes("${file.name}_${file.length()}".toByteArray()).toString()
+        val file = File(filePath).absoluteFile
+        // Deterministic from path, size and modification time, so a changed file gets a new ID
+        return UUID.nameUUIDFromBytes("${file.path}_${file.length()}_${file.lastModified()}".toByteArray()).toString()
     }
 
     actual suspend fun grabThumbnail(inputPath: String): String? =
@@ -193,11 +195,12 @@ actual object FFmpegUtils {
                 }
             }
 
-    actual suspend fun cacheInputVideo(fileName: String, data: ByteArray): String =
+    actual suspend fun ingestVideo(fileName: String, source: RawSource): IngestedVideo =
             withContext(Dispatchers.IO) {
                 val context = ActivityProvider.requireActivity().applicationContext
                 val cacheFile = File(context.cacheDir, "input_$fileName")
-                cacheFile.writeBytes(data)
-                return@withContext cacheFile.absolutePath
+                val (sha256, size) = VideoIngest.spool(source, Path(cacheFile.absolutePath))
+                // FFmpegKit probes files, not our stream; the caller probes when it needs to
+                return@withContext IngestedVideo(cacheFile.absolutePath, size, sha256, probe = null)
             }
 }
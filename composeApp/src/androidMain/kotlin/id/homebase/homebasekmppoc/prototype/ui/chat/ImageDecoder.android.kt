@@ -3,11 +3,27 @@ package id.homebase.homebasekmppoc.prototype.ui.chat
 import android.graphics.BitmapFactory
 import androidx.compose.ui.graphics.ImageBitmap
 import androidx.compose.ui.graphics.asImageBitmap
+import androidx.core.graphics.scale
 
 /** Android implementation: Decodes image bytes to ImageBitmap using BitmapFactory. */
-actual fun decodeImageBitmap(bytes: ByteArray): ImageBitmap? {
+actual fun decodeImageBitmap(bytes: ByteArray, targetWidth: Int, targetHeight: Int): ImageBitmap? {
     return try {
-        BitmapFactory.decodeByteArray(bytes, 0, bytes.size)?.asImageBitmap()
+        val bounds = BitmapFactory.Options().apply { inJustDecodeBounds = true }
+        BitmapFactory.decodeByteArray(bytes, 0, bytes.size, bounds)
+        val (w, h) = coverSize(bounds.outWidth, bounds.outHeight, targetWidth, targetHeight)
+            ?: return BitmapFactory.decodeByteArray(bytes, 0, bytes.size)?.asImageBitmap()
+
+        // Subsample during decode as far as it stays at or above the target, then scale the rest
+        var sampleSize = 1
+        while (bounds.outWidth / (sampleSize * 2) >= w && bounds.outHeight / (sampleSize * 2) >= h) {
+            sampleSize *= 2
+        }
+        val options = BitmapFactory.Options().apply { inSampleSize = sampleSize }
+        val bitmap = BitmapFactory.decodeByteArray(bytes, 0, bytes.size, options) ?: return null
+        if (bitmap.width == w && bitmap.height == h) return bitmap.asImageBitmap()
+        val scaled = bitmap.scale(w, h, filter = true)
+        if (scaled !== bitmap) bitmap.recycle()
+        scaled.asImageBitmap()
     } catch (e: Exception) {
         null
     }
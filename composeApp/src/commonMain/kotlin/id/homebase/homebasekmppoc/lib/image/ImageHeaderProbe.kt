@@ -0,0 +1,276 @@
+package id.homebase.homebasekmppoc.lib.image
+
+import kotlin.math.abs
+
+/**
+ * What the header of an encoded image says about it.
+ *
+ * size is the stored pixel size; orientation is the EXIF value (1 = as stored, 5..8 = rotated by
+ * 90 degrees), derived from irot for HEIC/AVIF.
+ */
+data class ImageProbe(
+    val contentType: String,
+    val size: ImageSize,
+    val orientation: Int = 1
+) {
+    /** The size once orientation is applied, which is what decoders that honour it return */
+    val displaySize: ImageSize
+        get() = if (orientation in 5..8) ImageSize(size.pixelHeight, size.pixelWidth) else size
+}
+
+/**
+ * Reads dimensions, orientation and format from the first bytes of JPEG, PNG, GIF, WebP, BMP,
+ * HEIC and AVIF files without decoding pixels. Returns null for anything else, or if the
+ * header is truncated or malformed, so callers can fall back to a full decode.
+ */
+object ImageHeaderProbe {
+
+    fun probe(bytes: ByteArray): ImageProbe? {
+        return try {
+            val r = ByteReader(bytes)
+            when {
+                r.u8(0) == 0xFF && r.u8(1) == 0xD8 -> probeJpeg(r)
+                r.u32(0) == 0x89504E47L -> probePng(r)
+                r.ascii(0, 4) == "GIF8" -> probeGif(r)
+                r.ascii(0, 4) == "RIFF" && r.ascii(8, 4) == "WEBP" -> probeWebp(r)
+                r.ascii(0, 2) == "BM" -> probeBmp(r)
+                r.ascii(4, 4) == "ftyp" -> probeHeif(r)
+                else -> null
+            }
+        } catch (_: IndexOutOfBoundsException) {
+            null // Truncated
+        }
+    }
+
+    private class ByteReader(val bytes: ByteArray) {
+        val size get() = bytes.size
+
+        fun u8(at: Int): Int {
+            if (at < 0 || at >= bytes.size) throw IndexOutOfBoundsException()
+            return bytes[at].toInt() and 0xFF
+        }
+
+        fun u16(at: Int, littleEndian: Boolean = false): Int =
+            if (littleEndian) u8(at) or (u8(at + 1) shl 8) else (u8(at) shl 8) or u8(at + 1)
+
+        fun u24le(at: Int): Int = u8(at) or (u8(at + 1) shl 8) or (u8(at + 2) shl 16)
+
+        fun u32(at: Int, littleEndian: Boolean = false): Long =
+            if (littleEndian) u16(at, true).toLong() or (u16(at + 2, true).toLong() shl 16)
+            else (u16(at).toLong() shl 16) or u16(at + 2).toLong()
+
+        fun ascii(at: Int, length: Int): String {
+            if (at < 0 || at + length > bytes.size) return ""
+            return CharArray(length) { (bytes[at + it].toInt() and 0xFF).toChar() }.concatToString()
+        }
+    }
+
+    private fun sizeOrNull(width: Long, height: Long): ImageSize? {
+        if (width <= 0 || height <= 0 || width > Int.MAX_VALUE || height > Int.MAX_VALUE) return null
+        return ImageSize(width.toInt(), height.toInt())
+    }
+
+    // JPEG: walk the marker segments to the first SOFn, picking up EXIF orientation on the way
+    private fun probeJpeg(r: ByteReader): ImageProbe? {
+        var pos = 2
+        var orientation = 1
+        while (true) {
+            if (r.u8(pos) != 0xFF) return null
+            // Any number of 0xFF fill bytes may precede a marker
+            while (r.u8(pos) == 0xFF) pos++
+            val marker = r.u8(pos)
+            pos++
+
+            // Standalone markers carry no length
+            if (marker == 0x01 || marker in 0xD0..0xD7) continue
+            // Image data or end of image before a frame header: not something we can size
+            if (marker == 0xD9 || marker == 0xDA) return null
+
+            val length = r.u16(pos)
+            if (length < 2) return null
+
+            when {
+                marker == 0xE1 && r.ascii(pos + 2, 6) == "Exif\u0000\u0000" ->
+                    orientation = exifOrientation(r, pos + 8, pos + length) ?: orientation
+
+                // SOF0..SOF15, except DHT (C4), JPG (C8) and DAC (CC) which share the range
+                marker in 0xC0..0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC -> {
+                    val size = sizeOrNull(r.u16(pos + 5).toLong(), r.u16(pos + 3).toLong()) ?: return null
+                    return ImageProbe("image/jpeg", size, orientation)
+                }
+            }
+            pos += length
+        }
+    }
+
+    private fun exifOrientation(r: ByteReader, tiff: Int, end: Int): Int? {
+        val littleEndian = when (r.ascii(tiff, 2)) {
+            "II" -> true
+            "MM" -> false
+            else -> return null
+        }
+        if (r.u16(tiff + 2, littleEndian) != 42) return null
+        val ifd = tiff + r.u32(tiff + 4, littleEndian).toInt()
+        if (ifd < tiff || ifd + 2 > end) return null
+
+        val entries = r.u16(ifd, littleEndian)
+        for (i in 0 until entries) {
+            val entry = ifd + 2 + i * 12
+            if (entry + 12 > end) return null
+            if (r.u16(entry, littleEndian) == 0x0112) {
+                val value = r.u16(entry + 8, littleEndian)
+                return if (value in 1..8) value else null
+            }
+        }
+        return null
+    }
+
+    private fun probePng(r: ByteReader): ImageProbe? {
+        if (r.ascii(12, 4) != "IHDR") return null
+        val size = sizeOrNull(r.u32(16), r.u32(20)) ?: return null
+        return ImageProbe("image/png", size)
+    }
+
+    private fun probeGif(r: ByteReader): ImageProbe? {
+        val version = r.ascii(3, 3)
+        if (version != "87a" && version != "89a") return null
+        val size = sizeOrNull(r.u16(6, true).toLong(), r.u16(8, true).toLong()) ?: return null
+        return ImageProbe("image/gif", size)
+    }
+
+    private fun probeWebp(r: ByteReader): ImageProbe? {
+        val size = when (r.ascii(12, 4)) {
+            // Lossy: keyframe start code, then 14 bit dimensions (the top 2 bits are scaling)
+            "VP8 " -> {
+                if (r.u8(23) != 0x9D || r.u8(24) != 0x01 || r.u8(25) != 0x2A) return null
+                sizeOrNull((r.u16(26, true) and 0x3FFF).toLong(), (r.u16(28, true) and 0x3FFF).toLong())
+            }
+            // Lossless: signature byte, then 14 bits each of width - 1 and height - 1
+            "VP8L" -> {
+                if (r.u8(20) != 0x2F) return null
+                val bits = r.u32(21, true)
+                sizeOrNull((bits and 0x3FFFL) + 1, ((bits shr 14) and 0x3FFFL) + 1)
+            }
+            // Extended: 24 bit canvas width - 1 and height - 1
+            "VP8X" -> sizeOrNull(r.u24le(24).toLong() + 1, r.u24le(27).toLong() + 1)
+            else -> null
+        } ?: return null
+        return ImageProbe("image/webp", size)
+    }
+
+    private fun probeBmp(r: ByteReader): ImageProbe? {
+        val headerSize = r.u32(14, true)
+        val size = if (headerSize == 12L) {
+            // OS/2 BITMAPCOREHEADER
+            sizeOrNull(r.u16(18, true).toLong(), r.u16(20, true).toLong())
+        } else {
+            // Negative height means top-down rows
+            sizeOrNull(r.u32(18, true).toInt().toLong(), abs(r.u32(22, true).toInt()).toLong())
+        } ?: return null
+        return ImageProbe("image/bmp", size)
+    }
+
+    // HEIC / AVIF (ISO base media file format)
+
+    private val heicBrands = setOf("heic", "heix", "heim", "heis", "hevc", "hevx", "hevm", "hevs")
+    private val avifBrands = setOf("avif", "avis")
+
+    private class Box(val type: String, val start: Int, val end: Int, val body: Int)
+
+    private fun boxes(r: ByteReader, from: Int, to: Int): Sequence<Box> = sequence {
+        var pos = from
+        while (pos + 8 <= to) {
+            var size = r.u32(pos)
+            val type = r.ascii(pos + 4, 4)
+            var header = 8
+            if (size == 1L) {
+                size = (r.u32(pos + 8) shl 32) or r.u32(pos + 12)
+                header = 16
+            } else if (size == 0L) {
+                size = (to - pos).toLong()
+            }
+            if (size < header || pos + size > to) break
+            yield(Box(type, pos, pos + size.toInt(), pos + header))
+            pos += size.toInt()
+        }
+    }
+
+    private fun probeHeif(r: ByteReader): ImageProbe? {
+        val ftyp = boxes(r, 0, r.size).firstOrNull() ?: return null
+        val brands = buildList {
+            add(r.ascii(ftyp.body, 4))
+            // Skip minor_version
+            var pos = ftyp.body + 8
+            while (pos + 4 <= ftyp.end) {
+                add(r.ascii(pos, 4))
+                pos += 4
+            }
+        }
+        val contentType = when {
+            brands.any { it in avifBrands } -> "image/avif"
+            brands.any { it in heicBrands } -> "image/heic"
+            else -> return null
+        }
+
+        // meta is a full box: 4 bytes of version and flags before its children
+        val meta = boxes(r, ftyp.end, r.size).firstOrNull { it.type == "meta" } ?: return null
+        val metaChildren = boxes(r, meta.body + 4, meta.end).toList()
+
+        val pitm = metaChildren.firstOrNull { it.type == "pitm" }
+        val primaryItem = pitm?.let { if (r.u8(it.body) == 0) r.u16(it.body + 4).toLong() else r.u32(it.body + 4) }
+
+        val iprp = metaChildren.firstOrNull { it.type == "iprp" } ?: return null
+        val iprpChildren = boxes(r, iprp.body, iprp.end).toList()
+        val ipco = iprpChildren.firstOrNull { it.type == "ipco" } ?: return null
+        val properties = boxes(r, ipco.body, ipco.end).toList()
+
+        // Properties of the primary item; without pitm/ipma fall back to the largest ispe
+        val ipma = iprpChildren.firstOrNull { it.type == "ipma" }
+        val associated = primaryItem
+            ?.let { item -> ipma?.let { ipmaProperties(r, it, item) } }
+            ?.mapNotNull { properties.getOrNull(it - 1) }
+            ?: properties
+
+        val size = associated.filter { it.type == "ispe" }
+            .mapNotNull { sizeOrNull(r.u32(it.body + 4), r.u32(it.body + 8)) }
+            .maxByOrNull { it.pixelWidth.toLong() * it.pixelHeight }
+            ?: return null
+
+        // irot is counter-clockwise quarter turns; as EXIF orientation 90 ccw is 8, 270 ccw is 6
+        val orientation = when (associated.firstOrNull { it.type == "irot" }?.let { r.u8(it.body) and 3 }) {
+            1 -> 8
+            2 -> 3
+            3 -> 6
+            else -> 1
+        }
+        return ImageProbe(contentType, size, orientation)
+    }
+
+    /** 1-based ipco indices associated with item in an ipma box. */
+    private fun ipmaProperties(r: ByteReader, ipma: Box, item: Long): List<Int>? {
+        val version = r.u8(ipma.body)
+        val flags = r.u8(ipma.body + 3)
+        var pos = ipma.body + 4
+        var entries = r.u32(pos)
+        pos += 4
+        while (entries-- > 0) {
+            val id = if (version < 1) r.u16(pos).toLong().also { pos += 2 } else r.u32(pos).also { pos += 4 }
+            val count = r.u8(pos)
+            pos++
+            val indices = ArrayList<Int>(count)
+            repeat(count) {
+                // The top bit is the essential flag
+                if (flags and 1 != 0) {
+                    indices.add(r.u16(pos) and 0x7FFF)
+                    pos += 2
+                } else {
+                    indices.add(r.u8(pos) and 0x7F)
+                    pos++
+                }
+            }
+            if (id == item) return indices
+            if (pos > ipma.end) return null
+        }
+        return null
+    }
+}
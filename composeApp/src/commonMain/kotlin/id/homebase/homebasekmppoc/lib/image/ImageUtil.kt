@@ -9,6 +9,25 @@ import kotlin.math.roundToInt
  */
 expect fun ByteArray.toImageBitmap(): ImageBitmap?
 
+/**
+ * An image decoded into memory, so several outputs can be produced from a single decode.
+ * Holds native pixel memory until closed.
+ */
+expect class DecodedImage : AutoCloseable {
+    val width: Int
+    val height: Int
+
+    /**
+     * Returns a new image scaled to exactly width x height with a high quality filter.
+     * Best results when shrinking by at most half per call.
+     */
+    fun scale(width: Int, height: Int): DecodedImage
+
+    fun encode(format: ImageFormat, quality: Int): ByteArray
+
+    override fun close()
+}
+
 /**
  * Platform-specific image manipulation operations.
  * Each platform implements this using their native image libraries.
@@ -62,6 +81,13 @@ expect object ImageUtils {
      * Utility: get natural size
      */
     fun getNaturalSize(srcBytes: ByteArray): ImageSize
+
+    /**
+     * Decode once for producing several outputs; the caller closes the result.
+     * With maxDimension > 0 the platform may decode at a reduced size, but never smaller than
+     * the natural size fitted into maxDimension x maxDimension.
+     */
+    fun decode(srcBytes: ByteArray, maxDimension: Int = 0): DecodedImage
 }
 
 /**
@@ -2,13 +2,19 @@ package id.homebase.homebasekmppoc.lib.image
 
 import id.homebase.homebasekmppoc.prototype.lib.drives.files.ThumbnailFile
 import id.homebase.homebasekmppoc.prototype.lib.drives.upload.EmbeddedThumb
+import kotlinx.coroutines.CompletableDeferred
+import kotlinx.coroutines.Deferred
 import kotlinx.coroutines.Dispatchers
+import kotlinx.coroutines.async
+import kotlinx.coroutines.coroutineScope
 import kotlinx.coroutines.withContext
 import kotlin.io.encoding.Base64
 import kotlin.io.encoding.ExperimentalEncodingApi
 import kotlin.math.abs
+import kotlin.math.ln
 import kotlin.math.max
 import kotlin.math.roundToInt
+import kotlin.math.sqrt
 
 // Thumb presets
 val baseThumbSizes = listOf(
@@ -89,12 +95,13 @@ suspend fun createThumbnails(
         return@withContext Triple(naturalSize, embedded, listOf(vectorThumb))
     }
 
-    // Determine natural size using ImageUtils (for non-SVG images)
+    // Determine natural size using ImageUtils (for non-SVG images), from the header where possible
     val naturalSize = ImageUtils.getNaturalSize(imageBytes)
 
     if (isGif) {
         // For GIF, create tiny thumb only (webp), no additional thumbnails
-        val tinyThumbFile = createImageThumbnail(imageBytes, payloadKey, tinyThumbSize, isTinyThumb = true)
+        val source = ImageUtils.decode(imageBytes, maxDimension = tinyThumbSize.maxPixelDimension)
+        val tinyThumbFile = renderThumbnails(source, naturalSize, imageBytes, payloadKey, listOf(tinyThumbSize to true)).single()
         val embeddedTiny = EmbeddedThumb(
             pixelWidth = naturalSize.pixelWidth,
             pixelHeight = naturalSize.pixelHeight,
@@ -105,16 +112,25 @@ suspend fun createThumbnails(
     }
 
     // general image case
-    val tinyThumbFile = createImageThumbnail(imageBytes, payloadKey, tinyThumbSize, isTinyThumb = true)
-
     val requestedSizes = thumbSizes ?: baseThumbSizes
     val applicableThumbs = getRevisedThumbs(naturalSize, requestedSizes)
 
-    // Create additional thumbnails (NOT including tiny thumb - only the applicable thumbs)
-    val additional = applicableThumbs.map { instr ->
-        // create with no tiny flag
-        createImageThumbnail(imageBytes, payloadKey, instr, isTinyThumb = false)
-    }
+    // Decode once, no larger than the biggest thumbnail needs; every thumbnail, the tiny one included, is made from this
+    val source = ImageUtils.decode(
+        imageBytes,
+        maxDimension = maxOf(tinyThumbSize.maxPixelDimension, applicableThumbs.maxOfOrNull { it.maxPixelDimension } ?: 0)
+    )
+
+    // Additional thumbnails (NOT including tiny thumb - only the applicable thumbs), then the tiny thumb
+    val rendered = renderThumbnails(
+        source,
+        naturalSize,
+        imageBytes,
+        payloadKey,
+        applicableThumbs.map { it to false } + (tinyThumbSize to true)
+    )
+    val additional = rendered.dropLast(1)
+    val tinyThumbFile = rendered.last()
 
     val embeddedTiny = EmbeddedThumb(
         pixelWidth = tinyThumbFile.pixelWidth,
@@ -129,8 +145,10 @@ suspend fun createThumbnails(
 /**
  * Create a single thumbnail according to instruction.
  * - Resizes to fit inside maxPixelDimension x maxPixelDimension preserving aspect.
- * - Tries initial quality; if resulting size > maxBytes it reduces quality in a loop until satisfying or quality==1.
+ * - Tries initial quality; if resulting size > maxBytes it searches for the highest quality that fits, shrinking only at quality 1.
  * - Returns ThumbnailFile (payload bytes).
+ *
+ * Decodes imageBytes on every call; use createThumbnails for several sizes of the same image.
  */
 suspend fun createImageThumbnail(
     imageBytes: ByteArray,
@@ -138,83 +156,124 @@ suspend fun createImageThumbnail(
     instruction: ThumbnailInstruction,
     isTinyThumb: Boolean = false
 ): ThumbnailFile = withContext(Dispatchers.Default) {
-    // Determine target format (tiny -> webp forced)
-    val targetFormat = if (isTinyThumb) ImageFormat.WEBP else instruction.type
-
-    val maxDim = instruction.maxPixelDimension
-
-    var quality = instruction.quality.coerceIn(1, 100)
-    var currentInputBytes = imageBytes
+    val source = ImageUtils.decode(imageBytes, maxDimension = instruction.maxPixelDimension)
+    renderThumbnails(source, ImageUtils.getNaturalSize(imageBytes), imageBytes, payloadKey, listOf(instruction to isTinyThumb))
+        .single()
+}
 
-    // Check if image is already at perfect size and doesn't need processing
-    val naturalSize = ImageUtils.getNaturalSize(imageBytes)
+/**
+ * Produces a thumbnail per (instruction, isTinyThumb) from an already decoded source, in the
+ * same order. Takes ownership of source and closes it. Output sizes follow naturalSize; source
+ * may be a reduced decode as long as it covers the largest of them.
+ *
+ * Sizes are built largest first, each downscaled from the previous one and never by more than
+ * half per step, so a 48 MP photo is resampled at full size only once and the filter still sees
+ * every pixel. Each size is encoded in parallel as soon as its pixels exist.
+ */
+internal suspend fun renderThumbnails(
+    source: DecodedImage,
+    naturalSize: ImageSize,
+    imageBytes: ByteArray,
+    payloadKey: String,
+    instructions: List<Pair<ThumbnailInstruction, Boolean>>
+): List<ThumbnailFile> {
     val naturalMax = max(naturalSize.pixelWidth, naturalSize.pixelHeight)
-
-    // If image is already at exact target size and within size limit, return as-is
-    // This optimization avoids unnecessary re-encoding
-    if (naturalMax == maxDim &&
-        imageBytes.size <= instruction.maxBytes &&
-        !isTinyThumb) {
-        return@withContext ThumbnailFile(
-            pixelWidth = naturalSize.pixelWidth,
-            pixelHeight = naturalSize.pixelHeight,
-            payload = imageBytes,
-            key = payloadKey,
-            contentType = "image/${targetFormat.name.lowercase()}",
-            quality = quality
-        )
+    val order = instructions.indices.sortedByDescending { instructions[it].first.maxPixelDimension }
+    val results = arrayOfNulls<Deferred<ThumbnailFile>>(instructions.size)
+    val images = mutableListOf(source)
+
+    try {
+        coroutineScope {
+            var previous = source
+            for (i in order) {
+                val (instruction, isTinyThumb) = instructions[i]
+
+                // If image is already at exact target size and within size limit, return as-is
+                // This optimization avoids unnecessary re-encoding
+                if (naturalMax == instruction.maxPixelDimension &&
+                    imageBytes.size <= instruction.maxBytes &&
+                    !isTinyThumb) {
+                    results[i] = CompletableDeferred(
+                        ThumbnailFile(
+                            pixelWidth = naturalSize.pixelWidth,
+                            pixelHeight = naturalSize.pixelHeight,
+                            payload = imageBytes,
+                            key = payloadKey,
+                            contentType = "image/${instruction.type.name.lowercase()}",
+                            quality = instruction.quality.coerceIn(1, 100)
+                        )
+                    )
+                    continue
+                }
+
+                val (targetW, targetH) = calculateTargetDimensions(
+                    naturalSize.pixelWidth,
+                    naturalSize.pixelHeight,
+                    instruction.maxPixelDimension,
+                    instruction.maxPixelDimension
+                )
+                val level = downscale(previous, targetW, targetH)
+                images.add(level)
+
+                // The full size source is by far the largest allocation, drop it as soon as possible
+                if (previous === source) {
+                    images.remove(source)
+                    source.close()
+                }
+                previous = level
+
+                results[i] = async(Dispatchers.Default) {
+                    encodeThumbnail(level, naturalSize, payloadKey, instruction, isTinyThumb)
+                }
+            }
+        }
+    } finally {
+        images.forEach { it.close() }
     }
 
-    // First resize attempt
-    var result = ImageUtils.resizePreserveAspect(
-        currentInputBytes,
-        maxWidth = maxDim,
-        maxHeight = maxDim,
-        outputFormat = targetFormat,
-        quality = quality
-    )
+    return results.map { it!!.await() }
+}
 
-    var safetyCounter = 0
-    while (result.bytes.size > instruction.maxBytes && quality > 1 && safetyCounter < 20) {
-        safetyCounter++
-
-        // Adjust quality drop proportional to excess
-        val excessRatio = result.bytes.size.toDouble() / instruction.maxBytes.toDouble()
-        val qualityDrop = minOf(40, maxOf(5, (quality * excessRatio * 0.5).roundToInt()))
-        quality = (quality - qualityDrop).coerceAtLeast(1)
-
-        // Use previous result as input for next compression attempt
-        currentInputBytes = result.bytes
-        result = ImageUtils.compressOnly(
-            currentInputBytes,
-            outputFormat = targetFormat,
-            quality = quality
-        )
+/**
+ * Scales from down to width x height in steps of at most half. Intermediate steps are closed.
+ */
+private fun downscale(from: DecodedImage, width: Int, height: Int): DecodedImage {
+    var current = from
+    while (current.width > 2 * width || current.height > 2 * height) {
+        val half = current.scale((current.width + 1) / 2, (current.height + 1) / 2)
+        if (current !== from) current.close()
+        current = half
+    }
+    val level = current.scale(width, height)
+    if (current !== from) current.close()
+    return level
+}
 
-        // If still too big for tiny thumb and quality reached near 1, try shrinking pixel dimensions
-        if (result.bytes.size > instruction.maxBytes && quality <= 2 && isTinyThumb) {
-            val newDim = maxOf(1, maxDim - 5)
-            if (newDim < 1) {
-                throw IllegalStateException("Cannot shrink tiny thumb further")
-            }
+/**
+ * Encodes level at the highest quality that fits the instruction's maxBytes, see encodeWithinBudget.
+ */
+private fun encodeThumbnail(
+    level: DecodedImage,
+    naturalSize: ImageSize,
+    payloadKey: String,
+    instruction: ThumbnailInstruction,
+    isTinyThumb: Boolean
+): ThumbnailFile {
+    // Determine target format (tiny -> webp forced)
+    val targetFormat = if (isTinyThumb) ImageFormat.WEBP else instruction.type
 
-            // Try with smaller dimensions
-            result = ImageUtils.resizePreserveAspect(
-                imageBytes,
-                maxWidth = newDim,
-                maxHeight = newDim,
-                outputFormat = targetFormat,
-                quality = 2
-            )
-            break
-        }
+    val encoding = encodeWithinBudget(level, targetFormat, instruction.quality, instruction.maxBytes) { dim, encodedBytes ->
+        // The tiny thumb is an embedded preview and must stay close to its size; others shrink to the estimated fit
+        val next = if (isTinyThumb) dim - 5 else minOf(dim - 1, (dim * sqrt(instruction.maxBytes.toDouble() / encodedBytes) * 0.95).toInt())
+        if (next < 1) null
+        else calculateTargetDimensions(naturalSize.pixelWidth, naturalSize.pixelHeight, next, next)
+            .let { (w, h) -> ImageSize(w, h) }
     }
 
-    val finalBytes = result.bytes
-    val thumb = ThumbnailFile(
-        pixelWidth = result.size.pixelWidth,
-        pixelHeight = result.size.pixelHeight,
-        payload = finalBytes,
+    return ThumbnailFile(
+        pixelWidth = encoding.size.pixelWidth,
+        pixelHeight = encoding.size.pixelHeight,
+        payload = encoding.bytes,
         key = payloadKey,
         contentType = when (targetFormat) {
             ImageFormat.WEBP -> "image/webp"
@@ -223,10 +282,103 @@ suspend fun createImageThumbnail(
             ImageFormat.BMP -> "image/bmp"
             ImageFormat.GIF -> "image/gif"
         },
-        quality = quality
+        quality = encoding.quality
     )
+}
+
+internal class BudgetedEncoding(
+    val bytes: ByteArray,
+    val quality: Int,
+    val size: ImageSize,
+    val encodes: Int
+)
+
+private const val MIN_QUALITY = 1
+
+// Stop searching once the best fitting quality is this close to the lowest one known not to fit
+private const val QUALITY_TOLERANCE = 3
+
+// Aim a little under the budget so the predicted probe usually fits
+private const val TARGET_FILL = 0.95
+
+// JPEG and WebP sizes grow roughly exponentially with quality in the range thumbnails use,
+// about 2.5% per quality point. Only used until the image has given us two points of its own.
+private const val SIZE_LOG_SLOPE = 0.025
+
+/**
+ * Finds the highest quality at which level encodes to at most maxBytes, always encoding from
+ * the decoded pixels. Tries the requested quality first; if that is too big, the size model
+ * picks the next probe and the bracket is then narrowed by interpolating the image's own
+ * log-size curve, falling back to bisection. Only when even MIN_QUALITY does not fit is the
+ * image shrunk, to the size returned by smallerThan (null to give up), at MIN_QUALITY.
+ */
+internal fun encodeWithinBudget(
+    level: DecodedImage,
+    format: ImageFormat,
+    quality: Int,
+    maxBytes: Int,
+    smallerThan: (maxDimension: Int, encodedBytes: Int) -> ImageSize?
+): BudgetedEncoding {
+    var encodes = 0
+    fun encodeAt(q: Int): ByteArray {
+        encodes++
+        return level.encode(format, q)
+    }
+
+    val levelSize = ImageSize(level.width, level.height)
+    val startQuality = quality.coerceIn(MIN_QUALITY, 100)
+    val first = encodeAt(startQuality)
+    if (first.size <= maxBytes)
+        return BudgetedEncoding(first, startQuality, levelSize, encodes)
+
+    // Invariant: tooBig does not fit; fits does (0 and null while nothing has fit yet)
+    var tooBig = startQuality
+    var tooBigBytes = first
+    var fits = 0
+    var fitsBytes: ByteArray? = null
+    var slope = SIZE_LOG_SLOPE
+    val target = ln(maxBytes * TARGET_FILL)
+    var steps = 0
+
+    while (tooBig - fits > 1 && (fitsBytes == null || tooBig - fits > QUALITY_TOLERANCE)) {
+        val predicted = when {
+            // Interpolation can crawl along a skewed curve; bisection bounds the worst case
+            steps >= 2 -> (fits + tooBig) / 2.0
+            fitsBytes != null -> {
+                val low = ln(fitsBytes.size.toDouble())
+                fits + (target - low) / (ln(tooBigBytes.size.toDouble()) - low) * (tooBig - fits)
+            }
+            else -> tooBig + (target - ln(tooBigBytes.size.toDouble())) / slope
+        }
+        val q = predicted.roundToInt().coerceIn(fits + 1, tooBig - 1)
+        val bytes = encodeAt(q)
+        steps++
+
+        if (bytes.size <= maxBytes) {
+            fits = q
+            fitsBytes = bytes
+        } else {
+            if (bytes.size < tooBigBytes.size)
+                slope = (ln(tooBigBytes.size.toDouble() / bytes.size) / (tooBig - q)).coerceIn(0.005, 0.2)
+            tooBig = q
+            tooBigBytes = bytes
+        }
+    }
+
+    if (fitsBytes != null)
+        return BudgetedEncoding(fitsBytes, fits, levelSize, encodes)
+
+    // Quality floor reached and still too big: shrink, staying at the floor
+    var bytes = tooBigBytes
+    var size = levelSize
+    while (bytes.size > maxBytes) {
+        val smaller = smallerThan(max(size.pixelWidth, size.pixelHeight), bytes.size) ?: break
+        encodes++
+        bytes = level.scale(smaller.pixelWidth, smaller.pixelHeight).use { it.encode(format, MIN_QUALITY) }
+        size = smaller
+    }
 
-    return@withContext thumb
+    return BudgetedEncoding(bytes, MIN_QUALITY, size, encodes)
 }
 
 /**
@@ -1,5 +1,7 @@
 package id.homebase.homebasekmppoc.media
 
+import kotlinx.io.RawSource
+
 expect object FFmpegUtils {
     fun getUniqueId(filePath: String): String
 
@@ -11,5 +13,9 @@ expect object FFmpegUtils {
 
     suspend fun segmentVideo(inputPath: String): Pair<String, String>?
 
-    suspend fun cacheInputVideo(fileName: String, data: ByteArray): String
+    /**
+     * Copies a picked video into the cache, streaming it from [source] so it is never held in
+     * memory whole, and hashes and probes it in the same pass.
+     */
+    suspend fun ingestVideo(fileName: String, source: RawSource): IngestedVideo
 }
@@ -0,0 +1,53 @@
+package id.homebase.homebasekmppoc.media
+
+import id.homebase.homebasekmppoc.prototype.lib.crypto.HashUtil
+import kotlinx.io.RawSource
+import kotlinx.io.buffered
+import kotlinx.io.files.Path
+import kotlinx.io.files.SystemFileSystem
+
+/** A picked video, copied into the cache in one streaming pass. */
+data class IngestedVideo(
+        val path: String,
+        val sizeBytes: Long,
+        /** SHA-256 of the content, lowercase hex. */
+        val sha256: String,
+        /** Metadata probed from the same pass, where the platform can; null otherwise. */
+        val probe: VideoProbe?
+)
+
+/** The streaming copy behind [FFmpegUtils.ingestVideo]. */
+internal object VideoIngest {
+    const val BUFFER_SIZE = 64 * 1024
+
+    /**
+     * Streams [source] into [target] a buffer at a time, hashing as it goes, and hands each buffer
+     * to [onChunk] too, e.g. to feed a probe. Returns the SHA-256 as hex and the size. Memory use
+     * is one buffer whatever the size of the video.
+     */
+    fun spool(
+            source: RawSource,
+            target: Path,
+            onChunk: (bytes: ByteArray, length: Int) -> Unit = { _, _ -> }
+    ): Pair<String, Long> {
+        val buffer = ByteArray(BUFFER_SIZE)
+        var size = 0L
+        val digest =
+                HashUtil.sha256Function().use { hash ->
+                    source.buffered().use { input ->
+                        SystemFileSystem.sink(target).buffered().use { output ->
+                            while (true) {
+                                val n = input.readAtMostTo(buffer)
+                                if (n == -1) break
+                                hash.update(buffer, 0, n)
+                                output.write(buffer, 0, n)
+                                onChunk(buffer, n)
+                                size += n
+                            }
+                        }
+                    }
+                    hash.hashToByteArray()
+                }
+        return digest.joinToString("") { it.toUByte().toString(16).padStart(2, '0') } to size
+    }
+}
@@ -0,0 +1,22 @@
+package id.homebase.homebasekmppoc.media
+
+/** What one ffprobe run tells us about a video. */
+data class VideoProbe(
+        val durationSeconds: Double,
+        val width: Int,
+        val height: Int,
+        /** Display rotation in degrees, normalised to 0, 90, 180 or 270. */
+        val rotation: Int,
+        val videoCodec: String?,
+        val hasAudio: Boolean
+) {
+    val isRotatedSideways: Boolean
+        get() = rotation == 90 || rotation == 270
+
+    /** Dimensions as displayed, after rotation. */
+    val displayWidth: Int
+        get() = if (isRotatedSideways) height else width
+
+    val displayHeight: Int
+        get() = if (isRotatedSideways) width else height
+}
@@ -58,3 +58,14 @@ class ServerException(
     problem: ProblemDetails?
 ) : OdinApiException(status, "Server error (status=$status)", correlationId, problem)
 
+/**
+ * The exception for a failed [status] when there is no body to read a problem from, e.g. a
+ * streamed response, as OdinApiProviderBase.throwForFailure would throw it.
+ */
+fun exceptionForStatus(status: Int): OdinApiException =
+    when (status) {
+        401 -> UnauthorizedException()
+        403 -> ForbiddenException()
+        404 -> NotFoundException()
+        else -> ServerException(status = status, correlationId = null, problem = null)
+    }
@@ -11,6 +11,7 @@ import io.ktor.client.call.body
 import io.ktor.client.request.accept
 import io.ktor.client.request.forms.MultiPartFormDataContent
 import io.ktor.client.request.get
+import io.ktor.client.request.header
 import io.ktor.client.request.patch
 import io.ktor.client.request.put
 import io.ktor.client.request.setBody
@@ -19,6 +20,7 @@ import io.ktor.client.statement.readRawBytes
 import io.ktor.http.ContentType
 import io.ktor.http.Headers
 import io.ktor.http.HttpHeaders
+import io.ktor.http.content.ByteArrayContent
 import io.ktor.http.content.TextContent
 import io.ktor.http.contentType
 
@@ -157,6 +159,46 @@ abstract class OdinApiProviderBase(
         )
     }
 
+    protected suspend fun plainPostJson(
+        url: String,
+        token: String,
+        jsonBody: String
+    ): ApiResponse {
+        requireHostInUrl(url)
+
+        return request(
+            {
+                httpClient.post(url) {
+                    bearerAuth(token)
+                    contentType(ContentType.Application.Json)
+                    accept(ContentType.Application.Json)
+                    setBody(TextContent(jsonBody, ContentType.Application.Json))
+                }
+            },
+            secret = null
+        )
+    }
+
+    protected suspend fun plainPutBytes(
+        url: String,
+        token: String,
+        bytes: ByteArray,
+        headers: Map<String, String> = emptyMap()
+    ): ApiResponse {
+        requireHostInUrl(url)
+
+        return request(
+            {
+                httpClient.put(url) {
+                    bearerAuth(token)
+                    headers.forEach { (name, value) -> header(name, value) }
+                    setBody(ByteArrayContent(bytes, ContentType.Application.OctetStream))
+                }
+            },
+            secret = null
+        )
+    }
+
     protected suspend fun plainPostMultipart(
         url: String,
         token: String,
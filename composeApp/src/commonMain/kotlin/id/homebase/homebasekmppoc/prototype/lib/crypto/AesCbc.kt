@@ -200,4 +200,23 @@ object AesCbc {
             key: SecureByteArray,
             iv: ByteArray
     ): Flow<ByteArray> = streamDecryptWithCbc(dataStream, key.toByteArray(), iv)
+
+    /**
+     * Decrypt whole blocks taken from anywhere in a CBC stream except its end, so they carry no
+     * padding. [iv] is the ciphertext block just before [cipherText], or the stream IV when it
+     * starts at the beginning. Uses the same artificial padding as [streamDecryptWithCbc].
+     */
+    suspend fun decryptBlocks(cipherText: ByteArray, key: ByteArray, iv: ByteArray): ByteArray {
+        require(cipherText.isNotEmpty() && cipherText.size % BLOCK_SIZE == 0) {
+            "CipherText must be a non-empty multiple of $BLOCK_SIZE bytes"
+        }
+        require(key.isNotEmpty()) { "Key cannot be empty" }
+        require(iv.size == BLOCK_SIZE) { "IV must be $BLOCK_SIZE bytes" }
+
+        val cipher = aes.keyDecoder().decodeFromByteArray(AES.Key.Format.RAW, key).cipher()
+        val padding = ByteArray(BLOCK_SIZE) { BLOCK_SIZE.toByte() }
+        val lastBlock = cipherText.copyOfRange(cipherText.size - BLOCK_SIZE, cipherText.size)
+        val encryptedPadding = cipher.encryptWithIv(lastBlock, padding).copyOfRange(0, BLOCK_SIZE)
+        return cipher.decryptWithIv(iv, ByteArrayUtil.combine(cipherText, encryptedPadding))
+    }
 }
@@ -4,6 +4,7 @@ import dev.whyoleg.cryptography.BinarySize.Companion.bytes
 import dev.whyoleg.cryptography.CryptographyProvider
 import dev.whyoleg.cryptography.algorithms.HKDF
 import dev.whyoleg.cryptography.algorithms.SHA256
+import dev.whyoleg.cryptography.functions.HashFunction
 import kotlinx.io.Source
 import kotlinx.io.readByteArray
 import kotlin.uuid.Uuid
@@ -21,6 +22,9 @@ object HashUtil {
         return sha256Algo.hasher().hash(input)
     }
 
+    /** Incremental SHA-256, for data that should not be read into memory at once. Close when done. */
+    fun sha256Function(): HashFunction = sha256Algo.hasher().createHashFunction()
+
     /** Compute SHA-256 hash of a stream with optional nonce Returns hash and stream length */
     suspend fun streamSha256(
             inputStream: Source,
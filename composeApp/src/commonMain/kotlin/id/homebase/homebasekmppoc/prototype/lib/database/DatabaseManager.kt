@@ -6,16 +6,19 @@ import app.cash.sqldelight.db.SqlCursor
 import app.cash.sqldelight.db.SqlPreparedStatement
 import co.touchlab.kermit.Logger
 import id.homebase.homebasekmppoc.lib.database.AppNotifications
+import id.homebase.homebasekmppoc.lib.database.Download
 import id.homebase.homebasekmppoc.lib.database.DriveLocalTagIndex
 import id.homebase.homebasekmppoc.lib.database.DriveMainIndex
 import id.homebase.homebasekmppoc.lib.database.DriveTagIndex
 import id.homebase.homebasekmppoc.lib.database.KeyValue
 import id.homebase.homebasekmppoc.lib.database.OdinDatabase
 import id.homebase.homebasekmppoc.lib.database.Outbox
+import kotlinx.coroutines.CoroutineDispatcher
 import kotlinx.coroutines.Dispatchers
 import kotlinx.coroutines.IO
 import kotlinx.coroutines.withContext
 import id.homebase.homebasekmppoc.lib.database.AppNotificationsWrapper
+import id.homebase.homebasekmppoc.lib.database.DownloadWrapper
 import id.homebase.homebasekmppoc.lib.database.DriveMainIndexWrapper
 import id.homebase.homebasekmppoc.lib.database.DriveTagIndexWrapper
 import id.homebase.homebasekmppoc.lib.database.DriveLocalTagIndexWrapper
@@ -27,6 +30,10 @@ private val appNotificationsAdapter = AppNotifications.Adapter(
     identityIdAdapter = UuidAdapter,
     notificationIdAdapter = UuidAdapter
 )
+private val downloadAdapter = Download.Adapter(
+    driveIdAdapter = UuidAdapter,
+    fileIdAdapter = UuidAdapter
+)
 private val driveMainIndexAdapter = DriveMainIndex.Adapter(
     identityIdAdapter = UuidAdapter,
     driveIdAdapter = UuidAdapter,
@@ -56,12 +63,15 @@ private val outboxAdapter = Outbox.Adapter(
     dependencyFileIdAdapter = UuidAdapter
 )
 
-class DatabaseManager(driverProvider: () -> SqlDriver) : AutoCloseable
+// dbDispatcher is injectable so tests can run database work on a virtual-time test dispatcher
+class DatabaseManager(
+    private val dbDispatcher: CoroutineDispatcher = Dispatchers.IO.limitedParallelism(1),
+    driverProvider: () -> SqlDriver
+) : AutoCloseable
 {
     private val logger = Logger.withTag("DatabaseManager")
     private var database: OdinDatabase
     private var driver: SqlDriver
-    private val dbDispatcher = Dispatchers.IO.limitedParallelism(1)
 
     init {
         driver = driverProvider()
@@ -69,6 +79,7 @@ class DatabaseManager(driverProvider: () -> SqlDriver) : AutoCloseable
         database = OdinDatabase(
             driver,
             appNotificationsAdapter,
+            downloadAdapter,
             driveLocalTagIndexAdapter,
             driveMainIndexAdapter,
             driveTagIndexAdapter,
@@ -79,7 +90,7 @@ class DatabaseManager(driverProvider: () -> SqlDriver) : AutoCloseable
     }
 
     companion object {
-        private const val DATABASE_VERSION=1  // Increase to wipe the database and rebuild all tables
+        private const val DATABASE_VERSION=5  // Increase to wipe the database and rebuild all tables
         private lateinit var instance: DatabaseManager
         val appDb: DatabaseManager get() = instance
 
@@ -87,7 +98,7 @@ class DatabaseManager(driverProvider: () -> SqlDriver) : AutoCloseable
             if (::instance.isInitialized) throw IllegalStateException("Already initialized")
 
             val driver = driverProvider()
-            instance = DatabaseManager(driverProvider)
+            instance = DatabaseManager(driverProvider = driverProvider)
 
             val version = instance.driveMainIndex.getSchemaVersion()
 
@@ -103,11 +114,13 @@ class DatabaseManager(driverProvider: () -> SqlDriver) : AutoCloseable
                 try {
                     val tables = listOf(
                         "AppNotifications",
+                        "Download",
                         "DriveLocalTagIndex",
                         "DriveMainIndex",
                         "DriveTagIndex",
                         "KeyValue",
-                        "Outbox"
+                        "Outbox",
+                        "OutboxSpoolRef"
                     )
                     tables.forEach { table ->
                         driver.execute(null, "DROP TABLE IF EXISTS $table;", 0)
@@ -129,6 +142,7 @@ class DatabaseManager(driverProvider: () -> SqlDriver) : AutoCloseable
     public val driveTagIndex: DriveTagIndexWrapper by lazy { DriveTagIndexWrapper(driver, driveTagIndexAdapter, this) }
     public val driveLocalTagIndex: DriveLocalTagIndexWrapper by lazy { DriveLocalTagIndexWrapper(driver, driveLocalTagIndexAdapter, this) }
     public val outbox: OutboxWrapper by lazy { OutboxWrapper(driver, outboxAdapter, this) }
+    public val downloads: DownloadWrapper by lazy { DownloadWrapper(driver, downloadAdapter, this) }
 
     suspend fun <R> executeReadQuery(
         identifier: Int?,
@@ -0,0 +1,153 @@
+package id.homebase.homebasekmppoc.lib.database
+
+import app.cash.sqldelight.db.SqlDriver
+import id.homebase.homebasekmppoc.prototype.lib.core.time.UnixTimeUtc
+import id.homebase.homebasekmppoc.prototype.lib.database.DatabaseManager
+import kotlin.uuid.Uuid
+import kotlinx.atomicfu.atomic
+import kotlinx.coroutines.flow.MutableStateFlow
+import kotlinx.coroutines.flow.StateFlow
+import kotlinx.coroutines.flow.asStateFlow
+import kotlinx.coroutines.flow.update
+
+/**
+ * The download queue, the counterpart of the outbox: a row per payload to fetch to a file, with
+ * a priority, a retry schedule and the progress of its part file. See DownloadManager.
+ */
+class DownloadWrapper(
+    driver: SqlDriver,
+    downloadAdapter: Download.Adapter,
+    private val databaseManager: DatabaseManager
+) {
+    private val delegate = DownloadQueries(driver, downloadAdapter)
+
+    private val lastStamp = atomic(0L)
+
+    // Next run time of every waiting row, kept in step with the table as for the outbox
+    val schedule = OutboxTimerHeap()
+
+    // Bumped whenever a download may have become due earlier than DownloadManager, which waits on it, would wake
+    private val _scheduleChanged = MutableStateFlow(0L)
+    val scheduleChanged: StateFlow<Long> = _scheduleChanged.asStateFlow()
+
+    private fun signalScheduleChanged() {
+        _scheduleChanged.update { it + 1 }
+    }
+
+    private fun nextCheckOutStamp(): Long {
+        while (true) {
+            val now = UnixTimeUtc.now().milliseconds
+            val current = lastStamp.value
+            val candidate = if (now > current) now else current + 1
+            if (lastStamp.compareAndSet(current, candidate)) {
+                return candidate
+            }
+        }
+    }
+
+    // Checks out the most urgent due download whose host is not in [busyHosts]
+    suspend fun checkout(now: UnixTimeUtc = UnixTimeUtc.now(), busyHosts: Collection<String> = emptyList()): Download?
+    {
+        return databaseManager.withWriteValue {
+            delegate.checkout(
+                checkOutStamp = nextCheckOutStamp(),
+                now = now.milliseconds,
+                busyHosts = busyHosts
+            ).executeAsOneOrNull()?.also { schedule.remove(it.rowId) }
+        }
+    }
+
+    fun selectByTargetPath(targetPath: String): Download? =
+        delegate.selectByTargetPath(targetPath).executeAsOneOrNull()
+
+    fun selectAll(): List<Download> = delegate.selectAll().executeAsList()
+
+    fun count(): Long = delegate.count().executeAsOne()
+
+    // Returns the rowId, or null if a download to targetPath is already queued
+    suspend fun insert(
+        driveId: Uuid,
+        fileId: Uuid,
+        payloadKey: String,
+        host: String,
+        targetPath: String,
+        expectedSha256: String?,
+        priority: Long,
+    ): Long? {
+        val rowId = databaseManager.withWriteValue {
+            delegate.transactionWithResult {
+                val n = delegate.insert(
+                    driveId,
+                    fileId,
+                    payloadKey,
+                    host,
+                    targetPath,
+                    expectedSha256,
+                    priority,
+                    0,
+                    0,
+                    null,
+                    0,
+                    null
+                ).value
+                if (n == 0L) return@transactionWithResult null
+                delegate.lastInsertRowId().executeAsOne()
+            }
+        } ?: return null
+        // Only once committed, so a rolled back insert leaves nothing in the heap
+        schedule.upsert(rowId, 0)
+        signalScheduleChanged()
+        return rowId
+    }
+
+    // Signals only when the retry is due before the scheduler would wake anyway: it sleeps until
+    // the first run time after its last round, which is no later than the first after [now]
+    suspend fun checkInFailed(
+        checkOutStamp: Long,
+        nextRunTime: Long,
+        now: UnixTimeUtc = UnixTimeUtc.now(),
+    ): Long {
+        val (n, earliest) = databaseManager.withWriteValue {
+            val rowId = delegate.selectCheckedOut(checkOutStamp).executeAsOneOrNull()?.rowId
+            val earliest = schedule.nextAfter(now.milliseconds)
+            delegate.checkInFailed(nextRunTime = nextRunTime, checkOutStamp = checkOutStamp).value
+                .also { if (rowId != null) schedule.upsert(rowId, nextRunTime) } to earliest
+        }
+        if (earliest == null || nextRunTime < earliest)
+            signalScheduleChanged()
+        return n
+    }
+
+    suspend fun updateProgress(
+        checkOutStamp: Long,
+        bytesReceived: Long,
+        totalBytes: Long?,
+    ): Long {
+        return databaseManager.withWriteValue {
+            delegate.updateProgress(bytesReceived = bytesReceived, totalBytes = totalBytes, checkOutStamp = checkOutStamp).value
+        }
+    }
+
+    // Call at startup: requeues whatever was checked out when the app stopped and rebuilds the schedule
+    suspend fun clearCheckedOut(): Long
+    {
+        val n = databaseManager.withWriteValue {
+            delegate.clearCheckedOut().value.also {
+                schedule.rebuild(delegate.selectSchedule { rowId, nextRunTime -> rowId to nextRunTime }.executeAsList())
+            }
+        }
+        signalScheduleChanged()
+        return n
+    }
+
+    suspend fun deleteByRowId(
+        rowId: Long,
+    ): Long
+    {
+        val n = databaseManager.withWriteValue {
+            delegate.deleteByRowId(rowId).value.also { schedule.remove(rowId) }
+        }
+        signalScheduleChanged() // A slot for its host may be free
+        return n
+    }
+}
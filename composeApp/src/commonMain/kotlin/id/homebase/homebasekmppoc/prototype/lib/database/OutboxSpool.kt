@@ -0,0 +1,206 @@
+package id.homebase.homebasekmppoc.prototype.lib.database
+
+import co.touchlab.kermit.Logger
+import id.homebase.homebasekmppoc.prototype.lib.crypto.HashUtil
+import id.homebase.homebasekmppoc.prototype.lib.serialization.OdinSystemSerializer
+import kotlinx.coroutines.Dispatchers
+import kotlinx.coroutines.IO
+import kotlinx.coroutines.NonCancellable
+import kotlinx.coroutines.sync.Mutex
+import kotlinx.coroutines.sync.withLock
+import kotlinx.coroutines.withContext
+import kotlinx.io.RawSource
+import kotlinx.io.buffered
+import kotlinx.io.files.Path
+import kotlinx.io.files.SystemFileSystem
+import kotlinx.serialization.Serializable
+import kotlin.uuid.Uuid
+
+/** A payload in the spool. Stored in Outbox.files as a JSON list when enqueued through OutboxSpool. */
+@Serializable
+data class SpoolEntry(
+    val hash: String,
+    val size: Long
+)
+
+data class SpoolRecovery(
+    val removedFiles: Int,
+    val rowsMissingPayload: List<Long>
+)
+
+/**
+ * Content-addressed store for outbox payloads, so media is neither copied into the SQLite file
+ * nor into memory. Each payload is streamed once into [directory] under its SHA-256; rows
+ * reference it through OutboxSpoolRef, and a file is deleted when its last reference goes.
+ *
+ * Ordering keeps the spool and the table consistent across a crash: the file is written (temp
+ * file + atomic rename) before the row that references it is committed, and the row is deleted
+ * before the file. The worst case is an unreferenced file, which recover() removes at startup.
+ *
+ * No OutboxUploader reads [source] yet, so uploads do not stream from the spool; until one does
+ * the spool only keeps payloads out of the database and out of memory while they wait.
+ */
+class OutboxSpool(
+    private val databaseManager: DatabaseManager,
+    val directory: Path
+) {
+    companion object {
+        private const val TAG = "OutboxSpool"
+        private const val TEMP_PREFIX = "tmp-"
+        private const val BUFFER_SIZE = 64 * 1024
+
+        fun decodeEntries(files: ByteArray?): List<SpoolEntry> {
+            if (files == null || files.isEmpty()) return emptyList()
+            return OdinSystemSerializer.deserialize<List<SpoolEntry>>(files.decodeToString())
+        }
+    }
+
+    // Guards the directory, the set of files written but not yet referenced by a row, and the
+    // temp files being written, which recover() must leave alone
+    private val mutex = Mutex()
+    private val pinned = mutableMapOf<String, Int>()
+    private val writing = mutableSetOf<String>()
+
+    init {
+        SystemFileSystem.createDirectories(directory)
+    }
+
+    fun pathOf(hash: String): Path = Path(directory, hash)
+
+    fun source(entry: SpoolEntry): RawSource = SystemFileSystem.source(pathOf(entry.hash))
+
+    /**
+     * Streams [payloads] into the spool and inserts an outbox row referencing them, in that order.
+     * Identical payloads are stored once. Returns the result of OutboxWrapper.insert().
+     */
+    suspend fun enqueue(
+        driveId: Uuid,
+        fileId: Uuid,
+        dependencyFileId: Uuid?,
+        priority: Long,
+        uploadType: Long,
+        json: ByteArray,
+        payloads: List<Path>
+    ): Long {
+        val entries = mutableListOf<SpoolEntry>()
+        try {
+            payloads.forEach { entries.add(put(it)) }
+            return databaseManager.outbox.insert(
+                driveId = driveId,
+                fileId = fileId,
+                dependencyFileId = dependencyFileId,
+                priority = priority,
+                uploadType = uploadType,
+                json = json,
+                files = OdinSystemSerializer.serialize(entries.toList()).encodeToByteArray(),
+                payloadBytes = entries.sumOf { it.size },
+                spoolHashes = entries.map { it.hash }.distinct()
+            )
+        } finally {
+            unpin(entries.map { it.hash })
+            // If the insert failed nothing references what we just wrote
+            release(entries.map { it.hash })
+        }
+    }
+
+    /**
+     * Copies [file] into the spool without reading it into memory. The entry stays pinned, safe
+     * from release() and recover(), until unpin() is called once it is referenced by a row.
+     */
+    suspend fun put(file: Path): SpoolEntry {
+        val temp = Path(directory, "$TEMP_PREFIX${Uuid.random()}")
+        mutex.withLock { writing.add(temp.name) }
+        try {
+            val (hash, size) = withContext(Dispatchers.IO) {
+                try {
+                    copyAndHash(file, temp)
+                } catch (e: Exception) {
+                    SystemFileSystem.delete(temp, mustExist = false)
+                    throw e
+                }
+            }
+
+            mutex.withLock {
+                val target = pathOf(hash)
+                if (SystemFileSystem.exists(target))
+                    SystemFileSystem.delete(temp) // Already spooled, share it
+                else
+                    SystemFileSystem.atomicMove(temp, target)
+                pinned[hash] = (pinned[hash] ?: 0) + 1
+            }
+            return SpoolEntry(hash, size)
+        } finally {
+            withContext(NonCancellable) { mutex.withLock { writing.remove(temp.name) } }
+        }
+    }
+
+    suspend fun unpin(hashes: Collection<String>) = mutex.withLock {
+        for (hash in hashes) {
+            val n = (pinned[hash] ?: continue) - 1
+            if (n == 0) pinned.remove(hash) else pinned[hash] = n
+        }
+    }
+
+    /** Deletes those of [hashes] that no outbox row references any more. Returns the number deleted. */
+    suspend fun release(hashes: Collection<String>): Int = mutex.withLock {
+        var deleted = 0
+        for (hash in hashes.toSet()) {
+            if (hash in pinned || databaseManager.outbox.spoolRefCount(hash) > 0) continue
+            SystemFileSystem.delete(pathOf(hash), mustExist = false)
+            deleted++
+        }
+        deleted
+    }
+
+    /**
+     * Run at startup. Removes half-written temp files and files no row references, and reports
+     * rows whose payload is gone. OutboxSync.start() deletes those rows and reports them failed,
+     * as no retry can bring the payload back.
+     * Safe to run again while the app is running: temp files a put() is still writing are kept.
+     */
+    suspend fun recover(): SpoolRecovery = mutex.withLock {
+        databaseManager.outbox.deleteDanglingSpoolRefs()
+        val referenced = databaseManager.outbox.spoolReferencedHashes()
+
+        var removed = 0
+        val present = mutableSetOf<String>()
+        for (path in SystemFileSystem.list(directory)) {
+            val name = path.name
+            if (name in writing) continue
+            if (name.startsWith(TEMP_PREFIX) || (name !in referenced && name !in pinned)) {
+                SystemFileSystem.delete(path, mustExist = false)
+                removed++
+            } else {
+                present.add(name)
+            }
+        }
+
+        val missing = (referenced - present)
+            .flatMap { databaseManager.outbox.rowsReferencingSpool(it) }
+            .distinct()
+        if (removed > 0 || missing.isNotEmpty())
+            Logger.w(TAG) { "Removed $removed orphaned spool files, ${missing.size} rows lost their payload" }
+
+        SpoolRecovery(removed, missing)
+    }
+
+    private fun copyAndHash(file: Path, temp: Path): Pair<String, Long> {
+        val buffer = ByteArray(BUFFER_SIZE)
+        var size = 0L
+        val digest = HashUtil.sha256Function().use { hash ->
+            SystemFileSystem.source(file).buffered().use { input ->
+                SystemFileSystem.sink(temp).buffered().use { output ->
+                    while (true) {
+                        val n = input.readAtMostTo(buffer)
+                        if (n == -1) break
+                        hash.update(buffer, 0, n)
+                        output.write(buffer, 0, n)
+                        size += n
+                    }
+                }
+            }
+            hash.hashToByteArray()
+        }
+        return digest.joinToString("") { it.toUByte().toString(16).padStart(2, '0') } to size
+    }
+}
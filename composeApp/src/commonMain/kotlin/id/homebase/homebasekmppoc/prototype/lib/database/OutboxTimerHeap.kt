@@ -0,0 +1,124 @@
+package id.homebase.homebasekmppoc.lib.database
+
+import kotlinx.atomicfu.locks.SynchronizedObject
+import kotlinx.atomicfu.locks.synchronized
+
+/**
+ * In-memory min-heap of nextRunTime for the Outbox rows that are not checked out, keyed by rowId.
+ * OutboxWrapper keeps it in step with the table, so OutboxSync can sleep until exactly the next
+ * due item instead of polling nextScheduled.
+ *
+ * Dependencies are not tracked here; an item may be due but still blocked by its dependency.
+ */
+class OutboxTimerHeap {
+    private val lock = SynchronizedObject()
+    private val rowIds = ArrayList<Long>()
+    private val times = ArrayList<Long>()
+    private val positions = HashMap<Long, Int>()
+
+    val size: Int get() = synchronized(lock) { rowIds.size }
+
+    /** The earliest nextRunTime, or null if nothing is waiting. */
+    fun peek(): Long? = synchronized(lock) { times.firstOrNull() }
+
+    /** The earliest nextRunTime strictly after [time]. Only visits entries at or before [time]. */
+    fun nextAfter(time: Long): Long? = synchronized(lock) {
+        var best: Long? = null
+        val stack = ArrayList<Int>()
+        if (times.isNotEmpty()) stack.add(0)
+        while (stack.isNotEmpty()) {
+            val i = stack.removeAt(stack.lastIndex)
+            val t = times[i]
+            if (t > time) {
+                // Children are never earlier than their parent
+                if (best == null || t < best) best = t
+                continue
+            }
+            val left = 2 * i + 1
+            if (left < times.size) stack.add(left)
+            if (left + 1 < times.size) stack.add(left + 1)
+        }
+        best
+    }
+
+    fun upsert(rowId: Long, nextRunTime: Long) = synchronized(lock) {
+        val i = positions[rowId]
+        if (i == null) {
+            rowIds.add(rowId)
+            times.add(nextRunTime)
+            positions[rowId] = rowIds.lastIndex
+            siftUp(rowIds.lastIndex)
+        } else {
+            val previous = times[i]
+            times[i] = nextRunTime
+            if (nextRunTime < previous) siftUp(i) else siftDown(i)
+        }
+    }
+
+    fun remove(rowId: Long): Boolean = synchronized(lock) {
+        val i = positions.remove(rowId) ?: return@synchronized false
+        val lastRow = rowIds.removeAt(rowIds.lastIndex)
+        val lastTime = times.removeAt(times.lastIndex)
+        if (i < rowIds.size) {
+            rowIds[i] = lastRow
+            times[i] = lastTime
+            positions[lastRow] = i
+            siftDown(i)
+            siftUp(i)
+        }
+        true
+    }
+
+    /** Replaces the content with (rowId, nextRunTime) pairs, e.g. loaded from the table at startup. */
+    fun rebuild(entries: List<Pair<Long, Long>>) = synchronized(lock) {
+        clearLocked()
+        for ((rowId, time) in entries) {
+            positions[rowId] = rowIds.size
+            rowIds.add(rowId)
+            times.add(time)
+        }
+        for (i in rowIds.size / 2 - 1 downTo 0) siftDown(i)
+    }
+
+    fun clear() = synchronized(lock) { clearLocked() }
+
+    private fun clearLocked() {
+        rowIds.clear()
+        times.clear()
+        positions.clear()
+    }
+
+    private fun siftUp(start: Int) {
+        var i = start
+        while (i > 0) {
+            val parent = (i - 1) / 2
+            if (times[parent] <= times[i]) break
+            swap(i, parent)
+            i = parent
+        }
+    }
+
+    private fun siftDown(start: Int) {
+        var i = start
+        while (true) {
+            val left = 2 * i + 1
+            if (left >= times.size) break
+            val right = left + 1
+            val child = if (right < times.size && times[right] < times[left]) right else left
+            if (times[i] <= times[child]) break
+            swap(i, child)
+            i = child
+        }
+    }
+
+    private fun swap(a: Int, b: Int) {
+        val row = rowIds[a]
+        rowIds[a] = rowIds[b]
+        rowIds[b] = row
+        val time = times[a]
+        times[a] = times[b]
+        times[b] = time
+        positions[rowIds[a]] = a
+        positions[rowIds[b]] = b
+    }
+}
@@ -10,6 +10,30 @@ import kotlin.Any
 import kotlin.Long
 import kotlin.uuid.Uuid
 import kotlinx.atomicfu.atomic
+import kotlinx.coroutines.flow.MutableStateFlow
+import kotlinx.coroutines.flow.StateFlow
+import kotlinx.coroutines.flow.asStateFlow
+import kotlinx.coroutines.flow.update
+
+/**
+ * Outbox items are scheduled in two lanes with separate concurrency budgets, so a few large
+ * media uploads cannot hold up small interactive items such as chat messages.
+ */
+enum class OutboxLane(val value: Long) {
+    Interactive(0),
+    Bulk(1);
+
+    companion object {
+        // Anything above this is media, not a message
+        const val MAX_INTERACTIVE_BYTES = 512L * 1024L
+
+        // Callers can force an item into the bulk lane with a priority at or above this
+        const val BULK_PRIORITY = 100L
+
+        fun classify(priority: Long, payloadBytes: Long): OutboxLane =
+            if (payloadBytes > MAX_INTERACTIVE_BYTES || priority >= BULK_PRIORITY) Bulk else Interactive
+    }
+}
 
 class OutboxWrapper(
     driver: SqlDriver,
@@ -17,9 +41,22 @@ class OutboxWrapper(
     private val databaseManager: DatabaseManager
 ) {
     private val delegate = OutboxQueries(driver, outboxAdapter)
+    private val spoolRefs = OutboxSpoolRefQueries(driver)
 
     private val lastId = atomic(0L)
 
+    // Next run time of every waiting row. Updated on insert, checkout, reschedule and delete;
+    // rebuilt from the table by clearCheckedOut() at startup.
+    val schedule = OutboxTimerHeap()
+
+    // Bumped whenever an item may have become due earlier than OutboxSync, which waits on it, would wake
+    private val _scheduleChanged = MutableStateFlow(0L)
+    val scheduleChanged: StateFlow<Long> = _scheduleChanged.asStateFlow()
+
+    private fun signalScheduleChanged() {
+        _scheduleChanged.update { it + 1 }
+    }
+
     // TEMP HACK - will make a different design
     fun getUniqueId(): Long {
         while (true) {
@@ -32,9 +69,19 @@ class OutboxWrapper(
         }
     }
 
-    suspend fun checkout(): Outbox?
+    // Checks out the next item in [lane], or in any lane if null
+    suspend fun checkout(now: UnixTimeUtc = UnixTimeUtc.now(), lane: OutboxLane? = null): Outbox?
     {
-        return databaseManager.withWriteValue { delegate.checkout(getUniqueId(), UnixTimeUtc.now().milliseconds).executeAsOneOrNull() }
+        val minLane = lane?.value ?: OutboxLane.Interactive.value
+        val maxLane = lane?.value ?: OutboxLane.Bulk.value
+        return databaseManager.withWriteValue {
+            delegate.checkout(
+                checkOutStamp = getUniqueId(),
+                now = now.milliseconds,
+                minLane = minLane,
+                maxLane = maxLane
+            ).executeAsOneOrNull()?.also { schedule.remove(it.rowId) }
+        }
     }
 
     fun nextScheduled(): UnixTimeUtc?
@@ -48,6 +95,10 @@ class OutboxWrapper(
         checkOutStamp: Long,
     ): Outbox? = delegate.selectCheckedOut(checkOutStamp).executeAsOneOrNull()
 
+    fun selectByRowId(
+        rowId: Long,
+    ): Outbox? = delegate.selectByRowId(rowId).executeAsOneOrNull()
+
     fun count(): Long = delegate.count().executeAsOne()
 
     suspend fun insert(
@@ -58,47 +109,102 @@ class OutboxWrapper(
         uploadType: Long,
         json: ByteArray,
         files: ByteArray?,
+        payloadBytes: Long = 0,
+        spoolHashes: List<String> = emptyList(), // Spool files this row holds a reference to
     ): Long {
-        return databaseManager.withWriteValue {
-            delegate.insert(
-                driveId,
-                fileId,
-                dependencyFileId,
-                priority,
-                0,
-                0,
-                0,
-                null,
-                uploadType,
-                json,
-                files
-            ).value
+        val (inserted, rowId) = databaseManager.withWriteValue {
+            delegate.transactionWithResult {
+                val n = delegate.insert(
+                    driveId,
+                    fileId,
+                    dependencyFileId,
+                    priority,
+                    0,
+                    0,
+                    0,
+                    null,
+                    uploadType,
+                    json,
+                    files,
+                    payloadBytes,
+                    OutboxLane.classify(priority, payloadBytes).value
+                ).value
+                val rowId = delegate.lastInsertRowId().executeAsOne()
+                spoolHashes.forEach { spoolRefs.insertRef(rowId, it) }
+                n to rowId
+            }
         }
+        // Only once committed, so a rolled back insert leaves nothing in the heap
+        schedule.upsert(rowId, 0)
+        signalScheduleChanged()
+        return inserted
     }
 
+    // Signals only when the retry is due before the scheduler would wake anyway: it sleeps until
+    // the first run time after its last round, which is no later than the first after [now]
     suspend fun checkInFailed(
         checkOutStamp: Long,
         nextRunTime: Long,
+        now: UnixTimeUtc = UnixTimeUtc.now(),
     ): Long {
-        return databaseManager.withWriteValue {
-            delegate.checkInFailed(checkOutStamp, nextRunTime).value
+        val (n, earliest) = databaseManager.withWriteValue {
+            val rowId = delegate.selectCheckedOut(checkOutStamp).executeAsOneOrNull()?.rowId
+            val earliest = schedule.nextAfter(now.milliseconds)
+            delegate.checkInFailed(nextRunTime = nextRunTime, checkOutStamp = checkOutStamp).value
+                .also { if (rowId != null) schedule.upsert(rowId, nextRunTime) } to earliest
         }
+        if (earliest == null || nextRunTime < earliest)
+            signalScheduleChanged()
+        return n
     }
 
+    suspend fun updateUploadState(
+        checkOutStamp: Long,
+        uploadState: ByteArray?,
+    ): Long {
+        return databaseManager.withWriteValue {
+            delegate.updateUploadState(uploadState = uploadState, checkOutStamp = checkOutStamp).value
+        }
+    }
 
+    // Call at startup: requeues whatever was checked out when the app stopped and rebuilds the schedule
     suspend fun clearCheckedOut(): Long
     {
-        return databaseManager.withWriteValue {
-            delegate.clearCheckedOut().value
+        val n = databaseManager.withWriteValue {
+            delegate.clearCheckedOut().value.also {
+                schedule.rebuild(delegate.selectSchedule { rowId, nextRunTime -> rowId to nextRunTime }.executeAsList())
+            }
         }
+        signalScheduleChanged()
+        return n
     }
 
     suspend fun deleteByRowId(
         rowId: Long,
     ): Long
+    {
+        val n = databaseManager.withWriteValue {
+            delegate.transactionWithResult {
+                spoolRefs.deleteRefsForRow(rowId)
+                delegate.deleteByRowId(rowId).value
+            }.also { schedule.remove(rowId) }
+        }
+        signalScheduleChanged() // Items depending on this one may now be sent
+        return n
+    }
+
+    fun spoolHashes(rowId: Long): List<String> = spoolRefs.selectHashesForRow(rowId).executeAsList()
+
+    fun spoolRefCount(hash: String): Long = spoolRefs.countRefs(hash).executeAsOne()
+
+    fun spoolReferencedHashes(): Set<String> = spoolRefs.selectReferencedHashes().executeAsList().toSet()
+
+    fun rowsReferencingSpool(hash: String): List<Long> = spoolRefs.selectRowsForHash(hash).executeAsList()
+
+    suspend fun deleteDanglingSpoolRefs(): Long
     {
         return databaseManager.withWriteValue {
-            delegate.deleteByRowId(rowId).value
+            spoolRefs.deleteDanglingRefs().value
         }
     }
 }
\ No newline at end of file
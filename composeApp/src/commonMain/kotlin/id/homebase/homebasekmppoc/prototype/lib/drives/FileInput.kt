@@ -11,3 +11,16 @@ expect suspend fun writeBytesToTempFile(
     prefix: String,
     suffix: String
 ): String
+
+/**
+ * Positional reads from a file without moving a shared cursor, so concurrent readers (one per
+ * HTTP range request) can share one open file.
+ */
+expect class RandomAccessFileInput(path: String) : AutoCloseable {
+    val length: Long
+
+    /** Reads up to [length] bytes at [position] into [buffer]; -1 at the end of the file. */
+    fun read(position: Long, buffer: ByteArray, offset: Int, length: Int): Int
+
+    override fun close()
+}
@@ -14,6 +14,7 @@ import id.homebase.homebasekmppoc.prototype.lib.serialization.OdinSystemSerializ
 import io.ktor.client.HttpClient
 import io.ktor.client.request.*
 import io.ktor.http.*
+import kotlinx.io.Sink
 import kotlinx.serialization.SerialName
 import kotlinx.serialization.Serializable
 import kotlin.io.encoding.Base64
@@ -209,6 +210,61 @@ public class DriveFileProvider(
     }
 
 
+    /**
+     * Streams a payload into [sink], decrypting it as it arrives, instead of holding all of it in
+     * memory as [getPayloadBytesDecrypted] does. With [resumeFrom], the sink already holds that
+     * many bytes of plaintext from an earlier attempt. See [PayloadDownloader].
+     */
+    suspend fun downloadPayload(
+        driveId: Uuid,
+        fileId: Uuid,
+        key: String,
+        sink: Sink,
+        resumeFrom: Long = 0,
+        onProgress: (suspend (bytesReceived: Long, totalBytes: Long?) -> Unit)? = null
+    ): PayloadDownloadResult {
+        val creds = requirePayloadCreds(driveId, fileId, key)
+        return PayloadDownloader(httpClient).download(
+            url = apiUrl(creds.domain, "/drives/$driveId/files/$fileId/payload/$key"),
+            sink = sink,
+            resumeFrom = resumeFrom,
+            configure = { bearerAuth(creds.accessToken) },
+            decryption = { payloadDecryption(it) },
+            onProgress = onProgress
+        )
+    }
+
+    /**
+     * Streams a payload to the file at [path], resuming a download of it that was cancelled or
+     * failed. With [expectedSha256], the plaintext must hash to it. See [PayloadDownloader].
+     */
+    suspend fun downloadPayloadToFile(
+        driveId: Uuid,
+        fileId: Uuid,
+        key: String,
+        path: String,
+        expectedSha256: String? = null,
+        onProgress: (suspend (bytesReceived: Long, totalBytes: Long?) -> Unit)? = null
+    ): PayloadDownloadResult {
+        val creds = requirePayloadCreds(driveId, fileId, key)
+        return PayloadDownloader(httpClient).downloadToFile(
+            url = apiUrl(creds.domain, "/drives/$driveId/files/$fileId/payload/$key"),
+            path = path,
+            expectedSha256 = expectedSha256,
+            configure = { bearerAuth(creds.accessToken) },
+            decryption = { payloadDecryption(it) },
+            onProgress = onProgress
+        )
+    }
+
+    private suspend fun requirePayloadCreds(driveId: Uuid, fileId: Uuid, key: String): ActiveCreds {
+        ValidationUtil.requireValidUuid(driveId, "driveId")
+        ValidationUtil.requireValidUuid(fileId, "fileId")
+        require(key.isNotBlank()) { "Key must be defined" }
+        return requireCreds()
+    }
+
+
     suspend fun getThumbBytesRaw(
         driveId: Uuid,
         fileId: Uuid,
@@ -288,6 +344,36 @@ public class DriveFileProvider(
         )
     }
 
+    /**
+     * Gets the stored thumbnail of [payload] that best fits a display size, chosen by
+     * [ThumbnailResolver.select] rather than a hard-coded width and height.
+     *
+     * @param widthPx Display width in pixels (layout size times density)
+     * @param heightPx Display height in pixels
+     * @param crop Whether the thumbnail will be cropped to fill the box rather than fit in it
+     * @return The chosen thumbnail and its decrypted bytes, or null if the payload has none
+     */
+    suspend fun getThumbBytesForDisplay(
+        driveId: Uuid,
+        fileId: Uuid,
+        payload: PayloadDescriptor,
+        widthPx: Int,
+        heightPx: Int,
+        crop: Boolean = false
+    ): Pair<ThumbnailDescriptor, BytesResponse>? {
+        val thumbnail = ThumbnailResolver.select(payload, widthPx, heightPx, crop) ?: return null
+        val bytes =
+            getThumbBytesDecrypted(
+                driveId = driveId,
+                fileId = fileId,
+                payloadKey = payload.key,
+                width = thumbnail.pixelWidth!!,
+                height = thumbnail.pixelHeight!!,
+                lastModified = payload.lastModified
+            ) ?: return null
+        return thumbnail to bytes
+    }
+
     /**
      * Gets transfer history for a file.
      *
@@ -519,6 +605,20 @@ public class DriveFileProvider(
     }
 
 
+    /** Key and IV of a payload from its response headers, or null if it is not encrypted. */
+    private suspend fun payloadDecryption(headers: Headers): PayloadDecryption? {
+        val payloadEncrypted =
+            headers["payloadencrypted"]?.equals("true", ignoreCase = true) == true
+
+        if (!payloadEncrypted) return null
+
+        val encryptedHeader64 = headers["sharedsecretencryptedheader64"]
+            ?: error("Can't decrypt; missing keyheader")
+        val keyHeader = decryptKeyHeader(EncryptedKeyHeader.fromBase64(encryptedHeader64))
+            ?: error("Missing shared secret")
+        return PayloadDecryption(keyHeader.aesKey, keyHeader.iv)
+    }
+
     /** Decrypts chunked bytes with offset handling. */
     suspend fun decryptChunkedBytes(
         headers: Headers,
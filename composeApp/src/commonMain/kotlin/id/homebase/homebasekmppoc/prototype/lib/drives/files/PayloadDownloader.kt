@@ -0,0 +1,283 @@
+package id.homebase.homebasekmppoc.prototype.lib.drives.files
+
+import co.touchlab.kermit.Logger
+import dev.whyoleg.cryptography.functions.HashFunction
+import id.homebase.homebasekmppoc.prototype.lib.base.exceptionForStatus
+import id.homebase.homebasekmppoc.prototype.lib.core.SecureByteArray
+import id.homebase.homebasekmppoc.prototype.lib.crypto.AesCbc
+import id.homebase.homebasekmppoc.prototype.lib.crypto.HashUtil
+import io.ktor.client.HttpClient
+import io.ktor.client.plugins.HttpTimeout
+import io.ktor.client.plugins.HttpTimeoutConfig
+import io.ktor.client.plugins.pluginOrNull
+import io.ktor.client.plugins.timeout
+import io.ktor.client.request.HttpRequestBuilder
+import io.ktor.client.request.header
+import io.ktor.client.request.prepareGet
+import io.ktor.client.statement.bodyAsChannel
+import io.ktor.http.Headers
+import io.ktor.http.HttpHeaders
+import io.ktor.http.HttpStatusCode
+import io.ktor.http.contentLength
+import io.ktor.utils.io.readAvailable
+import io.ktor.utils.io.readFully
+import kotlinx.coroutines.currentCoroutineContext
+import kotlinx.coroutines.ensureActive
+import kotlinx.io.IOException
+import kotlinx.io.Sink
+import kotlinx.io.buffered
+import kotlinx.io.files.Path
+import kotlinx.io.files.SystemFileSystem
+
+/** Key and IV of an encrypted payload, to decrypt it with as it downloads. */
+class PayloadDecryption(val aesKey: SecureByteArray, val iv: ByteArray)
+
+/** A finished payload download. */
+data class PayloadDownloadResult(
+    /** Plaintext bytes in the sink, counting any that were there before it resumed. */
+    val size: Long,
+    /** SHA-256 of the plaintext, lowercase hex; for a resumed sink, of the bytes this call wrote. */
+    val sha256: String,
+    val contentType: String
+)
+
+/**
+ * The payload is not what was expected: the wrong size, a partial block, bad padding or the wrong
+ * hash. Downloading the same bytes again will not help, so nothing is kept to resume from.
+ */
+class PayloadIntegrityException(message: String, cause: Throwable? = null) : IllegalStateException(message, cause)
+
+/**
+ * Streams a payload into a [Sink], decrypting it a window at a time on the way, so memory use is
+ * one window whatever the size of the payload.
+ *
+ * AES-CBC decrypts each window with the last ciphertext block before it as the IV, and holds the
+ * final block back until the stream ends, as only that one carries PKCS7 padding. Everything
+ * before the final block decrypts to exactly as many bytes as it has, so a plaintext position is
+ * also a ciphertext position, and a download can resume from any byte with a range request.
+ *
+ * A cancelled or dropped download throws out of [download]; what was written so far stays in
+ * the sink to resume from. [downloadToFile] keeps it in a `.part` file beside the target.
+ */
+class PayloadDownloader(
+    private val client: HttpClient,
+    private val windowSize: Int = DEFAULT_WINDOW_SIZE
+) {
+    companion object {
+        private const val TAG = "PayloadDownloader"
+        private const val BLOCK_SIZE = 16
+
+        const val DEFAULT_WINDOW_SIZE = 1024 * 1024
+    }
+
+    init {
+        require(windowSize > 0 && windowSize % BLOCK_SIZE == 0) { "Window size must be a positive multiple of $BLOCK_SIZE" }
+    }
+
+    /**
+     * Downloads [url] into [sink]. With [resumeFrom], the sink already holds that many bytes of
+     * plaintext and only the rest is fetched and written.
+     *
+     * [decryption] is given the response headers and returns the key for an encrypted payload, or
+     * null for a plain one. [expectedStoredSize] is the size on the server, the ciphertext size for
+     * an encrypted payload, when the caller knows it. [onProgress] is told the stored bytes
+     * received so far and their total, when the server says.
+     */
+    suspend fun download(
+        url: String,
+        sink: Sink,
+        resumeFrom: Long = 0,
+        expectedStoredSize: Long? = null,
+        configure: HttpRequestBuilder.() -> Unit = {},
+        decryption: suspend (Headers) -> PayloadDecryption?,
+        onProgress: (suspend (bytesReceived: Long, totalBytes: Long?) -> Unit)? = null
+    ): PayloadDownloadResult =
+        HashUtil.sha256Function().use { hash ->
+            stream(url, sink, resumeFrom, hash, expectedStoredSize, configure, decryption, onProgress)
+        }
+
+    /**
+     * Downloads [url] to the file at [path], through `[path].part`, which it is moved from once
+     * complete and verified. A part file left by a cancelled or failed attempt is resumed from.
+     * With [expectedSha256], the whole plaintext must hash to it.
+     */
+    suspend fun downloadToFile(
+        url: String,
+        path: String,
+        expectedStoredSize: Long? = null,
+        expectedSha256: String? = null,
+        configure: HttpRequestBuilder.() -> Unit = {},
+        decryption: suspend (Headers) -> PayloadDecryption?,
+        onProgress: (suspend (bytesReceived: Long, totalBytes: Long?) -> Unit)? = null
+    ): PayloadDownloadResult {
+        val part = Path("$path.part")
+        val resumeFrom = SystemFileSystem.metadataOrNull(part)?.size ?: 0L
+        if (resumeFrom > 0) {
+            Logger.i(TAG) { "Resuming download of $path at $resumeFrom bytes" }
+        }
+
+        val result = try {
+            HashUtil.sha256Function().use { hash ->
+                // The hash covers the whole file, so what is already there goes in first
+                if (resumeFrom > 0) {
+                    val buffer = ByteArray(windowSize)
+                    SystemFileSystem.source(part).buffered().use { input ->
+                        while (true) {
+                            val n = input.readAtMostTo(buffer)
+                            if (n == -1) break
+                            hash.update(buffer, 0, n)
+                        }
+                    }
+                }
+                SystemFileSystem.sink(part, append = true).buffered().use { sink ->
+                    stream(url, sink, resumeFrom, hash, expectedStoredSize, configure, decryption, onProgress)
+                }
+            }
+        } catch (e: PayloadIntegrityException) {
+            SystemFileSystem.delete(part, mustExist = false)
+            throw e
+        }
+
+        if (expectedSha256 != null && !result.sha256.equals(expectedSha256, ignoreCase = true)) {
+            SystemFileSystem.delete(part, mustExist = false)
+            throw PayloadIntegrityException("SHA-256 of $path is ${result.sha256}, expected $expectedSha256")
+        }
+        SystemFileSystem.atomicMove(part, Path(path))
+        return result
+    }
+
+    private suspend fun stream(
+        url: String,
+        sink: Sink,
+        resumeFrom: Long,
+        hash: HashFunction,
+        expectedStoredSize: Long?,
+        configure: HttpRequestBuilder.() -> Unit,
+        decryption: suspend (Headers) -> PayloadDecryption?,
+        onProgress: (suspend (bytesReceived: Long, totalBytes: Long?) -> Unit)?
+    ): PayloadDownloadResult {
+        require(resumeFrom >= 0) { "Cannot resume from $resumeFrom" }
+
+        // Whether the payload is encrypted is only known from the response, so ask from the
+        // block boundary before resumeFrom and one block more, which would be the IV
+        val requestStart = maxOf(0L, resumeFrom / BLOCK_SIZE * BLOCK_SIZE - BLOCK_SIZE)
+
+        return client.prepareGet(url) {
+            configure()
+            if (requestStart > 0) header(HttpHeaders.Range, "bytes=$requestStart-")
+            // A large payload outlasts a client's usual request timeout; a stall still trips the socket timeout
+            if (client.pluginOrNull(HttpTimeout) != null) {
+                timeout { requestTimeoutMillis = HttpTimeoutConfig.INFINITE_TIMEOUT_MS }
+            }
+        }.execute { response ->
+            val start: Long
+            val totalBytes: Long?
+            when (response.status) {
+                // A server that ignores the range sends all of it
+                HttpStatusCode.OK -> {
+                    start = 0
+                    totalBytes = response.contentLength()
+                }
+
+                HttpStatusCode.PartialContent -> {
+                    val contentRange = response.headers[HttpHeaders.ContentRange]
+                        ?: throw IllegalStateException("No Content-Range in a partial response")
+                    start = contentRange.substringAfter("bytes ").substringBefore('-').toLongOrNull()
+                        ?: throw IllegalStateException("No start in Content-Range ($contentRange)")
+                    check(start == requestStart) { "Asked for bytes from $requestStart, got $contentRange" }
+                    totalBytes = contentRange.substringAfterLast('/').toLongOrNull()
+                }
+
+                // With the status, so the retry policy gives up on a payload that is gone
+                else -> throw exceptionForStatus(response.status.value)
+            }
+            if (expectedStoredSize != null && totalBytes != null && totalBytes != expectedStoredSize) {
+                throw PayloadIntegrityException("Payload is $totalBytes bytes, expected $expectedStoredSize")
+            }
+
+            val keys = decryption(response.headers)
+            if (keys != null && totalBytes != null && totalBytes % BLOCK_SIZE != 0L) {
+                throw PayloadIntegrityException("Ciphertext of $totalBytes bytes is not a whole number of blocks")
+            }
+            val contentType = response.headers["decryptedcontenttype"]
+                ?: response.headers[HttpHeaders.ContentType]
+                ?: "application/octet-stream"
+
+            val channel = response.bodyAsChannel()
+            var received = start
+            var iv = keys?.iv
+            if (keys != null && start > 0) {
+                iv = ByteArray(BLOCK_SIZE).also { channel.readFully(it) }
+                received += BLOCK_SIZE
+            }
+
+            // The sink already holds the plaintext from here up to resumeFrom
+            var skip = resumeFrom - received
+            var written = 0L
+            fun write(bytes: ByteArray, from: Int, to: Int) {
+                val begin = from + minOf(skip, (to - from).toLong()).toInt()
+                skip -= begin - from
+                if (begin < to) {
+                    sink.write(bytes, begin, to)
+                    hash.update(bytes, begin, to)
+                    written += to - begin
+                }
+            }
+
+            // Room for a window and, for ciphertext, the block held back after it
+            val window = ByteArray(windowSize + BLOCK_SIZE)
+            var filled = 0
+            while (true) {
+                currentCoroutineContext().ensureActive()
+                val n = channel.readAvailable(window, filled, window.size - filled)
+                if (n == -1) break
+                filled += n
+                received += n
+                if (filled < window.size) continue
+
+                if (keys == null) {
+                    write(window, 0, filled)
+                    filled = 0
+                } else {
+                    // Everything but the last block, which may turn out to be the final one
+                    val cipherText = window.copyOf(windowSize)
+                    write(AesCbc.decryptBlocks(cipherText, keys.aesKey.unsafeBytes, iv!!), 0, windowSize)
+                    iv = cipherText.copyOfRange(windowSize - BLOCK_SIZE, windowSize)
+                    window.copyInto(window, 0, windowSize, window.size)
+                    filled = BLOCK_SIZE
+                }
+                onProgress?.invoke(received, totalBytes)
+            }
+
+            // Dropped early: the sink keeps what it has for a retry to resume from
+            if (totalBytes != null && received != totalBytes) {
+                throw IOException("Payload download ended at $received of $totalBytes bytes")
+            }
+
+            if (keys == null) {
+                write(window, 0, filled)
+            } else {
+                if (filled == 0 || filled % BLOCK_SIZE != 0) {
+                    throw PayloadIntegrityException("Ciphertext of $received bytes is not a whole number of blocks")
+                }
+                val plain = try {
+                    AesCbc.decrypt(window.copyOf(filled), keys.aesKey, iv!!)
+                } catch (e: Exception) {
+                    throw PayloadIntegrityException("Final block did not decrypt: wrong key or corrupt payload", e)
+                }
+                write(plain, 0, plain.size)
+            }
+            onProgress?.invoke(received, totalBytes)
+
+            if (skip > 0) {
+                throw PayloadIntegrityException("Resumed at $resumeFrom bytes, past the end of the payload")
+            }
+
+            PayloadDownloadResult(
+                size = resumeFrom + written,
+                sha256 = hash.hashToByteArray().joinToString("") { it.toUByte().toString(16).padStart(2, '0') },
+                contentType = contentType
+            )
+        }
+    }
+}
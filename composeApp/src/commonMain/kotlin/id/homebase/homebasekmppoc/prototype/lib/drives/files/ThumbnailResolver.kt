@@ -0,0 +1,97 @@
+package id.homebase.homebasekmppoc.prototype.lib.drives.files
+
+import kotlin.math.max
+import kotlin.math.min
+
+/**
+ * Picks which of a payload's stored thumbnails to fetch for a display size, so a 48 px avatar
+ * does not download the 1600 px variant.
+ *
+ * Sizes are in pixels: the layout size in dp times the screen density.
+ */
+object ThumbnailResolver {
+
+    /**
+     * Drawing a variant up to this much larger than it is counts as covering the display;
+     * the difference is not visible and saves stepping to a variant twice the size.
+     */
+    const val UPSCALE_TOLERANCE = 1.15
+
+    /**
+     * The smallest thumbnail that covers [widthPx] x [heightPx] without visible upscaling, or
+     * the largest there is if none does. Null when no thumbnail has known dimensions.
+     *
+     * With [crop] the variant has to fill the box (ContentScale.Crop); otherwise it only has to
+     * fit in it (ContentScale.Fit), which needs fewer pixels for a box of a different aspect.
+     */
+    fun select(
+        thumbnails: List<ThumbnailDescriptor>?,
+        widthPx: Int,
+        heightPx: Int,
+        crop: Boolean = false
+    ): ThumbnailDescriptor? {
+        val sized = sized(thumbnails)
+        if (sized.isEmpty()) return null
+        return sized.firstOrNull { covers(it, widthPx, heightPx, crop) } ?: sized.last()
+    }
+
+    fun select(payload: PayloadDescriptor, widthPx: Int, heightPx: Int, crop: Boolean = false) =
+        select(payload.thumbnails, widthPx, heightPx, crop)
+
+    /** Whether [thumbnail] drawn into [widthPx] x [heightPx] is scaled up by no more than the tolerance */
+    fun covers(thumbnail: ThumbnailDescriptor, widthPx: Int, heightPx: Int, crop: Boolean = false): Boolean {
+        val w = thumbnail.pixelWidth ?: return false
+        val h = thumbnail.pixelHeight ?: return false
+        if (w <= 0 || h <= 0) return false
+        if (widthPx <= 0 || heightPx <= 0) return true
+        val scaleX = widthPx.toDouble() / w
+        val scaleY = heightPx.toDouble() / h
+        val scale = if (crop) max(scaleX, scaleY) else min(scaleX, scaleY)
+        return scale <= UPSCALE_TOLERANCE
+    }
+
+    /** Thumbnails with known dimensions, smallest first; equal sizes by fewest bytes. */
+    internal fun sized(thumbnails: List<ThumbnailDescriptor>?): List<ThumbnailDescriptor> =
+        thumbnails.orEmpty()
+            .filter { (it.pixelWidth ?: 0) > 0 && (it.pixelHeight ?: 0) > 0 }
+            .sortedWith(
+                compareBy<ThumbnailDescriptor> { it.pixelWidth!!.toLong() * it.pixelHeight!! }
+                    .thenBy { it.bytesWritten ?: Long.MAX_VALUE }
+            )
+}
+
+/**
+ * The thumbnail a view is showing, stepped up as its layout grows.
+ *
+ * A view starts on the embedded preview, which costs no download. Each time it is laid out,
+ * [next] says which stored variant to fetch, if any: the one [ThumbnailResolver.select] picks,
+ * but only when that is larger than what is already loaded. Shrinking never fetches; the loaded
+ * variant still covers the smaller size.
+ */
+class ThumbnailProgression(
+    payload: PayloadDescriptor,
+    private val crop: Boolean = false
+) {
+    private val variants = ThumbnailResolver.sized(payload.thumbnails)
+
+    /** The stored variant loaded so far; null while only the preview is shown. */
+    var current: ThumbnailDescriptor? = null
+        private set
+
+    fun next(widthPx: Int, heightPx: Int): ThumbnailDescriptor? {
+        val loaded = current
+        if (loaded != null && ThumbnailResolver.covers(loaded, widthPx, heightPx, crop)) return null
+        val wanted = ThumbnailResolver.select(variants, widthPx, heightPx, crop) ?: return null
+        if (loaded != null && pixels(wanted) <= pixels(loaded)) return null
+        return wanted
+    }
+
+    /** Records that [thumbnail] has been fetched and is now shown. */
+    fun loaded(thumbnail: ThumbnailDescriptor) {
+        val loaded = current
+        if (loaded == null || pixels(thumbnail) > pixels(loaded)) current = thumbnail
+    }
+
+    private fun pixels(thumbnail: ThumbnailDescriptor) =
+        (thumbnail.pixelWidth ?: 0).toLong() * (thumbnail.pixelHeight ?: 0)
+}
@@ -37,6 +37,15 @@ data class LocalAppData(
     val iv: String? = null
 )
 
+@Serializable
+private data class BeginChunkedUploadRequest(
+    val totalBytes: Long,
+    val chunkSize: Int
+)
+
+@Serializable
+private data class BeginChunkedUploadResult(val uploadId: String)
+
 @Serializable
 private data class UpdateLocalMetadataTagsRequest(
     val localVersionTag: String?,
@@ -90,6 +99,8 @@ class DriveUploadProvider(
 
     companion object {
         private const val TAG = "DriveUploadProvider"
+        const val CHUNK_OFFSET_HEADER = "X-Chunk-Offset"
+        const val CHUNK_CRC_HEADER = "X-Chunk-Crc32c"
     }
 
     // ==================== HIGH-LEVEL UPLOAD METHODS ====================
@@ -286,6 +297,67 @@ class DriveUploadProvider(
     }
 
 
+    // ==================== RESUMABLE (CHUNKED) UPLOADS ====================
+
+    /**
+     * Transport for ResumableUploader against chunked upload endpoints: POST /drives/{id}/uploads,
+     * PUT /drives/{id}/uploads/{uploadId}/chunks/{index} and POST .../complete. Chunks carry their
+     * offset and crc32c so the host can reject corrupted or misplaced data.
+     *
+     * The host does not have these endpoints yet; they are assumed here and only exercised
+     * against mock servers in tests. Nothing in the app uses this transport until it does.
+     */
+    @ChunkedUploadEndpoints
+    fun chunkTransport(driveId: Uuid): ChunkUploadTransport =
+        object : ChunkUploadTransport {
+            override suspend fun begin(totalBytes: Long, chunkSize: Int): String {
+                val creds = requireCreds()
+                val response =
+                    plainPostJson(
+                        url = apiUrl(creds.domain, "/drives/${driveId}/uploads"),
+                        token = creds.accessToken,
+                        jsonBody = OdinSystemSerializer.serialize(
+                            BeginChunkedUploadRequest(totalBytes, chunkSize)
+                        )
+                    )
+                throwForFailure(response)
+                return deserialize<BeginChunkedUploadResult>(response.body).uploadId
+            }
+
+            override suspend fun putChunk(uploadId: String, chunk: UploadChunk, data: ByteArray) {
+                val creds = requireCreds()
+                val response =
+                    plainPutBytes(
+                        url = apiUrl(creds.domain, "/drives/${driveId}/uploads/${uploadId}/chunks/${chunk.index}"),
+                        token = creds.accessToken,
+                        bytes = data,
+                        headers = mapOf(
+                            CHUNK_OFFSET_HEADER to chunk.offset.toString(),
+                            CHUNK_CRC_HEADER to (chunk.crc32c ?: 0L).toString()
+                        )
+                    )
+                throwForSessionFailure(uploadId, response)
+            }
+
+            override suspend fun complete(uploadId: String) {
+                val creds = requireCreds()
+                val response =
+                    plainPostJson(
+                        url = apiUrl(creds.domain, "/drives/${driveId}/uploads/${uploadId}/complete"),
+                        token = creds.accessToken,
+                        jsonBody = "{}"
+                    )
+                throwForSessionFailure(uploadId, response)
+            }
+
+            // 404 or 410 on a session URL: the host expired the session or never had it
+            private fun throwForSessionFailure(uploadId: String, response: ApiResponse) {
+                if (response.status == 404 || response.status == 410)
+                    throw UploadSessionNotFoundException(uploadId)
+                throwForFailure(response)
+            }
+        }
+
     // ==================== LOW-LEVEL UPLOAD METHODS ====================
 
     /** Performs a raw upload to the drive. */
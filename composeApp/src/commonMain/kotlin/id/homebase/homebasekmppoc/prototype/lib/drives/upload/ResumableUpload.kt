@@ -0,0 +1,234 @@
+package id.homebase.homebasekmppoc.prototype.lib.drives.upload
+
+import co.touchlab.kermit.Logger
+import id.homebase.homebasekmppoc.prototype.lib.crypto.Crc32c
+import id.homebase.homebasekmppoc.prototype.lib.serialization.OdinSystemSerializer
+import kotlinx.io.buffered
+import kotlinx.io.files.Path
+import kotlinx.io.files.SystemFileSystem
+import kotlinx.io.readByteArray
+import kotlinx.serialization.Serializable
+
+/** One fixed-size slice of a payload. The crc32c is recorded just before the chunk is first sent. */
+@Serializable
+data class UploadChunk(
+    val index: Int,
+    val offset: Long,
+    val length: Int,
+    val crc32c: Long? = null,
+    val acknowledged: Boolean = false
+)
+
+/**
+ * Progress of a chunked upload. Persisted in the Outbox row (uploadState column) after every
+ * acknowledged chunk so a retry can continue from the first unacknowledged chunk.
+ */
+@Serializable
+data class ResumableUploadState(
+    val uploadId: String,
+    val totalBytes: Long,
+    val chunkSize: Int,
+    val chunks: List<UploadChunk>
+) {
+    val bytesAcknowledged: Long
+        get() = chunks.filter { it.acknowledged }.sumOf { it.length.toLong() }
+
+    val isComplete: Boolean
+        get() = chunks.all { it.acknowledged }
+
+    fun firstPendingChunk(): UploadChunk? = chunks.firstOrNull { !it.acknowledged }
+
+    fun withChunk(chunk: UploadChunk): ResumableUploadState =
+        copy(chunks = chunks.toMutableList().also { it[chunk.index] = chunk })
+
+    fun encode(): ByteArray = OdinSystemSerializer.serialize(this).encodeToByteArray()
+
+    companion object {
+        fun decode(bytes: ByteArray?): ResumableUploadState? {
+            if (bytes == null || bytes.isEmpty()) return null
+            return runCatching {
+                OdinSystemSerializer.deserialize<ResumableUploadState>(bytes.decodeToString())
+            }.getOrNull()
+        }
+
+        fun plan(uploadId: String, totalBytes: Long, chunkSize: Int): ResumableUploadState {
+            val count = ((totalBytes + chunkSize - 1) / chunkSize).toInt()
+            val chunks = (0 until count).map { i ->
+                val offset = i.toLong() * chunkSize
+                UploadChunk(
+                    index = i,
+                    offset = offset,
+                    length = minOf(chunkSize.toLong(), totalBytes - offset).toInt()
+                )
+            }
+            return ResumableUploadState(uploadId, totalBytes, chunkSize, chunks)
+        }
+    }
+}
+
+/** Server side of a chunked upload session. */
+interface ChunkUploadTransport {
+    /** Opens an upload session and returns its id. */
+    suspend fun begin(totalBytes: Long, chunkSize: Int): String
+
+    /**
+     * Stores one chunk. Must be idempotent for the same (uploadId, index). Throws
+     * [UploadSessionNotFoundException] if the host no longer knows [uploadId].
+     */
+    suspend fun putChunk(uploadId: String, chunk: UploadChunk, data: ByteArray)
+
+    /** Called once all chunks are acknowledged. Throws [UploadSessionNotFoundException] as putChunk. */
+    suspend fun complete(uploadId: String)
+}
+
+/**
+ * Marks code that talks to the chunked upload endpoints, which the host does not provide yet.
+ * Opting in outside of tests would send uploads to endpoints that do not exist.
+ */
+@RequiresOptIn(message = "The host has no chunked upload endpoints yet", level = RequiresOptIn.Level.ERROR)
+@Retention(AnnotationRetention.BINARY)
+@Target(AnnotationTarget.FUNCTION)
+annotation class ChunkedUploadEndpoints
+
+class ChunkChecksumMismatchException(message: String) : IllegalStateException(message)
+
+/** The host has expired or forgotten the session, so its chunks are gone with it. */
+class UploadSessionNotFoundException(val uploadId: String) :
+    IllegalStateException("Upload session $uploadId not found")
+
+/**
+ * Uploads an (already encrypted) payload file in checksummed chunks.
+ *
+ * A failing chunk throws straight out of upload(); the caller (OutboxSync) reschedules the item
+ * and the next attempt passes the persisted state back in, so only unacknowledged chunks are
+ * sent again. If the host has dropped the persisted session in the meantime, the upload starts
+ * over in a new one.
+ */
+class ResumableUploader(
+    private val transport: ChunkUploadTransport,
+    private val chunkSize: Int = DEFAULT_CHUNK_SIZE
+) {
+    companion object {
+        private const val TAG = "ResumableUploader"
+
+        // Multiple of the AES block size so CBC ciphertext splits on block boundaries
+        const val DEFAULT_CHUNK_SIZE = 4 * 1024 * 1024
+    }
+
+    init {
+        require(chunkSize > 0 && chunkSize % 16 == 0) { "Chunk size must be a positive multiple of 16" }
+    }
+
+    suspend fun upload(
+        filePath: String,
+        state: ResumableUploadState?,
+        persist: suspend (ResumableUploadState) -> Unit,
+        onProgress: (suspend (bytesSent: Long, totalBytes: Long) -> Unit)? = null
+    ): ResumableUploadState {
+        val path = Path(filePath)
+        val totalBytes = SystemFileSystem.metadataOrNull(path)?.size
+            ?: throw IllegalArgumentException("File not found: $filePath")
+
+        var source = SystemFileSystem.source(path).buffered()
+        try {
+            var position = 0L
+            return upload(filePath, totalBytes, state, persist, onProgress) { chunk ->
+                // A new session starts over from the first chunk
+                if (chunk.offset < position) {
+                    source.close()
+                    source = SystemFileSystem.source(path).buffered()
+                    position = 0
+                }
+                source.skip(chunk.offset - position)
+                position = chunk.offset + chunk.length
+                source.readByteArray(chunk.length)
+            }
+        } finally {
+            source.close()
+        }
+    }
+
+    /**
+     * Uploads a payload that is already in memory, such as an encrypted HLS segment, without
+     * writing it to a file first. [name] identifies it in errors and logs.
+     */
+    suspend fun upload(
+        data: ByteArray,
+        name: String,
+        state: ResumableUploadState?,
+        persist: suspend (ResumableUploadState) -> Unit,
+        onProgress: (suspend (bytesSent: Long, totalBytes: Long) -> Unit)? = null
+    ): ResumableUploadState =
+        upload(name, data.size.toLong(), state, persist, onProgress) { chunk ->
+            data.copyOfRange(chunk.offset.toInt(), (chunk.offset + chunk.length).toInt())
+        }
+
+    // Chunks are read in order, and only the unacknowledged ones; from the first again when a
+    // resumed session turns out to be gone
+    private suspend fun upload(
+        name: String,
+        totalBytes: Long,
+        state: ResumableUploadState?,
+        persist: suspend (ResumableUploadState) -> Unit,
+        onProgress: (suspend (bytesSent: Long, totalBytes: Long) -> Unit)?,
+        read: (UploadChunk) -> ByteArray
+    ): ResumableUploadState {
+        if (state == null || state.totalBytes != totalBytes || state.chunkSize != chunkSize) {
+            return send(name, begin(totalBytes, persist), persist, onProgress, read)
+        }
+
+        Logger.i(TAG) { "Resuming ${state.uploadId} at ${state.bytesAcknowledged}/$totalBytes bytes" }
+        return try {
+            send(name, state, persist, onProgress, read)
+        } catch (e: UploadSessionNotFoundException) {
+            // Only once: a session that is gone as soon as it was opened is the host's problem
+            Logger.w(TAG) { "Session ${e.uploadId} is gone, starting $name over" }
+            send(name, begin(totalBytes, persist), persist, onProgress, read)
+        }
+    }
+
+    private suspend fun begin(
+        totalBytes: Long,
+        persist: suspend (ResumableUploadState) -> Unit
+    ): ResumableUploadState =
+        ResumableUploadState.plan(transport.begin(totalBytes, chunkSize), totalBytes, chunkSize)
+            .also { persist(it) }
+
+    private suspend fun send(
+        name: String,
+        state: ResumableUploadState,
+        persist: suspend (ResumableUploadState) -> Unit,
+        onProgress: (suspend (bytesSent: Long, totalBytes: Long) -> Unit)?,
+        read: (UploadChunk) -> ByteArray
+    ): ResumableUploadState {
+        val totalBytes = state.totalBytes
+        var current = state
+
+        for (chunk in current.chunks) {
+            if (chunk.acknowledged) continue
+            val data = read(chunk)
+
+            val crc = Crc32c.calculateCrc32c(data = data).toLong()
+            if (chunk.crc32c != null && chunk.crc32c != crc) {
+                throw ChunkChecksumMismatchException(
+                    "Chunk ${chunk.index} of $name changed since it was first sent"
+                )
+            }
+
+            // Recorded before the chunk goes out, so a retry of it after a failure is checked too
+            val sent = chunk.copy(crc32c = crc)
+            if (chunk.crc32c == null) {
+                current = current.withChunk(sent)
+                persist(current)
+            }
+            transport.putChunk(current.uploadId, sent, data)
+
+            current = current.withChunk(sent.copy(acknowledged = true))
+            persist(current)
+            onProgress?.invoke(current.bytesAcknowledged, totalBytes)
+        }
+
+        transport.complete(current.uploadId)
+        return current
+    }
+}
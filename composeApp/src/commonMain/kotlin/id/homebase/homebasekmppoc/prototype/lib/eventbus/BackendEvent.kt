@@ -73,6 +73,54 @@ sealed interface  BackendEvent {
             val fileId : Uuid
         ) : OutboxEvent  // Only raised by Drive.sync()
 
+        // The item failed permanently (fatal error or out of retries) and was removed from the outbox
+        data class ItemFailed(
+            val driveId : Uuid,
+            val fileId : Uuid,
+            val errorMessage: String
+        ) : OutboxEvent
+
+    }
+
+    // Payload downloads queued with the DownloadManager, identified by the path they download to
+    sealed interface DownloadEvent : BackendEvent {
+        val driveId: Uuid
+        val fileId: Uuid
+        val targetPath: String
+
+        // resumedFrom is the plaintext already in the part file from an earlier attempt
+        data class ItemStarted(
+            override val driveId: Uuid,
+            override val fileId: Uuid,
+            override val targetPath: String,
+            val resumedFrom: Long
+        ) : DownloadEvent
+
+        // Stored (encrypted) bytes received, and their total once the server has said
+        data class ItemProgress(
+            override val driveId: Uuid,
+            override val fileId: Uuid,
+            override val targetPath: String,
+            val bytesReceived: Long,
+            val totalBytes: Long?
+        ) : DownloadEvent
+
+        // The file is complete and verified at targetPath
+        data class ItemCompleted(
+            override val driveId: Uuid,
+            override val fileId: Uuid,
+            override val targetPath: String,
+            val size: Long,
+            val sha256: String
+        ) : DownloadEvent
+
+        // The download failed permanently (fatal error or out of retries) and was removed from the queue
+        data class ItemFailed(
+            override val driveId: Uuid,
+            override val fileId: Uuid,
+            override val targetPath: String,
+            val errorMessage: String
+        ) : DownloadEvent
     }
     // Add sealed interface UploadUpdate for Outbox / upload status
     // Add sealed interface VideoUpdate (or WorkUpdate) compression & segmentation & encryption
@@ -7,7 +7,10 @@ import id.homebase.homebasekmppoc.prototype.lib.core.SecureByteArray
 import id.homebase.homebasekmppoc.prototype.lib.crypto.CryptoHelper
 import id.homebase.homebasekmppoc.prototype.lib.crypto.KeyHeader
 import id.homebase.homebasekmppoc.prototype.lib.drives.HomebaseFile
+import id.homebase.homebasekmppoc.prototype.lib.drives.files.PayloadDecryption
 import id.homebase.homebasekmppoc.prototype.lib.drives.files.PayloadDescriptor
+import id.homebase.homebasekmppoc.prototype.lib.drives.files.PayloadDownloadResult
+import id.homebase.homebasekmppoc.prototype.lib.drives.files.PayloadDownloader
 import id.homebase.homebasekmppoc.prototype.lib.serialization.OdinSystemSerializer
 import id.homebase.homebasekmppoc.prototype.lib.video.VideoMetaData
 import io.ktor.client.call.body
@@ -113,6 +116,50 @@ class PayloadWrapper(
 
     //
 
+    /**
+     * Streams the payload to the file at [path], decrypting it on the way, so it never has to fit
+     * in memory as with [getPayloadBytes]. A download of the same [path] that was cancelled or
+     * failed is resumed. See [PayloadDownloader].
+     */
+    suspend fun downloadPayloadToFile(
+            appOrOwner: AppOrOwner,
+            path: String,
+            onProgress: (suspend (bytesReceived: Long, totalBytes: Long?) -> Unit)? = null
+    ): PayloadDownloadResult {
+        val decryption =
+                if (isEncrypted) {
+                    val payloadIv =
+                            payloadDescriptor.iv?.let { Base64.decode(it) }
+                                    ?: throw Exception("No IV found in payload descriptor")
+                    val keyHeader = decryptKeyHeader() ?: throw Exception("Failed to decrypt KeyHeader")
+                    // The KeyHeader's AES key with the payload's IV, as in getPayloadBytes
+                    PayloadDecryption(keyHeader.aesKey, payloadIv)
+                } else {
+                    null
+                }
+
+        val client = createHttpClient()
+        try {
+            return PayloadDownloader(client).downloadToFile(
+                    url = getEncryptedPayloadUri(appOrOwner),
+                    path = path,
+                    // bytesWritten is the stored size, i.e. the ciphertext for encrypted payloads
+                    expectedStoredSize = payloadDescriptor.bytesWritten,
+                    configure = {
+                        headers {
+                            append("Cookie", "${cookieNameFrom(appOrOwner)}=${authenticated.clientAuthToken}")
+                        }
+                    },
+                    decryption = { decryption },
+                    onProgress = onProgress
+            )
+        } finally {
+            client.close()
+        }
+    }
+
+    //
+
     fun getVideoMetaData(appOrOwner: AppOrOwner): VideoMetaData {
         val playlistContent =
                 payloadDescriptor.descriptorContent
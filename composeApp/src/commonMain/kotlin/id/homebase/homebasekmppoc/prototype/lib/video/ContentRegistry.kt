@@ -0,0 +1,151 @@
+package id.homebase.homebasekmppoc.prototype.lib.video
+
+import co.touchlab.kermit.Logger
+import kotlinx.atomicfu.atomic
+import kotlinx.atomicfu.locks.SynchronizedObject
+import kotlinx.atomicfu.locks.synchronized
+
+/**
+ * Something [LocalVideoServer] serves, with the auth token its proxied segments need. An entry
+ * that is not [evictable] stays registered until it is unregistered, e.g. the manifests of a video
+ * that is being played: a player asks for them again between segments.
+ */
+class ContentEntry(
+    val id: String,
+    val source: RangeSource,
+    val contentType: String,
+    val authTokenHeaderName: String? = null,
+    val authToken: String? = null,
+    val evictable: Boolean = true
+) {
+    internal var streams = 0
+    internal var removed = false
+    internal var closed = false
+}
+
+/**
+ * The content [LocalVideoServer] serves, shared between the registering caller and the server's
+ * handler threads.
+ *
+ * Content held in memory counts against [maxBytes]; registering more evicts the least recently
+ * used evictable entries that hold memory. Evicting a source that reads ranges from elsewhere
+ * would free nothing and break a paused video, so those stay. A stream in progress holds a [Lease] on its entry, which keeps it from being
+ * evicted. An entry removed while leased stays readable until the last lease is closed, and only
+ * then is its source closed, which wipes in-memory buffers.
+ */
+class ContentRegistry(
+    val maxBytes: Long = DEFAULT_MAX_BYTES,
+    private val onRemoved: (entry: ContentEntry) -> Unit = {}
+) {
+    companion object {
+        const val DEFAULT_MAX_BYTES = 64L * 1024 * 1024
+    }
+
+    /** A stream's hold on an entry; close it when the response is written. */
+    inner class Lease internal constructor(val entry: ContentEntry) : AutoCloseable {
+        private val closed = atomic(false)
+
+        override fun close() {
+            if (closed.compareAndSet(false, true)) release(entry)
+        }
+    }
+
+    private val lock = SynchronizedObject()
+
+    // Iteration order is recency: use moves an entry to the end, eviction starts at the front
+    private val entries = LinkedHashMap<String, ContentEntry>()
+    private var resident = 0L
+    private var evictions = 0L
+
+    /** Bytes held in memory by registered entries, including removed ones still being streamed. */
+    val residentBytes: Long get() = synchronized(lock) { resident }
+    val evictionCount: Long get() = synchronized(lock) { evictions }
+    val size: Int get() = synchronized(lock) { entries.size }
+
+    /** Registers [entry], replacing any entry with the same id, and evicts down to the budget. */
+    fun register(entry: ContentEntry) {
+        val removed = mutableListOf<Pair<ContentEntry, Boolean>>()
+        synchronized(lock) {
+            entries.remove(entry.id)?.let { removeLocked(it, removed) }
+            entries[entry.id] = entry
+            resident += entry.source.residentBytes
+
+            val iterator = entries.values.iterator()
+            while (resident > maxBytes && iterator.hasNext()) {
+                val candidate = iterator.next()
+                if (candidate === entry || candidate.streams > 0 || !candidate.evictable) continue
+                if (candidate.source.residentBytes == 0L) continue
+                iterator.remove()
+                evictions++
+                removeLocked(candidate, removed)
+            }
+            if (resident > maxBytes) {
+                Logger.w("ContentRegistry") { "Over budget with streams in progress or pinned content: $resident of $maxBytes bytes" }
+            }
+        }
+        finishAll(removed)
+    }
+
+    /** Holds the entry for [id] open for a stream, or null if there is none. */
+    fun acquire(id: String): Lease? = synchronized(lock) {
+        val entry = entries.remove(id) ?: return null
+        entries[id] = entry
+        entry.streams++
+        Lease(entry)
+    }
+
+    /** The entry for [id] without holding it, e.g. to look up its auth token. Counts as a use. */
+    fun get(id: String): ContentEntry? = synchronized(lock) {
+        val entry = entries.remove(id) ?: return null
+        entries[id] = entry
+        entry
+    }
+
+    fun unregister(id: String): ContentEntry? {
+        val removed = mutableListOf<Pair<ContentEntry, Boolean>>()
+        synchronized(lock) {
+            entries.remove(id)?.let { removeLocked(it, removed) }
+        }
+        finishAll(removed)
+        return removed.firstOrNull()?.first
+    }
+
+    fun clear() {
+        val removed = mutableListOf<Pair<ContentEntry, Boolean>>()
+        synchronized(lock) {
+            entries.values.forEach { removeLocked(it, removed) }
+            entries.clear()
+        }
+        finishAll(removed)
+    }
+
+    private fun release(entry: ContentEntry) {
+        val close = synchronized(lock) {
+            entry.streams--
+            entry.removed && entry.streams == 0 && finishLocked(entry)
+        }
+        if (close) entry.source.close()
+    }
+
+    /** Marks [entry] removed; unless it is being streamed, its memory goes back to the budget now. */
+    private fun removeLocked(entry: ContentEntry, removed: MutableList<Pair<ContentEntry, Boolean>>) {
+        entry.removed = true
+        removed.add(entry to (entry.streams == 0 && finishLocked(entry)))
+    }
+
+    /** Returns the entry's memory to the budget; true the first time, when its source is to be closed. */
+    private fun finishLocked(entry: ContentEntry): Boolean {
+        if (entry.closed) return false
+        entry.closed = true
+        resident -= entry.source.residentBytes
+        return true
+    }
+
+    // Sources are closed, and buffers wiped, outside the lock; ones still streaming on their last release
+    private fun finishAll(removed: List<Pair<ContentEntry, Boolean>>) {
+        removed.forEach { (entry, close) ->
+            if (close) entry.source.close()
+            onRemoved(entry)
+        }
+    }
+}
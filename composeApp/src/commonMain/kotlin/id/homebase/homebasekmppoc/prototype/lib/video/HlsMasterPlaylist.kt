@@ -0,0 +1,109 @@
+package id.homebase.homebasekmppoc.prototype.lib.video
+
+/** One rendition listed in an HLS master playlist. */
+data class HlsVariant(
+    /** Peak bits per second, as BANDWIDTH. */
+    val bandwidth: Long,
+    val averageBandwidth: Long?,
+    val width: Int?,
+    val height: Int?,
+    val codecs: String?,
+    /** The media playlist of the rendition. */
+    val uri: String
+)
+
+/**
+ * Reading and rewriting HLS master (multivariant) playlists: a list of `#EXT-X-STREAM-INF`
+ * tags, each followed by the URI of a media playlist for one rendition of the video. Alternative
+ * renditions (`#EXT-X-MEDIA`) and I-frame playlists name theirs in a URI attribute.
+ */
+object HlsMasterPlaylist {
+
+    private const val STREAM_INF = "#EXT-X-STREAM-INF:"
+    private val URI_TAGS = listOf("#EXT-X-MEDIA:", "#EXT-X-I-FRAME-STREAM-INF:")
+    private val uriAttribute = Regex("""URI="([^"]*)"""")
+
+    /** True for a master playlist, false for a media playlist of segments. */
+    fun isMaster(lines: List<String>): Boolean = lines.any { it.startsWith(STREAM_INF) }
+
+    /** As [isMaster], without splitting [playlist] into a list of lines. */
+    fun isMaster(playlist: String): Boolean = playlist.lineSequence().any { it.startsWith(STREAM_INF) }
+
+    fun variants(lines: List<String>): List<HlsVariant> {
+        val variants = mutableListOf<HlsVariant>()
+        var attributes: Map<String, String>? = null
+        for (line in lines) {
+            when {
+                line.startsWith(STREAM_INF) -> attributes = parseAttributes(line.removePrefix(STREAM_INF))
+                line.isBlank() || line.startsWith("#") -> {}
+                attributes != null -> {
+                    val resolution = attributes["RESOLUTION"]?.split('x')
+                    variants.add(
+                        HlsVariant(
+                            bandwidth = attributes["BANDWIDTH"]?.toLongOrNull()
+                                ?: throw Exception("Variant $line has no BANDWIDTH"),
+                            averageBandwidth = attributes["AVERAGE-BANDWIDTH"]?.toLongOrNull(),
+                            width = resolution?.getOrNull(0)?.toIntOrNull(),
+                            height = resolution?.getOrNull(1)?.toIntOrNull(),
+                            codecs = attributes["CODECS"],
+                            uri = line.trim()
+                        )
+                    )
+                    attributes = null
+                }
+            }
+        }
+        return variants
+    }
+
+    /** Every playlist URI in [lines], variant or alternative, in order: those [rewriteUris] rewrites. */
+    fun playlistUris(lines: List<String>): List<String> {
+        val uris = mutableListOf<String>()
+        rewriteUris(lines) { uris.add(it); it }
+        return uris
+    }
+
+    /** Every playlist URI in [lines], variant or alternative, replaced by [rewrite]. */
+    fun rewriteUris(lines: List<String>, rewrite: (String) -> String): List<String> {
+        var variantFollows = false
+        return lines.map { line ->
+            when {
+                line.startsWith(STREAM_INF) -> {
+                    variantFollows = true
+                    line
+                }
+                URI_TAGS.any { line.startsWith(it) } ->
+                    uriAttribute.replace(line) { "URI=\"${rewrite(it.groupValues[1])}\"" }
+                line.isBlank() || line.startsWith("#") -> line
+                variantFollows -> {
+                    variantFollows = false
+                    rewrite(line.trim())
+                }
+                else -> line
+            }
+        }
+    }
+
+    /** `NAME=value,NAME="quoted, value"` into a map, quotes removed. */
+    internal fun parseAttributes(list: String): Map<String, String> {
+        val attributes = mutableMapOf<String, String>()
+        var i = 0
+        while (i < list.length) {
+            val equals = list.indexOf('=', i)
+            if (equals < 0) break
+            val name = list.substring(i, equals).trim()
+            val value: String
+            if (list.getOrNull(equals + 1) == '"') {
+                val close = list.indexOf('"', equals + 2).let { if (it < 0) list.length else it }
+                value = list.substring(equals + 2, close)
+                i = list.indexOf(',', close).let { if (it < 0) list.length else it + 1 }
+            } else {
+                val comma = list.indexOf(',', equals).let { if (it < 0) list.length else it }
+                value = list.substring(equals + 1, comma)
+                i = comma + 1
+            }
+            attributes[name] = value
+        }
+        return attributes
+    }
+}
@@ -0,0 +1,172 @@
+package id.homebase.homebasekmppoc.prototype.lib.video
+
+import io.ktor.http.encodeURLParameter
+import kotlin.math.ceil
+
+/**
+ * Rewrites an uploaded HLS media playlist for playback, in a single pass over its text:
+ *
+ * - the URI of an AES-128 `#EXT-X-KEY` becomes [keyUri];
+ * - each segment, a byte range of the one video payload, becomes [segmentUrl] with the range
+ *   appended to its path as `/offset/length` and the query dropped, and its `#EXT-X-BYTERANGE`
+ *   is removed; a segment without a range gets [segmentUrl] as is;
+ * - `#EXT-X-TARGETDURATION` becomes the ceiling of the longest `#EXTINF`, as players require.
+ *
+ * Every segment is a URL of the same payload, so [segmentUrl] is signed once by the caller and
+ * shared rather than signed per segment.
+ *
+ * Given a [proxy], the proxied copy the local server hands to the player is written in the same
+ * pass, each https segment URL routed through its /proxy endpoint. The encoded form of the shared
+ * part of the URL is worked out once as well.
+ */
+internal class HlsPlaylistRewriter(
+    private val segmentUrl: String,
+    private val keyUri: String?,
+    private val proxy: Proxy? = null
+) {
+    /** Segments are requested as `[serverUrl]/proxy?url=<segment url>&manifestId=[manifestId]`. */
+    class Proxy(val serverUrl: String, val manifestId: String)
+
+    /** The playlist with the remote segment URLs, and the proxied copy when there is a proxy. */
+    class Result(val playlist: String, val proxied: String?)
+
+    private val rangeBase = segmentUrl.substringBefore('?')
+
+    // Only https URLs are proxied; the others are written to the proxied copy unchanged
+    private val proxiedSegment = proxy?.let { proxied(segmentUrl, it) }
+    private val proxiedRangeBase = proxy?.let { proxied(rangeBase, it) }
+    private val proxySuffix = proxy?.let { "&manifestId=${it.manifestId}" }
+
+    fun rewrite(playlist: String): Result {
+        if (!playlist.startsWith("#EXTM3U")) {
+            throw Exception("Invalid HLS playlist content")
+        }
+
+        // Segment names and byte range tags become full URLs, so the output outgrows the input
+        val out = StringBuilder(playlist.length * 2)
+        val proxied = proxy?.let { StringBuilder(playlist.length * 3) }
+
+        var maxDuration = 0.0
+        var targetDurationAt = -1
+        var proxiedTargetDurationAt = -1
+
+        // The byte range of the next segment, if it has one
+        var rangeLength = -1L
+        var rangeOffset = 0L
+        var nextOffset = 0L
+
+        var lineStart = 0
+        var written = 0
+        while (lineStart <= playlist.length) {
+            val newline = playlist.indexOf('\n', lineStart).let { if (it < 0) playlist.length else it }
+            val lineEnd = if (newline > lineStart && playlist[newline - 1] == '\r') newline - 1 else newline
+            val start = lineStart
+            lineStart = newline + 1
+
+            if (playlist.startsWith(EXT_X_BYTERANGE, start)) {
+                // length[@offset]; without an offset the range follows on from the previous one
+                val value = playlist.substring(start + EXT_X_BYTERANGE.length, lineEnd).trim()
+                rangeLength = value.substringBefore('@').toLongOrNull()
+                    ?: throw Exception("Invalid byte range: $value")
+                rangeOffset = if ('@' in value) {
+                    value.substringAfter('@').toLongOrNull() ?: throw Exception("Invalid byte range: $value")
+                } else {
+                    nextOffset
+                }
+                nextOffset = rangeOffset + rangeLength
+                continue
+            }
+
+            if (written++ > 0) {
+                out.append('\n')
+                proxied?.append('\n')
+            }
+
+            when {
+                playlist.startsWith(EXTINF, start) -> {
+                    val comma = playlist.indexOf(',', start).let { if (it in 0..lineEnd) it else lineEnd }
+                    playlist.substring(start + EXTINF.length, comma).trim().toDoubleOrNull()?.let {
+                        if (it > maxDuration) maxDuration = it
+                    }
+                    out.append(playlist, start, lineEnd)
+                    proxied?.append(playlist, start, lineEnd)
+                }
+
+                // Its value is only known at the end, and is written in then
+                playlist.startsWith(EXT_X_TARGETDURATION, start) -> {
+                    out.append(EXT_X_TARGETDURATION)
+                    targetDurationAt = out.length
+                    proxied?.append(EXT_X_TARGETDURATION)
+                    proxiedTargetDurationAt = proxied?.length ?: -1
+                }
+
+                playlist.startsWith(EXT_X_KEY_AES_128, start) -> {
+                    val line = rewriteKey(playlist.substring(start, lineEnd))
+                    out.append(line)
+                    proxied?.append(line)
+                }
+
+                playlist.startsWith("#", start) || isBlank(playlist, start, lineEnd) -> {
+                    out.append(playlist, start, lineEnd)
+                    proxied?.append(playlist, start, lineEnd)
+                }
+
+                rangeLength >= 0 -> {
+                    out.append(rangeBase).append('/').append(rangeOffset).append('/').append(rangeLength)
+                    if (proxied != null) {
+                        if (proxiedRangeBase != null) {
+                            // Digits need no encoding and '/' encodes as %2F
+                            proxied.append(proxiedRangeBase)
+                                .append("%2F").append(rangeOffset).append("%2F").append(rangeLength)
+                                .append(proxySuffix)
+                        } else {
+                            proxied.append(rangeBase).append('/').append(rangeOffset).append('/').append(rangeLength)
+                        }
+                    }
+                    rangeLength = -1
+                }
+
+                else -> {
+                    out.append(segmentUrl)
+                    if (proxied != null) {
+                        if (proxiedSegment != null) {
+                            proxied.append(proxiedSegment).append(proxySuffix)
+                        } else {
+                            proxied.append(segmentUrl)
+                        }
+                    }
+                }
+            }
+        }
+
+        val targetDuration = ceil(maxDuration).toInt().toString()
+        if (targetDurationAt >= 0) out.insert(targetDurationAt, targetDuration)
+        if (proxied != null && proxiedTargetDurationAt >= 0) proxied.insert(proxiedTargetDurationAt, targetDuration)
+
+        return Result(out.toString(), proxied?.toString())
+    }
+
+    private fun rewriteKey(line: String): String {
+        val key = keyUri ?: throw Exception("AES key is null but playlist requires encryption key")
+        val valueStart = line.indexOf(URI_ATTRIBUTE).takeIf { it >= 0 }?.plus(URI_ATTRIBUTE.length)
+            ?: return line
+        val valueEnd = line.indexOf('"', valueStart).takeIf { it >= 0 } ?: return line
+        return line.substring(0, valueStart) + key + line.substring(valueEnd)
+    }
+
+    private companion object {
+        const val EXTINF = "#EXTINF:"
+        const val EXT_X_BYTERANGE = "#EXT-X-BYTERANGE:"
+        const val EXT_X_TARGETDURATION = "#EXT-X-TARGETDURATION:"
+        const val EXT_X_KEY_AES_128 = "#EXT-X-KEY:METHOD=AES-128"
+        const val URI_ATTRIBUTE = "URI=\""
+
+        fun proxied(url: String, proxy: Proxy): String? =
+            if (url.startsWith("https://")) "${proxy.serverUrl}/proxy?url=${url.encodeURLParameter()}" else null
+
+        fun isBlank(text: String, start: Int, end: Int): Boolean {
+            for (i in start until end) if (!text[i].isWhitespace()) return false
+            return true
+        }
+    }
+}
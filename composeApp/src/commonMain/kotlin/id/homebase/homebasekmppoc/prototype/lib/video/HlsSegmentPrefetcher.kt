@@ -0,0 +1,182 @@
+package id.homebase.homebasekmppoc.prototype.lib.video
+
+import co.touchlab.kermit.Logger
+import kotlinx.atomicfu.locks.SynchronizedObject
+import kotlinx.atomicfu.locks.synchronized
+import kotlinx.coroutines.CancellationException
+import kotlinx.coroutines.CoroutineScope
+import kotlinx.coroutines.Deferred
+import kotlinx.coroutines.Dispatchers
+import kotlinx.coroutines.ExperimentalCoroutinesApi
+import kotlinx.coroutines.IO
+import kotlinx.coroutines.SupervisorJob
+import kotlinx.coroutines.async
+import kotlinx.coroutines.cancel
+import kotlinx.coroutines.currentCoroutineContext
+import kotlinx.coroutines.ensureActive
+
+/** One HLS segment as the origin returned it; still encrypted when the playlist has a key. */
+class HlsSegment(val bytes: ByteArray, val contentType: String)
+
+/**
+ * Read-ahead for the segments of the HLS playlists [LocalVideoServer] proxies.
+ *
+ * When the player asks for a segment, the next [prefetchCount] segments of the playlist are
+ * fetched concurrently, so they are ready by the time it gets to them even when each request
+ * takes longer than a segment plays. Fetched segments are kept in an LRU of [maxCacheBytes], so
+ * seeking back is served from memory. A request outside the read-ahead window (a seek) cancels
+ * the prefetches that are no longer ahead of the playhead.
+ */
+class HlsSegmentPrefetcher(
+    private val prefetchCount: Int = DEFAULT_PREFETCH_COUNT,
+    val maxCacheBytes: Long = DEFAULT_MAX_CACHE_BYTES,
+    private val scope: CoroutineScope = CoroutineScope(SupervisorJob() + Dispatchers.IO),
+    private val fetch: suspend (url: String, headers: Map<String, String>) -> HlsSegment
+) : AutoCloseable {
+
+    companion object {
+        const val DEFAULT_PREFETCH_COUNT = 3
+        const val DEFAULT_MAX_CACHE_BYTES = 64L * 1024 * 1024
+    }
+
+    private class Playlist(val segments: List<String>, val headers: Map<String, String>) {
+        val indexOf: Map<String, Int> = segments.withIndex().associate { (i, url) -> url to i }
+    }
+
+    private class Fetch(val manifestId: String, val index: Int, val result: Deferred<HlsSegment>) {
+        // Set once the player itself waits for it; a seek does not cancel those
+        var wanted = false
+    }
+
+    private val lock = SynchronizedObject()
+    private val playlists = HashMap<String, Playlist>()
+
+    // Iteration order is recency: a hit is moved to the end, eviction starts at the front
+    private val cache = LinkedHashMap<String, HlsSegment>()
+    private val inFlight = HashMap<String, Fetch>()
+    private var cacheBytes = 0L
+    private var hits = 0L
+    private var fetches = 0L
+    private var cancelled = 0L
+
+    val hitCount: Long get() = synchronized(lock) { hits }
+    val fetchCount: Long get() = synchronized(lock) { fetches }
+    val cancelledCount: Long get() = synchronized(lock) { cancelled }
+    val cachedBytes: Long get() = synchronized(lock) { cacheBytes }
+
+    /**
+     * Makes the segments of [playlist] prefetchable under [manifestId]. [headers] (the auth token)
+     * are sent with every segment request.
+     */
+    fun register(manifestId: String, playlist: String, headers: Map<String, String>) {
+        val segments = playlist.lineSequence()
+            .map { it.trim() }
+            .filter { it.isNotEmpty() && !it.startsWith("#") }
+            .toList()
+        synchronized(lock) { playlists[manifestId] = Playlist(segments, headers) }
+    }
+
+    /** Cancels the prefetches of [manifestId] and drops its cached segments. */
+    fun unregister(manifestId: String) {
+        synchronized(lock) {
+            val playlist = playlists.remove(manifestId) ?: return
+            playlist.segments.forEach { url ->
+                cache.remove(url)?.let { cacheBytes -= it.bytes.size }
+            }
+            inFlight.values.filter { it.manifestId == manifestId }.forEach { it.result.cancel() }
+        }
+    }
+
+    fun isSegment(manifestId: String, url: String): Boolean =
+        synchronized(lock) { playlists[manifestId]?.indexOf?.containsKey(url) == true }
+
+    /** The segment at [url], from the cache, a prefetch already under way, or the origin. */
+    suspend fun segment(manifestId: String, url: String): HlsSegment {
+        while (true) {
+            val pending = synchronized(lock) {
+                val playlist = playlists[manifestId]
+                    ?: throw IllegalArgumentException("No playlist registered for $manifestId")
+                val index = playlist.indexOf[url]
+                    ?: throw IllegalArgumentException("$url is not a segment of $manifestId")
+
+                val cached = cache.remove(url)
+                if (cached != null) {
+                    cache[url] = cached
+                    hits++
+                    moveTo(manifestId, playlist, index)
+                    return cached
+                }
+                // The segment asked for is requested before the ones after it
+                val wanted = startLocked(manifestId, playlist, index).also { it.wanted = true }
+                moveTo(manifestId, playlist, index)
+                wanted.result
+            }
+
+            try {
+                return pending.await()
+            } catch (e: CancellationException) {
+                currentCoroutineContext().ensureActive()
+                // Cancelled by a seek just before we marked it wanted: fetch it again
+                if (!pending.isCancelled) throw e
+            }
+        }
+    }
+
+    /** Cancels the prefetches outside the new window and starts the ones inside it. */
+    private fun moveTo(manifestId: String, playlist: Playlist, index: Int) {
+        val window = index..minOf(index + prefetchCount, playlist.segments.lastIndex)
+        inFlight.values
+            .filter { it.manifestId == manifestId && !it.wanted && it.index !in window && !it.result.isCancelled }
+            .forEach {
+                it.result.cancel()
+                cancelled++
+            }
+        for (next in index + 1..window.last) {
+            if (!cache.containsKey(playlist.segments[next])) startLocked(manifestId, playlist, next)
+        }
+    }
+
+    @OptIn(ExperimentalCoroutinesApi::class)
+    private fun startLocked(manifestId: String, playlist: Playlist, index: Int): Fetch {
+        val url = playlist.segments[index]
+        // A cancelled fetch stays listed until it has wound down; start a new one over it
+        inFlight[url]?.takeIf { !it.result.isCancelled }?.let { return it }
+
+        fetches++
+        val result = scope.async { fetch(url, playlist.headers) }
+        val started = Fetch(manifestId, index, result)
+        inFlight[url] = started
+        result.invokeOnCompletion { cause ->
+            synchronized(lock) {
+                if (inFlight[url] === started) inFlight.remove(url)
+                if (cause == null && playlists[manifestId] === playlist) putLocked(url, result.getCompleted())
+            }
+            if (cause != null && cause !is CancellationException) {
+                Logger.w("HlsSegmentPrefetcher") { "Segment fetch failed: ${cause.message}" }
+            }
+        }
+        return started
+    }
+
+    private fun putLocked(url: String, segment: HlsSegment) {
+        cache.remove(url)?.let { cacheBytes -= it.bytes.size }
+        if (segment.bytes.size > maxCacheBytes) return
+        cache[url] = segment
+        cacheBytes += segment.bytes.size
+        val iterator = cache.values.iterator()
+        while (cacheBytes > maxCacheBytes && iterator.hasNext()) {
+            cacheBytes -= iterator.next().bytes.size
+            iterator.remove()
+        }
+    }
+
+    override fun close() {
+        scope.cancel()
+        synchronized(lock) {
+            playlists.clear()
+            cache.clear()
+            inFlight.clear()
+            cacheBytes = 0
+        }
+    }
+}
@@ -3,12 +3,16 @@ package id.homebase.homebasekmppoc.prototype.lib.video
 import co.touchlab.kermit.Logger
 import id.homebase.homebasekmppoc.prototype.lib.core.SecureByteArray
 import io.ktor.client.HttpClient
+import io.ktor.client.call.body
 import io.ktor.client.request.get
 import io.ktor.client.request.header
 import io.ktor.client.statement.bodyAsChannel
 import io.ktor.http.ContentType
+import io.ktor.http.HttpHeaders
 import io.ktor.http.HttpStatusCode
+import io.ktor.http.isSuccess
 import io.ktor.http.content.OutgoingContent
+import io.ktor.server.application.ApplicationCall
 import io.ktor.server.cio.CIO
 import io.ktor.server.engine.EmbeddedServer
 import io.ktor.server.engine.embeddedServer
@@ -17,6 +21,8 @@ import io.ktor.server.response.respondBytes
 import io.ktor.server.routing.get
 import io.ktor.server.routing.routing
 import io.ktor.utils.io.ByteReadChannel
+import io.ktor.utils.io.ByteWriteChannel
+import kotlinx.coroutines.CancellationException
 
 /**
  * Simple HTTP server for serving video content locally
@@ -24,19 +30,37 @@ import io.ktor.utils.io.ByteReadChannel
  *
  * This is fully common code - Ktor server works across all platforms!
  * Auth tokens are registered with content and used for proxying remote URLs
+ *
+ * Segments of playlists registered with [registerHlsPlaylist] are read ahead [prefetchSegments]
+ * at a time and cached; 0 proxies every request as it comes.
+ *
+ * Content held in memory is limited to [maxContentBytes]; the least recently used is evicted
+ * once that is exceeded, but never while it is being streamed.
  */
-class LocalVideoServer {
+class LocalVideoServer(
+    prefetchSegments: Int = HlsSegmentPrefetcher.DEFAULT_PREFETCH_COUNT,
+    maxContentBytes: Long = ContentRegistry.DEFAULT_MAX_BYTES
+) {
     private lateinit var server: EmbeddedServer<*, *>
     private lateinit var serverUrl: String
-    private val contentRegistry = mutableMapOf<String, ContentData>()
     private val httpClient = HttpClient() // Reusable HTTP client for proxy requests
 
-    private data class ContentData(
-        val data: SecureByteArray,
-        val contentType: String,
-        val authTokenHeaderName: String? = null,
-        val authToken: String? = null
-    )
+    private val segmentPrefetcher = if (prefetchSegments > 0) {
+        HlsSegmentPrefetcher(prefetchCount = prefetchSegments) { url, headers -> fetchSegment(url, headers) }
+    } else {
+        null
+    }
+
+    /** Read-ahead statistics, for tests and logging; null when prefetching is off. */
+    val prefetcher: HlsSegmentPrefetcher? get() = segmentPrefetcher
+
+    // Registered by callers, read by the handler threads
+    private val contentRegistry = ContentRegistry(maxContentBytes) { removed ->
+        segmentPrefetcher?.unregister(removed.id)
+    }
+
+    /** The registered content, for tests and logging. */
+    val registry: ContentRegistry get() = contentRegistry
 
     /**
      * Get the server URL (server must be started first)
@@ -64,55 +88,14 @@ class LocalVideoServer {
                         return@get
                     }
 
-                    val content = contentRegistry[id]
-                    if (content == null) {
+                    // Held until the response is written, so the content is not evicted mid-stream
+                    val lease = contentRegistry.acquire(id)
+                    if (lease == null) {
                         Logger.w("LocalVideoServer") { "Content not found: $id" }
                         call.response.status(HttpStatusCode.NotFound)
                         return@get
                     }
-
-                    val data = content.data.unsafeBytes
-                    val totalSize = data.size.toLong()
-
-                    // Parse Range header (e.g., "bytes=0-1023")
-                    val rangeHeader = call.request.headers["Range"]
-
-                    if (rangeHeader != null && rangeHeader.startsWith("bytes=")) {
-                        // Handle range request
-                        val rangeSpec = rangeHeader.substringAfter("bytes=")
-                        val (startStr, endStr) = rangeSpec.split("-", limit = 2)
-
-                        val start = startStr.toLongOrNull() ?: 0
-                        val end = if (endStr.isEmpty()) totalSize - 1 else (endStr.toLongOrNull() ?: totalSize - 1)
-
-                        val actualEnd = minOf(end, totalSize - 1)
-                        val length = (actualEnd - start + 1).toInt()
-
-                        Logger.d("LocalVideoServer") { "Range request for $id: bytes=$start-$actualEnd/$totalSize (${content.contentType})" }
-
-                        // Set 206 Partial Content status
-                        call.response.status(HttpStatusCode.PartialContent)
-                        call.response.headers.append("Content-Range", "bytes $start-$actualEnd/$totalSize")
-                        call.response.headers.append("Accept-Ranges", "bytes")
-                        call.response.headers.append("Content-Length", length.toString())
-
-                        // Send the requested range
-                        call.respondBytes(
-                            bytes = data.sliceArray(start.toInt()..actualEnd.toInt()),
-                            contentType = ContentType.parse(content.contentType)
-                        )
-                    } else {
-                        // Normal request - send entire content
-                        Logger.d("LocalVideoServer") { "Serving full content: $id (${data.size} bytes, ${content.contentType})" }
-
-                        call.response.headers.append("Accept-Ranges", "bytes")
-                        call.response.headers.append("Content-Length", totalSize.toString())
-
-                        call.respondBytes(
-                            bytes = data,
-                            contentType = ContentType.parse(content.contentType)
-                        )
-                    }
+                    lease.use { serveContent(call, id, it.entry) }
                 }
 
                 // Proxy endpoint for remote URLs with auth header
@@ -126,8 +109,29 @@ class LocalVideoServer {
 
                     // Get manifest ID to look up the associated auth token from content data
                     val manifestId = call.request.queryParameters["manifestId"]
-                    val authTokenHeaderName = manifestId?.let { contentRegistry[it]?.authTokenHeaderName }
-                    val authToken = manifestId?.let { contentRegistry[it]?.authToken }
+                    val manifest = manifestId?.let { contentRegistry.get(it) }
+                    val authTokenHeaderName = manifest?.authTokenHeaderName
+                    val authToken = manifest?.authToken
+
+                    // Whole segments of a registered playlist come from the read-ahead; anything
+                    // else, and anything it fails on, is proxied as is
+                    val prefetcher = segmentPrefetcher
+                    if (prefetcher != null && manifestId != null && call.request.headers[HttpHeaders.Range] == null &&
+                        prefetcher.isSegment(manifestId, url)
+                    ) {
+                        val segment = try {
+                            prefetcher.segment(manifestId, url)
+                        } catch (e: CancellationException) {
+                            throw e
+                        } catch (e: Exception) {
+                            Logger.w("LocalVideoServer") { "Prefetched segment failed, proxying instead: ${e.message}" }
+                            null
+                        }
+                        if (segment != null) {
+                            call.respondBytes(segment.bytes, ContentType.parse(segment.contentType))
+                            return@get
+                        }
+                    }
 
                     try {
                         Logger.i("LocalVideoServer") { "Proxying request to: $url" }
@@ -194,6 +198,38 @@ class LocalVideoServer {
         return serverUrl
     }
 
+    private suspend fun serveContent(call: ApplicationCall, id: String, content: ContentEntry) {
+        val source = content.source
+        val totalSize = source.size
+        call.response.headers.append(HttpHeaders.AcceptRanges, "bytes")
+
+        // Parse Range header (e.g., "bytes=0-1023"); anything else gets the whole content
+        val range = call.request.headers[HttpHeaders.Range]?.let { parseByteRange(it, totalSize) }
+        if (range != null && range.isEmpty()) {
+            call.response.headers.append(HttpHeaders.ContentRange, "bytes */$totalSize")
+            call.respond(HttpStatusCode.RequestedRangeNotSatisfiable)
+            return
+        }
+
+        val served = range ?: 0L until totalSize
+        if (range != null) {
+            Logger.d("LocalVideoServer") { "Range request for $id: bytes=${range.first}-${range.last}/$totalSize (${content.contentType})" }
+            call.response.headers.append(HttpHeaders.ContentRange, "bytes ${range.first}-${range.last}/$totalSize")
+        } else {
+            Logger.d("LocalVideoServer") { "Serving full content: $id ($totalSize bytes, ${content.contentType})" }
+        }
+
+        // Streamed from the source a window at a time, never the whole range at once
+        call.respond(object : OutgoingContent.WriteChannelContent() {
+            override val contentType = ContentType.parse(content.contentType)
+            override val contentLength = served.last - served.first + 1
+            override val status = if (range != null) HttpStatusCode.PartialContent else HttpStatusCode.OK
+            override suspend fun writeTo(channel: ByteWriteChannel) {
+                source.writeRange(served.first, served.last, channel)
+            }
+        })
+    }
+
     /**
      * Stop the server
      */
@@ -202,6 +238,7 @@ class LocalVideoServer {
             server.stop(1000, 2000)
         }
         contentRegistry.clear()
+        segmentPrefetcher?.close()
         httpClient.close()
         Logger.i("LocalVideoServer") { "Video server stopped" }
     }
@@ -214,27 +251,72 @@ class LocalVideoServer {
         data: ByteArray,
         contentType: String,
         authTokenHeaderName: String? = null,
-        authToken: String? = null) {
-        contentRegistry[id] = ContentData(
-            SecureByteArray(data),
+        authToken: String? = null,
+        evictable: Boolean = true) {
+        registerContent(id, ByteArrayRangeSource(SecureByteArray(data)), contentType, authTokenHeaderName, authToken, evictable)
+    }
+
+    /**
+     * Register content that is read a range at a time as it is requested, such as a video
+     * in the encrypted cache or on the server. The server closes [source] when it is unregistered.
+     * Content that is not [evictable] is never evicted to make room for other content.
+     */
+    fun registerContent(
+        id: String,
+        source: RangeSource,
+        contentType: String,
+        authTokenHeaderName: String? = null,
+        authToken: String? = null,
+        evictable: Boolean = true) {
+        contentRegistry.register(ContentEntry(
+            id,
+            source,
             contentType,
             authTokenHeaderName,
-            authToken)
+            authToken,
+            evictable))
         if (authToken != null) {
-            Logger.d("LocalVideoServer") { "Registered content: $id (${data.size} bytes, $contentType) with auth token" }
+            Logger.d("LocalVideoServer") { "Registered content: $id (${source.size} bytes, $contentType) with auth token" }
+        } else {
+            Logger.d("LocalVideoServer") { "Registered content: $id (${source.size} bytes, $contentType)" }
+        }
+    }
+
+    /**
+     * Read ahead the segments of [playlist] (the playlist with the remote URLs, before they are
+     * rewritten to go through /proxy) when the player asks for them under manifest [manifestId].
+     * The manifest must be registered first; its auth token is sent with the segment requests.
+     */
+    fun registerHlsPlaylist(manifestId: String, playlist: String) {
+        val prefetcher = segmentPrefetcher ?: return
+        val content = contentRegistry.get(manifestId) ?: throw IllegalArgumentException("Manifest not registered: $manifestId")
+        val headers = if (content.authTokenHeaderName != null && content.authToken != null) {
+            mapOf(content.authTokenHeaderName to content.authToken)
         } else {
-            Logger.d("LocalVideoServer") { "Registered content: $id (${data.size} bytes, $contentType)" }
+            emptyMap()
+        }
+        prefetcher.register(manifestId, playlist, headers)
+    }
+
+    private suspend fun fetchSegment(url: String, headers: Map<String, String>): HlsSegment {
+        val response = httpClient.get(url) {
+            headers.forEach { (name, value) -> header(name, value) }
         }
+        if (!response.status.isSuccess()) throw IllegalStateException("Segment request failed: ${response.status}")
+        return HlsSegment(
+            bytes = response.body<ByteArray>(),
+            contentType = response.headers[HttpHeaders.ContentType] ?: "application/octet-stream"
+        )
     }
 
     /**
-     * Unregister content to free up memory
+     * Unregister content to free up memory; a stream in progress keeps it until it finishes
      * @param id The content identifier to remove
      */
     fun unregisterContent(id: String) {
-        val removed = contentRegistry.remove(id)
+        val removed = contentRegistry.unregister(id)
         if (removed != null) {
-            Logger.d("LocalVideoServer") { "Unregistered content: $id (freed ${removed.data.unsafeBytes.size} bytes)" }
+            Logger.d("LocalVideoServer") { "Unregistered content: $id (${removed.source.size} bytes)" }
         } else {
             Logger.w("LocalVideoServer") { "Attempted to unregister non-existent content: $id" }
         }
@@ -249,3 +331,27 @@ class LocalVideoServer {
         return "$serverUrl/content/$id"
     }
 }
+
+/**
+ * The bytes a Range header asks for out of [totalSize]: null when there is no single byte range
+ * to honour (serve everything), empty when it cannot be satisfied.
+ */
+internal fun parseByteRange(header: String, totalSize: Long): LongRange? {
+    if (!header.startsWith("bytes=")) return null
+    val spec = header.substringAfter("bytes=").trim()
+    if (spec.contains(',')) return null
+    val startStr = spec.substringBefore('-', "").trim()
+    val endStr = spec.substringAfter('-', "").trim()
+
+    if (startStr.isEmpty()) {
+        // Suffix range: the last N bytes
+        val suffix = endStr.toLongOrNull() ?: return null
+        if (suffix <= 0 || totalSize == 0L) return LongRange.EMPTY
+        return maxOf(0L, totalSize - suffix) until totalSize
+    }
+
+    val start = startStr.toLongOrNull() ?: return null
+    val end = if (endStr.isEmpty()) totalSize - 1 else endStr.toLongOrNull() ?: return null
+    if (start >= totalSize || end < start) return LongRange.EMPTY
+    return start..minOf(end, totalSize - 1)
+}
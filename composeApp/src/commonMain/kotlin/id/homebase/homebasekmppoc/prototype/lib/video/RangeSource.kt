@@ -0,0 +1,238 @@
+package id.homebase.homebasekmppoc.prototype.lib.video
+
+import id.homebase.homebasekmppoc.prototype.lib.base.exceptionForStatus
+import id.homebase.homebasekmppoc.prototype.lib.core.SecureByteArray
+import id.homebase.homebasekmppoc.prototype.lib.crypto.AesCbc
+import id.homebase.homebasekmppoc.prototype.lib.drives.RandomAccessFileInput
+import io.ktor.client.HttpClient
+import io.ktor.client.request.header
+import io.ktor.client.request.prepareGet
+import io.ktor.client.statement.HttpResponse
+import io.ktor.client.statement.bodyAsChannel
+import io.ktor.http.HttpHeaders
+import io.ktor.http.HttpStatusCode
+import io.ktor.http.isSuccess
+import io.ktor.utils.io.ByteWriteChannel
+import io.ktor.utils.io.readAvailable
+import io.ktor.utils.io.writeFully
+import kotlinx.coroutines.Dispatchers
+import kotlinx.coroutines.IO
+import kotlinx.coroutines.withContext
+import kotlin.math.min
+
+/**
+ * Content that [LocalVideoServer] serves, read a range at a time so a video never has to be in
+ * memory whole. Memory per request is one window, whatever the size of the content or the range.
+ */
+interface RangeSource : AutoCloseable {
+    /** Size in bytes of the content as served; the plaintext size for encrypted content. */
+    val size: Long
+
+    /** Bytes held in memory for as long as the source is open, not counting per-request windows. */
+    val residentBytes: Long get() = 0
+
+    /** Writes bytes [start]..[endInclusive] of the content to [channel]. */
+    suspend fun writeRange(start: Long, endInclusive: Long, channel: ByteWriteChannel)
+
+    override fun close() {}
+
+    companion object {
+        const val DEFAULT_WINDOW_SIZE = 64 * 1024
+    }
+}
+
+/** Raw bytes behind a [RangeSource]: a file in the cache or a remote payload. */
+interface RangeReader : AutoCloseable {
+    /** Exactly [length] bytes at [offset]. */
+    suspend fun read(offset: Long, length: Int): ByteArray
+
+    override fun close() {}
+}
+
+/** Small content that is already in memory, such as a rewritten HLS manifest. Closing wipes it. */
+class ByteArrayRangeSource(private val data: SecureByteArray) : RangeSource {
+    override val size: Long = data.unsafeBytes.size.toLong()
+
+    override val residentBytes: Long get() = size
+
+    override suspend fun writeRange(start: Long, endInclusive: Long, channel: ByteWriteChannel) {
+        // Written straight from the array, without copying the range out first
+        channel.writeFully(data.unsafeBytes, start.toInt(), endInclusive.toInt() + 1)
+    }
+
+    override fun close() = data.clear()
+}
+
+/** Unencrypted content of a known [size], read from [reader] one window at a time. */
+class PlainRangeSource(
+    override val size: Long,
+    private val reader: RangeReader,
+    private val windowSize: Int = RangeSource.DEFAULT_WINDOW_SIZE
+) : RangeSource {
+
+    override suspend fun writeRange(start: Long, endInclusive: Long, channel: ByteWriteChannel) {
+        var position = start
+        while (position <= endInclusive) {
+            val length = min(windowSize.toLong(), endInclusive - position + 1).toInt()
+            channel.writeFully(reader.read(position, length))
+            position += length
+        }
+    }
+
+    override fun close() = reader.close()
+}
+
+/**
+ * AES-CBC encrypted content, decrypted on the fly. Each window is read from [reader] aligned to
+ * 16-byte blocks, together with the block before it as the IV, so any range can be served without
+ * decrypting what comes before it. Only the final block carries PKCS7 padding.
+ */
+class CbcRangeSource private constructor(
+    override val size: Long,
+    private val cipherSize: Long,
+    private val key: SecureByteArray,
+    private val iv: ByteArray,
+    private val reader: RangeReader,
+    private val windowSize: Int
+) : RangeSource {
+
+    companion object {
+        private const val BLOCK_SIZE = 16
+
+        /**
+         * Opens [cipherSize] bytes of ciphertext behind [reader]. Decrypts the last block once to
+         * learn how much padding there is, and so the plaintext size.
+         */
+        suspend fun open(
+            reader: RangeReader,
+            cipherSize: Long,
+            key: SecureByteArray,
+            iv: ByteArray,
+            windowSize: Int = RangeSource.DEFAULT_WINDOW_SIZE
+        ): CbcRangeSource {
+            require(cipherSize > 0 && cipherSize % BLOCK_SIZE == 0L) {
+                "Ciphertext size $cipherSize is not a multiple of $BLOCK_SIZE"
+            }
+            require(windowSize >= BLOCK_SIZE) { "Window must hold at least one block" }
+
+            val tail = if (cipherSize > BLOCK_SIZE) {
+                val blocks = reader.read(cipherSize - 2 * BLOCK_SIZE, 2 * BLOCK_SIZE)
+                AesCbc.decrypt(blocks.copyOfRange(BLOCK_SIZE, 2 * BLOCK_SIZE), key, blocks.copyOf(BLOCK_SIZE))
+            } else {
+                AesCbc.decrypt(reader.read(0, BLOCK_SIZE), key, iv)
+            }
+            val size = cipherSize - BLOCK_SIZE + tail.size
+            return CbcRangeSource(size, cipherSize, key, iv, reader, windowSize - windowSize % BLOCK_SIZE)
+        }
+    }
+
+    private val totalBlocks = cipherSize / BLOCK_SIZE
+
+    override suspend fun writeRange(start: Long, endInclusive: Long, channel: ByteWriteChannel) {
+        var position = start
+        while (position <= endInclusive) {
+            val firstBlock = position / BLOCK_SIZE
+            val blocks = min((windowSize / BLOCK_SIZE).toLong(), totalBlocks - firstBlock).toInt()
+            val plain = decryptWindow(firstBlock, blocks)
+
+            val windowStart = firstBlock * BLOCK_SIZE
+            val from = (position - windowStart).toInt()
+            val to = min(plain.size.toLong(), endInclusive - windowStart + 1).toInt()
+            channel.writeFully(plain, from, to)
+            position = windowStart + to
+        }
+    }
+
+    private suspend fun decryptWindow(firstBlock: Long, blocks: Int): ByteArray {
+        val isLast = firstBlock + blocks == totalBlocks
+        return if (firstBlock == 0L) {
+            val cipherText = reader.read(0, blocks * BLOCK_SIZE)
+            decrypt(cipherText, iv, isLast)
+        } else {
+            // The block before the window is its IV
+            val withIv = reader.read((firstBlock - 1) * BLOCK_SIZE, (blocks + 1) * BLOCK_SIZE)
+            decrypt(withIv.copyOfRange(BLOCK_SIZE, withIv.size), withIv.copyOf(BLOCK_SIZE), isLast)
+        }
+    }
+
+    private suspend fun decrypt(cipherText: ByteArray, iv: ByteArray, isLast: Boolean): ByteArray =
+        if (isLast) AesCbc.decrypt(cipherText, key, iv)
+        else AesCbc.decryptBlocks(cipherText, key.unsafeBytes, iv)
+
+    override fun close() = reader.close()
+}
+
+/** Reads from a local file, such as the encrypted download cache. */
+class FileRangeReader(path: String) : RangeReader {
+    private val file = RandomAccessFileInput(path)
+
+    val length: Long get() = file.length
+
+    override suspend fun read(offset: Long, length: Int): ByteArray = withContext(Dispatchers.IO) {
+        val bytes = ByteArray(length)
+        var filled = 0
+        while (filled < length) {
+            val n = file.read(offset + filled, bytes, filled, length - filled)
+            if (n < 0) throw IllegalStateException("File ends before ${offset + length}")
+            filled += n
+        }
+        bytes
+    }
+
+    override fun close() = file.close()
+}
+
+/**
+ * Reads a remote payload with HTTP range requests, so seeking in a video fetches only what is
+ * played. Closes [client] when closed.
+ */
+class HttpRangeReader(
+    private val client: HttpClient,
+    private val url: String,
+    private val headers: Map<String, String> = emptyMap()
+) : RangeReader {
+
+    // Streamed rather than buffered by the client, so the status and Content-Range are checked
+    // before any of the body is read: a server that ignores the range answers with all of it
+    override suspend fun read(offset: Long, length: Int): ByteArray =
+        client.prepareGet(url) {
+            headers.forEach { (name, value) -> header(name, value) }
+            header(HttpHeaders.Range, "bytes=$offset-${offset + length - 1}")
+        }.execute { response ->
+            val contentRange = contentRangeOf(response)
+            check(contentRange.substringAfter("bytes ").substringBefore('-').toLongOrNull() == offset) {
+                "Asked for bytes from $offset, got $contentRange"
+            }
+            val bytes = ByteArray(length)
+            val channel = response.bodyAsChannel()
+            var filled = 0
+            while (filled < length) {
+                val n = channel.readAvailable(bytes, filled, length - filled)
+                if (n < 0) throw IllegalStateException("Expected $length bytes at $offset, got $filled")
+                filled += n
+            }
+            bytes
+        }
+
+    /** Total size of the remote payload, from the Content-Range of a one byte request. */
+    suspend fun contentLength(): Long =
+        client.prepareGet(url) {
+            headers.forEach { (name, value) -> header(name, value) }
+            header(HttpHeaders.Range, "bytes=0-0")
+        }.execute { response ->
+            val contentRange = contentRangeOf(response)
+            contentRange.substringAfterLast('/').toLongOrNull()
+                ?: throw IllegalStateException("No size in Content-Range ($contentRange)")
+        }
+
+    private fun contentRangeOf(response: HttpResponse): String {
+        if (!response.status.isSuccess()) throw exceptionForStatus(response.status.value)
+        if (response.status != HttpStatusCode.PartialContent) {
+            throw IllegalStateException("Range request answered with ${response.status}")
+        }
+        return response.headers[HttpHeaders.ContentRange]
+            ?: throw IllegalStateException("No Content-Range in a partial response")
+    }
+
+    override fun close() = client.close()
+}
@@ -0,0 +1,256 @@
+package id.homebase.homebasekmppoc.prototype.lib.video
+
+import id.homebase.homebasekmppoc.prototype.lib.drives.files.PayloadFile
+import id.homebase.homebasekmppoc.prototype.lib.http.AppOrOwner
+import id.homebase.homebasekmppoc.prototype.lib.http.HeaderWrapper
+import id.homebase.homebasekmppoc.prototype.lib.serialization.OdinSystemSerializer
+import kotlinx.atomicfu.locks.SynchronizedObject
+import kotlinx.atomicfu.locks.synchronized
+import kotlinx.serialization.Serializable
+import kotlin.math.ceil
+import kotlin.math.roundToLong
+
+/** The preview for [startSeconds] until [endSeconds]: a tile of the sprite sheet [sheet]. */
+data class StoryboardTile(
+    val startSeconds: Double,
+    val endSeconds: Double,
+    /** The sprite sheet, by payload key once uploaded. */
+    val sheet: String,
+    val x: Int,
+    val y: Int,
+    val width: Int,
+    val height: Int
+)
+
+/**
+ * What StoryboardIndex.grid() lays the tiles out from. Uploaded as the descriptor of the first
+ * sheet instead of the tiles themselves, which for a long video would not fit in the file header.
+ */
+@Serializable
+data class StoryboardGrid(
+    val durationSeconds: Double,
+    val intervalSeconds: Double,
+    val tileWidth: Int,
+    val tileHeight: Int,
+    val columns: Int,
+    val rows: Int
+)
+
+/**
+ * Where to find a preview frame for any time in a video, as sprite sheet tiles at a fixed
+ * interval. Written and read as WebVTT, a cue per tile with a `sheet#xywh=x,y,w,h` fragment, as
+ * players expect for thumbnail tracks. An index made by [grid] knows its [layout] and is uploaded
+ * as that.
+ */
+class StoryboardIndex(val tiles: List<StoryboardTile>, val layout: StoryboardGrid? = null) {
+
+    companion object {
+        /** Payload keys of the sheets; the first also carries the grid as its descriptor. */
+        const val SHEET_KEY_PREFIX = "pst_sb"
+        const val MAX_SHEETS = 100
+
+        fun sheetKey(sheet: Int): String = SHEET_KEY_PREFIX + sheet.toString().padStart(2, '0')
+
+        /**
+         * The tiles of sheets of [columns] x [rows], filled a row at a time, for a frame every
+         * [intervalSeconds] of a video of [durationSeconds].
+         */
+        fun grid(
+            durationSeconds: Double,
+            intervalSeconds: Double,
+            tileWidth: Int,
+            tileHeight: Int,
+            columns: Int,
+            rows: Int,
+            sheetName: (Int) -> String = ::sheetKey
+        ): StoryboardIndex {
+            require(intervalSeconds > 0) { "Interval must be positive" }
+            val count = maxOf(1, ceil(durationSeconds / intervalSeconds).toInt())
+            val perSheet = columns * rows
+            val tiles = (0 until count).map { i ->
+                val cell = i % perSheet
+                StoryboardTile(
+                    startSeconds = i * intervalSeconds,
+                    endSeconds = minOf((i + 1) * intervalSeconds, maxOf(durationSeconds, i * intervalSeconds)),
+                    sheet = sheetName(i / perSheet),
+                    x = (cell % columns) * tileWidth,
+                    y = (cell / columns) * tileHeight,
+                    width = tileWidth,
+                    height = tileHeight
+                )
+            }
+            val layout = StoryboardGrid(durationSeconds, intervalSeconds, tileWidth, tileHeight, columns, rows)
+            return StoryboardIndex(tiles, layout)
+        }
+
+        /** The index of a storyboard uploaded as [sheetCount] sheets with [descriptor] on the first. */
+        fun fromDescriptor(descriptor: String, sheetCount: Int): StoryboardIndex {
+            val layout = OdinSystemSerializer.deserialize<StoryboardGrid>(descriptor)
+            return grid(
+                layout.durationSeconds,
+                layout.intervalSeconds,
+                layout.tileWidth,
+                layout.tileHeight,
+                layout.columns,
+                layout.rows
+            ).takeSheets(sheetCount)
+        }
+
+        fun parseWebVtt(vtt: String): StoryboardIndex {
+            val lines = vtt.lines().map { it.trim() }
+            if (lines.firstOrNull()?.startsWith("WEBVTT") != true) {
+                throw Exception("Invalid WebVTT content")
+            }
+            val tiles = mutableListOf<StoryboardTile>()
+            var i = 0
+            while (i < lines.size) {
+                val timing = lines[i]
+                if (!timing.contains("-->")) {
+                    i++
+                    continue
+                }
+                val payload = lines.getOrNull(i + 1) ?: throw Exception("Cue without a tile at line ${i + 1}")
+                val region = payload.substringAfter("#xywh=", "").split(',').mapNotNull { it.trim().toIntOrNull() }
+                if (region.size != 4) throw Exception("Cue without a tile region: $payload")
+                tiles.add(
+                    StoryboardTile(
+                        startSeconds = parseTimestamp(timing.substringBefore("-->")),
+                        endSeconds = parseTimestamp(timing.substringAfter("-->").trim().substringBefore(' ')),
+                        sheet = payload.substringBefore('#'),
+                        x = region[0],
+                        y = region[1],
+                        width = region[2],
+                        height = region[3]
+                    )
+                )
+                i += 2
+            }
+            return StoryboardIndex(tiles)
+        }
+
+        // hh:mm:ss.mmm, hours optional
+        private fun parseTimestamp(value: String): Double {
+            val parts = value.trim().split(':')
+            val seconds = parts.last().toDoubleOrNull() ?: throw Exception("Invalid WebVTT timestamp: $value")
+            return parts.dropLast(1).fold(0.0) { acc, part ->
+                acc * 60 + (part.toIntOrNull() ?: throw Exception("Invalid WebVTT timestamp: $value"))
+            } * 60 + seconds
+        }
+
+        private fun formatTimestamp(seconds: Double): String {
+            val millis = (seconds * 1000).roundToLong()
+            val h = millis / 3_600_000
+            val m = millis / 60_000 % 60
+            val s = millis / 1000 % 60
+            val ms = millis % 1000
+            return "${h.pad(2)}:${m.pad(2)}:${s.pad(2)}.${ms.pad(3)}"
+        }
+
+        private fun Long.pad(length: Int) = toString().padStart(length, '0')
+    }
+
+    /** The sheets, in the order their tiles start. */
+    val sheets: List<String>
+        get() = tiles.map { it.sheet }.distinct()
+
+    /**
+     * The tile to preview [seconds] with. Times before the first tile get the first, after the
+     * last the last; null only when there are no tiles.
+     */
+    fun tileAt(seconds: Double): StoryboardTile? {
+        if (tiles.isEmpty()) return null
+        // The last tile starting at or before seconds
+        var low = 0
+        var high = tiles.size - 1
+        while (low < high) {
+            val mid = (low + high + 1) / 2
+            if (tiles[mid].startSeconds <= seconds) low = mid else high = mid - 1
+        }
+        return tiles[low]
+    }
+
+    /**
+     * The tiles on the first [count] sheets, the last of them stretched to the end of the video.
+     * For when fewer sheets were made than the grid has, as the last frame can come before the
+     * last multiple of the interval.
+     */
+    fun takeSheets(count: Int): StoryboardIndex {
+        if (count >= sheets.size) return this
+        val end = requireNotNull(layout) { "Only a grid can be cut to fewer sheets" }.durationSeconds
+        val kept = sheets.take(count).toSet()
+        val tiles = tiles.filter { it.sheet in kept }
+        if (tiles.isEmpty()) return StoryboardIndex(tiles, layout)
+        return StoryboardIndex(tiles.dropLast(1) + tiles.last().copy(endSeconds = end), layout)
+    }
+
+    fun toWebVtt(): String = buildString {
+        appendLine("WEBVTT")
+        for (tile in tiles) {
+            appendLine()
+            appendLine("${formatTimestamp(tile.startSeconds)} --> ${formatTimestamp(tile.endSeconds)}")
+            appendLine("${tile.sheet}#xywh=${tile.x},${tile.y},${tile.width},${tile.height}")
+        }
+    }
+
+    /**
+     * Payloads to upload the storyboard with alongside the video: a sheet each, keyed as the
+     * index names them, the first with the [layout] as its descriptor content. Only for an index
+     * made by [grid] with the default sheet keys, as that is what the reader rebuilds.
+     */
+    fun toPayloadFiles(sheetPaths: List<String>, contentType: String = "image/jpeg"): List<PayloadFile> {
+        require(sheetPaths.size == sheets.size) { "${sheets.size} sheets, ${sheetPaths.size} files" }
+        val layout = requireNotNull(layout) { "Only a grid can be uploaded" }
+        require(sheets == sheets.indices.map(::sheetKey)) { "Sheets must be keyed by sheetKey()" }
+        val descriptor = OdinSystemSerializer.serialize(layout)
+        return sheets.zip(sheetPaths).mapIndexed { i, (key, path) ->
+            PayloadFile(
+                key = key,
+                filePath = path,
+                contentType = contentType,
+                descriptorContent = if (i == 0) descriptor else null
+            )
+        }
+    }
+}
+
+/**
+ * Resolves times in a video to preview images from the storyboard uploaded with it. Sheets are
+ * fetched once, when first needed, and the last few are kept.
+ */
+class StoryboardPreview private constructor(
+    private val appOrOwner: AppOrOwner,
+    private val headerWrapper: HeaderWrapper,
+    val index: StoryboardIndex,
+    private val cachedSheets: Int
+) {
+    companion object {
+        /** The storyboard of the file in [headerWrapper], or null if it was uploaded without one. */
+        fun load(appOrOwner: AppOrOwner, headerWrapper: HeaderWrapper, cachedSheets: Int = 4): StoryboardPreview? {
+            val first = headerWrapper.payloads.find { it.key == StoryboardIndex.sheetKey(0) } ?: return null
+            val descriptor = first.descriptorContent ?: return null
+            val keys = headerWrapper.payloads.map { it.key }.toSet()
+            val sheetCount = (0 until StoryboardIndex.MAX_SHEETS).takeWhile { StoryboardIndex.sheetKey(it) in keys }.size
+            val index = StoryboardIndex.fromDescriptor(descriptor, sheetCount)
+            return StoryboardPreview(appOrOwner, headerWrapper, index, cachedSheets)
+        }
+    }
+
+    /** A tile and the bytes of the sprite sheet it is in. */
+    class Region(val tile: StoryboardTile, val sheetBytes: ByteArray)
+
+    private val lock = SynchronizedObject()
+    private val sheets = LinkedHashMap<String, ByteArray>()
+
+    suspend fun regionAt(seconds: Double): Region? {
+        val tile = index.tileAt(seconds) ?: return null
+        val cached = synchronized(lock) { sheets.remove(tile.sheet)?.also { sheets[tile.sheet] = it } }
+        if (cached != null) return Region(tile, cached)
+
+        val bytes = headerWrapper.getPayloadWrapper(tile.sheet).getPayloadBytes(appOrOwner)
+        synchronized(lock) {
+            sheets[tile.sheet] = bytes
+            while (sheets.size > cachedSheets) sheets.remove(sheets.keys.first())
+        }
+        return Region(tile, bytes)
+    }
+}
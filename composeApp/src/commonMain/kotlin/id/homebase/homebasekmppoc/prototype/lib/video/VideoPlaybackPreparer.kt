@@ -3,12 +3,20 @@ import id.homebase.homebasekmppoc.prototype.lib.serialization.OdinSystemSerializ
 import id.homebase.homebasekmppoc.prototype.lib.http.AppOrOwner
 import id.homebase.homebasekmppoc.prototype.lib.http.PayloadWrapper
 import id.homebase.homebasekmppoc.prototype.lib.http.cookieNameFrom
+import id.homebase.homebasekmppoc.prototype.lib.http.createHttpClient
+import id.homebase.homebasekmppoc.prototype.lib.video.CbcRangeSource
+import id.homebase.homebasekmppoc.prototype.lib.video.HlsMasterPlaylist
+import id.homebase.homebasekmppoc.prototype.lib.video.HlsPlaylistRewriter
+import id.homebase.homebasekmppoc.prototype.lib.video.HttpRangeReader
 import id.homebase.homebasekmppoc.prototype.lib.video.LocalVideoServer
+import id.homebase.homebasekmppoc.prototype.lib.video.PlainRangeSource
+import id.homebase.homebasekmppoc.prototype.lib.video.RangeSource
 import id.homebase.homebasekmppoc.prototype.lib.video.VideoMetaData
-import io.ktor.http.encodeURLParameter
+import kotlinx.atomicfu.locks.SynchronizedObject
+import kotlinx.atomicfu.locks.synchronized
 import kotlinx.coroutines.Dispatchers
 import kotlinx.coroutines.withContext
-import kotlin.math.ceil
+import kotlin.io.encoding.Base64
 import kotlin.uuid.Uuid
 
 sealed class VideoPlaybackPreparationResult {
@@ -34,46 +42,54 @@ suspend fun prepareVideoContentForPlayback(
                 (videoMetaData.hlsPlaylist == null && videoMetaData.key != null))
 
         if (isHls) {
-
-            // For HLS, when hlsPlaylist is null, we need to get a new VideoMetaData from a different payload
-            if (videoMetaData.hlsPlaylist == null) {
-                val videoMetaDataPayload = videoPayload.headerWrapper.getPayloadWrapper(videoMetaData.key!!)
-                val json = videoMetaDataPayload.getPayloadBytes(appOrOwner).decodeToString()
-                videoMetaData = OdinSystemSerializer.deserialize<VideoMetaData>(json)
-            }
+            videoMetaData = resolveHlsMetaData(appOrOwner, videoPayload, videoMetaData)
 
             Logger.i ("VideoPreparer") { "Preparing HLS video playback" }
 
-            val hlsPlayList = createHlsPlaylist(
-                appOrOwner,
-                videoPayload,
-                videoMetaData)
-
-            Logger.i("VideoPreparer") { "HLS patched playlist:\n $hlsPlayList" }
-
-            val serverUrl = videoServer.getServerUrl()
             val contentId = "video-manifest-${videoPayload.getCompositeKey()}.m3u8"
 
-            // Rewrite the playlist
-            val proxiedPlayList = hlsPlayList.lines().joinToString("\n") { line ->
-                if (line.startsWith("https://")) {
-                    val encodedUrl = line.encodeURLParameter()
-                    "$serverUrl/proxy?url=$encodedUrl&manifestId=$contentId"
-                } else {
-                    line
+            // An adaptive bitrate video: each rendition is a payload of its own with its own
+            // media playlist, registered before the master playlist that points at them. Every
+            // URI in the master playlist, variant or alternative rendition, is the key of that
+            // payload on this file (see AbrLadder.masterPlaylistFor)
+            if (HlsMasterPlaylist.isMaster(videoMetaData.hlsPlaylist ?: "")) {
+                val variantIds = mutableMapOf<String, String>()
+                try {
+                    val playlistLines = videoMetaData.hlsPlaylist?.lines() ?: emptyList()
+                    for (uri in HlsMasterPlaylist.playlistUris(playlistLines).distinct()) {
+                        val variantPayload = videoPayload.headerWrapper.getPayloadWrapper(uri)
+                        val variantMetaData = resolveHlsMetaData(
+                            appOrOwner,
+                            variantPayload,
+                            variantPayload.getVideoMetaData(appOrOwner))
+                        if (HlsMasterPlaylist.isMaster(variantMetaData.hlsPlaylist ?: "")) {
+                            throw Exception("Variant $uri is a master playlist")
+                        }
+                        val variantId = "video-manifest-${variantPayload.getCompositeKey()}.m3u8"
+                        registerHlsContent(appOrOwner, videoServer, variantPayload, variantMetaData, variantId)
+                        variantIds[uri] = variantId
+                    }
+                    val master = createHlsPlaylist(appOrOwner, videoPayload, videoMetaData) { uri ->
+                        videoServer.getContentUrl(variantIds[uri] ?: throw Exception("Variant $uri not found"))
+                    }.playlist
+                    Logger.i("VideoPreparer") { "HLS master playlist:\n $master" }
+                    videoServer.registerContent(
+                        id = contentId,
+                        data = master.encodeToByteArray(),
+                        contentType = "application/vnd.apple.mpegurl",
+                        authTokenHeaderName = cookieNameFrom(appOrOwner),
+                        authToken = videoPayload.authenticated.clientAuthToken,
+                        evictable = false
+                    )
+                } catch (e: Exception) {
+                    variantIds.values.forEach { videoServer.unregisterContent(it) }
+                    throw e
                 }
+                synchronized(variantManifestsLock) { variantManifests[contentId] = variantIds.values.toList() }
+            } else {
+                registerHlsContent(appOrOwner, videoServer, videoPayload, videoMetaData, contentId)
             }
 
-            Logger.i("VideoPreparer") { "HLS proxied playlist:\n $proxiedPlayList" }
-
-            videoServer.registerContent(
-                id = contentId,
-                data = proxiedPlayList.encodeToByteArray(),
-                contentType = "application/vnd.apple.mpegurl",
-                authTokenHeaderName = cookieNameFrom(appOrOwner),
-                authToken = videoPayload.authenticated.clientAuthToken
-            )
-
             return@withContext VideoPlaybackPreparationResult.Success(
                 url = videoServer.getContentUrl(contentId),
                 contentId = contentId
@@ -81,15 +97,15 @@ suspend fun prepareVideoContentForPlayback(
         }
 
         //
-        // Non-HLS - load entire video into RAM
+        // Non-HLS - served straight from the server with range requests as the player seeks
         //
         else {
-            val videoBytes = videoPayload.getPayloadBytes(appOrOwner)
+            val source = openPayloadRangeSource(appOrOwner, videoPayload)
             val contentId = "video-${Uuid.random()}"
 
             videoServer.registerContent(
                 id = contentId,
-                data = videoBytes,
+                source = source,
                 contentType = "video/mp4",
                 authTokenHeaderName = cookieNameFrom(appOrOwner),
                 authToken = videoPayload.authenticated.clientAuthToken
@@ -111,148 +127,138 @@ suspend fun prepareVideoContentForPlayback(
 
 //
 
+// Master playlist content id -> the media playlists of its renditions, unregistered with it
+private val variantManifestsLock = SynchronizedObject()
+private val variantManifests = mutableMapOf<String, List<String>>()
+
 fun unprepareVideoContent(contentId: String, videoServer: LocalVideoServer) {
     videoServer.unregisterContent(contentId)
+    synchronized(variantManifestsLock) { variantManifests.remove(contentId) }
+        ?.forEach { videoServer.unregisterContent(it) }
 }
 
 //
 
-private suspend fun createHlsPlaylist(
+// For HLS, when hlsPlaylist is null, we need to get a new VideoMetaData from a different payload
+private suspend fun resolveHlsMetaData(
     appOrOwner: AppOrOwner,
     videoPayload: PayloadWrapper,
-    videoMetaData: VideoMetaData): String {
+    videoMetaData: VideoMetaData): VideoMetaData {
 
-    if (!videoMetaData.isSegmented) {
-        throw Exception("Video is not segmented; HLS playlist cannot be created")
+    if (videoMetaData.hlsPlaylist != null) {
+        return videoMetaData
     }
-
-    if (videoMetaData.hlsPlaylist == null) {
-        throw Exception("Insufficient data to create HLS playlist")
-    }
-
-    val hlsPlaylist = videoMetaData.hlsPlaylist
-
-    var lines = hlsPlaylist.lines()
-    if (lines.isEmpty() || !lines[0].startsWith("#EXTM3U")) {
-        throw Exception("Invalid HLS playlist content")
-    }
-
-    lines = patchHlsUrls(appOrOwner, videoPayload, lines)
-    lines = fixTargetDuration(lines)
-    lines = convertByteRangesToUrlPath(lines)
-
-    return lines.joinToString("\n")
+    val key = videoMetaData.key ?: throw Exception("Insufficient data to create HLS playlist")
+    val videoMetaDataPayload = videoPayload.headerWrapper.getPayloadWrapper(key)
+    val json = videoMetaDataPayload.getPayloadBytes(appOrOwner).decodeToString()
+    return OdinSystemSerializer.deserialize<VideoMetaData>(json)
 }
 
 //
 
-private suspend fun patchHlsUrls(
+/**
+ * Registers the media playlist of [videoPayload] under [contentId], its segments proxied through
+ * the server and read ahead.
+ */
+private suspend fun registerHlsContent(
     appOrOwner: AppOrOwner,
+    videoServer: LocalVideoServer,
     videoPayload: PayloadWrapper,
-    lines: List<String>): List<String> {
-
-    val modifiedLines = ArrayList<String>(lines.size) // Pre-allocate size
-
-    val aesKey = videoPayload.decryptKeyHeader()?.aesKey?.base64Encode()
-    for (line in lines) {
-        when {
-            // Case 1: Encryption Key
-            line.startsWith("#EXT-X-KEY:METHOD=AES-128") -> {
-                if (aesKey == null) {
-                    throw Exception("AES key is null but playlist requires encryption key")
-                }
-                val uriRegex = Regex("""URI="([^"]+)"""")
-                val match = uriRegex.find(line)
-                if (match != null && match.groupValues.size > 1) {
-                    val originalKeyUri = match.groupValues[1]
-                    val newKeyUri = "data:application/octet-stream;base64,$aesKey"
-                    modifiedLines.add(line.replace(originalKeyUri, newKeyUri))
-                }
-            }
-            // Case 2: Segment URL (Not a comment/tag and not empty)
-            !line.startsWith("#") && line.isNotBlank() -> {
-                val newUrl = videoPayload.getEncryptedPayloadUri(appOrOwner)
-                modifiedLines.add(newUrl)
-            }
-            // Case 3: Metadata / Comments / Empty lines
-            else -> {
-                modifiedLines.add(line)
-            }
-        }
-    }
-
-    return modifiedLines
+    videoMetaData: VideoMetaData,
+    contentId: String) {
+
+    // The proxied copy for the player is written in the same pass as the playlist itself
+    val playlists = createHlsPlaylist(
+        appOrOwner,
+        videoPayload,
+        videoMetaData,
+        proxy = HlsPlaylistRewriter.Proxy(videoServer.getServerUrl(), contentId))
+    val hlsPlayList = playlists.playlist
+    val proxiedPlayList = playlists.proxied ?: hlsPlayList
+
+    Logger.i("VideoPreparer") { "HLS patched playlist:\n $hlsPlayList" }
+    Logger.i("VideoPreparer") { "HLS proxied playlist:\n $proxiedPlayList" }
+
+    // Kept until unprepareVideoContent: segments are proxied with the manifest's auth token
+    videoServer.registerContent(
+        id = contentId,
+        data = proxiedPlayList.encodeToByteArray(),
+        contentType = "application/vnd.apple.mpegurl",
+        authTokenHeaderName = cookieNameFrom(appOrOwner),
+        authToken = videoPayload.authenticated.clientAuthToken,
+        evictable = false
+    )
+    // Segments are requested by their remote URLs, so read ahead on those
+    videoServer.registerHlsPlaylist(contentId, hlsPlayList)
 }
 
 //
 
-private fun fixTargetDuration(lines: List<String>): List<String> {
-    // 1. Calculate the maximum segment duration found in EXTINF tags
-    val maxDuration = lines.asSequence()
-        .filter { it.startsWith("#EXTINF:") }
-        .mapNotNull {
-            it.substringAfter(":")
-                .substringBefore(",")
-                .toDoubleOrNull()
-        }
-        .maxOrNull() ?: 0.0
-
-    // 2. Target duration must be the ceiling of the max duration
-    val newTarget = ceil(maxDuration).toInt()
+private const val REMOTE_WINDOW_SIZE = 1024 * 1024
 
-    // 3. Return new list with updated header
-    return lines.map { line ->
-        if (line.startsWith("#EXT-X-TARGETDURATION:")) {
-            "#EXT-X-TARGETDURATION:$newTarget"
-        } else {
-            line
-        }
+/**
+ * A range source over the payload on the server: each window the player asks for is fetched with
+ * a range request and, for encrypted files, decrypted on its own. A window is larger than for a
+ * local file to keep the number of round trips down during normal playback.
+ */
+private suspend fun openPayloadRangeSource(
+    appOrOwner: AppOrOwner,
+    videoPayload: PayloadWrapper
+): RangeSource {
+    val reader = HttpRangeReader(
+        client = createHttpClient(),
+        url = videoPayload.getEncryptedPayloadUri(appOrOwner),
+        headers = mapOf("Cookie" to "${cookieNameFrom(appOrOwner)}=${videoPayload.authenticated.clientAuthToken}")
+    )
+    try {
+        // bytesWritten is the stored size, i.e. the ciphertext for encrypted payloads
+        val storedSize = videoPayload.payloadDescriptor.bytesWritten ?: reader.contentLength()
+        val keyHeader = videoPayload.decryptKeyHeader()
+            ?: return PlainRangeSource(storedSize, reader, REMOTE_WINDOW_SIZE)
+
+        val payloadIv = videoPayload.payloadDescriptor.iv?.let { Base64.decode(it) }
+            ?: throw Exception("No IV found in payload descriptor")
+        return CbcRangeSource.open(reader, storedSize, keyHeader.aesKey, payloadIv, REMOTE_WINDOW_SIZE)
+    } catch (e: Exception) {
+        reader.close()
+        throw e
     }
 }
 
 //
 
-private fun convertByteRangesToUrlPath(lines: List<String>): List<String> {
-    val result = mutableListOf<String>()
-
-    // Stores: Pair(offset, length)
-    var pendingRange: Pair<String, String>? = null
-
-    for (line in lines) {
-        when {
-            line.startsWith("#EXT-X-BYTERANGE:") -> {
-                val rawValue = line.substringAfter(":")
-                val parts = rawValue.split("@")
-                val length = parts[0]
-                // HLS spec says if offset is missing, it continues from previous.
-                // However, based on your examples having explicit offsets, we parse part[1].
-                val offset = parts.getOrNull(1) ?: "0"
-
-                pendingRange = offset to length
-                // We skip adding this line to result (it is deleted)
-            }
-
-            line.isNotBlank() && !line.startsWith("#") -> {
-                if (pendingRange != null) {
-                    val (offset, length) = pendingRange
+/**
+ * The playable form of the playlist in [videoMetaData]. A master playlist has its variant URIs
+ * rewritten by [variantUrl]; a media playlist is rewritten by [HlsPlaylistRewriter], its segments
+ * all pointed at the one payload URL, signed once for the playlist.
+ */
+private suspend fun createHlsPlaylist(
+    appOrOwner: AppOrOwner,
+    videoPayload: PayloadWrapper,
+    videoMetaData: VideoMetaData,
+    proxy: HlsPlaylistRewriter.Proxy? = null,
+    variantUrl: (String) -> String = { throw Exception("Unexpected variant playlist $it") }): HlsPlaylistRewriter.Result {
 
-                    // Drop query parameters here
-                    val cleanBaseUrl = line.substringBefore("?")
+    if (!videoMetaData.isSegmented) {
+        throw Exception("Video is not segmented; HLS playlist cannot be created")
+    }
 
-                    result.add("$cleanBaseUrl/$offset/$length")
+    val hlsPlaylist = videoMetaData.hlsPlaylist ?: throw Exception("Insufficient data to create HLS playlist")
 
-                    // Reset
-                    pendingRange = null
-                } else {
-                    result.add(line)
-                }
-            }
+    if (!hlsPlaylist.startsWith("#EXTM3U")) {
+        throw Exception("Invalid HLS playlist content")
+    }
 
-            else -> {
-                // Pass through header tags, EXTINF, etc.
-                result.add(line)
-            }
-        }
+    // A master playlist lists renditions rather than segments; only their URIs change
+    if (HlsMasterPlaylist.isMaster(hlsPlaylist)) {
+        val master = HlsMasterPlaylist.rewriteUris(hlsPlaylist.lines(), variantUrl).joinToString("\n")
+        return HlsPlaylistRewriter.Result(master, null)
     }
-    return result
-}
\ No newline at end of file
+
+    val aesKey = videoPayload.decryptKeyHeader()?.aesKey?.base64Encode()
+    val rewriter = HlsPlaylistRewriter(
+        segmentUrl = videoPayload.getEncryptedPayloadUri(appOrOwner),
+        keyUri = aesKey?.let { "data:application/octet-stream;base64,$it" },
+        proxy = proxy)
+    return rewriter.rewrite(hlsPlaylist)
+}
@@ -138,7 +138,8 @@ fun ChatFileHeaderPanel(
             Spacer(Modifier.height(4.dp))
             ThumbnailImage(
                     thumbnail = thumbnail,
-                    modifier = Modifier.fillMaxWidth().height(150.dp).clip(RoundedCornerShape(8.dp))
+                    modifier = Modifier.fillMaxWidth().height(150.dp).clip(RoundedCornerShape(8.dp)),
+                    fileId = header.fileId.toString()
             )
             Text(
                     text =
@@ -193,6 +194,7 @@ fun ChatFileHeaderPanel(
         } else {
             payloads.forEach { payload ->
                 PayloadSection(
+                        fileId = header.fileId.toString(),
                         payload = payload,
                         payloadBytes = payloadBytes,
                         expandedPayloadKey = expandedPayloadKey,
@@ -206,6 +208,7 @@ fun ChatFileHeaderPanel(
 
 @Composable
 private fun PayloadSection(
+        fileId: String,
         payload: PayloadDescriptor,
         payloadBytes: Map<String, BytesResponse>,
         expandedPayloadKey: String?,
@@ -238,7 +241,9 @@ private fun PayloadSection(
             Spacer(Modifier.height(8.dp))
             ThumbnailImage(
                     thumbnail = thumbnail,
-                    modifier = Modifier.fillMaxWidth().height(100.dp).clip(RoundedCornerShape(8.dp))
+                    modifier = Modifier.fillMaxWidth().height(100.dp).clip(RoundedCornerShape(8.dp)),
+                    fileId = fileId,
+                    thumbnailKey = payload.key
             )
         }
 
@@ -3,9 +3,11 @@ package id.homebase.homebasekmppoc.prototype.ui.chat
 import androidx.compose.foundation.Image
 import androidx.compose.foundation.clickable
 import androidx.compose.foundation.layout.Arrangement
+import androidx.compose.foundation.layout.BoxWithConstraints
 import androidx.compose.foundation.layout.Column
 import androidx.compose.foundation.layout.Row
 import androidx.compose.foundation.layout.Spacer
+import androidx.compose.foundation.layout.fillMaxSize
 import androidx.compose.foundation.layout.fillMaxWidth
 import androidx.compose.foundation.layout.height
 import androidx.compose.foundation.layout.padding
@@ -33,8 +35,12 @@ import androidx.compose.ui.unit.dp
 import id.homebase.homebasekmppoc.prototype.lib.chat.ChatMessageData
 import id.homebase.homebasekmppoc.prototype.lib.chat.ConversationData
 import id.homebase.homebasekmppoc.prototype.lib.drives.files.ThumbnailDescriptor
+import kotlinx.coroutines.Dispatchers
+import kotlinx.coroutines.withContext
 import kotlin.io.encoding.Base64
 import kotlin.io.encoding.ExperimentalEncodingApi
+import kotlin.math.ceil
+import kotlin.math.max
 
 /**
  * List of conversations (fileType 8888). Clicking a conversation navigates to its messages.
@@ -77,7 +83,8 @@ fun ConversationCard(item: ConversationData, onClick: () -> Unit) {
                                                 thumbnail = thumb,
                                                 modifier =
                                                         Modifier.size(100.dp)
-                                                                .clip(RoundedCornerShape(8.dp))
+                                                                .clip(RoundedCornerShape(8.dp)),
+                                                fileId = item.fileId?.toString()
                                         )
                                 }
 
@@ -157,7 +164,8 @@ fun ChatMessageCard(item: ChatMessageData, onClick: () -> Unit) {
                                                 thumbnail = thumb,
                                                 modifier =
                                                         Modifier.size(100.dp)
-                                                                .clip(RoundedCornerShape(8.dp))
+                                                                .clip(RoundedCornerShape(8.dp)),
+                                                fileId = item.fileId.toString()
                                         )
                                 }
 
@@ -201,42 +209,90 @@ fun ChatMessageCard(item: ChatMessageData, onClick: () -> Unit) {
         }
 }
 
-/** Composable to display a 100x100 thumbnail image from a ThumbnailDescriptor. */
+/** Thumbnail key the cache files embedded previews under, next to payload thumbnail keys. */
+const val PREVIEW_THUMBNAIL_KEY = "preview"
+
+/**
+ * Composable to display a thumbnail image from a ThumbnailDescriptor, cropped to fill [modifier].
+ *
+ * With a [fileId] the decoded bitmap is kept in [ImageBitmapCache.shared] at the size it is
+ * drawn, so an item scrolled back into view shows it on its first frame. Otherwise, or on a miss,
+ * the size placeholder is shown while the image is decoded off the main thread.
+ */
 @OptIn(ExperimentalEncodingApi::class)
 @Composable
-fun ThumbnailImage(thumbnail: ThumbnailDescriptor, modifier: Modifier = Modifier) {
-        var imageBitmap by remember { mutableStateOf<ImageBitmap?>(null) }
-
-        LaunchedEffect(thumbnail.content) {
-                thumbnail.content?.let { base64Content ->
-                        try {
-                                val bytes = Base64.decode(base64Content)
-                                imageBitmap = decodeImageBitmap(bytes)
-                        } catch (e: Exception) {
-                                imageBitmap = null
+fun ThumbnailImage(
+        thumbnail: ThumbnailDescriptor,
+        modifier: Modifier = Modifier,
+        fileId: String? = null,
+        thumbnailKey: String = PREVIEW_THUMBNAIL_KEY
+) {
+        BoxWithConstraints(modifier = modifier, contentAlignment = Alignment.Center) {
+                val content = thumbnail.content
+                val targetWidth = if (constraints.hasBoundedWidth) constraints.maxWidth else 0
+                val targetHeight = if (constraints.hasBoundedHeight) constraints.maxHeight else 0
+                val key =
+                        fileId?.let { ImageBitmapKey(it, thumbnailKey, targetWidth, targetHeight) }
+                val fingerprint = content?.hashCode() ?: 0
+
+                var imageBitmap by
+                        remember(key, content) {
+                                mutableStateOf(key?.let { ImageBitmapCache.shared.get(it, fingerprint) })
                         }
-                }
-        }
 
-        imageBitmap?.let { bitmap ->
-                Image(
-                        bitmap = bitmap,
-                        contentDescription = "Preview thumbnail",
-                        modifier = modifier,
-                        contentScale = ContentScale.Crop
-                )
-        }
-                ?: run {
-                        thumbnail.content?.let {
-                                Text(
-                                        text =
-                                                "📷 ${thumbnail.pixelWidth ?: 0}x${thumbnail.pixelHeight ?: 0}",
-                                        style = MaterialTheme.typography.bodySmall,
-                                        modifier = modifier
-                                )
+                LaunchedEffect(key, content) {
+                        if (imageBitmap != null || content == null) return@LaunchedEffect
+                        val decode: suspend () -> ImageBitmap? = {
+                                withContext(Dispatchers.Default) {
+                                        try {
+                                                decodeImageBitmap(
+                                                        Base64.decode(content),
+                                                        targetWidth,
+                                                        targetHeight
+                                                )
+                                        } catch (e: IllegalArgumentException) {
+                                                null
+                                        }
+                                }
                         }
+                        imageBitmap =
+                                if (key != null) ImageBitmapCache.shared.getOrDecode(key, fingerprint, decode)
+                                else decode()
                 }
+
+                imageBitmap?.let { bitmap ->
+                        Image(
+                                bitmap = bitmap,
+                                contentDescription = "Preview thumbnail",
+                                modifier = Modifier.fillMaxSize(),
+                                contentScale = ContentScale.Crop
+                        )
+                }
+                        ?: run {
+                                content?.let {
+                                        Text(
+                                                text =
+                                                        "📷 ${thumbnail.pixelWidth ?: 0}x${thumbnail.pixelHeight ?: 0}",
+                                                style = MaterialTheme.typography.bodySmall
+                                        )
+                                }
+                        }
+        }
 }
 
-/** Platform-specific function to decode image bytes to ImageBitmap. */
-expect fun decodeImageBitmap(bytes: ByteArray): ImageBitmap?
+/**
+ * The size to decode a width x height image at so it covers targetWidth x targetHeight the way
+ * ContentScale.Crop draws it, or null to keep the decoded size: no target, or it would upscale.
+ */
+internal fun coverSize(width: Int, height: Int, targetWidth: Int, targetHeight: Int): Pair<Int, Int>? {
+        if (width <= 0 || height <= 0 || targetWidth <= 0 || targetHeight <= 0) return null
+        val scale = max(targetWidth.toDouble() / width, targetHeight.toDouble() / height)
+        if (scale >= 1.0) return null
+        return max(1, ceil(width * scale).toInt()) to max(1, ceil(height * scale).toInt())
+}
+
+/**
+ * Platform-specific function to decode image bytes to ImageBitmap, reduced to [coverSize] of the
+ * target when one is given.
+ */
+expect fun decodeImageBitmap(bytes: ByteArray, targetWidth: Int = 0, targetHeight: Int = 0): ImageBitmap?
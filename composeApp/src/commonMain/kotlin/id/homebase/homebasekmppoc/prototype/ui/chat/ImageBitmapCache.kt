@@ -0,0 +1,134 @@
+package id.homebase.homebasekmppoc.prototype.ui.chat
+
+import androidx.compose.ui.graphics.ImageBitmap
+import kotlinx.atomicfu.locks.SynchronizedObject
+import kotlinx.atomicfu.locks.synchronized
+import kotlinx.coroutines.CompletableDeferred
+
+/**
+ * One decoded bitmap: the file, which of its thumbnails, and the pixel size it was decoded for
+ * (0 x 0 for its natural size).
+ */
+data class ImageBitmapKey(
+    val fileId: String,
+    val thumbnailKey: String,
+    val targetWidth: Int = 0,
+    val targetHeight: Int = 0
+)
+
+/**
+ * Byte-budgeted LRU of decoded bitmaps, so list items that scroll back into view are drawn from
+ * memory instead of being base64 and image decoded again. Bitmaps are counted at 4 bytes per
+ * pixel.
+ *
+ * Each entry remembers a fingerprint of the encoded content it was decoded from; a lookup with a
+ * different fingerprint (the file was edited and its preview changed) is a miss.
+ *
+ * The platforms call [trimToSize] and [clear] when the OS reports memory pressure.
+ */
+class ImageBitmapCache(val maxBytes: Long = DEFAULT_MAX_BYTES) {
+
+    private class Entry(val bitmap: ImageBitmap, val fingerprint: Int, val bytes: Long)
+
+    private class Pending(val fingerprint: Int, val result: CompletableDeferred<ImageBitmap?>)
+
+    private val lock = SynchronizedObject()
+
+    // Iteration order is recency: a hit is moved to the end, eviction starts at the front
+    private val entries = LinkedHashMap<ImageBitmapKey, Entry>()
+    private val pending = HashMap<ImageBitmapKey, Pending>()
+    private var currentBytes = 0L
+    private var hits = 0L
+    private var misses = 0L
+
+    val sizeBytes: Long get() = synchronized(lock) { currentBytes }
+    val hitCount: Long get() = synchronized(lock) { hits }
+    val missCount: Long get() = synchronized(lock) { misses }
+
+    /** The cached bitmap for [key] if it was decoded from content with this [fingerprint]. */
+    fun get(key: ImageBitmapKey, fingerprint: Int): ImageBitmap? = synchronized(lock) {
+        val entry = entries.remove(key)
+        if (entry == null || entry.fingerprint != fingerprint) {
+            if (entry != null) currentBytes -= entry.bytes
+            misses++
+            return null
+        }
+        entries[key] = entry
+        hits++
+        entry.bitmap
+    }
+
+    fun put(key: ImageBitmapKey, fingerprint: Int, bitmap: ImageBitmap) {
+        synchronized(lock) {
+            entries.remove(key)?.let { currentBytes -= it.bytes }
+            val bytes = bitmap.width.toLong() * bitmap.height * 4
+            // One bitmap over the whole budget would only flush everything else
+            if (bytes > maxBytes) return
+            entries[key] = Entry(bitmap, fingerprint, bytes)
+            currentBytes += bytes
+            trimLocked(maxBytes)
+        }
+    }
+
+    /**
+     * The cached bitmap, or the result of [decode], which is then cached. Concurrent calls for
+     * the same key and fingerprint share one decode; if the caller running it is cancelled (its
+     * list item scrolled away) a waiting caller takes over.
+     */
+    suspend fun getOrDecode(
+        key: ImageBitmapKey,
+        fingerprint: Int,
+        decode: suspend () -> ImageBitmap?
+    ): ImageBitmap? {
+        while (true) {
+            val mine = CompletableDeferred<ImageBitmap?>()
+            val running = synchronized(lock) {
+                get(key, fingerprint)?.let { return it }
+                val other = pending[key]
+                if (other != null && other.fingerprint == fingerprint) {
+                    other.result
+                } else {
+                    pending[key] = Pending(fingerprint, mine)
+                    null
+                }
+            }
+
+            if (running != null) {
+                running.await()?.let { return it }
+                continue
+            }
+
+            try {
+                val bitmap = decode()
+                if (bitmap != null) put(key, fingerprint, bitmap)
+                mine.complete(bitmap)
+                return bitmap
+            } finally {
+                mine.complete(null)
+                synchronized(lock) {
+                    if (pending[key]?.result === mine) pending.remove(key)
+                }
+            }
+        }
+    }
+
+    /** Evicts least recently used bitmaps until at most [bytes] are held. */
+    fun trimToSize(bytes: Long) = synchronized(lock) { trimLocked(bytes) }
+
+    fun clear() = trimToSize(0)
+
+    private fun trimLocked(limit: Long) {
+        val iterator = entries.values.iterator()
+        while (currentBytes > limit && iterator.hasNext()) {
+            currentBytes -= iterator.next().bytes
+            iterator.remove()
+        }
+    }
+
+    companion object {
+        const val DEFAULT_MAX_BYTES = 32L * 1024 * 1024
+
+        /** The cache the chat and drive lists draw their previews from. */
+        val shared = ImageBitmapCache()
+    }
+}
@@ -0,0 +1,238 @@
+package id.homebase.homebasekmppoc.prototype.ui.driveFetch
+
+import co.touchlab.kermit.Logger
+import id.homebase.homebasekmppoc.lib.database.Download
+import id.homebase.homebasekmppoc.prototype.lib.core.time.UnixTimeUtc
+import id.homebase.homebasekmppoc.prototype.lib.database.DatabaseManager
+import id.homebase.homebasekmppoc.prototype.lib.drives.files.DriveFileProvider
+import id.homebase.homebasekmppoc.prototype.lib.drives.files.PayloadDownloadResult
+import id.homebase.homebasekmppoc.prototype.lib.eventbus.BackendEvent
+import id.homebase.homebasekmppoc.prototype.lib.eventbus.EventBus
+import kotlinx.coroutines.CoroutineScope
+import kotlinx.coroutines.Dispatchers
+import kotlinx.coroutines.IO
+import kotlinx.coroutines.Job
+import kotlinx.coroutines.NonCancellable
+import kotlinx.coroutines.SupervisorJob
+import kotlinx.coroutines.cancelAndJoin
+import kotlinx.coroutines.flow.first
+import kotlinx.coroutines.launch
+import kotlinx.coroutines.sync.Mutex
+import kotlinx.coroutines.sync.withLock
+import kotlinx.coroutines.withContext
+import kotlinx.coroutines.withTimeoutOrNull
+import kotlinx.io.files.Path
+import kotlinx.io.files.SystemFileSystem
+import kotlin.coroutines.cancellation.CancellationException
+import kotlin.uuid.Uuid
+
+interface DownloadFetcher {
+    /**
+     * Fetches the payload of [download] to its targetPath, resuming from targetPath.part if an
+     * earlier attempt left one, as PayloadDownloader.downloadToFile does.
+     */
+    suspend fun fetch(
+        download: Download,
+        onProgress: suspend (bytesReceived: Long, totalBytes: Long?) -> Unit
+    ): PayloadDownloadResult
+}
+
+class DrivePayloadFetcher(private val driveFileProvider: DriveFileProvider) : DownloadFetcher {
+    override suspend fun fetch(
+        download: Download,
+        onProgress: suspend (bytesReceived: Long, totalBytes: Long?) -> Unit
+    ): PayloadDownloadResult =
+        driveFileProvider.downloadPayloadToFile(
+            driveId = download.driveId,
+            fileId = download.fileId,
+            key = download.payloadKey,
+            path = download.targetPath,
+            expectedSha256 = download.expectedSha256,
+            onProgress = onProgress
+        )
+}
+
+/**
+ * Downloads payloads to files from the Download table, the way OutboxSync sends the outbox: most
+ * urgent first (lowest priority value), failures retried with backoff, and whatever was checked
+ * out when the app stopped requeued by start(). At most [maxConcurrent] downloads run at once,
+ * and no more than [maxPerHost] of them from the same host.
+ *
+ * The part file beside each target is the partial download; a requeued download resumes from it.
+ * The table records the stored bytes received at each checkpoint of [checkpointBytes], for
+ * showing progress without touching the file.
+ */
+class DownloadManager(
+    private val databaseManager: DatabaseManager,
+    private val fetcher: DownloadFetcher,
+    private val eventBus: EventBus,
+    scope: CoroutineScope? = null,
+    private val retryPolicy: OutboxRetryPolicy = OutboxRetryPolicy(),
+    private val clock: () -> UnixTimeUtc = { UnixTimeUtc.now() },
+    private val maxConcurrent: Int = 4,
+    private val maxPerHost: Int = 2,
+    private val checkpointBytes: Long = 4L * 1024 * 1024)
+{
+    init {
+        require(maxConcurrent >= 1 && maxPerHost >= 1) { "Need at least one download at a time" }
+    }
+
+    // Downloads use the DB, the network and the disk, so we use the IO dispatcher
+    private val scope = scope ?: CoroutineScope(SupervisorJob() + Dispatchers.IO)
+
+    // Guards active and activePerHost, and makes checkout and launch one step
+    private val mutex = Mutex()
+    private val active = HashMap<Long, Job>() // By rowId
+    private val activePerHost = HashMap<String, Int>()
+    private var schedulerJob: Job? = null
+
+    /**
+     * Queues the payload [payloadKey] of [fileId] for download to [targetPath] from [host], the
+     * identity it is stored on. Returns false if a download to [targetPath] is already queued.
+     */
+    suspend fun enqueue(
+        driveId: Uuid,
+        fileId: Uuid,
+        payloadKey: String,
+        host: String,
+        targetPath: String,
+        priority: Long = 0,
+        expectedSha256: String? = null
+    ): Boolean =
+        databaseManager.downloads.insert(driveId, fileId, payloadKey, host, targetPath, expectedSha256, priority) != null
+
+    /** Removes the download to [targetPath] from the queue, stopping it if it is running, and its part file. */
+    suspend fun cancel(targetPath: String): Boolean {
+        val download = databaseManager.downloads.selectByTargetPath(targetPath) ?: return false
+        // Once the row is gone it cannot be checked out again
+        val job = mutex.withLock {
+            databaseManager.downloads.deleteByRowId(download.rowId)
+            active[download.rowId]
+        }
+        job?.cancelAndJoin()
+        SystemFileSystem.delete(Path("$targetPath.part"), mustExist = false)
+        return true
+    }
+
+    /**
+     * Starts the scheduler: requeues downloads left checked out by a crash or stop(), then sleeps
+     * until either the earliest next run time or an enqueue / reschedule, and checks out what it can.
+     */
+    fun start() {
+        if (schedulerJob?.isActive == true)
+            return
+        schedulerJob = scope.launch {
+            databaseManager.downloads.clearCheckedOut()
+            runScheduler()
+        }
+    }
+
+    /**
+     * Stops the scheduler and the running downloads, and waits for them, so a start() that
+     * follows cannot requeue a download whose part file is still being written. Their rows stay
+     * checked out until then.
+     */
+    suspend fun stop() {
+        schedulerJob?.cancelAndJoin()
+        schedulerJob = null
+        mutex.withLock { active.values.toList() }.forEach { it.cancelAndJoin() }
+    }
+
+    private suspend fun runScheduler() {
+        val downloads = databaseManager.downloads
+        var seenVersion = -1L
+        var lastRound = Long.MIN_VALUE
+
+        while (true) {
+            val version = downloads.scheduleChanged.value
+            val now = clock().milliseconds
+            val wakeAt = downloads.schedule.nextAfter(lastRound)
+
+            if (version != seenVersion || (wakeAt != null && wakeAt <= now)) {
+                seenVersion = version
+                lastRound = now
+                fill()
+                continue
+            }
+
+            if (wakeAt == null)
+                downloads.scheduleChanged.first { it != seenVersion }
+            else
+                withTimeoutOrNull(wakeAt - now) { downloads.scheduleChanged.first { it != seenVersion } }
+        }
+    }
+
+    // Checks out and launches due downloads until a limit is reached or nothing more can go
+    private suspend fun fill() {
+        mutex.withLock {
+            while (active.size < maxConcurrent) {
+                val busyHosts = activePerHost.filterValues { it >= maxPerHost }.keys
+                val download = databaseManager.downloads.checkout(clock(), busyHosts) ?: break
+                activePerHost[download.host] = (activePerHost[download.host] ?: 0) + 1
+                active[download.rowId] = scope.launch { runDownload(download) }
+            }
+        }
+    }
+
+    private suspend fun runDownload(download: Download) {
+        try {
+            downloadItem(download)
+        } finally {
+            withContext(NonCancellable) {
+                mutex.withLock {
+                    active.remove(download.rowId)
+                    val n = (activePerHost[download.host] ?: 1) - 1
+                    if (n == 0) activePerHost.remove(download.host) else activePerHost[download.host] = n
+                }
+            }
+        }
+        // Its slot may be what a due download was waiting for
+        fill()
+    }
+
+    private suspend fun downloadItem(download: Download) {
+        val part = Path("${download.targetPath}.part")
+        val resumedFrom = SystemFileSystem.metadataOrNull(part)?.size ?: 0L
+        try {
+            eventBus.emit(BackendEvent.DownloadEvent.ItemStarted(download.driveId, download.fileId,
+                download.targetPath, resumedFrom))
+
+            var checkpoint = 0L
+            val result = fetcher.fetch(download) { bytesReceived, totalBytes ->
+                eventBus.emit(BackendEvent.DownloadEvent.ItemProgress(download.driveId, download.fileId,
+                    download.targetPath, bytesReceived, totalBytes))
+                if (bytesReceived - checkpoint >= checkpointBytes) {
+                    checkpoint = bytesReceived
+                    databaseManager.downloads.updateProgress(download.checkOutStamp!!, bytesReceived, totalBytes)
+                }
+            }
+
+            databaseManager.downloads.deleteByRowId(download.rowId)
+            eventBus.emit(BackendEvent.DownloadEvent.ItemCompleted(download.driveId, download.fileId,
+                download.targetPath, result.size, result.sha256))
+        } catch (e: CancellationException) {
+            throw e // Row stays checked out and the part file stays; clearCheckedOut() requeues it on next start
+        } catch (e: Exception) {
+            handleFailure(download, e)
+        }
+    }
+
+    private suspend fun handleFailure(download: Download, e: Exception) {
+        val attempt = download.checkOutCount.toInt()
+        val failure = retryPolicy.classify(e)
+
+        if (retryPolicy.shouldGiveUp(failure, attempt)) {
+            Logger.e("Giving up on download to ${download.targetPath} after ${attempt + 1} attempts ($failure)", e)
+            databaseManager.downloads.deleteByRowId(download.rowId)
+            SystemFileSystem.delete(Path("${download.targetPath}.part"), mustExist = false)
+            eventBus.emit(BackendEvent.DownloadEvent.ItemFailed(download.driveId, download.fileId,
+                download.targetPath, e.message ?: "Unknown error"))
+        } else {
+            // The part file is kept for the retry to resume from
+            val waitMs = retryPolicy.nextDelayMs(attempt)
+            Logger.w("Failed download to ${download.targetPath}, retry in $waitMs ms (attempt ${attempt + 1})", e)
+            val now = clock()
+            databaseManager.downloads.checkInFailed(download.checkOutStamp!!, now.milliseconds + waitMs, now)
+        }
+    }
+}
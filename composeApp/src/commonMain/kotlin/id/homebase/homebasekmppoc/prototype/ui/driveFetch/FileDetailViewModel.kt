@@ -345,6 +345,8 @@ class FileDetailViewModel(
 
         viewModelScope.launch {
             try {
+                // The exact stored variant its row lists, not one picked for a display size
+                // (getThumbBytesForDisplay): this page inspects every variant
                 val bytes =
                     provider.getThumbBytesDecrypted(
                         driveId = driveId,
@@ -0,0 +1,132 @@
+package id.homebase.homebasekmppoc.prototype.ui.driveFetch
+
+import id.homebase.homebasekmppoc.prototype.lib.base.OdinApiException
+import id.homebase.homebasekmppoc.prototype.lib.drives.files.PayloadIntegrityException
+import id.homebase.homebasekmppoc.prototype.lib.drives.upload.ChunkChecksumMismatchException
+import kotlinx.coroutines.sync.Mutex
+import kotlinx.coroutines.sync.withLock
+import kotlinx.io.IOException
+import kotlinx.serialization.SerializationException
+import kotlin.random.Random
+
+enum class FailureClass {
+    Retryable,
+    Fatal
+}
+
+/**
+ * Decides how the outbox reacts to a failed upload, and the download queue to a failed download:
+ * capped exponential backoff with full jitter for transient errors, give up on permanent ones.
+ */
+class OutboxRetryPolicy(
+    val baseDelayMs: Long = 2_000L,
+    val maxDelayMs: Long = 15 * 60_000L,
+    val maxAttempts: Int = 25,
+    private val random: Random = Random.Default
+) {
+    fun classify(e: Throwable): FailureClass =
+        when (e) {
+            is OdinApiException -> classifyStatus(e.status)
+            is IOException -> FailureClass.Retryable // Includes ktor connect / request timeouts
+            is ChunkChecksumMismatchException -> FailureClass.Fatal
+            is PayloadIntegrityException -> FailureClass.Fatal // Wrong key or size; fetching it again won't help
+            is SerializationException, is IllegalArgumentException -> FailureClass.Fatal
+            else -> FailureClass.Retryable
+        }
+
+    fun classifyStatus(status: Int): FailureClass =
+        when (status) {
+            401 -> FailureClass.Retryable // Token may be refreshed before the next attempt
+            408, 425, 429 -> FailureClass.Retryable
+            in 400..499 -> FailureClass.Fatal
+            else -> FailureClass.Retryable
+        }
+
+    // Failures that say something about the host rather than the item; these feed the circuit breaker
+    fun isHostFailure(e: Throwable): Boolean =
+        when (e) {
+            is OdinApiException -> e.status == 408 || e.status == 429 || e.status in 500..599
+            is IOException -> true
+            else -> false
+        }
+
+    /** Full jitter: uniform in [0, min(maxDelayMs, baseDelayMs * 2^attempt)]. */
+    fun nextDelayMs(attempt: Int): Long {
+        val ceiling = minOf(maxDelayMs, baseDelayMs shl attempt.coerceIn(0, 30))
+        return random.nextLong(0, ceiling + 1)
+    }
+
+    fun shouldGiveUp(failure: FailureClass, attempt: Int): Boolean =
+        failure == FailureClass.Fatal || attempt + 1 >= maxAttempts
+}
+
+/**
+ * Stops the outbox from hammering a host that is down. After [failureThreshold] consecutive host
+ * failures the breaker opens and checkout pauses; once the open period has passed a single probe
+ * item is let through. Each consecutive trip doubles the open period, up to [maxOpenDurationMs].
+ *
+ * There is one OutboxSync per identity, and each owns its breaker.
+ */
+class CircuitBreaker(
+    private val failureThreshold: Int = 5,
+    private val openDurationMs: Long = 30_000L,
+    private val maxOpenDurationMs: Long = 10 * 60_000L
+) {
+    enum class State {
+        Closed,
+        Open,
+        HalfOpen
+    }
+
+    private val mutex = Mutex()
+    private var state = State.Closed
+    private var consecutiveFailures = 0
+    private var trips = 0
+    private var openUntil = 0L
+    private var probeInFlight = false
+
+    suspend fun state(): State = mutex.withLock { state }
+
+    /** Returns the time the breaker allows the next probe, or null if it is not open. */
+    suspend fun retryAt(): Long? = mutex.withLock { if (state == State.Open) openUntil else null }
+
+    /** Returns true if a new item may be checked out now. */
+    suspend fun tryAcquire(now: Long): Boolean = mutex.withLock {
+        when (state) {
+            State.Closed -> true
+            State.Open -> {
+                if (now < openUntil) return@withLock false
+                state = State.HalfOpen
+                probeInFlight = true
+                true
+            }
+            State.HalfOpen -> {
+                if (probeInFlight) return@withLock false
+                probeInFlight = true
+                true
+            }
+        }
+    }
+
+    /** Call when an acquired slot found nothing to send, so another probe may go later. */
+    suspend fun release() = mutex.withLock {
+        probeInFlight = false
+    }
+
+    suspend fun recordSuccess() = mutex.withLock {
+        state = State.Closed
+        consecutiveFailures = 0
+        trips = 0
+        probeInFlight = false
+    }
+
+    suspend fun recordFailure(now: Long) = mutex.withLock {
+        consecutiveFailures++
+        if (state == State.HalfOpen || consecutiveFailures >= failureThreshold) {
+            trips++
+            state = State.Open
+            probeInFlight = false
+            openUntil = now + minOf(maxOpenDurationMs, openDurationMs shl (trips - 1).coerceAtMost(20))
+        }
+    }
+}
@@ -2,64 +2,91 @@ package id.homebase.homebasekmppoc.prototype.ui.driveFetch
 
 import co.touchlab.kermit.Logger
 import id.homebase.homebasekmppoc.lib.database.Outbox
+import id.homebase.homebasekmppoc.lib.database.OutboxLane
 import id.homebase.homebasekmppoc.prototype.lib.core.time.UnixTimeUtc
 import id.homebase.homebasekmppoc.prototype.lib.database.DatabaseManager
+import id.homebase.homebasekmppoc.prototype.lib.database.OutboxSpool
 import id.homebase.homebasekmppoc.prototype.lib.eventbus.BackendEvent
 import id.homebase.homebasekmppoc.prototype.lib.eventbus.EventBus
 import kotlinx.atomicfu.atomic
 import kotlinx.coroutines.CoroutineScope
-import kotlinx.coroutines.delay
 import kotlinx.coroutines.Dispatchers
 import kotlinx.coroutines.IO
+import kotlinx.coroutines.Job
 import kotlinx.coroutines.launch
 import kotlinx.coroutines.SupervisorJob
+import kotlinx.coroutines.flow.first
+import kotlinx.coroutines.withTimeoutOrNull
 import kotlinx.coroutines.sync.*
+import kotlin.coroutines.cancellation.CancellationException
 
 interface OutboxUploader {
     suspend fun upload(outboxRecord: Outbox, eventBus : EventBus): Unit
 }
 
+/**
+ * Sends the outbox in two lanes (see OutboxLane). Each lane has its own worker budget, so chat
+ * messages are never queued behind large media uploads. When the interactive lane has nothing
+ * to do its workers steal bulk items, but always leave one interactive slot free.
+ */
 class OutboxSync(
     private val databaseManager: DatabaseManager,
     private val uploader: OutboxUploader,
     private val eventBus: EventBus,
-    scope: CoroutineScope? = null)
+    scope: CoroutineScope? = null,
+    private val retryPolicy: OutboxRetryPolicy = OutboxRetryPolicy(),
+    private val circuitBreaker: CircuitBreaker = CircuitBreaker(),
+    private val clock: () -> UnixTimeUtc = { UnixTimeUtc.now() },
+    private val interactiveThreads: Int = 2,
+    private val bulkThreads: Int = 2,
+    private val spool: OutboxSpool? = null)
 {
+    init {
+        require(interactiveThreads >= 1 && bulkThreads >= 1) { "Each lane needs at least one thread" }
+    }
+
     // The threads use the DB & Network, so we use the IO dispatcher
     private val scope = scope ?: CoroutineScope(SupervisorJob() + Dispatchers.IO)
-    private val MAX_SENDING_THREADS = 3
-    private val WAIT_INCREMENT_SECONDS = 30L
-    private val semaphore = Semaphore(MAX_SENDING_THREADS)
+    private val MAX_SENDING_THREADS = interactiveThreads + bulkThreads
+    private val interactiveSemaphore = Semaphore(interactiveThreads)
+    private val bulkSemaphore = Semaphore(bulkThreads)
+    private val stolenSlots = atomic(0) // Interactive threads currently sending a bulk item
     private val activeThreads = atomic(0)
     private val totalSent = atomic(0)
     private val counterMutex = Mutex()
+    private var schedulerJob: Job? = null
 
-    // The send() function spawns a thread when it acquires the lock.
+    // The send() function spawns a thread per lane when it acquires the lane's lock.
     // Then send() returns true if it begins processing in a thread, and false if
-    // another thread is already processing.
+    // other threads are already processing.
     // Then the call immediately knows if a worker thread has been spawned.
     //
     suspend fun send(): Boolean {
+        val interactive = send(OutboxLane.Interactive)
+        val bulk = send(OutboxLane.Bulk)
+        return interactive || bulk
+    }
+
+    private suspend fun send(lane: OutboxLane): Boolean {
+        val semaphore = if (lane == OutboxLane.Interactive) interactiveSemaphore else bulkSemaphore
         if (!semaphore.tryAcquire()) {
             return false
         }
 
         scope.launch {
-            try {
+            val stoppedAt = try {
                 counterMutex.withLock {
                     if (activeThreads.incrementAndGet() == 1) {
                         eventBus.emit(BackendEvent.OutboxEvent.Started)
                     }
                 }
-                outboxSend()
+                outboxSend(lane)
             } finally {
                 // After loop, check if this is the final thread
-                var nextSend : UnixTimeUtc? = null
                 try {
                     counterMutex.withLock {
                         if (activeThreads.decrementAndGet() == 0) {
                             val n = totalSent.getAndSet(0)
-                            nextSend = databaseManager.outbox.nextScheduled()
                             eventBus.emit(BackendEvent.OutboxEvent.Completed(n))
                         }
                     }
@@ -67,52 +94,187 @@ class OutboxSync(
                 finally {
                     semaphore.release()
                 }
-                if (nextSend != null)
-                {
-                    val delay = nextSend!!.milliseconds - UnixTimeUtc.now().milliseconds
-                    delay(delay) // Put the thread to sleep
-                    send()
-                }
             }
+            // Something may have become due after our last look but before the slot was free,
+            // when the scheduler could not start a thread for it
+            if (becameDueSince(stoppedAt))
+                send()
         }
         return true
     }
 
-    private suspend fun outboxSend() {
+    /**
+     * Starts the scheduler: requeues items left checked out by a crash, then sleeps until either
+     * the earliest next run time in the outbox timer heap or an enqueue / reschedule, whichever
+     * comes first. Nothing wakes up while the outbox is empty.
+     */
+    fun start() {
+        if (schedulerJob?.isActive == true)
+            return
+        schedulerJob = scope.launch {
+            databaseManager.outbox.clearCheckedOut()
+            spool?.recover()?.let { failRowsMissingPayload(it.rowsMissingPayload) }
+            runScheduler()
+        }
+    }
+
+    // A row whose spooled payload is gone can never be sent, so it fails now instead of retrying
+    private suspend fun failRowsMissingPayload(rowIds: List<Long>) {
+        for (rowId in rowIds) {
+            val outboxRecord = databaseManager.outbox.selectByRowId(rowId) ?: continue
+            Logger.e("Payload of ${outboxRecord.fileId} is gone from the spool, dropping it")
+            deleteItem(rowId)
+            eventBus.emit(BackendEvent.OutboxEvent.ItemFailed(outboxRecord.driveId, outboxRecord.fileId,
+                "Payload is gone from the spool"))
+        }
+    }
+
+    fun stop() {
+        schedulerJob?.cancel()
+        schedulerJob = null
+    }
+
+    private suspend fun runScheduler() {
+        val outbox = databaseManager.outbox
+        var seenVersion = -1L
+        var lastRound = Long.MIN_VALUE
+
         while (true) {
-            Logger.i("Popping Outbox")
+            val version = outbox.scheduleChanged.value
+            val now = clock().milliseconds
+
+            // While the breaker is open nothing goes out before it lets a probe through
+            val retryAt = circuitBreaker.retryAt()
+            val wakeAt =
+                if (retryAt != null) retryAt.takeIf { it > lastRound && outbox.schedule.size > 0 }
+                else outbox.schedule.nextAfter(lastRound)
+
+            if (version != seenVersion || (wakeAt != null && wakeAt <= now)) {
+                seenVersion = version
+                lastRound = now
+                send()
+                continue
+            }
 
-            val outboxRecord = databaseManager.outbox.checkout()
+            if (wakeAt == null)
+                outbox.scheduleChanged.first { it != seenVersion }
+            else
+                withTimeoutOrNull(wakeAt - now) { outbox.scheduleChanged.first { it != seenVersion } }
+        }
+    }
+
+    private suspend fun becameDueSince(time: Long): Boolean {
+        val now = clock().milliseconds
+        val retryAt = circuitBreaker.retryAt()
+        if (retryAt != null)
+            return retryAt in (time + 1)..now
+        val due = databaseManager.outbox.schedule.nextAfter(time) ?: return false
+        return due <= now
+    }
+
+    // An interactive thread may take a bulk item as long as one interactive slot stays free
+    private fun tryStealSlot(): Boolean {
+        while (true) {
+            val current = stolenSlots.value
+            if (current >= interactiveThreads - 1)
+                return false
+            if (stolenSlots.compareAndSet(current, current + 1))
+                return true
+        }
+    }
+
+    // Returns the time the thread ran out of work
+    private suspend fun outboxSend(lane: OutboxLane): Long {
+        while (true) {
+            Logger.i("Popping Outbox ($lane)")
+
+            val now = clock()
+            if (!circuitBreaker.tryAcquire(now.milliseconds)) {
+                Logger.i("Circuit breaker open, pausing outbox")
+                return now.milliseconds
+            }
+
+            var stolen = false
+            var outboxRecord = databaseManager.outbox.checkout(now, lane)
+
+            if (outboxRecord == null && lane == OutboxLane.Interactive && tryStealSlot()) {
+                outboxRecord = databaseManager.outbox.checkout(now, OutboxLane.Bulk)
+                if (outboxRecord == null)
+                    stolenSlots.decrementAndGet()
+                else
+                    stolen = true
+            }
 
             if (outboxRecord == null) {
-                Logger.i("No more items in outbox")
-                break;
+                Logger.i("No more items in outbox ($lane)")
+                circuitBreaker.release()
+                return now.milliseconds
             }
 
-            // Doesn't matter if it's not fully thread safe, semaphore ultimate guard
+            // Doesn't matter if it's not fully thread safe, semaphores are the ultimate guard
             if (activeThreads.value < MAX_SENDING_THREADS)
                 this.send() // Try to spawn a thread for parallel outbox processing
 
             try {
-                // We sent the item, send an event
-                eventBus.emit(BackendEvent.OutboxEvent.ItemStarted(outboxRecord.driveId, outboxRecord.fileId))
-                Logger.i("Log the data from the outboxRecord here...")
-
-                uploader.upload(outboxRecord, eventBus)
-
-                // if successful we remove it from the database
-                databaseManager.outbox.deleteByRowId(outboxRecord.rowId)
-
-                // We sent the item, send an event
-                eventBus.emit(BackendEvent.OutboxEvent.ItemCompleted(outboxRecord.driveId, outboxRecord.fileId))
-                totalSent.incrementAndGet()
-            } catch (e: Exception) {
-                val n = WAIT_INCREMENT_SECONDS * outboxRecord.checkOutCount
-                Logger.w("Failed upload for ${outboxRecord.fileId}, retry in $n seconds (attempt ${outboxRecord.checkOutCount + 1})", e)
-                databaseManager.outbox.checkInFailed(outboxRecord.checkOutStamp!!,
-                    UnixTimeUtc.now().addSeconds(n).seconds)
-                eventBus.emit(BackendEvent.OutboxEvent.Failed(e.message ?: "Unknown error"))
+                sendItem(outboxRecord)
+            } finally {
+                if (stolen)
+                    stolenSlots.decrementAndGet()
             }
         }
     }
+
+    private suspend fun sendItem(outboxRecord: Outbox) {
+        try {
+            // We sent the item, send an event
+            eventBus.emit(BackendEvent.OutboxEvent.ItemStarted(outboxRecord.driveId, outboxRecord.fileId))
+            Logger.i("Log the data from the outboxRecord here...")
+
+            uploader.upload(outboxRecord, eventBus)
+
+            // if successful we remove it from the database
+            deleteItem(outboxRecord.rowId)
+
+            // We sent the item, send an event
+            eventBus.emit(BackendEvent.OutboxEvent.ItemCompleted(outboxRecord.driveId, outboxRecord.fileId))
+            totalSent.incrementAndGet()
+            circuitBreaker.recordSuccess()
+        } catch (e: CancellationException) {
+            throw e // Item stays checked out; clearCheckedOut() requeues it on next start
+        } catch (e: Exception) {
+            handleFailure(outboxRecord, e)
+        }
+    }
+
+    // The row goes before its spool files, so a crash in between only leaves orphans for recover()
+    private suspend fun deleteItem(rowId: Long) {
+        val hashes = if (spool != null) databaseManager.outbox.spoolHashes(rowId) else emptyList()
+        databaseManager.outbox.deleteByRowId(rowId)
+        if (hashes.isNotEmpty())
+            spool?.release(hashes)
+    }
+
+    private suspend fun handleFailure(outboxRecord: Outbox, e: Exception) {
+        // A non-host failure still proves the host is answering
+        if (retryPolicy.isHostFailure(e))
+            circuitBreaker.recordFailure(clock().milliseconds)
+        else
+            circuitBreaker.recordSuccess()
+
+        val attempt = outboxRecord.checkOutCount.toInt()
+        val failure = retryPolicy.classify(e)
+
+        if (retryPolicy.shouldGiveUp(failure, attempt)) {
+            Logger.e("Giving up on ${outboxRecord.fileId} after ${attempt + 1} attempts ($failure)", e)
+            deleteItem(outboxRecord.rowId)
+            eventBus.emit(BackendEvent.OutboxEvent.ItemFailed(outboxRecord.driveId, outboxRecord.fileId,
+                e.message ?: "Unknown error"))
+        } else {
+            val waitMs = retryPolicy.nextDelayMs(attempt)
+            Logger.w("Failed upload for ${outboxRecord.fileId}, retry in $waitMs ms (attempt ${attempt + 1})", e)
+            val now = clock()
+            databaseManager.outbox.checkInFailed(outboxRecord.checkOutStamp!!, now.milliseconds + waitMs, now)
+            eventBus.emit(BackendEvent.OutboxEvent.Failed(e.message ?: "Unknown error"))
+        }
+    }
 }
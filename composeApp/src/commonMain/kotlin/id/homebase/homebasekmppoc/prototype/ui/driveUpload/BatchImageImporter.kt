@@ -0,0 +1,263 @@
+package id.homebase.homebasekmppoc.prototype.ui.driveUpload
+
+import co.touchlab.kermit.Logger as KLogger
+import id.homebase.homebasekmppoc.lib.image.ImageHeaderProbe
+import id.homebase.homebasekmppoc.lib.image.ImageSize
+import id.homebase.homebasekmppoc.lib.image.createThumbnails
+import id.homebase.homebasekmppoc.prototype.lib.drives.files.ThumbnailFile
+import id.homebase.homebasekmppoc.prototype.lib.drives.openFileInput
+import id.homebase.homebasekmppoc.prototype.lib.drives.upload.EmbeddedThumb
+import kotlinx.atomicfu.atomic
+import kotlinx.coroutines.CancellationException
+import kotlinx.coroutines.CompletableDeferred
+import kotlinx.coroutines.Dispatchers
+import kotlinx.coroutines.IO
+import kotlinx.coroutines.NonCancellable
+import kotlinx.coroutines.channels.Channel
+import kotlinx.coroutines.flow.Flow
+import kotlinx.coroutines.flow.buffer
+import kotlinx.coroutines.flow.channelFlow
+import kotlinx.coroutines.launch
+import kotlinx.coroutines.sync.Mutex
+import kotlinx.coroutines.sync.Semaphore
+import kotlinx.coroutines.sync.withLock
+import kotlinx.coroutines.withContext
+import kotlinx.io.buffered
+import kotlinx.io.files.Path
+import kotlinx.io.files.SystemFileSystem
+import kotlinx.io.readByteArray
+import kotlin.uuid.Uuid
+
+/** One image of a batch, in input order. */
+sealed interface ImportResult {
+    val index: Int
+    val sourcePath: String
+
+    /**
+     * The original is at [spoolPath], ready to upload as a payload; delete it with
+     * [BatchImageImporter.discard] once uploaded.
+     */
+    data class Imported(
+        override val index: Int,
+        override val sourcePath: String,
+        val spoolPath: String,
+        val byteCount: Long,
+        val naturalSize: ImageSize,
+        val previewThumbnail: EmbeddedThumb,
+        val thumbnails: List<ThumbnailFile>
+    ) : ImportResult
+
+    data class Failed(
+        override val index: Int,
+        override val sourcePath: String,
+        val cause: Throwable
+    ) : ImportResult
+}
+
+/**
+ * Prepares a batch of picked images for upload, [parallelism] at a time, without holding the
+ * batch in memory.
+ *
+ * Each original is streamed into [spoolDirectory] and only read back, decoded and thumbnailed
+ * once [memoryBudgetBytes] has room for it, going by its size on disk and its pixel count from
+ * the header. Results come out of [import] in input order, each as soon as it and everything
+ * before it is ready, so the uploader can start on the first image while the rest are still
+ * being processed. At most 2 x parallelism images are started but not yet collected.
+ */
+class BatchImageImporter(
+    private val spoolDirectory: Path,
+    private val parallelism: Int = 4,
+    val memoryBudgetBytes: Long = DEFAULT_MEMORY_BUDGET
+) {
+    companion object {
+        private const val TAG = "BatchImageImporter"
+        const val DEFAULT_MEMORY_BUDGET = 256L * 1024 * 1024
+        private const val HEADER_BYTES = 64 * 1024
+        private const val BYTES_PER_PIXEL = 4
+    }
+
+    init {
+        require(parallelism > 0) { "parallelism must be positive" }
+        SystemFileSystem.createDirectories(spoolDirectory)
+    }
+
+    private val budget = MemoryBudget(memoryBudgetBytes)
+
+    /** The most memory that has been reserved at once, for tests and logging. */
+    val peakReservedBytes: Long get() = budget.peak
+
+    fun import(sourcePaths: List<String>, payloadKey: String): Flow<ImportResult> = channelFlow {
+        val finished = Channel<ImportResult>(Channel.UNLIMITED)
+        val window = Semaphore(parallelism * 2)
+        val workers = Semaphore(parallelism)
+
+        launch {
+            sourcePaths.forEachIndexed { index, path ->
+                window.acquire()
+                workers.acquire()
+                launch(Dispatchers.Default) {
+                    try {
+                        val result = importOne(index, path, payloadKey)
+                        // Closed once collection has stopped: nobody will upload it
+                        if (finished.trySend(result).isFailure) withContext(NonCancellable) { discard(result) }
+                    } finally {
+                        workers.release()
+                    }
+                }
+            }
+        }
+
+        // Put completions back into input order
+        val early = HashMap<Int, ImportResult>()
+        try {
+            for (next in sourcePaths.indices) {
+                var result = early.remove(next)
+                while (result == null) {
+                    val received = finished.receive()
+                    if (received.index == next) result = received else early[received.index] = received
+                }
+                send(result)
+                window.release()
+            }
+        } finally {
+            // Collection stopped early: nobody will upload what was finished but not yet handed over
+            finished.close()
+            withContext(NonCancellable) {
+                early.values.forEach { discard(it) }
+                while (true) discard(finished.tryReceive().getOrNull() ?: break)
+            }
+        }
+    }.buffer(Channel.RENDEZVOUS)
+
+    /** Deletes the spooled original of [result], once it has been uploaded or is not wanted. */
+    suspend fun discard(result: ImportResult) {
+        if (result !is ImportResult.Imported) return
+        withContext(Dispatchers.IO) {
+            SystemFileSystem.delete(Path(result.spoolPath), mustExist = false)
+        }
+    }
+
+    private suspend fun importOne(index: Int, sourcePath: String, payloadKey: String): ImportResult {
+        val spoolPath = Path(spoolDirectory, "import-${Uuid.random()}")
+        return try {
+            val byteCount = withContext(Dispatchers.IO) { spool(sourcePath, spoolPath) }
+            val probe = withContext(Dispatchers.IO) { readHeader(spoolPath) }.let { ImageHeaderProbe.probe(it) }
+
+            // Without a header to go by (SVG, unknown formats), assume the worst and take it all
+            val cost = probe?.let { byteCount + it.size.pixelWidth.toLong() * it.size.pixelHeight * BYTES_PER_PIXEL }
+                ?: memoryBudgetBytes
+
+            budget.withReservation(cost) {
+                val bytes = withContext(Dispatchers.IO) {
+                    SystemFileSystem.source(spoolPath).buffered().use { it.readByteArray() }
+                }
+                val (naturalSize, preview, thumbnails) = createThumbnails(bytes, payloadKey)
+                ImportResult.Imported(
+                    index = index,
+                    sourcePath = sourcePath,
+                    spoolPath = spoolPath.toString(),
+                    byteCount = byteCount,
+                    naturalSize = naturalSize,
+                    previewThumbnail = preview,
+                    thumbnails = thumbnails
+                )
+            }
+        } catch (e: CancellationException) {
+            withContext(NonCancellable) { SystemFileSystem.delete(spoolPath, mustExist = false) }
+            throw e
+        } catch (e: Exception) {
+            KLogger.w(TAG, e) { "Failed to import $sourcePath" }
+            SystemFileSystem.delete(spoolPath, mustExist = false)
+            ImportResult.Failed(index, sourcePath, e)
+        }
+    }
+
+    private fun spool(sourcePath: String, spoolPath: Path): Long {
+        openFileInput(sourcePath).block().use { input ->
+            SystemFileSystem.sink(spoolPath).buffered().use { output ->
+                return output.transferFrom(input)
+            }
+        }
+    }
+
+    private fun readHeader(spoolPath: Path): ByteArray {
+        val header = ByteArray(HEADER_BYTES)
+        var length = 0
+        SystemFileSystem.source(spoolPath).buffered().use { input ->
+            while (length < header.size) {
+                val n = input.readAtMostTo(header, length, header.size)
+                if (n == -1) break
+                length += n
+            }
+        }
+        return header.copyOf(length)
+    }
+}
+
+/**
+ * Bytes of memory that concurrent work reserves before it starts and returns when done.
+ * Reservations are granted in arrival order; one larger than the whole budget waits for
+ * everything else to finish and then runs alone.
+ */
+internal class MemoryBudget(val capacity: Long) {
+    private class Waiter(val bytes: Long, val granted: CompletableDeferred<Unit>)
+
+    private val mutex = Mutex()
+    private val waiters = ArrayDeque<Waiter>()
+    private var used = 0L
+    private val peakUsed = atomic(0L)
+
+    val peak: Long get() = peakUsed.value
+
+    suspend fun <T> withReservation(bytes: Long, block: suspend () -> T): T {
+        val amount = bytes.coerceIn(0L, capacity)
+        acquire(amount)
+        try {
+            return block()
+        } finally {
+            withContext(NonCancellable) { release(amount) }
+        }
+    }
+
+    private suspend fun acquire(bytes: Long) {
+        val waiter = mutex.withLock {
+            if (waiters.isEmpty() && used + bytes <= capacity) {
+                take(bytes)
+                return
+            }
+            Waiter(bytes, CompletableDeferred()).also { waiters.addLast(it) }
+        }
+        try {
+            waiter.granted.await()
+        } catch (e: CancellationException) {
+            withContext(NonCancellable) {
+                mutex.withLock {
+                    // Granted in the meantime: hand it straight back
+                    if (!waiters.remove(waiter)) releaseLocked(bytes)
+                    else grantLocked()
+                }
+            }
+            throw e
+        }
+    }
+
+    private suspend fun release(bytes: Long) = mutex.withLock { releaseLocked(bytes) }
+
+    private fun releaseLocked(bytes: Long) {
+        used -= bytes
+        grantLocked()
+    }
+
+    private fun grantLocked() {
+        while (waiters.isNotEmpty() && used + waiters.first().bytes <= capacity) {
+            val next = waiters.removeFirst()
+            take(next.bytes)
+            next.granted.complete(Unit)
+        }
+    }
+
+    private fun take(bytes: Long) {
+        used += bytes
+        if (used > peakUsed.value) peakUsed.value = used
+    }
+}
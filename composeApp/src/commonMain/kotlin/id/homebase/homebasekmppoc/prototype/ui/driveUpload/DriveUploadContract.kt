@@ -7,6 +7,9 @@ data class DriveUploadUiState(
     val isUploadingText: Boolean = false,
     val isUploadingEncryptedPayloadText: Boolean = false,
     val isUploadingImage: Boolean = false,
+    val isUploadingImages: Boolean = false,
+    val imagesUploaded: Int = 0,
+    val imagesToUpload: Int = 0,
     val isPickingImage: Boolean = false,
     val uploadResult: String? = null,
     val errorMessage: String? = null,
@@ -21,6 +24,9 @@ data class DriveUploadUiState(
         if (isUploadingText != other.isUploadingText) return false
         if (isUploadingEncryptedPayloadText != other.isUploadingEncryptedPayloadText) return false
         if (isUploadingImage != other.isUploadingImage) return false
+        if (isUploadingImages != other.isUploadingImages) return false
+        if (imagesUploaded != other.imagesUploaded) return false
+        if (imagesToUpload != other.imagesToUpload) return false
         if (isPickingImage != other.isPickingImage) return false
         if (uploadResult != other.uploadResult) return false
         if (errorMessage != other.errorMessage) return false
@@ -36,6 +42,9 @@ data class DriveUploadUiState(
     override fun hashCode(): Int {
         var result = isUploadingText.hashCode()
         result = 31 * result + isUploadingImage.hashCode()
+        result = 31 * result + isUploadingImages.hashCode()
+        result = 31 * result + imagesUploaded
+        result = 31 * result + imagesToUpload
         result = 31 * result + isUploadingEncryptedPayloadText.hashCode()
         result = 31 * result + isPickingImage.hashCode()
         result = 31 * result + (uploadResult?.hashCode() ?: 0)
@@ -60,6 +69,9 @@ sealed interface DriveUploadUiAction {
     /** User wants to upload selected image */
     data object UploadImageClicked : DriveUploadUiAction
 
+    /** User wants to pick several images from gallery and upload them all */
+    data object PickImagesClicked : DriveUploadUiAction
+
     /** Image was successfully picked from gallery */
     data class ImagePicked(val filePath: String, val name: String) : DriveUploadUiAction {
         override fun equals(other: Any?): Boolean {
@@ -78,6 +90,9 @@ sealed interface DriveUploadUiAction {
         }
     }
 
+    /** Several images were picked from gallery, to be uploaded in order */
+    data class ImagesPicked(val filePaths: List<String>) : DriveUploadUiAction
+
     /** Image picking failed */
     data class ImagePickFailed(val error: String) : DriveUploadUiAction
 
@@ -90,6 +105,9 @@ sealed interface DriveUploadUiEvent {
     /** Request to open file picker for images */
     data object OpenImagePicker : DriveUploadUiEvent
 
+    /** Request to open file picker for several images at once */
+    data object OpenMultiImagePicker : DriveUploadUiEvent
+
     /** Show success toast/snackbar */
     data class ShowSuccess(val message: String) : DriveUploadUiEvent
 
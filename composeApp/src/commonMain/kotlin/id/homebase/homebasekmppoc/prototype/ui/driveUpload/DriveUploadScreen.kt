@@ -41,7 +41,7 @@ fun DriveUploadScreen(
     onNavigateBack: () -> Unit
 ) {
     val isAnyOperationInProgress =
-        state.isUploadingText || state.isUploadingImage || state.isPickingImage
+        state.isUploadingText || state.isUploadingImage || state.isUploadingImages || state.isPickingImage
 
     Scaffold(
         topBar = {
@@ -154,6 +154,27 @@ fun DriveUploadScreen(
                         }
                         Text(if (state.isUploadingImage) "Uploading..." else "Upload Image")
                     }
+
+                    Spacer(modifier = Modifier.height(12.dp))
+
+                    // Pick several images and upload them as they are prepared
+                    Button(
+                        onClick = { onAction(DriveUploadUiAction.PickImagesClicked) },
+                        enabled = !isAnyOperationInProgress
+                    ) {
+                        if (state.isUploadingImages) {
+                            CircularProgressIndicator(
+                                modifier = Modifier.size(20.dp),
+                                strokeWidth = 2.dp
+                            )
+                            Spacer(modifier = Modifier.width(8.dp))
+                        }
+                        Text(
+                            if (state.isUploadingImages)
+                                "Uploading ${state.imagesUploaded} of ${state.imagesToUpload}..."
+                            else "Pick and Upload Several Images"
+                        )
+                    }
                 }
             }
 
@@ -1,5 +1,6 @@
 package id.homebase.homebasekmppoc.prototype.ui.driveUpload
 
+import id.homebase.homebasekmppoc.lib.image.ImageSize
 import id.homebase.homebasekmppoc.lib.image.createThumbnails
 import id.homebase.homebasekmppoc.prototype.lib.base.CredentialsManager
 import id.homebase.homebasekmppoc.prototype.lib.crypto.ByteArrayUtil
@@ -149,14 +150,79 @@ class DriveUploadService(
             "Uploading image with uniqueId: $actualUniqueId, file: ${filePath}"
         }
 
-        val post = createSamplePostContent();
-        val contentJson = OdinSystemSerializer.serialize(post)
         val imageBytes = readFileBytes(filePath)
         val (imageSize, previewThumb, thumbnails) = createThumbnails(
             imageBytes,
             payloadKey = payloadKey
         );
 
+        return uploadPreparedImage(
+            driveId, filePath, payloadKey, actualUniqueId, fileType, dataType, encrypt,
+            imageSize, previewThumb, thumbnails
+        )
+    }
+
+    /**
+     * Uploads a batch of images, each as soon as [importer] has spooled and thumbnailed it, so
+     * the first upload starts while later images are still being processed. Results are in the
+     * order of [filePaths]; an image that could not be imported is logged and skipped.
+     *
+     * @param driveId The target drive to upload to
+     * @param filePaths The picked image files
+     * @param importer Prepares the images in parallel within its memory budget
+     * @param payloadKey The key for the payload of each file
+     * @param encrypt Whether to encrypt the files
+     * @param onUploaded Called with the input index and result of each upload
+     */
+    suspend fun uploadImages(
+        driveId: Uuid,
+        filePaths: List<String>,
+        importer: BatchImageImporter,
+        payloadKey: String = "pst_mdia",
+        encrypt: Boolean = false,
+        onUploaded: suspend (index: Int, result: ImageUploadResult) -> Unit = { _, _ -> }
+    ) {
+        importer.import(filePaths, payloadKey).collect { imported ->
+            when (imported) {
+                is ImportResult.Failed ->
+                    KLogger.w(TAG) { "Skipping ${imported.sourcePath}: ${imported.cause.message}" }
+
+                is ImportResult.Imported -> try {
+                    val result = uploadPreparedImage(
+                        driveId,
+                        imported.spoolPath,
+                        payloadKey,
+                        Uuid.random().toString(),
+                        FILE_TYPE_MEDIA,
+                        DATA_TYPE_IMAGE,
+                        encrypt,
+                        imported.naturalSize,
+                        imported.previewThumbnail,
+                        imported.thumbnails
+                    )
+                    onUploaded(imported.index, result)
+                } finally {
+                    importer.discard(imported)
+                }
+            }
+        }
+    }
+
+    private suspend fun uploadPreparedImage(
+        driveId: Uuid,
+        filePath: String,
+        payloadKey: String,
+        actualUniqueId: String,
+        fileType: Int,
+        dataType: Int,
+        encrypt: Boolean,
+        imageSize: ImageSize,
+        previewThumb: EmbeddedThumb,
+        thumbnails: List<ThumbnailFile>
+    ): ImageUploadResult {
+        val post = createSamplePostContent();
+        val contentJson = OdinSystemSerializer.serialize(post)
+
         val metadata =
             UploadFileMetadata(
                 allowDistribution = true,
@@ -18,6 +18,8 @@ import kotlinx.coroutines.flow.asStateFlow
 import kotlinx.coroutines.flow.receiveAsFlow
 import kotlinx.coroutines.flow.update
 import kotlinx.coroutines.launch
+import kotlinx.io.files.Path
+import kotlinx.io.files.SystemTemporaryDirectory
 import kotlin.uuid.Uuid
 
 /**
@@ -49,6 +51,8 @@ class DriveUploadViewModel(private val driveUploadService: DriveUploadService?)
             is DriveUploadUiAction.UploadEncryptedPayloadTextClicked -> handleUploadEncryptedPayloadText()
             is DriveUploadUiAction.UploadImageClicked -> handleUploadImage()
             is DriveUploadUiAction.ImagePicked -> handleImagePicked(action.filePath, action.name)
+            is DriveUploadUiAction.PickImagesClicked -> handlePickImages()
+            is DriveUploadUiAction.ImagesPicked -> handleImagesPicked(action.filePaths)
             is DriveUploadUiAction.ImagePickFailed -> handleImagePickError(action.error)
             is DriveUploadUiAction.ImagePickCancelled -> handleImagePickCancelled()
         }
@@ -71,6 +75,66 @@ class DriveUploadViewModel(private val driveUploadService: DriveUploadService?)
         }
     }
 
+    private fun handlePickImages() {
+        _uiState.update { it.copy(isPickingImage = true, errorMessage = null) }
+        sendEvent(DriveUploadUiEvent.OpenMultiImagePicker)
+    }
+
+    // Each image is uploaded as soon as the importer has prepared it, in the order picked
+    private fun handleImagesPicked(filePaths: List<String>) {
+        if (driveUploadService == null) {
+            _uiState.update {
+                it.copy(
+                    isPickingImage = false,
+                    errorMessage = "Not authenticated - DriveUploadService unavailable"
+                )
+            }
+            return
+        }
+
+        _uiState.update {
+            it.copy(
+                isPickingImage = false,
+                isUploadingImages = true,
+                imagesUploaded = 0,
+                imagesToUpload = filePaths.size,
+                errorMessage = null,
+                uploadResult = null
+            )
+        }
+
+        viewModelScope.launch {
+            try {
+                driveUploadService.uploadImages(
+                    driveId = publicPostsDriveId,
+                    filePaths = filePaths,
+                    importer = BatchImageImporter(Path(SystemTemporaryDirectory, "image_import")),
+                    encrypt = true
+                ) { _, result ->
+                    Logger.i("DriveUploadViewModel") { "Image upload successful: ${result.fileId}" }
+                    _uiState.update { it.copy(imagesUploaded = it.imagesUploaded + 1) }
+                }
+
+                val uploaded = _uiState.value.imagesUploaded
+                _uiState.update {
+                    it.copy(
+                        isUploadingImages = false,
+                        uploadResult = "$uploaded of ${filePaths.size} images uploaded"
+                    )
+                }
+            } catch (e: Throwable) {
+                Logger.e("DriveUploadViewModel") { "Image upload failed: ${e.message}" }
+                _uiState.update {
+                    it.copy(
+                        isUploadingImages = false,
+                        errorMessage = "Image upload failed after ${it.imagesUploaded} of " +
+                            "${filePaths.size}: ${e.message}"
+                    )
+                }
+            }
+        }
+    }
+
     private fun handleImagePickError(error: String) {
         Logger.e("DriveUploadViewModel") { "Image pick failed: $error" }
         _uiState.update {
@@ -26,7 +26,7 @@ import io.github.vinceglb.filekit.FileKit
 import io.github.vinceglb.filekit.dialogs.FileKitType
 import io.github.vinceglb.filekit.dialogs.openFilePicker
 import io.github.vinceglb.filekit.name
-import io.github.vinceglb.filekit.readBytes
+import io.github.vinceglb.filekit.source
 import kotlinx.coroutines.launch
 
 @Composable
@@ -43,12 +43,14 @@ fun FFmpegTestScreen(onBack: () -> Unit) {
                 val file =
                         FileKit.openFilePicker(type = FileKitType.Video, title = "Select a Video")
                 if (file != null) {
-                    val bytes = file.readBytes()
-                    val fileName = file.name
-                    // Use platform-agnostic cache helper
-                    val path = FFmpegUtils.cacheInputVideo(fileName, bytes)
-                    selectedFilePath = path
-                    logText = "Selected and Cached: $path"
+                    // Streamed into the cache, never read into memory whole
+                    val video = FFmpegUtils.ingestVideo(file.name, file.source())
+                    selectedFilePath = video.path
+                    logText =
+                            "Selected and Cached: ${video.path} (${video.sizeBytes} bytes, sha256 ${video.sha256})"
+                    video.probe?.let {
+                        logText += "\nProbed: ${it.displayWidth}x${it.displayHeight}, ${it.durationSeconds} s"
+                    }
                 }
             } catch (e: Exception) {
                 logText = "Error picking file: ${e.message}"
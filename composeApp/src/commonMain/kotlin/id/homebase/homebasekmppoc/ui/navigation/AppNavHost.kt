@@ -38,6 +38,7 @@ import id.homebase.homebasekmppoc.ui.screens.login.LoginScreen
 import id.homebase.homebasekmppoc.ui.screens.login.LoginUiEvent
 import id.homebase.homebasekmppoc.ui.screens.login.LoginViewModel
 import io.github.vinceglb.filekit.FileKit
+import io.github.vinceglb.filekit.dialogs.FileKitMode
 import io.github.vinceglb.filekit.dialogs.FileKitType
 import io.github.vinceglb.filekit.dialogs.openFilePicker
 import io.github.vinceglb.filekit.name
@@ -211,6 +212,31 @@ fun AppNavHost(
                             }
                         }
 
+                        is DriveUploadUiEvent.OpenMultiImagePicker -> {
+                            coroutineScope.launch {
+                                try {
+                                    val files =
+                                        FileKit.openFilePicker(
+                                            type = FileKitType.Image,
+                                            mode = FileKitMode.Multiple()
+                                        )
+                                    if (!files.isNullOrEmpty()) {
+                                        viewModel.onAction(
+                                            DriveUploadUiAction.ImagesPicked(files.map { it.path })
+                                        )
+                                    } else {
+                                        viewModel.onAction(DriveUploadUiAction.ImagePickCancelled)
+                                    }
+                                } catch (e: Exception) {
+                                    viewModel.onAction(
+                                        DriveUploadUiAction.ImagePickFailed(
+                                            e.message ?: "Unknown error"
+                                        )
+                                    )
+                                }
+                            }
+                        }
+
                         is DriveUploadUiEvent.ShowSuccess -> {
                             // TODO: Show snackbar
                         }
@@ -0,0 +1,245 @@
+package id.homebase.homebasekmppoc.lib.image
+
+import kotlin.test.Test
+import kotlin.test.assertEquals
+import kotlin.test.assertNull
+
+class ImageHeaderProbeTest {
+
+    // ========== Builders ==========
+
+    private class Bytes {
+        private val out = ArrayList<Byte>()
+        fun u8(vararg values: Int) = apply { values.forEach { out.add(it.toByte()) } }
+        fun u16(value: Int, littleEndian: Boolean = false) = apply {
+            if (littleEndian) u8(value, value shr 8) else u8(value shr 8, value)
+        }
+        fun u32(value: Long, littleEndian: Boolean = false) = apply {
+            if (littleEndian) u16(value.toInt(), true).u16((value shr 16).toInt(), true)
+            else u16((value shr 16).toInt()).u16(value.toInt())
+        }
+        fun ascii(text: String) = apply { text.forEach { u8(it.code) } }
+        fun bytes(data: ByteArray) = apply { data.forEach { out.add(it) } }
+        fun build() = out.toByteArray()
+    }
+
+    private fun segment(marker: Int, body: ByteArray) =
+        Bytes().u8(0xFF, marker).u16(body.size + 2).bytes(body).build()
+
+    private fun sof(width: Int, height: Int) =
+        Bytes().u8(8).u16(height).u16(width).u8(3, 1, 0x22, 0, 2, 0x11, 1, 3, 0x11, 1).build()
+
+    private fun exif(orientation: Int, littleEndian: Boolean): ByteArray {
+        val tiff = Bytes()
+            .ascii(if (littleEndian) "II" else "MM")
+            .u16(42, littleEndian)
+            .u32(8, littleEndian)
+            .u16(2, littleEndian)
+            .u16(0x010F, littleEndian).u16(2, littleEndian).u32(4, littleEndian).ascii("ACME") // Make
+            .u16(0x0112, littleEndian).u16(3, littleEndian).u32(1, littleEndian).u16(orientation, littleEndian).u16(0)
+            .u32(0, littleEndian)
+            .build()
+        return Bytes().ascii("Exif").u8(0, 0).bytes(tiff).build()
+    }
+
+    private fun jpeg(vararg segments: ByteArray) =
+        Bytes().u8(0xFF, 0xD8).apply { segments.forEach { bytes(it) } }.u8(0xFF, 0xD9).build()
+
+    private fun box(type: String, vararg children: ByteArray): ByteArray {
+        val body = Bytes().apply { children.forEach { bytes(it) } }.build()
+        return Bytes().u32(8L + body.size).ascii(type).bytes(body).build()
+    }
+
+    private fun fullBox(type: String, version: Int, flags: Int, vararg children: ByteArray) =
+        box(type, Bytes().u8(version, 0, 0, flags).build(), *children)
+
+    private fun ispe(width: Long, height: Long) =
+        fullBox("ispe", 0, 0, Bytes().u32(width).u32(height).build())
+
+    private fun ftyp(major: String, vararg compatible: String) =
+        box("ftyp", Bytes().ascii(major).u32(0).apply { compatible.forEach { ascii(it) } }.build())
+
+    // ========== JPEG ==========
+
+    @Test
+    fun jpeg_progressiveWithExifAndTablesBeforeFrame() {
+        val data = jpeg(
+            segment(0xE0, Bytes().ascii("JFIF").u8(0, 1, 1, 0).u16(72).u16(72).u8(0, 0).build()),
+            segment(0xE1, exif(orientation = 6, littleEndian = false)),
+            segment(0xDB, ByteArray(65)),
+            // DHT shares the SOFn range and must not be read as a frame header
+            segment(0xC4, ByteArray(28)),
+            Bytes().u8(0xFF, 0xFF, 0xFF).build(), // Fill bytes before the next marker
+            segment(0xC2, sof(4000, 3000))
+        )
+
+        val probe = ImageHeaderProbe.probe(data)!!
+        assertEquals("image/jpeg", probe.contentType)
+        assertEquals(ImageSize(4000, 3000), probe.size)
+        assertEquals(6, probe.orientation)
+        assertEquals(ImageSize(3000, 4000), probe.displaySize)
+    }
+
+    @Test
+    fun jpeg_littleEndianExif() {
+        val data = jpeg(segment(0xE1, exif(orientation = 3, littleEndian = true)), segment(0xC0, sof(640, 480)))
+
+        val probe = ImageHeaderProbe.probe(data)!!
+        assertEquals(3, probe.orientation)
+        assertEquals(ImageSize(640, 480), probe.displaySize)
+    }
+
+    @Test
+    fun jpeg_withoutExifIsUpright() {
+        val probe = ImageHeaderProbe.probe(jpeg(segment(0xC1, sof(17, 9))))!!
+        assertEquals(ImageSize(17, 9), probe.size)
+        assertEquals(1, probe.orientation)
+    }
+
+    @Test
+    fun jpeg_truncatedOrFrameless_returnsNull() {
+        val full = jpeg(segment(0xE1, exif(6, false)), segment(0xC0, sof(640, 480)))
+        assertNull(ImageHeaderProbe.probe(full.copyOf(20)))
+        assertNull(ImageHeaderProbe.probe(jpeg(segment(0xDA, ByteArray(10)), segment(0xC0, sof(640, 480)))))
+    }
+
+    // ========== PNG, GIF, BMP ==========
+
+    @Test
+    fun png_readsIhdr() {
+        val data = Bytes().u8(0x89).ascii("PNG").u8(0x0D, 0x0A, 0x1A, 0x0A)
+            .u32(13).ascii("IHDR").u32(1920).u32(1080).u8(8, 6, 0, 0, 0)
+            .build()
+        assertEquals(ImageProbe("image/png", ImageSize(1920, 1080)), ImageHeaderProbe.probe(data))
+    }
+
+    @Test
+    fun gif_readsLogicalScreen() {
+        val data = Bytes().ascii("GIF89a").u16(500, true).u16(281, true).u8(0xF7, 0, 0).build()
+        assertEquals(ImageProbe("image/gif", ImageSize(500, 281)), ImageHeaderProbe.probe(data))
+        assertNull(ImageHeaderProbe.probe(Bytes().ascii("GIF90a").u16(1, true).u16(1, true).build()))
+    }
+
+    @Test
+    fun bmp_topDownRowsHaveNegativeHeight() {
+        val data = Bytes().ascii("BM").u32(0, true).u32(0, true).u32(54, true)
+            .u32(40, true).u32(300, true).u32((-200L) and 0xFFFFFFFFL, true)
+            .build()
+        assertEquals(ImageProbe("image/bmp", ImageSize(300, 200)), ImageHeaderProbe.probe(data))
+    }
+
+    // ========== WebP ==========
+
+    private fun riff(chunk: String, payload: ByteArray) =
+        Bytes().ascii("RIFF").u32(4L + 8 + payload.size, true).ascii("WEBP")
+            .ascii(chunk).u32(payload.size.toLong(), true).bytes(payload)
+            .build()
+
+    @Test
+    fun webp_lossy() {
+        // Frame tag, start code, then 14 bit sizes with scaling bits set that must be masked off
+        val payload = Bytes().u8(0x30, 0x01, 0x00).u8(0x9D, 0x01, 0x2A)
+            .u16(0xC000 or 1024, true).u16(0x4000 or 768, true)
+            .build()
+        assertEquals(ImageSize(1024, 768), ImageHeaderProbe.probe(riff("VP8 ", payload))!!.size)
+    }
+
+    @Test
+    fun webp_lossless() {
+        val bits = (4095L - 1) or ((3L - 1) shl 14)
+        val payload = Bytes().u8(0x2F).u32(bits, true).build()
+        assertEquals(ImageSize(4095, 3), ImageHeaderProbe.probe(riff("VP8L", payload))!!.size)
+    }
+
+    @Test
+    fun webp_extended() {
+        val width = 16383 + 100 - 1
+        val height = 9 - 1
+        val payload = Bytes().u8(0x10, 0, 0, 0)
+            .u8(width, width shr 8, width shr 16)
+            .u8(height, height shr 8, height shr 16)
+            .build()
+        assertEquals(ImageSize(16383 + 100, 9), ImageHeaderProbe.probe(riff("VP8X", payload))!!.size)
+    }
+
+    // ========== HEIC / AVIF ==========
+
+    @Test
+    fun heic_usesPrimaryItemNotThumbnail() {
+        val data = Bytes()
+            .bytes(ftyp("heic", "mif1", "heic"))
+            .bytes(
+                fullBox(
+                    "meta", 0, 0,
+                    fullBox("hdlr", 0, 0, Bytes().u32(0).ascii("pict").u32(0).u32(0).u32(0).u8(0).build()),
+                    fullBox("pitm", 0, 0, Bytes().u16(1).build()),
+                    box(
+                        "iprp",
+                        box(
+                            "ipco",
+                            ispe(320, 240), // 1: the thumbnail's
+                            ispe(4032, 3024), // 2: the primary image's
+                            box("irot", Bytes().u8(3).build()) // 3: 270 degrees counter-clockwise
+                        ),
+                        fullBox(
+                            "ipma", 0, 0,
+                            Bytes().u32(2)
+                                .u16(1).u8(2, 0x80 or 2, 3)
+                                .u16(2).u8(1, 1)
+                                .build()
+                        )
+                    )
+                )
+            )
+            .build()
+
+        val probe = ImageHeaderProbe.probe(data)!!
+        assertEquals("image/heic", probe.contentType)
+        assertEquals(ImageSize(4032, 3024), probe.size)
+        assertEquals(6, probe.orientation)
+        assertEquals(ImageSize(3024, 4032), probe.displaySize)
+    }
+
+    @Test
+    fun avif_compatibleBrandLargeSizeBoxAndNoPrimaryItem() {
+        val metaBody = Bytes().u8(0, 0, 0, 0)
+            .bytes(box("iprp", box("ipco", ispe(64, 64), ispe(1200, 800))))
+            .build()
+        // A 64-bit largesize header on meta
+        val meta = Bytes().u32(1).ascii("meta").u32(0).u32(16L + metaBody.size).bytes(metaBody).build()
+        val data = Bytes().bytes(ftyp("mif1", "miaf", "avif")).bytes(meta).build()
+
+        val probe = ImageHeaderProbe.probe(data)!!
+        assertEquals("image/avif", probe.contentType)
+        assertEquals(ImageSize(1200, 800), probe.size)
+        assertEquals(1, probe.orientation)
+    }
+
+    @Test
+    fun isobmffThatIsNotAnImage_returnsNull() {
+        val mp4 = Bytes().bytes(ftyp("isom", "iso2", "mp41")).bytes(box("moov")).build()
+        assertNull(ImageHeaderProbe.probe(mp4))
+    }
+
+    // ========== Other ==========
+
+    @Test
+    fun unknownOrEmpty_returnsNull() {
+        assertNull(ImageHeaderProbe.probe(ByteArray(0)))
+        assertNull(ImageHeaderProbe.probe("<svg width=\"10\"></svg>".encodeToByteArray()))
+        assertNull(ImageHeaderProbe.probe(ByteArray(64) { 0x42 }))
+    }
+
+    @Test
+    fun testImages_matchTheirNames() {
+        for ((name, size) in listOf(
+            "Sample400x800.webp" to ImageSize(400, 800),
+            "Sample800x400.webp" to ImageSize(800, 400),
+            "sample640x640.webp" to ImageSize(640, 640),
+            "sample1024x1024.webp" to ImageSize(1024, 1024)
+        )) {
+            if (!TestImageLoader.testImageExists(name)) continue
+            assertEquals(size, ImageHeaderProbe.probe(TestImageLoader.loadTestImage(name))?.size, name)
+        }
+    }
+}
@@ -0,0 +1,179 @@
+package id.homebase.homebasekmppoc.prototype.lib.database
+
+import kotlinx.coroutines.Dispatchers
+import kotlinx.coroutines.async
+import kotlinx.coroutines.test.runTest
+import kotlinx.coroutines.yield
+import kotlinx.io.buffered
+import kotlinx.io.files.Path
+import kotlinx.io.files.SystemFileSystem
+import kotlinx.io.files.SystemTemporaryDirectory
+import kotlinx.io.readByteArray
+import kotlin.random.Random
+import kotlin.test.AfterTest
+import kotlin.test.Test
+import kotlin.test.assertContentEquals
+import kotlin.test.assertEquals
+import kotlin.test.assertTrue
+import kotlin.uuid.Uuid
+
+class OutboxSpoolTest {
+    private val root = Path(SystemTemporaryDirectory, "spool-test-${Uuid.random()}")
+    private val spoolDir = Path(root, "spool")
+
+    @AfterTest
+    fun tearDown() {
+        deleteRecursively(root)
+    }
+
+    private fun deleteRecursively(path: Path) {
+        if (SystemFileSystem.metadataOrNull(path)?.isDirectory == true)
+            SystemFileSystem.list(path).forEach { deleteRecursively(it) }
+        SystemFileSystem.delete(path, mustExist = false)
+    }
+
+    private fun writeFile(name: String, bytes: ByteArray): Path {
+        SystemFileSystem.createDirectories(root)
+        val path = Path(root, name)
+        SystemFileSystem.sink(path).buffered().use { it.write(bytes) }
+        return path
+    }
+
+    private fun spoolFiles(): List<String> = SystemFileSystem.list(spoolDir).map { it.name }.sorted()
+
+    private suspend fun OutboxSpool.enqueue(vararg payloads: Path): Long =
+        enqueue(
+            driveId = Uuid.random(),
+            fileId = Uuid.random(),
+            dependencyFileId = null,
+            priority = 0L,
+            uploadType = 0L,
+            json = byteArrayOf(),
+            payloads = payloads.toList()
+        )
+
+    @Test
+    fun testPayloadsAreStreamedDeduplicatedAndReferenceCounted() = runTest {
+        DatabaseManager { createInMemoryDatabase() }.use { dbm ->
+            val spool = OutboxSpool(dbm, spoolDir)
+            val video = Random(1).nextBytes(3 * 1024 * 1024 + 7)
+            val thumb = Random(2).nextBytes(2_000)
+            val videoPath = writeFile("video.mp4", video)
+            val thumbPath = writeFile("thumb.jpg", thumb)
+
+            spool.enqueue(videoPath, thumbPath)
+            spool.enqueue(videoPath) // Same video queued again, e.g. shared to a second chat
+            assertEquals(2, spoolFiles().size)
+
+            val first = dbm.outbox.checkout()!!
+            val entries = OutboxSpool.decodeEntries(first.files)
+            assertEquals(listOf(video.size.toLong(), thumb.size.toLong()), entries.map { it.size })
+            assertEquals(video.size.toLong() + thumb.size, first.payloadBytes)
+            val spooled = spool.source(entries[0]).buffered().use { it.readByteArray() }
+            assertContentEquals(video, spooled)
+
+            // Completing the first item frees the thumbnail; the video is still referenced
+            val hashes = dbm.outbox.spoolHashes(first.rowId)
+            dbm.outbox.deleteByRowId(first.rowId)
+            assertEquals(1, spool.release(hashes))
+            assertEquals(listOf(entries[0].hash), spoolFiles())
+
+            val second = dbm.outbox.checkout()!!
+            val secondHashes = dbm.outbox.spoolHashes(second.rowId)
+            dbm.outbox.deleteByRowId(second.rowId)
+            spool.release(secondHashes)
+            assertEquals(emptyList(), spoolFiles())
+        }
+    }
+
+    @Test
+    fun testCrashBeforeRowIsCommitted() = runTest {
+        DatabaseManager { createInMemoryDatabase() }.use { dbm ->
+            val payload = writeFile("a.bin", Random(3).nextBytes(10_000))
+
+            // Spooled, then the app died before the outbox row was inserted; plus a half-written file
+            OutboxSpool(dbm, spoolDir).put(payload)
+            SystemFileSystem.sink(Path(spoolDir, "tmp-${Uuid.random()}")).buffered().use { it.writeByte(1) }
+            assertEquals(2, spoolFiles().size)
+
+            val recovery = OutboxSpool(dbm, spoolDir).recover()
+            assertEquals(2, recovery.removedFiles)
+            assertTrue(recovery.rowsMissingPayload.isEmpty())
+            assertEquals(emptyList(), spoolFiles())
+        }
+    }
+
+    @Test
+    fun testRecoverDuringPutKeepsItsTempFile() = runTest {
+        DatabaseManager { createInMemoryDatabase() }.use { dbm ->
+            val spool = OutboxSpool(dbm, spoolDir)
+            val payload = Random(9).nextBytes(16 * 1024 * 1024)
+            val path = writeFile("big.bin", payload)
+
+            // As when OutboxSync is stopped and started again while an item is being enqueued
+            val put = async(Dispatchers.Default) { spool.put(path) }
+            while (!put.isCompleted) {
+                spool.recover()
+                yield()
+            }
+
+            val entry = put.await()
+            spool.source(entry).buffered().use { assertContentEquals(payload, it.readByteArray()) }
+        }
+    }
+
+    @Test
+    fun testCrashBetweenRowDeleteAndFileRelease() = runTest {
+        DatabaseManager { createInMemoryDatabase() }.use { dbm ->
+            val spool = OutboxSpool(dbm, spoolDir)
+            spool.enqueue(writeFile("a.bin", Random(4).nextBytes(10_000)))
+            spool.enqueue(writeFile("b.bin", Random(5).nextBytes(10_000)))
+
+            // The upload of one item completed, the app died before its file was released
+            val done = dbm.outbox.checkout()!!
+            dbm.outbox.deleteByRowId(done.rowId)
+            assertEquals(2, spoolFiles().size)
+
+            val recovery = OutboxSpool(dbm, spoolDir).recover()
+            assertEquals(1, recovery.removedFiles)
+            assertEquals(1, spoolFiles().size)
+            assertEquals(1L, dbm.outbox.count())
+        }
+    }
+
+    @Test
+    fun testRowWhosePayloadVanishedIsReported() = runTest {
+        DatabaseManager { createInMemoryDatabase() }.use { dbm ->
+            val spool = OutboxSpool(dbm, spoolDir)
+            spool.enqueue(writeFile("a.bin", Random(6).nextBytes(1_000)))
+            val row = dbm.outbox.checkout()!!
+            dbm.outbox.clearCheckedOut()
+
+            // E.g. the OS cleared the app's storage behind our back
+            SystemFileSystem.delete(spool.pathOf(OutboxSpool.decodeEntries(row.files).single().hash))
+
+            val recovery = spool.recover()
+            assertEquals(listOf(row.rowId), recovery.rowsMissingPayload)
+            assertEquals(1L, dbm.outbox.count(), "The outbox decides what to do with the row")
+        }
+    }
+
+    @Test
+    fun testFailedInsertLeavesNoFiles() = runTest {
+        DatabaseManager { createInMemoryDatabase() }.use { dbm ->
+            val spool = OutboxSpool(dbm, spoolDir)
+            val driveId = Uuid.random()
+            val fileId = Uuid.random()
+            val payload = writeFile("a.bin", Random(7).nextBytes(1_000))
+
+            spool.enqueue(driveId, fileId, null, 0L, 0L, byteArrayOf(), listOf(payload))
+            val other = writeFile("b.bin", Random(8).nextBytes(1_000))
+            val failed = runCatching {
+                // UNIQUE(driveId, fileId) rejects the second row
+                spool.enqueue(driveId, fileId, null, 0L, 0L, byteArrayOf(), listOf(other))
+            }
+            assertTrue(failed.isFailure)
+            assertEquals(1, spoolFiles().size)
+        }
+    }
+}
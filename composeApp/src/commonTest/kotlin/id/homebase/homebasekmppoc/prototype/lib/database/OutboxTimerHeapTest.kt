@@ -0,0 +1,118 @@
+package id.homebase.homebasekmppoc.prototype.lib.database
+
+import id.homebase.homebasekmppoc.lib.database.OutboxTimerHeap
+import id.homebase.homebasekmppoc.prototype.lib.core.time.UnixTimeUtc
+import kotlinx.coroutines.test.runTest
+import kotlin.random.Random
+import kotlin.test.Test
+import kotlin.test.assertEquals
+import kotlin.test.assertNull
+import kotlin.uuid.Uuid
+
+class OutboxTimerHeapTest {
+
+    @Test
+    fun testMatchesSortedReference() {
+        val heap = OutboxTimerHeap()
+        val reference = mutableMapOf<Long, Long>()
+        val random = Random(11)
+
+        repeat(5_000) {
+            val rowId = random.nextLong(0, 200)
+            when (random.nextInt(3)) {
+                0, 1 -> {
+                    val time = random.nextLong(0, 10_000)
+                    heap.upsert(rowId, time)
+                    reference[rowId] = time
+                }
+                else -> assertEquals(reference.remove(rowId) != null, heap.remove(rowId))
+            }
+
+            assertEquals(reference.size, heap.size)
+            assertEquals(reference.values.minOrNull(), heap.peek())
+            val probe = random.nextLong(-1, 10_000)
+            assertEquals(reference.values.filter { it > probe }.minOrNull(), heap.nextAfter(probe))
+        }
+    }
+
+    @Test
+    fun testRebuild() {
+        val heap = OutboxTimerHeap()
+        heap.upsert(99, 1)
+        heap.rebuild(listOf(1L to 500L, 2L to 42L, 3L to 9_000L))
+
+        assertEquals(3, heap.size)
+        assertEquals(42L, heap.peek())
+        assertEquals(9_000L, heap.nextAfter(500))
+        assertNull(heap.nextAfter(9_000))
+        heap.clear()
+        assertNull(heap.peek())
+    }
+
+    @Test
+    fun testFollowsTable() = runTest {
+        DatabaseManager { createInMemoryDatabase() }.use { dbm ->
+            repeat(3) {
+                dbm.outbox.insert(
+                    driveId = Uuid.random(),
+                    fileId = Uuid.random(),
+                    dependencyFileId = null,
+                    priority = 0L,
+                    uploadType = 0L,
+                    json = byteArrayOf(),
+                    files = null
+                )
+            }
+            assertEquals(3, dbm.outbox.schedule.size)
+
+            val item = dbm.outbox.checkout()!!
+            assertEquals(2, dbm.outbox.schedule.size)
+
+            dbm.outbox.checkInFailed(item.checkOutStamp!!, 5_000)
+            assertEquals(3, dbm.outbox.schedule.size)
+            assertEquals(5_000L, dbm.outbox.schedule.nextAfter(0))
+
+            val second = dbm.outbox.checkout()!!
+            dbm.outbox.deleteByRowId(second.rowId)
+            assertEquals(2, dbm.outbox.schedule.size)
+
+            // A restart loses the heap; clearCheckedOut() reloads it from the table
+            dbm.outbox.checkout()!!
+            dbm.outbox.schedule.clear()
+            dbm.outbox.clearCheckedOut()
+            assertEquals(2, dbm.outbox.schedule.size)
+            assertEquals(dbm.outbox.count().toInt(), dbm.outbox.schedule.size)
+        }
+    }
+
+    @Test
+    fun testFailureSignalsOnlyWhenDueBeforeTheNextWake() = runTest {
+        DatabaseManager { createInMemoryDatabase() }.use { dbm ->
+            repeat(4) {
+                dbm.outbox.insert(
+                    driveId = Uuid.random(),
+                    fileId = Uuid.random(),
+                    dependencyFileId = null,
+                    priority = 0L,
+                    uploadType = 0L,
+                    json = byteArrayOf(),
+                    files = null
+                )
+            }
+            val now = UnixTimeUtc(1_000)
+            val (a, b, c) = List(3) { dbm.outbox.checkout(now)!! }
+            // The fourth stays in the heap at 0, as one waiting on a dependency would; the
+            // scheduler is past it, so it must not hide the retries below
+            val version = dbm.outbox.scheduleChanged.value
+
+            dbm.outbox.checkInFailed(b.checkOutStamp!!, 10_000, now)
+            assertEquals(version + 1, dbm.outbox.scheduleChanged.value, "Nothing else to wake for")
+
+            dbm.outbox.checkInFailed(a.checkOutStamp!!, 20_000, now)
+            assertEquals(version + 1, dbm.outbox.scheduleChanged.value, "Due after the next wake")
+
+            dbm.outbox.checkInFailed(c.checkOutStamp!!, 5_000, now)
+            assertEquals(version + 2, dbm.outbox.scheduleChanged.value, "Due before the next wake")
+        }
+    }
+}
@@ -0,0 +1,147 @@
+package id.homebase.homebasekmppoc.prototype.lib.drives.files
+
+import kotlin.test.Test
+import kotlin.test.assertEquals
+import kotlin.test.assertNull
+import kotlin.test.assertTrue
+
+class ThumbnailResolverTest {
+
+    private fun thumb(width: Int?, height: Int?, bytes: Long? = null) =
+        ThumbnailDescriptor(pixelWidth = width, pixelHeight = height, contentType = "image/webp", bytesWritten = bytes)
+
+    // What the default ThumbnailGenerator presets (320, 640, 1080, 1600) make of a 4:3 photo
+    private val landscape = listOf(
+        thumb(1600, 1200, 560_000),
+        thumb(320, 240, 22_000),
+        thumb(1080, 810, 260_000),
+        thumb(640, 480, 90_000)
+    )
+    private val portrait = landscape.map { thumb(it.pixelHeight, it.pixelWidth, it.bytesWritten) }
+
+    private fun ThumbnailDescriptor?.dims() = this?.let { "${it.pixelWidth}x${it.pixelHeight}" }
+
+    // ========== Selection ==========
+
+    @Test
+    fun select_smallestThatCovers() {
+        assertEquals("320x240", ThumbnailResolver.select(landscape, 144, 144).dims()) // 48 dp avatar at 3x
+        assertEquals("640x480", ThumbnailResolver.select(landscape, 600, 400).dims())
+        assertEquals("1080x810", ThumbnailResolver.select(landscape, 1080, 2000).dims()) // Full width on a phone
+        assertEquals("1600x1200", ThumbnailResolver.select(landscape, 1440, 1000).dims())
+    }
+
+    @Test
+    fun select_noneCovers_returnsLargest() {
+        assertEquals("1600x1200", ThumbnailResolver.select(landscape, 4000, 3000).dims())
+    }
+
+    @Test
+    fun select_toleratesSlightUpscale() {
+        // 1.125x on 320x240 is within tolerance, 1.19x is not
+        assertEquals("320x240", ThumbnailResolver.select(landscape, 360, 270).dims())
+        assertEquals("640x480", ThumbnailResolver.select(landscape, 380, 285).dims())
+    }
+
+    @Test
+    fun select_cropNeedsToFillTheBox() {
+        // Fitting 320 x 240 into a square only needs its width to cover; filling it needs its height
+        assertEquals("320x240", ThumbnailResolver.select(landscape, 300, 300).dims())
+        assertEquals("640x480", ThumbnailResolver.select(landscape, 300, 300, crop = true).dims())
+
+        // A wide banner over a portrait image
+        assertEquals("240x320", ThumbnailResolver.select(portrait, 300, 100).dims())
+        assertEquals("480x640", ThumbnailResolver.select(portrait, 300, 100, crop = true).dims())
+    }
+
+    @Test
+    fun select_squareAndPanoramaShapes() {
+        val square = listOf(thumb(320, 320), thumb(640, 640), thumb(1080, 1080))
+        assertEquals("640x640", ThumbnailResolver.select(square, 500, 500).dims())
+
+        val panorama = listOf(thumb(320, 80), thumb(640, 160), thumb(1600, 400))
+        // Fit is limited by width; crop into a tall box by height
+        assertEquals("320x80", ThumbnailResolver.select(panorama, 320, 320).dims())
+        assertEquals("1600x400", ThumbnailResolver.select(panorama, 320, 320, crop = true).dims())
+    }
+
+    @Test
+    fun select_ignoresVariantsWithoutDimensions() {
+        val mixed = listOf(thumb(null, null), thumb(640, null), thumb(0, 100), thumb(320, 240))
+        assertEquals("320x240", ThumbnailResolver.select(mixed, 1000, 1000).dims())
+
+        assertNull(ThumbnailResolver.select(listOf(thumb(null, 100), thumb(0, 0)), 100, 100))
+        assertNull(ThumbnailResolver.select(emptyList(), 100, 100))
+        assertNull(ThumbnailResolver.select(PayloadDescriptor(key = "pst_mdi0"), 100, 100))
+    }
+
+    @Test
+    fun select_equalSizesPreferFewerBytes() {
+        val variants = listOf(thumb(640, 480, 120_000), thumb(640, 480, 70_000), thumb(640, 480))
+        assertEquals(70_000L, ThumbnailResolver.select(variants, 500, 400)?.bytesWritten)
+    }
+
+    @Test
+    fun select_unknownDisplaySize_returnsSmallest() {
+        assertEquals("320x240", ThumbnailResolver.select(landscape, 0, 0).dims())
+    }
+
+    // ========== Progression ==========
+
+    @Test
+    fun progression_stepsUpAsLayoutGrowsAndNeverDown() {
+        val progression = ThumbnailProgression(PayloadDescriptor(key = "pst_mdi0", thumbnails = landscape))
+        val fetched = mutableListOf<String?>()
+        for (size in listOf(100, 200, 300, 400, 800, 400, 100, 1200, 1300)) {
+            progression.next(size, size)?.let {
+                fetched.add(it.dims())
+                progression.loaded(it)
+            }
+        }
+
+        assertEquals(listOf("320x240", "640x480", "1080x810", "1600x1200"), fetched)
+        assertEquals("1600x1200", progression.current.dims())
+    }
+
+    @Test
+    fun progression_withoutStoredVariants_staysOnPreview() {
+        val progression = ThumbnailProgression(PayloadDescriptor(key = "pst_mdi0", previewThumbnail = thumb(20, 15)))
+        assertNull(progression.next(1000, 1000))
+        assertNull(progression.current)
+    }
+
+    // ========== Bytes transferred ==========
+
+    @Test
+    fun bytesTransferred_againstHardCodedLargest() {
+        // A chat screen: 40 avatars at 48 dp, 20 grid tiles at 120 dp, cropped, on a 3x screen,
+        // then one image opened full screen on a 1080 px wide phone
+        val payload = PayloadDescriptor(key = "pst_mdi0", thumbnails = landscape)
+        val displays = List(40) { Triple(144, 144, true) } +
+            List(20) { Triple(360, 360, true) } +
+            listOf(Triple(1080, 2200, false))
+
+        val hardCoded = displays.sumOf { landscape.maxBy { it.pixelWidth!! }.bytesWritten!! }
+        val resolved = displays.sumOf { (w, h, crop) ->
+            ThumbnailResolver.select(payload, w, h, crop)!!.bytesWritten!!
+        }
+
+        println("Hard-coded 1600 px: ${hardCoded / 1024} KB, resolved: ${resolved / 1024} KB")
+        assertEquals(40 * 22_000L + 20 * 90_000L + 260_000L, resolved)
+        assertTrue(resolved * 10 < hardCoded)
+    }
+
+    @Test
+    fun bytesTransferred_progressionFetchesEachStepOnce() {
+        val progression = ThumbnailProgression(PayloadDescriptor(key = "pst_mdi0", thumbnails = landscape), crop = true)
+        var transferred = 0L
+        // A tile expanding to full screen in animation frames
+        for (size in 150..1000 step 25) {
+            progression.next(size, size)?.let {
+                transferred += it.bytesWritten!!
+                progression.loaded(it)
+            }
+        }
+        assertEquals(22_000L + 90_000L + 260_000L + 560_000L, transferred)
+    }
+}
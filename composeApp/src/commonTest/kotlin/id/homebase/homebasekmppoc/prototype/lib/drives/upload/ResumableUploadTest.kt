@@ -0,0 +1,255 @@
+package id.homebase.homebasekmppoc.prototype.lib.drives.upload
+
+import id.homebase.homebasekmppoc.prototype.lib.base.ApiCredentials
+import id.homebase.homebasekmppoc.prototype.lib.base.CredentialsManager
+import id.homebase.homebasekmppoc.prototype.lib.core.SecureByteArray
+import id.homebase.homebasekmppoc.prototype.lib.crypto.Crc32c
+import id.homebase.homebasekmppoc.prototype.lib.database.DatabaseManager
+import id.homebase.homebasekmppoc.prototype.lib.database.createInMemoryDatabase
+import io.ktor.client.HttpClient
+import io.ktor.client.engine.mock.MockEngine
+import io.ktor.client.engine.mock.respond
+import io.ktor.http.HttpHeaders
+import io.ktor.http.HttpMethod
+import io.ktor.http.HttpStatusCode
+import io.ktor.http.content.OutgoingContent
+import io.ktor.http.headersOf
+import kotlinx.coroutines.test.runTest
+import kotlinx.io.IOException
+import kotlinx.io.buffered
+import kotlinx.io.files.Path
+import kotlinx.io.files.SystemFileSystem
+import kotlinx.io.files.SystemTemporaryDirectory
+import kotlin.random.Random
+import kotlin.test.Test
+import kotlin.test.assertContentEquals
+import kotlin.test.assertEquals
+import kotlin.test.assertFailsWith
+import kotlin.test.assertNotNull
+import kotlin.test.assertTrue
+import kotlin.uuid.Uuid
+
+/**
+ * Mock drive host for chunked uploads. [failures] maps a chunk index to how many attempts
+ * should fail before the chunk is accepted; even attempts drop the connection after the body
+ * was received, odd attempts answer 503. Chunks for a session it does not know get a 404.
+ */
+private class FlakyChunkServer(failures: Map<Int, Int> = emptyMap()) {
+    private val remainingFailures = failures.toMutableMap()
+    private val sessions = mutableSetOf<String>()
+    val stored = mutableMapOf<Int, ByteArray>()
+    var bytesReceived = 0L
+    var beginCount = 0
+    var completed = false
+
+    /** Forgets every session and what was stored for it, as a host that expired them would. */
+    fun dropSessions() {
+        sessions.clear()
+        stored.clear()
+    }
+
+    val client = HttpClient(MockEngine) {
+        engine {
+            addHandler { request ->
+                val path = request.url.encodedPath
+                val uploadId = path.substringAfter("/uploads/", "").substringBefore('/')
+                when {
+                    request.method == HttpMethod.Post && path.endsWith("/uploads") -> {
+                        beginCount++
+                        sessions.add("upload-$beginCount")
+                        respond(
+                            content = """{"uploadId":"upload-$beginCount"}""",
+                            status = HttpStatusCode.OK,
+                            headers = headersOf(HttpHeaders.ContentType, "application/json")
+                        )
+                    }
+
+                    uploadId.isNotEmpty() && uploadId !in sessions ->
+                        respond(content = "", status = HttpStatusCode.NotFound)
+
+                    request.method == HttpMethod.Put && path.contains("/chunks/") -> {
+                        val index = path.substringAfterLast("/").toInt()
+                        val data = (request.body as OutgoingContent.ByteArrayContent).bytes()
+                        bytesReceived += data.size
+
+                        val failuresLeft = remainingFailures[index] ?: 0
+                        if (failuresLeft > 0) {
+                            remainingFailures[index] = failuresLeft - 1
+                            if (failuresLeft % 2 == 0) throw IOException("Connection reset on chunk $index")
+                            respond(content = "", status = HttpStatusCode.ServiceUnavailable)
+                        } else {
+                            val crc = request.headers[DriveUploadProvider.CHUNK_CRC_HEADER]!!.toLong()
+                            assertEquals(Crc32c.calculateCrc32c(data = data).toLong(), crc)
+                            stored[index] = data
+                            respond(content = "", status = HttpStatusCode.OK)
+                        }
+                    }
+
+                    request.method == HttpMethod.Post && path.endsWith("/complete") -> {
+                        completed = true
+                        respond(content = "{}", status = HttpStatusCode.OK)
+                    }
+
+                    else -> respond(content = "", status = HttpStatusCode.NotFound)
+                }
+            }
+        }
+    }
+
+    fun assembled(): ByteArray =
+        stored.keys.sorted().fold(ByteArray(0)) { acc, index -> acc + stored.getValue(index) }
+}
+
+@OptIn(ChunkedUploadEndpoints::class)
+class ResumableUploadTest {
+
+    private val chunkSize = 64 * 1024
+    private val totalBytes = 3 * 1024 * 1024 + 100 // Forces a short final chunk
+
+    private suspend fun createProvider(server: FlakyChunkServer): DriveUploadProvider {
+        val credentialsManager = CredentialsManager()
+        credentialsManager.setActiveCredentials(
+            ApiCredentials.create(
+                domain = "test.domain.com",
+                clientAccessToken = "token",
+                sharedSecret = SecureByteArray(ByteArray(32) { it.toByte() })
+            )
+        )
+        return DriveUploadProvider(server.client, credentialsManager)
+    }
+
+    private fun writeTempFile(bytes: ByteArray): Path {
+        val path = Path(SystemTemporaryDirectory, "resumable-${Uuid.random()}.bin")
+        SystemFileSystem.sink(path).buffered().use { it.write(bytes) }
+        return path
+    }
+
+    @Test
+    fun testLargeUploadResumesFromFirstUnacknowledgedChunk() = runTest {
+        val payload = Random(42).nextBytes(totalBytes)
+        val path = writeTempFile(payload)
+        val failures = mapOf(5 to 1, 17 to 2, 48 to 1)
+        val server = FlakyChunkServer(failures)
+        val driveId = Uuid.random()
+        val uploader = ResumableUploader(createProvider(server).chunkTransport(driveId), chunkSize)
+
+        try {
+            DatabaseManager { createInMemoryDatabase() }.use { dbm ->
+                dbm.outbox.insert(
+                    driveId = driveId,
+                    fileId = Uuid.random(),
+                    dependencyFileId = null,
+                    priority = 0L,
+                    uploadType = 0L,
+                    json = byteArrayOf(),
+                    files = null
+                )
+
+                // Mimic OutboxSync: checkout, upload, check in as failed and retry
+                var failedAttempts = 0
+                while (true) {
+                    val record = assertNotNull(dbm.outbox.checkout(), "Item should be available for retry")
+                    val stamp = record.checkOutStamp!!
+                    try {
+                        uploader.upload(
+                            filePath = path.toString(),
+                            state = ResumableUploadState.decode(record.uploadState),
+                            persist = { dbm.outbox.updateUploadState(stamp, it.encode()) }
+                        )
+                        dbm.outbox.deleteByRowId(record.rowId)
+                        break
+                    } catch (e: Exception) {
+                        failedAttempts++
+                        dbm.outbox.checkInFailed(stamp, 0)
+                    }
+                    assertTrue(failedAttempts <= failures.values.sum(), "Too many attempts")
+                }
+
+                assertEquals(failures.values.sum(), failedAttempts)
+                assertEquals(0L, dbm.outbox.count())
+            }
+
+            assertTrue(server.completed)
+            assertEquals(1, server.beginCount, "A resumed upload must reuse its session")
+            assertContentEquals(payload, server.assembled())
+
+            // Each failure retransmits at most the one chunk that failed
+            val maxBytes = totalBytes.toLong() + failures.values.sum() * chunkSize
+            assertTrue(server.bytesReceived <= maxBytes, "Sent ${server.bytesReceived} bytes, bound $maxBytes")
+        } finally {
+            SystemFileSystem.delete(path, mustExist = false)
+        }
+    }
+
+    @Test
+    fun testUploadStartsOverWhenTheSessionIsGone() = runTest {
+        val payload = Random(9).nextBytes(chunkSize * 6)
+        val path = writeTempFile(payload)
+        val server = FlakyChunkServer(mapOf(3 to 1))
+        val uploader = ResumableUploader(createProvider(server).chunkTransport(Uuid.random()), chunkSize)
+
+        try {
+            var saved: ResumableUploadState? = null
+            assertFailsWith<Exception> {
+                uploader.upload(path.toString(), null, persist = { saved = it })
+            }
+            assertEquals(3, saved!!.firstPendingChunk()?.index)
+
+            // The host expires the session before the retry
+            server.dropSessions()
+            val result = uploader.upload(path.toString(), saved, persist = { saved = it })
+
+            assertEquals(2, server.beginCount)
+            assertEquals("upload-2", result.uploadId)
+            assertEquals(result, saved)
+            assertTrue(result.isComplete)
+            assertTrue(server.completed)
+            assertContentEquals(payload, server.assembled())
+        } finally {
+            SystemFileSystem.delete(path, mustExist = false)
+        }
+    }
+
+    @Test
+    fun testStateRoundTripsThroughOutboxRow() = runTest {
+        val state = ResumableUploadState.plan("abc", totalBytes.toLong(), chunkSize)
+        val acked = state.copy(chunks = state.chunks.mapIndexed { i, c ->
+            if (i < 3) c.copy(acknowledged = true, crc32c = i.toLong()) else c
+        })
+
+        val decoded = assertNotNull(ResumableUploadState.decode(acked.encode()))
+        assertEquals(acked, decoded)
+        assertEquals(3, decoded.firstPendingChunk()?.index)
+        assertEquals(3L * chunkSize, decoded.bytesAcknowledged)
+        assertEquals(100, decoded.chunks.last().length)
+    }
+
+    @Test
+    fun testChangedPayloadIsRejectedOnResume() = runTest {
+        val payload = Random(7).nextBytes(chunkSize * 4)
+        val path = writeTempFile(payload)
+        val server = FlakyChunkServer(mapOf(2 to 1))
+        val uploader = ResumableUploader(createProvider(server).chunkTransport(Uuid.random()), chunkSize)
+
+        try {
+            var saved: ResumableUploadState? = null
+            assertFailsWith<Exception> {
+                uploader.upload(path.toString(), null, persist = { saved = it })
+            }
+            // Chunks 0 and 1 were acknowledged; chunk 2 failed but its checksum was kept
+            assertEquals(2, saved!!.firstPendingChunk()?.index)
+            assertNotNull(saved!!.chunks[2].crc32c)
+
+            // The file is edited inside chunk 2 before the retry
+            val edited = payload.copyOf().also { it[2 * chunkSize + 10] = (it[2 * chunkSize + 10] + 1).toByte() }
+            SystemFileSystem.sink(path).buffered().use { it.write(edited) }
+
+            assertFailsWith<ChunkChecksumMismatchException> {
+                uploader.upload(path.toString(), saved, persist = { })
+            }
+            assertTrue(2 !in server.stored, "The changed chunk must not be sent")
+        } finally {
+            SystemFileSystem.delete(path, mustExist = false)
+        }
+    }
+}
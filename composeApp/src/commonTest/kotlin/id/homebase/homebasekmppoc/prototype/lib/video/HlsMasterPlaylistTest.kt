@@ -0,0 +1,77 @@
+package id.homebase.homebasekmppoc.prototype.lib.video
+
+import kotlin.test.Test
+import kotlin.test.assertEquals
+import kotlin.test.assertFalse
+import kotlin.test.assertNull
+import kotlin.test.assertTrue
+
+/** Unit tests for HlsMasterPlaylist. */
+class HlsMasterPlaylistTest {
+
+    private val master =
+        """
+        #EXTM3U
+        #EXT-X-VERSION:3
+        #EXT-X-MEDIA:TYPE=AUDIO,GROUP-ID="aud",NAME="main",URI="audio.m3u8"
+        #EXT-X-STREAM-INF:BANDWIDTH=1240000,AVERAGE-BANDWIDTH=928000,RESOLUTION=640x360,CODECS="avc1.64001e,mp4a.40.2"
+        index_360p.m3u8
+
+        #EXT-X-STREAM-INF:BANDWIDTH=4360000,RESOLUTION=1280x720,CODECS="avc1.64001f,mp4a.40.2"
+        index_720p.m3u8
+        """.trimIndent().lines()
+
+    private val media =
+        """
+        #EXTM3U
+        #EXT-X-TARGETDURATION:6
+        #EXTINF:6.0,
+        index.ts
+        #EXT-X-ENDLIST
+        """.trimIndent().lines()
+
+    @Test
+    fun testIsMaster() {
+        assertTrue(HlsMasterPlaylist.isMaster(master))
+        assertFalse(HlsMasterPlaylist.isMaster(media))
+    }
+
+    @Test
+    fun testVariants() {
+        val variants = HlsMasterPlaylist.variants(master)
+
+        assertEquals(listOf("index_360p.m3u8", "index_720p.m3u8"), variants.map { it.uri })
+        assertEquals(1240000L, variants[0].bandwidth)
+        assertEquals(928000L, variants[0].averageBandwidth)
+        assertEquals(640, variants[0].width)
+        assertEquals(360, variants[0].height)
+        assertEquals("avc1.64001e,mp4a.40.2", variants[0].codecs)
+        assertNull(variants[1].averageBandwidth)
+        assertEquals(720, variants[1].height)
+    }
+
+    @Test
+    fun testParseAttributes_quotedCommas() {
+        val attributes = HlsMasterPlaylist.parseAttributes("""BANDWIDTH=1,CODECS="a,b",NAME="x"""")
+
+        assertEquals(mapOf("BANDWIDTH" to "1", "CODECS" to "a,b", "NAME" to "x"), attributes)
+    }
+
+    @Test
+    fun testPlaylistUris_includeAlternativeRenditions() {
+        assertEquals(listOf("audio.m3u8", "index_360p.m3u8", "index_720p.m3u8"), HlsMasterPlaylist.playlistUris(master))
+        assertEquals(emptyList(), HlsMasterPlaylist.playlistUris(media))
+    }
+
+    @Test
+    fun testRewriteUris() {
+        val rewritten = HlsMasterPlaylist.rewriteUris(master) { "http://local/$it" }
+
+        assertEquals(master.size, rewritten.size)
+        assertTrue(rewritten.contains("http://local/index_360p.m3u8"))
+        assertTrue(rewritten.contains("http://local/index_720p.m3u8"))
+        assertTrue(rewritten.any { it.startsWith("#EXT-X-MEDIA:") && it.endsWith("URI=\"http://local/audio.m3u8\"") })
+        // Tags other than the URIs are untouched
+        assertEquals(master.filter { it.startsWith("#EXT-X-STREAM-INF") }, rewritten.filter { it.startsWith("#EXT-X-STREAM-INF") })
+    }
+}
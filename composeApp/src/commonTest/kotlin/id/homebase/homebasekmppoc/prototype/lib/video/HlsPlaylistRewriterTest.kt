@@ -0,0 +1,108 @@
+package id.homebase.homebasekmppoc.prototype.lib.video
+
+import io.ktor.http.encodeURLParameter
+import kotlin.test.Test
+import kotlin.test.assertEquals
+import kotlin.test.assertFailsWith
+import kotlin.test.assertNull
+
+/** Unit tests for HlsPlaylistRewriter. */
+class HlsPlaylistRewriterTest {
+
+    private val segmentUrl = "https://frodo.dotyou.cloud/api/owner/v1/drive/files/payload?ss=%7B%22iv%22%3A%22abc%22%7D"
+    private val base = "https://frodo.dotyou.cloud/api/owner/v1/drive/files/payload"
+    private val keyUri = "data:application/octet-stream;base64,AAECAw=="
+    private val proxy = HlsPlaylistRewriter.Proxy("http://127.0.0.1:8080", "video-manifest-1.m3u8")
+
+    private val playlist =
+        """
+        #EXTM3U
+        #EXT-X-VERSION:4
+        #EXT-X-TARGETDURATION:4
+        #EXT-X-MEDIA-SEQUENCE:0
+        #EXT-X-KEY:METHOD=AES-128,URI="enc.key",IV=0x00000000000000000000000000000001
+        #EXTINF:4.004,
+        #EXT-X-BYTERANGE:1000@0
+        index.ts
+        #EXTINF:5.2,
+        #EXT-X-BYTERANGE:2000@1000
+        index.ts
+        #EXTINF:1.5,
+        #EXT-X-BYTERANGE:500
+        index.ts
+        #EXT-X-ENDLIST
+        """.trimIndent()
+
+    @Test
+    fun testRewrite_mediaPlaylist() {
+        val result = HlsPlaylistRewriter(segmentUrl, keyUri).rewrite(playlist)
+
+        assertEquals(
+            """
+            #EXTM3U
+            #EXT-X-VERSION:4
+            #EXT-X-TARGETDURATION:6
+            #EXT-X-MEDIA-SEQUENCE:0
+            #EXT-X-KEY:METHOD=AES-128,URI="$keyUri",IV=0x00000000000000000000000000000001
+            #EXTINF:4.004,
+            $base/0/1000
+            #EXTINF:5.2,
+            $base/1000/2000
+            #EXTINF:1.5,
+            $base/3000/500
+            #EXT-X-ENDLIST
+            """.trimIndent(),
+            result.playlist
+        )
+        assertNull(result.proxied)
+    }
+
+    @Test
+    fun testRewrite_proxiedCopyMatchesEncodingEachUrl() {
+        val result = HlsPlaylistRewriter(segmentUrl, keyUri, proxy).rewrite(playlist)
+
+        // As if every https line of the playlist had been proxied on its own
+        val expected = result.playlist.lines().joinToString("\n") { line ->
+            if (line.startsWith("https://")) {
+                "${proxy.serverUrl}/proxy?url=${line.encodeURLParameter()}&manifestId=${proxy.manifestId}"
+            } else {
+                line
+            }
+        }
+        assertEquals(expected, result.proxied)
+    }
+
+    @Test
+    fun testRewrite_segmentsWithoutRangesKeepTheSignedUrl() {
+        val result = HlsPlaylistRewriter(segmentUrl, keyUri = null, proxy = proxy).rewrite(
+            "#EXTM3U\r\n#EXT-X-TARGETDURATION:10\r\n#EXTINF:6.0,\r\nsegment0.ts\r\n#EXTINF:6.0,\r\nsegment1.ts\r\n"
+        )
+
+        assertEquals(
+            "#EXTM3U\n#EXT-X-TARGETDURATION:6\n#EXTINF:6.0,\n$segmentUrl\n#EXTINF:6.0,\n$segmentUrl\n",
+            result.playlist
+        )
+        assertEquals(
+            "${proxy.serverUrl}/proxy?url=${segmentUrl.encodeURLParameter()}&manifestId=${proxy.manifestId}",
+            result.proxied!!.lines()[3]
+        )
+    }
+
+    @Test
+    fun testRewrite_otherUrlsAreNotProxied() {
+        val result = HlsPlaylistRewriter("http://localhost/payload?x=1", keyUri = null, proxy = proxy)
+            .rewrite("#EXTM3U\n#EXTINF:2.0,\n#EXT-X-BYTERANGE:10@20\na.ts")
+
+        assertEquals("#EXTM3U\n#EXTINF:2.0,\nhttp://localhost/payload/20/10", result.proxied)
+    }
+
+    @Test
+    fun testRewrite_errors() {
+        assertFailsWith<Exception> { HlsPlaylistRewriter(segmentUrl, keyUri).rewrite("WEBVTT") }
+        // An encrypted playlist needs a key
+        assertFailsWith<Exception> { HlsPlaylistRewriter(segmentUrl, keyUri = null).rewrite(playlist) }
+        assertFailsWith<Exception> {
+            HlsPlaylistRewriter(segmentUrl, keyUri).rewrite("#EXTM3U\n#EXT-X-BYTERANGE:abc\nindex.ts")
+        }
+    }
+}
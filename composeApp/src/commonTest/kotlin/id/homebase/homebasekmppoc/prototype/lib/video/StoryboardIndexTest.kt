@@ -0,0 +1,136 @@
+package id.homebase.homebasekmppoc.prototype.lib.video
+
+import kotlin.test.Test
+import kotlin.test.assertEquals
+import kotlin.test.assertFailsWith
+import kotlin.test.assertNull
+import kotlin.test.assertSame
+import kotlin.test.assertTrue
+
+/** Unit tests for StoryboardIndex. */
+class StoryboardIndexTest {
+
+    // 250 s at 2 s: 125 tiles, a full sheet of 10 x 10 and a quarter of the next
+    private val index = StoryboardIndex.grid(
+        durationSeconds = 249.5,
+        intervalSeconds = 2.0,
+        tileWidth = 160,
+        tileHeight = 90,
+        columns = 10,
+        rows = 10
+    )
+
+    @Test
+    fun testGrid_layout() {
+        assertEquals(125, index.tiles.size)
+        assertEquals(listOf("pst_sb00", "pst_sb01"), index.sheets)
+
+        val first = index.tiles[0]
+        assertEquals(StoryboardTile(0.0, 2.0, "pst_sb00", 0, 0, 160, 90), first)
+        // A row at a time
+        assertEquals(1440 to 0, index.tiles[9].x to index.tiles[9].y)
+        assertEquals(0 to 90, index.tiles[10].x to index.tiles[10].y)
+        assertEquals(1440 to 810, index.tiles[99].x to index.tiles[99].y)
+        // Then the next sheet, from its top left
+        assertEquals("pst_sb01", index.tiles[100].sheet)
+        assertEquals(0 to 0, index.tiles[100].x to index.tiles[100].y)
+    }
+
+    @Test
+    fun testGrid_lastTileEndsWithTheVideo() {
+        val last = index.tiles.last()
+        assertEquals(248.0, last.startSeconds)
+        assertEquals(249.5, last.endSeconds)
+    }
+
+    @Test
+    fun testTileAt() {
+        assertEquals(index.tiles[0], index.tileAt(0.0))
+        assertEquals(index.tiles[0], index.tileAt(1.999))
+        assertEquals(index.tiles[1], index.tileAt(2.0))
+        assertEquals(index.tiles[100], index.tileAt(200.5))
+        // Clamped at both ends
+        assertEquals(index.tiles[0], index.tileAt(-5.0))
+        assertEquals(index.tiles.last(), index.tileAt(10_000.0))
+        assertNull(StoryboardIndex(emptyList()).tileAt(1.0))
+    }
+
+    @Test
+    fun testWebVtt_roundTrip() {
+        val vtt = index.toWebVtt()
+
+        val lines = vtt.lines()
+        assertEquals("WEBVTT", lines[0])
+        assertEquals("00:00:00.000 --> 00:00:02.000", lines[2])
+        assertEquals("pst_sb00#xywh=0,0,160,90", lines[3])
+        assertEquals(index.tiles, StoryboardIndex.parseWebVtt(vtt).tiles)
+    }
+
+    @Test
+    fun testWebVtt_hoursAndShortTimestamps() {
+        val parsed = StoryboardIndex.parseWebVtt(
+            """
+            WEBVTT
+
+            01:02:03.500 --> 01:02:05.500
+            a#xywh=1,2,3,4
+
+            05.500 --> 07.000 align:start
+            b#xywh=5,6,7,8
+            """.trimIndent()
+        )
+
+        assertEquals(3723.5, parsed.tiles[0].startSeconds)
+        assertEquals(5.5, parsed.tiles[1].startSeconds)
+        assertEquals(7.0, parsed.tiles[1].endSeconds)
+        assertEquals(StoryboardTile(5.5, 7.0, "b", 5, 6, 7, 8), parsed.tiles[1])
+    }
+
+    @Test
+    fun testWebVtt_rejectsOtherContent() {
+        assertFailsWith<Exception> { StoryboardIndex.parseWebVtt("#EXTM3U") }
+        assertFailsWith<Exception> { StoryboardIndex.parseWebVtt("WEBVTT\n\n00:00.000 --> 00:02.000\nno-region") }
+    }
+
+    @Test
+    fun testToPayloadFiles() {
+        val payloads = index.toPayloadFiles(listOf("/tmp/sheet_000.jpg", "/tmp/sheet_001.jpg"))
+
+        assertEquals(listOf("pst_sb00", "pst_sb01"), payloads.map { it.key })
+        assertNull(payloads[1].descriptorContent)
+        assertFailsWith<IllegalArgumentException> { index.toPayloadFiles(listOf("/tmp/sheet_000.jpg")) }
+        // Only what grid() needs, the reader lays the tiles out again
+        val descriptor = payloads[0].descriptorContent!!
+        assertEquals(index.tiles, StoryboardIndex.fromDescriptor(descriptor, 2).tiles)
+        assertFailsWith<IllegalArgumentException> {
+            StoryboardIndex(index.tiles).toPayloadFiles(listOf("/tmp/sheet_000.jpg", "/tmp/sheet_001.jpg"))
+        }
+    }
+
+    @Test
+    fun testToPayloadFiles_descriptorDoesNotGrowWithTheVideo() {
+        // 11 hours at 4 s, 100 full sheets
+        val long = StoryboardIndex.grid(40_000.0, 4.0, 160, 90, 10, 10)
+        val paths = long.sheets.map { "/tmp/$it.jpg" }
+
+        val descriptor = long.toPayloadFiles(paths)[0].descriptorContent!!
+        assertEquals(100, long.sheets.size)
+        assertTrue(descriptor.length < 200, "Descriptor of ${descriptor.length} chars")
+        assertEquals(long.tiles, StoryboardIndex.fromDescriptor(descriptor, 100).tiles)
+    }
+
+    @Test
+    fun testTakeSheets_lastTileEndsWithTheVideo() {
+        val first = index.takeSheets(1)
+
+        assertEquals(listOf("pst_sb00"), first.sheets)
+        assertEquals(100, first.tiles.size)
+        assertEquals(198.0, first.tiles.last().startSeconds)
+        assertEquals(249.5, first.tiles.last().endSeconds)
+        assertEquals(index.tiles.take(99), first.tiles.take(99))
+        assertSame(index, index.takeSheets(2))
+        // What a reader finds when only the first sheet was made
+        val descriptor = first.toPayloadFiles(listOf("/tmp/sheet_000.jpg"))[0].descriptorContent!!
+        assertEquals(first.tiles, StoryboardIndex.fromDescriptor(descriptor, 1).tiles)
+    }
+}
@@ -8,6 +8,7 @@ import androidx.compose.ui.window.application
 import id.homebase.homebasekmppoc.prototype.MessageDialogHandler
 import id.homebase.homebasekmppoc.prototype.lib.database.DatabaseDriverFactory
 import id.homebase.homebasekmppoc.prototype.lib.database.DatabaseManager
+import id.homebase.homebasekmppoc.prototype.ui.chat.installHeapPressureHook
 import kotlinx.coroutines.runBlocking
 
 fun main() = application {
@@ -16,6 +17,7 @@ fun main() = application {
         // DatabaseManager.wipe { DatabaseDriverFactory().createDriver() } // <-- uncomment to wipe all the tables.
         DatabaseManager.initialize { DatabaseDriverFactory().createDriver() }
     }
+    installHeapPressureHook()
 
     Window(
         onCloseRequest = ::exitApplication,
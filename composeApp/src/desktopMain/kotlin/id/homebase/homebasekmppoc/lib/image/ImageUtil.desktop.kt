@@ -3,11 +3,21 @@ package id.homebase.homebasekmppoc.lib.image
 import androidx.compose.ui.graphics.ImageBitmap
 import androidx.compose.ui.graphics.toComposeImageBitmap
 import co.touchlab.kermit.Logger
+import org.jetbrains.skia.ColorAlphaType
+import org.jetbrains.skia.ColorType
 import org.jetbrains.skia.Image
 import org.jetbrains.skia.EncodedImageFormat
 import org.jetbrains.skia.IRect
+import org.jetbrains.skia.ImageInfo
+import org.jetbrains.skia.Matrix33
 import org.jetbrains.skia.Surface
 import org.jetbrains.skia.Rect
+import org.jetbrains.skia.SamplingMode
+import java.awt.image.BufferedImage
+import java.io.ByteArrayInputStream
+import java.nio.ByteBuffer
+import java.nio.ByteOrder
+import javax.imageio.ImageIO
 
 /**
  * Desktop/JVM implementation: Convert ByteArray to ImageBitmap using Skia
@@ -22,6 +32,37 @@ actual fun ByteArray.toImageBitmap(): ImageBitmap? {
     }
 }
 
+/**
+ * Desktop implementation of DecodedImage backed by a Skia image
+ */
+actual class DecodedImage internal constructor(private val image: Image) : AutoCloseable {
+    actual val width: Int get() = image.width
+    actual val height: Int get() = image.height
+
+    actual fun scale(width: Int, height: Int): DecodedImage {
+        val surface = Surface.makeRasterN32Premul(width, height)
+        surface.canvas.drawImageRect(
+            image,
+            Rect.makeWH(image.width.toFloat(), image.height.toFloat()),
+            Rect.makeWH(width.toFloat(), height.toFloat()),
+            SamplingMode.MITCHELL,
+            null,
+            true
+        )
+        val scaled = surface.makeImageSnapshot()
+        surface.close()
+        return DecodedImage(scaled)
+    }
+
+    actual fun encode(format: ImageFormat, quality: Int): ByteArray =
+        image.encodeToData(ImageUtils.encodedFormatFor(format), quality)?.bytes
+            ?: throw IllegalStateException("Failed to encode image")
+
+    actual override fun close() {
+        image.close()
+    }
+}
+
 /**
  * Desktop implementation of ImageUtils using Skia
  */
@@ -31,7 +72,7 @@ actual object ImageUtils {
         return Image.makeFromEncoded(bytes)
     }
 
-    private fun encodedFormatFor(format: ImageFormat): EncodedImageFormat = when (format) {
+    internal fun encodedFormatFor(format: ImageFormat): EncodedImageFormat = when (format) {
         ImageFormat.WEBP -> EncodedImageFormat.WEBP
         ImageFormat.JPEG -> EncodedImageFormat.JPEG
         ImageFormat.PNG -> EncodedImageFormat.PNG
@@ -39,6 +80,102 @@ actual object ImageUtils {
         ImageFormat.GIF -> EncodedImageFormat.WEBP // GIF encoding not supported, fallback to WEBP
     }
 
+    // ImageIO subsampling keeps every n-th pixel rather than filtering, so leave the final
+    // resample at least this much reduction to smooth over
+    private const val SUBSAMPLE_HEADROOM = 2
+
+    private val subsampledTypes = setOf("image/jpeg", "image/png", "image/gif", "image/bmp")
+
+    /** Largest power of two the natural size can be divided by and still cover the target with headroom */
+    internal fun subsampleFactor(natural: ImageSize, targetW: Int, targetH: Int): Int {
+        var factor = 1
+        while (natural.pixelWidth / (factor * 2) >= targetW * SUBSAMPLE_HEADROOM &&
+            natural.pixelHeight / (factor * 2) >= targetH * SUBSAMPLE_HEADROOM) {
+            factor *= 2
+        }
+        return factor
+    }
+
+    /**
+     * Returns the natural size and the image decoded no larger than needed to produce
+     * maxWidth x maxHeight. Large JPEG, PNG, GIF and BMP files are read with ImageIO source
+     * subsampling, so the full resolution raster is never allocated; EXIF orientation, which
+     * ImageIO ignores, is applied afterwards. Anything else is a regular Skia decode.
+     */
+    internal fun decodeForSize(srcBytes: ByteArray, maxWidth: Int, maxHeight: Int): Pair<ImageSize, Image> {
+        val probe = ImageHeaderProbe.probe(srcBytes)
+        if (probe == null) {
+            val image = decodeImage(srcBytes)
+            return ImageSize(image.width, image.height) to image
+        }
+
+        val natural = probe.displaySize
+        val (targetW, targetH) = calculateTargetDimensions(natural.pixelWidth, natural.pixelHeight, maxWidth, maxHeight)
+        val factor = subsampleFactor(natural, targetW, targetH)
+        if (factor == 1 || probe.contentType !in subsampledTypes)
+            return natural to decodeImage(srcBytes)
+
+        val subsampled = try {
+            readSubsampled(srcBytes, factor)?.let { orient(it, probe.orientation) }
+        } catch (e: Exception) {
+            Logger.w("ImageUtils", e) { "Subsampled decode failed, decoding at full size" }
+            null
+        }
+        return natural to (subsampled ?: decodeImage(srcBytes))
+    }
+
+    private fun readSubsampled(srcBytes: ByteArray, factor: Int): Image? {
+        val input = ImageIO.createImageInputStream(ByteArrayInputStream(srcBytes)) ?: return null
+        input.use {
+            val reader = ImageIO.getImageReaders(input).asSequence().firstOrNull() ?: return null
+            try {
+                reader.input = input
+                val param = reader.defaultReadParam.apply { setSourceSubsampling(factor, factor, 0, 0) }
+                return toSkiaImage(reader.read(0, param))
+            } finally {
+                reader.dispose()
+            }
+        }
+    }
+
+    private fun toSkiaImage(buffered: BufferedImage): Image {
+        val w = buffered.width
+        val h = buffered.height
+        val argb = buffered.getRGB(0, 0, w, h, null, 0, w)
+        // An ARGB int stored little-endian is B, G, R, A
+        val bytes = ByteArray(argb.size * 4)
+        ByteBuffer.wrap(bytes).order(ByteOrder.LITTLE_ENDIAN).asIntBuffer().put(argb)
+        return Image.makeRaster(ImageInfo(w, h, ColorType.BGRA_8888, ColorAlphaType.UNPREMUL), bytes, w * 4)
+    }
+
+    /** Applies an EXIF orientation (2..8) the way Skia does when it decodes. */
+    private fun orient(image: Image, orientation: Int): Image {
+        if (orientation !in 2..8) return image
+        val w = image.width.toFloat()
+        val h = image.height.toFloat()
+        // Maps stored (x, y) to displayed (X, Y)
+        val matrix = when (orientation) {
+            2 -> Matrix33(-1f, 0f, w, 0f, 1f, 0f, 0f, 0f, 1f) // Mirrored
+            3 -> Matrix33(-1f, 0f, w, 0f, -1f, h, 0f, 0f, 1f) // 180
+            4 -> Matrix33(1f, 0f, 0f, 0f, -1f, h, 0f, 0f, 1f) // Mirrored vertically
+            5 -> Matrix33(0f, 1f, 0f, 1f, 0f, 0f, 0f, 0f, 1f) // Transposed
+            6 -> Matrix33(0f, -1f, h, 1f, 0f, 0f, 0f, 0f, 1f) // 90 clockwise
+            7 -> Matrix33(0f, -1f, h, -1f, 0f, w, 0f, 0f, 1f) // Transversed
+            else -> Matrix33(0f, 1f, 0f, -1f, 0f, w, 0f, 0f, 1f) // 90 counter-clockwise
+        }
+        val swaps = orientation >= 5
+        val surface = Surface.makeRasterN32Premul(
+            if (swaps) image.height else image.width,
+            if (swaps) image.width else image.height
+        )
+        surface.canvas.concat(matrix)
+        surface.canvas.drawImage(image, 0f, 0f)
+        val oriented = surface.makeImageSnapshot()
+        surface.close()
+        image.close()
+        return oriented
+    }
+
     actual fun resizePreserveAspect(
         srcBytes: ByteArray,
         maxWidth: Int,
@@ -46,9 +183,9 @@ actual object ImageUtils {
         outputFormat: ImageFormat,
         quality: Int
     ): ImageResult {
-        val srcImage = decodeImage(srcBytes)
-        val naturalW = srcImage.width
-        val naturalH = srcImage.height
+        val (natural, srcImage) = decodeForSize(srcBytes, maxWidth, maxHeight)
+        val naturalW = natural.pixelWidth
+        val naturalH = natural.pixelHeight
 
         val (targetW, targetH) = calculateTargetDimensions(naturalW, naturalH, maxWidth, maxHeight)
 
@@ -67,9 +204,16 @@ actual object ImageUtils {
         val surface = Surface.makeRasterN32Premul(targetW, targetH)
         val canvas = surface.canvas
 
-        // Scale and draw
-        canvas.scale(targetW.toFloat() / naturalW, targetH.toFloat() / naturalH)
-        canvas.drawImage(srcImage, 0f, 0f)
+        // Scale and draw; the source may already be subsampled, so map its whole extent
+        canvas.drawImageRect(
+            srcImage,
+            Rect.makeWH(srcImage.width.toFloat(), srcImage.height.toFloat()),
+            Rect.makeWH(targetW.toFloat(), targetH.toFloat()),
+            SamplingMode.MITCHELL,
+            null,
+            true
+        )
+        srcImage.close()
 
         // Get the resized image
         val resized = surface.makeImageSnapshot()
@@ -205,8 +349,14 @@ actual object ImageUtils {
     }
 
     actual fun getNaturalSize(srcBytes: ByteArray): ImageSize {
+        // Skia applies EXIF orientation when decoding, so compare with the probe's display size
+        ImageHeaderProbe.probe(srcBytes)?.let { return it.displaySize }
         val img = decodeImage(srcBytes)
         return ImageSize(img.width, img.height)
     }
+
+    actual fun decode(srcBytes: ByteArray, maxDimension: Int): DecodedImage =
+        if (maxDimension <= 0) DecodedImage(decodeImage(srcBytes))
+        else DecodedImage(decodeForSize(srcBytes, maxDimension, maxDimension).second)
 }
 
@@ -0,0 +1,277 @@
+package id.homebase.homebasekmppoc.media
+
+import id.homebase.homebasekmppoc.prototype.lib.video.HlsMasterPlaylist
+import java.io.File
+import java.util.UUID
+import kotlin.math.roundToInt
+import kotlinx.coroutines.Dispatchers
+import kotlinx.coroutines.withContext
+
+/** One rung of the ladder: a size and the bitrate to encode it at. */
+data class AbrRendition(
+        /** Also names its playlist and segment file, e.g. 720p. */
+        val name: String,
+        val width: Int,
+        val height: Int,
+        val videoBitrateKbps: Int
+) {
+    /** Peaks allowed above the average, over a buffer of two seconds' worth. */
+    val maxRateKbps: Int
+        get() = videoBitrateKbps * 3 / 2
+
+    val bufferSizeKbits: Int
+        get() = videoBitrateKbps * 2
+}
+
+/**
+ * A master playlist over the encoded renditions, each a single-file HLS media playlist. The master
+ * playlist on disk names them by file, e.g. index_360p.m3u8; see [AbrLadder.masterPlaylistFor].
+ */
+data class AbrVideo(
+        val probe: VideoProbe,
+        val outputDir: String,
+        val masterPlaylistPath: String,
+        val renditions: List<EncodedRendition>
+)
+
+data class EncodedRendition(val rendition: AbrRendition, val playlistPath: String, val segmentPath: String)
+
+/**
+ * Encodes a video into an adaptive bitrate ladder.
+ *
+ * Renditions are picked from the source: the standard rungs no larger than it, so nothing is
+ * upscaled, and the source itself when it is smaller than the lowest. Their bitrates are scaled by
+ * how hard the content is to compress, measured by a short constant-quality encode of a sample: a
+ * talking head needs far fewer bits than confetti at the same size.
+ *
+ * All renditions come from one decode, split in the filter graph and encoded side by side, with
+ * keyframes at the same times so a player can switch between them at any segment. ffmpeg writes
+ * the media playlists and the master playlist listing them.
+ */
+object AbrLadder {
+
+    /** The short side of the picture (360p is 640x360, or 360x640 in portrait) and its bitrate. */
+    private data class Rung(val shortSide: Int, val videoBitrateKbps: Int)
+
+    private val RUNGS = listOf(Rung(360, 800), Rung(720, 2800), Rung(1080, 5000))
+
+    private const val AUDIO_BITRATE = "128k"
+    private const val SEGMENT_SECONDS = 6
+    const val MASTER_PLAYLIST = "master.m3u8"
+
+    private const val SAMPLE_SECONDS = 4.0
+    // What a 360p sample of typical content takes at the sample quality; complexity 1.0
+    private const val REFERENCE_SAMPLE_KBPS = 800.0
+    private const val MIN_COMPLEXITY = 0.5
+    private const val MAX_COMPLEXITY = 1.5
+
+    /**
+     * The renditions for a source of [probe]'s size whose content has [complexity] (1.0 is
+     * typical), lowest first.
+     */
+    fun plan(probe: VideoProbe, complexity: Double = 1.0): List<AbrRendition> {
+        val portrait = probe.displayHeight > probe.displayWidth
+        val sourceShort = minOf(probe.displayWidth, probe.displayHeight)
+        val sourceLong = maxOf(probe.displayWidth, probe.displayHeight)
+        if (sourceShort <= 0) return emptyList()
+        val scale = complexity.coerceIn(MIN_COMPLEXITY, MAX_COMPLEXITY)
+
+        fun rendition(short: Int, baseKbps: Int): AbrRendition {
+            val evenShort = short - short % 2
+            val long = (sourceLong.toDouble() * evenShort / sourceShort / 2).roundToInt() * 2
+            return AbrRendition(
+                    name = "${evenShort}p",
+                    width = if (portrait) evenShort else long,
+                    height = if (portrait) long else evenShort,
+                    videoBitrateKbps = (baseKbps * scale).roundToInt()
+            )
+        }
+
+        val rungs = RUNGS.filter { it.shortSide <= sourceShort }
+        if (rungs.isEmpty()) {
+            // Smaller than the lowest rung: the source size, at a bitrate for its area
+            val lowest = RUNGS.first()
+            val share = sourceShort.toDouble() / lowest.shortSide
+            return listOf(rendition(sourceShort, (lowest.videoBitrateKbps * share * share).roundToInt()))
+        }
+        return rungs.map { rendition(it.shortSide, it.videoBitrateKbps) }
+    }
+
+    /**
+     * Encodes a few seconds from the middle of [inputPath] at 360p and constant quality and
+     * compares the bitrate that took with typical content. Returns 1.0 if it cannot tell.
+     */
+    suspend fun measureComplexity(inputPath: String, probe: VideoProbe, workDir: File): Double {
+        val sampleSeconds = minOf(SAMPLE_SECONDS, probe.durationSeconds)
+        if (sampleSeconds <= 0) return 1.0
+        val start = ((probe.durationSeconds - sampleSeconds) / 2).coerceAtLeast(0.0)
+        val sample = plan(probe).first()
+        val sampleFile = File(workDir, "complexity_sample.mkv")
+
+        val command =
+                listOf(
+                        FFmpegBinaryManager.ffmpegPath(),
+                        "-y",
+                        "-ss",
+                        start.toString(),
+                        "-t",
+                        sampleSeconds.toString(),
+                        "-i",
+                        inputPath,
+                        "-an",
+                        "-vf",
+                        "scale=${sample.width}:${sample.height}",
+                        "-c:v",
+                        "libx264",
+                        "-preset",
+                        "veryfast",
+                        "-crf",
+                        "23",
+                        "-threads",
+                        FFmpegJobRunner.shared.threadsPerJob.toString(),
+                        sampleFile.absolutePath
+                )
+        try {
+            if (FFmpegUtils.runProcess(command) != 0 || !sampleFile.exists()) return 1.0
+            val sampleKbps = sampleFile.length() * 8 / 1000.0 / sampleSeconds
+            // A source below 360p is compared with typical content at its own size
+            val area = sample.width.toDouble() * sample.height / (640 * 360)
+            return sampleKbps / (REFERENCE_SAMPLE_KBPS * minOf(1.0, area))
+        } finally {
+            sampleFile.delete()
+        }
+    }
+
+    /**
+     * Probes [inputPath], measures its complexity, and encodes the ladder with a master playlist,
+     * reporting the share done to [onProgress]. Returns null if ffmpeg is unavailable or fails.
+     */
+    suspend fun encode(inputPath: String, onProgress: ((Float) -> Unit)? = null): AbrVideo? =
+            withContext(Dispatchers.IO) {
+                if (!FFmpegBinaryManager.isAvailable()) {
+                    println("FFmpeg binaries not available for this platform")
+                    return@withContext null
+                }
+
+                val probe = VideoPreparation.probe(inputPath) ?: return@withContext null
+                val outputDir = File(System.getProperty("java.io.tmpdir"), "abr_${UUID.randomUUID()}")
+                outputDir.mkdirs()
+
+                val renditions = plan(probe, measureComplexity(inputPath, probe, outputDir))
+                val result =
+                        AbrVideo(
+                                probe = probe,
+                                outputDir = outputDir.absolutePath,
+                                masterPlaylistPath = File(outputDir, MASTER_PLAYLIST).absolutePath,
+                                renditions =
+                                        renditions.map {
+                                            EncodedRendition(
+                                                    it,
+                                                    File(outputDir, "index_${it.name}.m3u8").absolutePath,
+                                                    File(outputDir, "index_${it.name}.ts").absolutePath
+                                            )
+                                        }
+                        )
+
+                // Output names are relative to outputDir, as in VideoPreparation
+                val command = buildCommand(inputPath, probe, renditions)
+                val exitCode =
+                        FFmpegUtils.runProcess(command, outputDir, probe.durationSeconds) { progress ->
+                            progress.fraction?.let { onProgress?.invoke(it) }
+                        }
+                val complete =
+                        File(result.masterPlaylistPath).exists() &&
+                                result.renditions.all { File(it.playlistPath).exists() }
+                if (exitCode != 0 || !complete) {
+                    outputDir.deleteRecursively()
+                    return@withContext null
+                }
+                result
+            }
+
+    /**
+     * The master playlist of [video] to upload, naming each rendition by the key of the payload it
+     * is uploaded as, given by [payloadKey]. Playback reads every URI in an uploaded master
+     * playlist as a payload key on the same file.
+     */
+    fun masterPlaylistFor(video: AbrVideo, payloadKey: (AbrRendition) -> String): String {
+        val keys = video.renditions.associate { File(it.playlistPath).name to payloadKey(it.rendition) }
+        return HlsMasterPlaylist.rewriteUris(File(video.masterPlaylistPath).readLines()) { uri ->
+            keys[uri] ?: throw IllegalStateException("Master playlist lists $uri, which is not a rendition")
+        }.joinToString("\n")
+    }
+
+    internal fun buildCommand(inputPath: String, probe: VideoProbe, renditions: List<AbrRendition>): List<String> {
+        val command = mutableListOf(FFmpegBinaryManager.ffmpegPath(), "-y", "-i", inputPath)
+
+        // One decode, one scaled copy per rendition
+        command.add("-filter_complex")
+        command.add(
+                "[0:v]split=${renditions.size}" +
+                        renditions.indices.joinToString("") { "[s$it]" } +
+                        renditions.withIndex().joinToString("") { (i, r) -> ";[s$i]scale=${r.width}:${r.height}[v$i]" }
+        )
+        for (i in renditions.indices) {
+            command.addAll(listOf("-map", "[v$i]"))
+            if (probe.hasAudio) command.addAll(listOf("-map", "0:a:0"))
+        }
+
+        command.addAll(
+                listOf(
+                        "-c:v",
+                        "libx264",
+                        "-preset",
+                        "fast",
+                        "-pix_fmt",
+                        "yuv420p",
+                        "-threads",
+                        FFmpegJobRunner.shared.threadsPerJob.toString(),
+                        // Keyframes at the same times in every rendition, so segments line up
+                        "-force_key_frames",
+                        "expr:gte(t,n_forced*$SEGMENT_SECONDS)",
+                        "-sc_threshold",
+                        "0"
+                )
+        )
+        for ((i, r) in renditions.withIndex()) {
+            command.addAll(
+                    listOf(
+                            "-b:v:$i",
+                            "${r.videoBitrateKbps}k",
+                            "-maxrate:v:$i",
+                            "${r.maxRateKbps}k",
+                            "-bufsize:v:$i",
+                            "${r.bufferSizeKbits}k"
+                    )
+            )
+        }
+        if (probe.hasAudio) command.addAll(listOf("-c:a", "aac", "-b:a", AUDIO_BITRATE))
+
+        val streamMap =
+                renditions.withIndex().joinToString(" ") { (i, r) ->
+                    if (probe.hasAudio) "v:$i,a:$i,name:${r.name}" else "v:$i,name:${r.name}"
+                }
+        command.addAll(
+                listOf(
+                        "-f",
+                        "hls",
+                        "-hls_time",
+                        SEGMENT_SECONDS.toString(),
+                        "-hls_list_size",
+                        "0",
+                        "-hls_playlist_type",
+                        "vod",
+                        "-hls_flags",
+                        "single_file",
+                        "-hls_segment_filename",
+                        "index_%v.ts",
+                        "-master_pl_name",
+                        MASTER_PLAYLIST,
+                        "-var_stream_map",
+                        streamMap,
+                        "index_%v.m3u8"
+                )
+        )
+        return command
+    }
+}
@@ -0,0 +1,256 @@
+package id.homebase.homebasekmppoc.media
+
+import java.io.File
+import java.io.IOException
+import java.io.InputStream
+import java.io.OutputStream
+import java.util.concurrent.TimeUnit
+import kotlinx.atomicfu.atomic
+import kotlinx.coroutines.Dispatchers
+import kotlinx.coroutines.coroutineScope
+import kotlinx.coroutines.flow.Flow
+import kotlinx.coroutines.flow.channelFlow
+import kotlinx.coroutines.launch
+import kotlinx.coroutines.runInterruptible
+import kotlinx.coroutines.sync.Semaphore
+import kotlinx.coroutines.sync.withPermit
+
+/** One `-progress` report from a running ffmpeg. */
+data class FFmpegProgress(
+        /** Output time written so far; never goes backwards within a job. */
+        val outTimeMicros: Long,
+        val frame: Long,
+        val fps: Double,
+        /** Encoding speed relative to real time, or null before ffmpeg can tell. */
+        val speed: Double?,
+        val totalSizeBytes: Long,
+        /** Duration of the input, when the caller knew it. */
+        val durationMicros: Long?,
+        /** The last report of a job that ran to completion. */
+        val isEnd: Boolean
+) {
+    /** Share of the input done, 0..1, or null without a duration. */
+    val fraction: Float?
+        get() =
+                when {
+                    isEnd -> 1f
+                    durationMicros == null || durationMicros <= 0 -> null
+                    else -> (outTimeMicros.toDouble() / durationMicros).coerceIn(0.0, 1.0).toFloat()
+                }
+}
+
+/** How an ffmpeg or ffprobe job ended, with the last lines it logged. */
+class FFmpegJobResult(val exitCode: Int, val logTail: List<String>) {
+    val isSuccess: Boolean
+        get() = exitCode == 0
+}
+
+class FFmpegException(val result: FFmpegJobResult) :
+        Exception("ffmpeg exited with ${result.exitCode}: ${result.logTail.takeLast(3).joinToString(" | ")}")
+
+/**
+ * Turns the key=value blocks ffmpeg writes with `-progress` into [FFmpegProgress]; one per block,
+ * on its closing `progress=` line.
+ */
+internal class FFmpegProgressParser(private val durationMicros: Long?) {
+    private val values = HashMap<String, String>()
+    private var lastOutTime = 0L
+
+    fun accept(line: String): FFmpegProgress? {
+        val separator = line.indexOf('=')
+        if (separator < 0) return null
+        val key = line.substring(0, separator).trim()
+        val value = line.substring(separator + 1).trim()
+        if (key != "progress") {
+            values[key] = value
+            return null
+        }
+
+        // out_time_us can be N/A, or slightly negative at the start with B-frames
+        val outTime = values["out_time_us"]?.toLongOrNull() ?: values["out_time_ms"]?.toLongOrNull()
+        if (outTime != null && outTime > lastOutTime) lastOutTime = outTime
+
+        val progress =
+                FFmpegProgress(
+                        outTimeMicros = lastOutTime,
+                        frame = values["frame"]?.toLongOrNull() ?: 0,
+                        fps = values["fps"]?.toDoubleOrNull() ?: 0.0,
+                        speed = values["speed"]?.removeSuffix("x")?.toDoubleOrNull(),
+                        totalSizeBytes = values["total_size"]?.toLongOrNull() ?: 0,
+                        durationMicros = durationMicros,
+                        isEnd = value == "end"
+                )
+        values.clear()
+        return progress
+    }
+}
+
+/**
+ * Runs ffmpeg and ffprobe as child processes that behave like coroutines.
+ *
+ * Cancelling the calling coroutine kills the process and anything it started, so an encode never
+ * outlives its caller. Encodes are limited to [maxConcurrentJobs] at a time, so that together they
+ * use about [cpuBudget] cores at [threadsPerJob] each; callers queue for a slot. Only the last
+ * [logTailLines] lines of a job's log are kept, for diagnostics, whatever it writes.
+ */
+class FFmpegJobRunner(
+        val cpuBudget: Int = Runtime.getRuntime().availableProcessors(),
+        val threadsPerJob: Int = minOf(DEFAULT_THREADS_PER_JOB, cpuBudget),
+        private val logTailLines: Int = DEFAULT_LOG_TAIL_LINES
+) {
+    companion object {
+        const val DEFAULT_THREADS_PER_JOB = 4
+        const val DEFAULT_LOG_TAIL_LINES = 40
+        private const val KILL_GRACE_SECONDS = 2L
+
+        /** The runner FFmpegUtils and VideoPreparation share, so their encodes share one budget. */
+        val shared: FFmpegJobRunner by lazy { FFmpegJobRunner() }
+    }
+
+    val maxConcurrentJobs: Int = maxOf(1, cpuBudget / threadsPerJob)
+
+    private val slots = Semaphore(maxConcurrentJobs)
+    private val active = atomic(0)
+
+    /** Encodes running now, not counting those waiting for a slot. */
+    val activeJobs: Int
+        get() = active.value
+
+    /**
+     * Runs the ffmpeg [command] (binary first) in [directory] and reports its progress to
+     * [onProgress]. [durationSeconds] of the input, if known, gives the progress a fraction.
+     */
+    suspend fun run(
+            command: List<String>,
+            directory: File? = null,
+            durationSeconds: Double? = null,
+            onProgress: (suspend (FFmpegProgress) -> Unit)? = null
+    ): FFmpegJobResult =
+            slots.withPermit {
+                active.incrementAndGet()
+                try {
+                    // Progress on stdout, the log on stderr; never wait on stdin
+                    val managed =
+                            listOf(command.first(), "-nostdin", "-nostats", "-progress", "pipe:1") +
+                                    command.drop(1)
+                    val parser = FFmpegProgressParser(durationSeconds?.let { (it * 1_000_000).toLong() })
+                    execute(managed, directory) { line ->
+                        val progress = parser.accept(line)
+                        if (progress != null && onProgress != null) onProgress(progress)
+                    }
+                } finally {
+                    active.decrementAndGet()
+                }
+            }
+
+    /** [run] as a stream of progress, which fails with [FFmpegException] if ffmpeg does. */
+    fun progress(command: List<String>, directory: File? = null, durationSeconds: Double? = null): Flow<FFmpegProgress> =
+            channelFlow {
+                val result = run(command, directory, durationSeconds) { send(it) }
+                if (!result.isSuccess) throw FFmpegException(result)
+            }
+
+    /**
+     * Runs a short command such as ffprobe, outside the encode budget, and returns its stdout.
+     * [stdin], if given, writes the command's input, e.g. for `-i pipe:0`; the stream is closed
+     * after it returns. Killed on cancellation like [run].
+     */
+    suspend fun output(command: List<String>, stdin: (suspend (OutputStream) -> Unit)? = null): String {
+        val output = StringBuilder()
+        execute(command, null, stdin) { output.appendLine(it) }
+        return output.toString()
+    }
+
+    private suspend fun execute(
+            command: List<String>,
+            directory: File?,
+            stdin: (suspend (OutputStream) -> Unit)? = null,
+            onStdout: suspend (String) -> Unit
+    ): FFmpegJobResult = coroutineScope {
+        val process = ProcessBuilder(command).directory(directory).start()
+        val tail = ArrayDeque<String>(logTailLines)
+
+        try {
+            if (stdin == null) {
+                process.outputStream.close()
+            } else {
+                launch(Dispatchers.IO) { ProcessInput(process.outputStream).use { stdin(it) } }
+            }
+            val stdout = launch(Dispatchers.IO) { readLines(process.inputStream) { onStdout(it) } }
+            val stderr =
+                    launch(Dispatchers.IO) {
+                        readLines(process.errorStream) { line ->
+                            synchronized(tail) {
+                                if (tail.size == logTailLines) tail.removeFirst()
+                                tail.addLast(line)
+                            }
+                        }
+                    }
+
+            val exitCode = runInterruptible(Dispatchers.IO) { process.waitFor() }
+            stdout.join()
+            stderr.join()
+
+            val result = FFmpegJobResult(exitCode, synchronized(tail) { tail.toList() })
+            if (!result.isSuccess) {
+                println("[FFmpeg] ${command.first()} exited with $exitCode:")
+                result.logTail.forEach { println("[FFmpeg] $it") }
+            }
+            result
+        } finally {
+            // Cancelled, or a reader failed: nothing else will stop it
+            if (process.isAlive) killTree(process)
+        }
+    }
+
+    // Ends when the process closes the stream, which killing it does
+    private suspend fun readLines(stream: InputStream, onLine: suspend (String) -> Unit) {
+        try {
+            stream.bufferedReader().use { reader ->
+                while (true) onLine(reader.readLine() ?: break)
+            }
+        } catch (e: IOException) {
+            // Stream closed under us by killTree
+        }
+    }
+
+    private fun killTree(process: Process) {
+        val descendants = process.descendants().toList()
+        descendants.forEach { it.destroy() }
+        process.destroy()
+        if (!process.waitFor(KILL_GRACE_SECONDS, TimeUnit.SECONDS)) process.destroyForcibly()
+        descendants.filter { it.isAlive }.forEach { it.destroyForcibly() }
+    }
+}
+
+/**
+ * A process's stdin that drops what is written once the process stops reading, as ffprobe does
+ * once it has seen enough, so the writer is not failed by it. Errors of the writer's own still are.
+ */
+private class ProcessInput(private val stream: OutputStream) : OutputStream() {
+    private var closedByProcess = false
+
+    override fun write(b: Int) = write(byteArrayOf(b.toByte()), 0, 1)
+
+    override fun write(b: ByteArray, off: Int, len: Int) = tolerate { stream.write(b, off, len) }
+
+    override fun flush() = tolerate { stream.flush() }
+
+    // Our end is closed even when the process closed its end first
+    override fun close() {
+        try {
+            stream.close()
+        } catch (e: IOException) {
+            closedByProcess = true
+        }
+    }
+
+    private fun tolerate(block: () -> Unit) {
+        if (closedByProcess) return
+        try {
+            block()
+        } catch (e: IOException) {
+            closedByProcess = true
+        }
+    }
+}
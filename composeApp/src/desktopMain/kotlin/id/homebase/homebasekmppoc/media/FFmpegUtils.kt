@@ -1,17 +1,20 @@
 package id.homebase.homebasekmppoc.media
 
-import java.io.BufferedReader
 import java.io.File
+import java.nio.file.Files
+import java.nio.file.StandardCopyOption
 import java.util.UUID
-import java.util.concurrent.TimeUnit
 import kotlinx.coroutines.Dispatchers
 import kotlinx.coroutines.withContext
+import kotlinx.io.RawSource
+import kotlinx.io.files.Path
 
 actual object FFmpegUtils {
 
+    /** Changes whenever the file is moved, resized or rewritten, so it can key cached results. */
     actual fun getUniqueId(filePath: String): String {
-        val file = File(filePath)
-        return UUID.nameUUIDFromBytes("${file.name}_${file.length()}".toByteArray()).toString()
+        val file = File(filePath).absoluteFile
+        return UUID.nameUUIDFromBytes("${file.path}_${file.length()}_${file.lastModified()}".toByteArray()).toString()
     }
 
     actual suspend fun grabThumbnail(inputPath: String): String? =
@@ -23,7 +26,12 @@ actual object FFmpegUtils {
 
                 val uniqueId = getUniqueId(inputPath)
                 val outputPath = "${System.getProperty("java.io.tmpdir")}/thumb_$uniqueId.jpg"
+                // Grabbed before from this very file
+                if (File(outputPath).exists()) return@withContext outputPath
 
+                // Written aside and renamed once complete, so a grab that fails or is cancelled
+                // never leaves a truncated thumbnail to be served from then on
+                val temp = File("${System.getProperty("java.io.tmpdir")}/thumb_${uniqueId}_${UUID.randomUUID()}.jpg")
                 val command =
                         listOf(
                                 FFmpegBinaryManager.ffmpegPath(),
@@ -34,40 +42,25 @@ actual object FFmpegUtils {
                                 "00:00:01.000",
                                 "-vframes",
                                 "1",
-                                outputPath
+                                temp.absolutePath
                         )
 
-                val exitCode = runProcess(command)
-                if (exitCode == 0 && File(outputPath).exists()) {
+                try {
+                    if (runProcess(command) != 0 || !temp.exists()) return@withContext null
+                    Files.move(
+                            temp.toPath(),
+                            File(outputPath).toPath(),
+                            StandardCopyOption.REPLACE_EXISTING,
+                            StandardCopyOption.ATOMIC_MOVE
+                    )
                     outputPath
-                } else {
-                    null
+                } finally {
+                    temp.delete()
                 }
             }
 
     actual suspend fun getRotationFromFile(filePath: String): Int =
-            withContext(Dispatchers.IO) {
-                if (!FFmpegBinaryManager.isAvailable()) {
-                    return@withContext 0
-                }
-
-                val command =
-                        listOf(
-                                FFmpegBinaryManager.ffprobePath(),
-                                "-v",
-                                "quiet",
-                                "-select_streams",
-                                "v:0",
-                                "-show_entries",
-                                "stream_side_data=rotation",
-                                "-of",
-                                "default=noprint_wrappers=1:nokey=1",
-                                filePath
-                        )
-
-                val output = runProcessWithOutput(command)
-                output.trim().toIntOrNull() ?: 0
-            }
+            MediaProbeCache.shared.get(filePath)?.rotation ?: 0
 
     actual suspend fun compressVideo(inputPath: String, onProgress: ((Float) -> Unit)?): String? =
             withContext(Dispatchers.IO) {
@@ -94,10 +87,17 @@ actual object FFmpegUtils {
                                 "scale='min(1280,iw)':-2",
                                 "-preset",
                                 "fast",
+                                "-threads",
+                                FFmpegJobRunner.shared.threadsPerJob.toString(),
                                 outputPath
                         )
 
-                val exitCode = runProcess(command)
+                // Progress needs the duration to be a fraction
+                val duration = onProgress?.let { VideoPreparation.probe(inputPath)?.durationSeconds }
+                val exitCode =
+                        runProcess(command, durationSeconds = duration) { progress ->
+                            progress.fraction?.let { onProgress?.invoke(it) }
+                        }
                 if (exitCode == 0 && File(outputPath).exists()) {
                     outputPath
                 } else {
@@ -145,6 +145,8 @@ actual object FFmpegUtils {
                     command.add("30")
                     command.add("-bf")
                     command.add("2")
+                    command.add("-threads")
+                    command.add(FFmpegJobRunner.shared.threadsPerJob.toString())
                     command.add("-c:a")
                     command.add("copy")
                 }
@@ -169,36 +171,57 @@ actual object FFmpegUtils {
                 }
             }
 
-    actual suspend fun cacheInputVideo(fileName: String, data: ByteArray): String =
-            withContext(Dispatchers.IO) {
-                val cacheFile = File(System.getProperty("java.io.tmpdir"), "input_$fileName")
-                cacheFile.writeBytes(data)
-                cacheFile.absolutePath
-            }
-
-    private fun runProcess(command: List<String>): Int {
-        val processBuilder = ProcessBuilder(command).redirectErrorStream(true)
+    actual suspend fun ingestVideo(fileName: String, source: RawSource): IngestedVideo =
+            ingest(source, File(System.getProperty("java.io.tmpdir"), "input_$fileName"))
 
-        println("Running: ${command.joinToString(" ")}")
+    /**
+     * Spools [source] to [target] and, in the same pass, pipes it into ffprobe, so the video is
+     * read once and never held in memory. ffprobe stops reading once it has seen the headers;
+     * for an MP4 with its index at the end it reads through to it.
+     */
+    internal suspend fun ingest(source: RawSource, target: File): IngestedVideo =
+            withContext(Dispatchers.IO) {
+                val targetPath = Path(target.absolutePath)
+                if (!FFmpegBinaryManager.isAvailable()) {
+                    val (sha256, size) = VideoIngest.spool(source, targetPath)
+                    return@withContext IngestedVideo(target.absolutePath, size, sha256, probe = null)
+                }
 
-        val process = processBuilder.start()
+                val command =
+                        listOf(
+                                FFmpegBinaryManager.ffprobePath(),
+                                "-v",
+                                "quiet",
+                                "-print_format",
+                                "json",
+                                "-show_format",
+                                "-show_streams",
+                                "-i",
+                                "pipe:0"
+                        )
 
-        // Consume output to prevent blocking
-        process.inputStream.bufferedReader().use { reader ->
-            reader.forEachLine { line -> println("[FFmpeg] $line") }
-        }
+                var spooled: Pair<String, Long>? = null
+                val probeOutput =
+                        FFmpegJobRunner.shared.output(command) { stdin ->
+                            spooled = VideoIngest.spool(source, targetPath) { bytes, length -> stdin.write(bytes, 0, length) }
+                        }
+                val (sha256, size) = spooled!!
+                val info = MediaInfo.parse(probeOutput)
+                // Probed already, so later lookups of the cached copy need not run ffprobe again
+                if (info != null) MediaProbeCache.shared.put(target.absolutePath, info)
+                IngestedVideo(target.absolutePath, size, sha256, info?.toVideoProbe())
+            }
 
-        val completed = process.waitFor(5, TimeUnit.MINUTES)
-        return if (completed) process.exitValue() else -1
+    internal suspend fun runProcess(
+            command: List<String>,
+            directory: File? = null,
+            durationSeconds: Double? = null,
+            onProgress: ((FFmpegProgress) -> Unit)? = null
+    ): Int {
+        println("Running: ${command.joinToString(" ")}")
+        return FFmpegJobRunner.shared.run(command, directory, durationSeconds) { onProgress?.invoke(it) }.exitCode
     }
 
-    private fun runProcessWithOutput(command: List<String>): String {
-        val processBuilder = ProcessBuilder(command).redirectErrorStream(true)
-
-        val process = processBuilder.start()
-        val output = process.inputStream.bufferedReader().use(BufferedReader::readText)
-
-        process.waitFor(30, TimeUnit.SECONDS)
-        return output
-    }
+    internal suspend fun runProcessWithOutput(command: List<String>): String =
+            FFmpegJobRunner.shared.output(command)
 }
@@ -0,0 +1,238 @@
+package id.homebase.homebasekmppoc.media
+
+import co.touchlab.kermit.Logger
+import id.homebase.homebasekmppoc.prototype.lib.core.SecureByteArray
+import id.homebase.homebasekmppoc.prototype.lib.crypto.AesCbc
+import id.homebase.homebasekmppoc.prototype.lib.crypto.ByteArrayUtil
+import id.homebase.homebasekmppoc.prototype.lib.drives.upload.ResumableUploadState
+import id.homebase.homebasekmppoc.prototype.lib.drives.upload.ResumableUploader
+import java.io.File
+import java.util.UUID
+import kotlin.math.ceil
+import kotlinx.coroutines.CancellationException
+import kotlinx.coroutines.Dispatchers
+import kotlinx.coroutines.async
+import kotlinx.coroutines.channels.Channel
+import kotlinx.coroutines.coroutineScope
+import kotlinx.coroutines.withContext
+
+/** One HLS segment, encrypted with its own IV and uploaded. */
+class EncryptedHlsSegment(
+        val index: Int,
+        val durationSeconds: Double,
+        val iv: ByteArray,
+        val uploadId: String,
+        val plainBytes: Long,
+        val cipherBytes: Long
+)
+
+/** The uploaded segments and a playlist that plays them, given the key. */
+class HlsUploadResult(val playlist: String, val segments: List<EncryptedHlsSegment>)
+
+/**
+ * Segments a video into HLS, encrypting and uploading each segment as soon as ffmpeg has
+ * finished it, while the rest of the video is still being segmented.
+ *
+ * ffmpeg writes segments and the playlist under temporary names and renames them once complete,
+ * so a segment listed in the playlist is whole. Every progress report checks the playlist for new
+ * segments and hands them to an uploader running alongside. Each is read once, encrypted in
+ * memory with AES-128-CBC under a fresh IV (HLS METHOD=AES-128), and sent through its own
+ * resumable upload, so the ciphertext never goes to disk. Uploaded segments are deleted.
+ *
+ * A chunk that fails is retried from the last acknowledged chunk, up to [maxAttempts] times.
+ */
+class HlsUploadPipeline(
+        private val uploader: ResumableUploader,
+        private val runner: FFmpegJobRunner = FFmpegJobRunner.shared,
+        private val segmentSeconds: Int = DEFAULT_SEGMENT_SECONDS,
+        private val maxAttempts: Int = DEFAULT_MAX_ATTEMPTS
+) {
+    companion object {
+        private const val TAG = "HlsUploadPipeline"
+        const val DEFAULT_SEGMENT_SECONDS = 6
+        const val DEFAULT_MAX_ATTEMPTS = 3
+        private const val PLAYLIST = "index.m3u8"
+    }
+
+    private class ListedSegment(val index: Int, val fileName: String, val durationSeconds: Double)
+
+    /**
+     * Segments [inputPath], uploading each segment encrypted with [key]. In the returned playlist
+     * every segment refers to the key at [keyUri] and is named by [segmentUri]. Returns null if
+     * ffmpeg is unavailable or fails; an upload that fails for good throws.
+     */
+    suspend fun upload(
+            inputPath: String,
+            key: SecureByteArray,
+            keyUri: String,
+            segmentUri: (EncryptedHlsSegment) -> String = { it.uploadId },
+            onSegmentUploaded: suspend (EncryptedHlsSegment) -> Unit = {}
+    ): HlsUploadResult? =
+            withContext(Dispatchers.IO) {
+                if (!FFmpegBinaryManager.isAvailable()) {
+                    println("FFmpeg binaries not available for this platform")
+                    return@withContext null
+                }
+                val probe = VideoPreparation.probe(inputPath) ?: return@withContext null
+
+                val workDir = File(System.getProperty("java.io.tmpdir"), "hls_upload_${UUID.randomUUID()}")
+                workDir.mkdirs()
+                try {
+                    segmentAndUpload(inputPath, probe, workDir, key, onSegmentUploaded)?.let { segments ->
+                        HlsUploadResult(buildPlaylist(segments, keyUri, segmentUri), segments)
+                    }
+                } finally {
+                    workDir.deleteRecursively()
+                }
+            }
+
+    private suspend fun segmentAndUpload(
+            inputPath: String,
+            probe: VideoProbe,
+            workDir: File,
+            key: SecureByteArray,
+            onSegmentUploaded: suspend (EncryptedHlsSegment) -> Unit
+    ): List<EncryptedHlsSegment>? = coroutineScope {
+        val ready = Channel<ListedSegment>(Channel.UNLIMITED)
+        val uploads = async {
+            val uploaded = mutableListOf<EncryptedHlsSegment>()
+            for (segment in ready) {
+                val encrypted = encryptAndUpload(File(workDir, segment.fileName), segment, key)
+                uploaded.add(encrypted)
+                onSegmentUploaded(encrypted)
+            }
+            uploaded
+        }
+
+        var listed = 0
+        fun listNewSegments() {
+            val segments = readPlaylist(File(workDir, PLAYLIST))
+            for (segment in segments.drop(listed)) ready.trySend(segment)
+            listed = maxOf(listed, segments.size)
+        }
+
+        val result =
+                runner.run(buildCommand(inputPath, probe), workDir, probe.durationSeconds) { listNewSegments() }
+        if (!result.isSuccess) {
+            uploads.cancel()
+            return@coroutineScope null
+        }
+        // The last segment is listed when ffmpeg finishes, after its last progress report
+        listNewSegments()
+        ready.close()
+        uploads.await()
+    }
+
+    private suspend fun encryptAndUpload(file: File, segment: ListedSegment, key: SecureByteArray): EncryptedHlsSegment {
+        val plain = file.readBytes()
+        val iv = ByteArrayUtil.getRndByteArray(16)
+        val cipherText = AesCbc.encrypt(plain, key, iv)
+
+        var state: ResumableUploadState? = null
+        var attempt = 1
+        while (true) {
+            try {
+                state = uploader.upload(cipherText, file.name, state, persist = { state = it })
+                break
+            } catch (e: Exception) {
+                if (e is CancellationException || attempt >= maxAttempts) throw e
+                Logger.w(TAG) { "Segment ${segment.index} upload failed (attempt $attempt): ${e.message}" }
+                attempt++
+            }
+        }
+        file.delete()
+
+        return EncryptedHlsSegment(
+                index = segment.index,
+                durationSeconds = segment.durationSeconds,
+                iv = iv,
+                uploadId = state!!.uploadId,
+                plainBytes = plain.size.toLong(),
+                cipherBytes = cipherText.size.toLong()
+        )
+    }
+
+    // A partly written playlist is never seen: ffmpeg renames it into place
+    private fun readPlaylist(file: File): List<ListedSegment> {
+        if (!file.exists()) return emptyList()
+        val segments = mutableListOf<ListedSegment>()
+        var duration: Double? = null
+        for (line in file.readLines()) {
+            val trimmed = line.trim()
+            when {
+                trimmed.startsWith("#EXTINF:") ->
+                        duration = trimmed.removePrefix("#EXTINF:").substringBefore(',').toDoubleOrNull()
+                trimmed.isEmpty() || trimmed.startsWith("#") -> {}
+                else -> {
+                    segments.add(ListedSegment(segments.size, trimmed, duration ?: 0.0))
+                    duration = null
+                }
+            }
+        }
+        return segments
+    }
+
+    private fun buildCommand(inputPath: String, probe: VideoProbe): List<String> {
+        val command = mutableListOf(FFmpegBinaryManager.ffmpegPath(), "-y", "-i", inputPath)
+        // As segmentVideo: copied unless rotated, which needs a re-encode to apply
+        if (probe.isRotatedSideways) {
+            command.addAll(
+                    listOf(
+                            "-c:v",
+                            "libx264",
+                            "-preset",
+                            "veryfast",
+                            "-crf",
+                            "23",
+                            "-g",
+                            "30",
+                            "-bf",
+                            "2",
+                            "-threads",
+                            runner.threadsPerJob.toString()
+                    )
+            )
+        } else {
+            command.addAll(listOf("-c:v", "copy"))
+        }
+        // No -hls_playlist_type vod: it holds the playlist back until the end, and segments are
+        // found through it. buildPlaylist marks ours VOD.
+        command.addAll(
+                listOf(
+                        "-c:a",
+                        "copy",
+                        "-f",
+                        "hls",
+                        "-hls_time",
+                        segmentSeconds.toString(),
+                        "-hls_list_size",
+                        "0",
+                        "-hls_flags",
+                        "temp_file",
+                        "-hls_segment_filename",
+                        "segment_%05d.ts",
+                        PLAYLIST
+                )
+        )
+        return command
+    }
+
+    private fun buildPlaylist(
+            segments: List<EncryptedHlsSegment>,
+            keyUri: String,
+            segmentUri: (EncryptedHlsSegment) -> String
+    ): String = buildString {
+        appendLine("#EXTM3U")
+        appendLine("#EXT-X-VERSION:3")
+        appendLine("#EXT-X-TARGETDURATION:${ceil(segments.maxOfOrNull { it.durationSeconds } ?: 0.0).toInt()}")
+        appendLine("#EXT-X-MEDIA-SEQUENCE:0")
+        appendLine("#EXT-X-PLAYLIST-TYPE:VOD")
+        for (segment in segments) {
+            val iv = segment.iv.joinToString("") { it.toUByte().toString(16).padStart(2, '0') }
+            appendLine("#EXT-X-KEY:METHOD=AES-128,URI=\"$keyUri\",IV=0x$iv")
+            appendLine("#EXTINF:${segment.durationSeconds},")
+            appendLine(segmentUri(segment))
+        }
+        appendLine("#EXT-X-ENDLIST")
+    }
+}
@@ -0,0 +1,214 @@
+package id.homebase.homebasekmppoc.media
+
+import java.io.File
+import java.nio.file.Files
+import java.nio.file.StandardCopyOption
+import kotlin.math.abs
+import kotlinx.coroutines.Dispatchers
+import kotlinx.coroutines.withContext
+import kotlinx.serialization.Serializable
+import kotlinx.serialization.json.Json
+import kotlinx.serialization.json.JsonArray
+import kotlinx.serialization.json.JsonObject
+import kotlinx.serialization.json.contentOrNull
+import kotlinx.serialization.json.doubleOrNull
+import kotlinx.serialization.json.intOrNull
+import kotlinx.serialization.json.jsonArray
+import kotlinx.serialization.json.jsonObject
+import kotlinx.serialization.json.jsonPrimitive
+import kotlinx.serialization.json.longOrNull
+
+/** One stream of a media file, as ffprobe reports it. */
+@Serializable
+data class MediaStreamInfo(
+        val index: Int,
+        /** video, audio, subtitle or data. */
+        val codecType: String?,
+        val codecName: String?,
+        val width: Int? = null,
+        val height: Int? = null,
+        val bitRate: Long? = null,
+        val sampleRate: Int? = null,
+        val channels: Int? = null
+)
+
+/** Everything one ffprobe run tells us about a media file. */
+@Serializable
+data class MediaInfo(
+        val durationSeconds: Double,
+        /** Overall bitrate of the container, bits per second. */
+        val bitRate: Long?,
+        val formatName: String?,
+        /** Display rotation of the first video stream, normalised to 0, 90, 180 or 270. */
+        val rotation: Int,
+        val streams: List<MediaStreamInfo>
+) {
+    val video: MediaStreamInfo?
+        get() = streams.firstOrNull { it.codecType == "video" }
+
+    val hasAudio: Boolean
+        get() = streams.any { it.codecType == "audio" }
+
+    /** The video view of this, or null if there is no video stream. */
+    fun toVideoProbe(): VideoProbe? {
+        val video = video ?: return null
+        return VideoProbe(
+                durationSeconds = durationSeconds,
+                width = video.width ?: 0,
+                height = video.height ?: 0,
+                rotation = rotation,
+                videoCodec = video.codecName,
+                hasAudio = hasAudio
+        )
+    }
+
+    companion object {
+        private val json = Json { ignoreUnknownKeys = true }
+
+        /** Parses the output of `ffprobe -print_format json -show_format -show_streams`. */
+        fun parse(output: String): MediaInfo? {
+            val root = runCatching { json.parseToJsonElement(output).jsonObject }.getOrNull() ?: return null
+            val streams = root["streams"]?.jsonArray?.map { it.jsonObject } ?: return null
+            if (streams.isEmpty()) return null
+            val format = root["format"] as? JsonObject
+            val video = streams.firstOrNull { it.string("codec_type") == "video" }
+
+            val duration =
+                    format?.get("duration")?.jsonPrimitive?.doubleOrNull
+                            ?: video?.get("duration")?.jsonPrimitive?.doubleOrNull
+                            ?: 0.0
+
+            // Newer ffprobe reports rotation as display matrix side data, older as a rotate tag
+            val rotation =
+                    (video?.get("side_data_list") as? JsonArray)
+                            ?.firstNotNullOfOrNull { (it as? JsonObject)?.get("rotation")?.jsonPrimitive?.intOrNull }
+                            ?: (video?.get("tags") as? JsonObject)?.string("rotate")?.toIntOrNull()
+                            ?: 0
+
+            return MediaInfo(
+                    durationSeconds = duration,
+                    bitRate = format?.long("bit_rate"),
+                    formatName = format?.string("format_name"),
+                    rotation = abs(((rotation % 360) + 360) % 360),
+                    streams =
+                            streams.mapIndexed { i, stream ->
+                                MediaStreamInfo(
+                                        index = stream["index"]?.jsonPrimitive?.intOrNull ?: i,
+                                        codecType = stream.string("codec_type"),
+                                        codecName = stream.string("codec_name"),
+                                        width = stream["width"]?.jsonPrimitive?.intOrNull,
+                                        height = stream["height"]?.jsonPrimitive?.intOrNull,
+                                        bitRate = stream.long("bit_rate"),
+                                        sampleRate = stream.string("sample_rate")?.toIntOrNull(),
+                                        channels = stream["channels"]?.jsonPrimitive?.intOrNull
+                                )
+                            }
+            )
+        }
+
+        private fun JsonObject.string(key: String): String? = this[key]?.jsonPrimitive?.contentOrNull
+
+        // ffprobe writes most numbers as strings
+        private fun JsonObject.long(key: String): Long? =
+                this[key]?.jsonPrimitive?.let { it.longOrNull ?: it.contentOrNull?.toLongOrNull() }
+    }
+}
+
+/**
+ * Probe results by [FFmpegUtils.getUniqueId], so a file is probed once however often its
+ * metadata is asked for. The id changes with the file's path, size or modification time, so an
+ * edited file is probed again rather than served stale.
+ *
+ * The most recent [maxEntries] results are kept in memory, and every result is written to
+ * [directory] as JSON so it outlives the process; pass null to keep them in memory only.
+ */
+class MediaProbeCache(
+        private val directory: File? = defaultDirectory(),
+        private val maxEntries: Int = DEFAULT_MAX_ENTRIES,
+        private val runProbe: suspend (path: String) -> String? = { ffprobe(it) }
+) {
+    companion object {
+        const val DEFAULT_MAX_ENTRIES = 256
+
+        val shared: MediaProbeCache by lazy { MediaProbeCache() }
+
+        private val json = Json { ignoreUnknownKeys = true }
+
+        private fun defaultDirectory() = File(System.getProperty("java.io.tmpdir"), "homebase-probe-cache")
+
+        private suspend fun ffprobe(path: String): String? {
+            if (!FFmpegBinaryManager.isAvailable()) return null
+            return FFmpegUtils.runProcessWithOutput(
+                    listOf(
+                            FFmpegBinaryManager.ffprobePath(),
+                            "-v",
+                            "quiet",
+                            "-print_format",
+                            "json",
+                            "-show_format",
+                            "-show_streams",
+                            path
+                    )
+            )
+        }
+    }
+
+    // Access ordered, so the eldest entry is the least recently used
+    private val memory = LinkedHashMap<String, MediaInfo>(16, 0.75f, true)
+
+    /** The probe of [path], from the cache if the file has not changed; null if it cannot be probed. */
+    suspend fun get(path: String): MediaInfo? =
+            withContext(Dispatchers.IO) {
+                if (!File(path).exists()) return@withContext null
+                val key = FFmpegUtils.getUniqueId(path)
+
+                synchronized(memory) { memory[key] }?.let { return@withContext it }
+
+                val diskEntry = directory?.let { File(it, "$key.json") }
+                val fromDisk =
+                        diskEntry?.takeIf { it.exists() }?.let { entry ->
+                            runCatching { json.decodeFromString(MediaInfo.serializer(), entry.readText()) }.getOrNull()
+                        }
+                if (fromDisk != null) {
+                    remember(key, fromDisk)
+                    return@withContext fromDisk
+                }
+
+                val info = runProbe(path)?.let { MediaInfo.parse(it) } ?: return@withContext null
+                store(key, info)
+                info
+            }
+
+    /** Caches [info] as the probe of [path], e.g. one taken while the file was being written. */
+    suspend fun put(path: String, info: MediaInfo) =
+            withContext(Dispatchers.IO) { store(FFmpegUtils.getUniqueId(path), info) }
+
+    /** Forgets everything, in memory and on disk. */
+    fun clear() {
+        synchronized(memory) { memory.clear() }
+        directory?.listFiles { file -> file.extension == "json" }?.forEach { it.delete() }
+    }
+
+    private fun store(key: String, info: MediaInfo) {
+        remember(key, info)
+        directory?.let { dir ->
+            dir.mkdirs()
+            // Written aside and renamed, so a concurrent reader never sees half an entry
+            val temp = File(dir, "$key.json.tmp")
+            temp.writeText(json.encodeToString(MediaInfo.serializer(), info))
+            Files.move(
+                    temp.toPath(),
+                    File(dir, "$key.json").toPath(),
+                    StandardCopyOption.REPLACE_EXISTING,
+                    StandardCopyOption.ATOMIC_MOVE
+            )
+        }
+    }
+
+    private fun remember(key: String, info: MediaInfo) {
+        synchronized(memory) {
+            memory[key] = info
+            if (memory.size > maxEntries) memory.remove(memory.keys.first())
+        }
+    }
+}
@@ -0,0 +1,100 @@
+package id.homebase.homebasekmppoc.media
+
+import id.homebase.homebasekmppoc.prototype.lib.video.StoryboardIndex
+import java.io.File
+import java.util.UUID
+import kotlin.math.roundToInt
+import kotlinx.coroutines.Dispatchers
+import kotlinx.coroutines.withContext
+
+/** Sprite sheets of preview frames and the index that finds a time's frame in them. */
+data class Storyboard(
+        val index: StoryboardIndex,
+        val intervalSeconds: Double,
+        val outputDir: String,
+        /** JPEG sheets, in the order of [StoryboardIndex.sheets]. */
+        val sheetPaths: List<String>
+)
+
+/**
+ * Extracts a preview frame at a fixed interval for scrubbing, in one decode of the video.
+ *
+ * The select filter passes the first frame at or after each multiple of the interval, so frames
+ * are found by their timestamps rather than by seeking; the tile filter lays them out a row at a
+ * time on sheets of [COLUMNS] x [ROWS], written as JPEG. Long videos get a longer interval so that
+ * no more than [StoryboardIndex.MAX_SHEETS] sheets are needed.
+ */
+object StoryboardGenerator {
+
+    const val DEFAULT_INTERVAL_SECONDS = 2.0
+    const val DEFAULT_TILE_WIDTH = 160
+    private const val COLUMNS = 10
+    private const val ROWS = 10
+    private const val JPEG_QUALITY = 5
+
+    /**
+     * Frames of [inputPath] [intervalSeconds] apart, [tileWidth] wide, on sprite sheets named as
+     * payloads by [StoryboardIndex.sheetKey]. Returns null if ffmpeg is unavailable or fails.
+     */
+    suspend fun generate(
+            inputPath: String,
+            intervalSeconds: Double = DEFAULT_INTERVAL_SECONDS,
+            tileWidth: Int = DEFAULT_TILE_WIDTH
+    ): Storyboard? =
+            withContext(Dispatchers.IO) {
+                if (!FFmpegBinaryManager.isAvailable()) {
+                    println("FFmpeg binaries not available for this platform")
+                    return@withContext null
+                }
+
+                val probe = VideoPreparation.probe(inputPath) ?: return@withContext null
+                if (probe.displayWidth <= 0 || probe.displayHeight <= 0) return@withContext null
+
+                val maxTiles = StoryboardIndex.MAX_SHEETS * COLUMNS * ROWS
+                val interval = maxOf(intervalSeconds, probe.durationSeconds / maxTiles)
+                val tileHeight = (tileWidth.toDouble() * probe.displayHeight / probe.displayWidth / 2).roundToInt() * 2
+                val index =
+                        StoryboardIndex.grid(probe.durationSeconds, interval, tileWidth, tileHeight, COLUMNS, ROWS)
+
+                val outputDir = File(System.getProperty("java.io.tmpdir"), "storyboard_${UUID.randomUUID()}")
+                outputDir.mkdirs()
+
+                val command = buildCommand(inputPath, interval, tileWidth, tileHeight)
+                val exitCode = FFmpegUtils.runProcess(command, outputDir, probe.durationSeconds)
+                val written = index.sheets.indices.takeWhile { File(outputDir, sheetFileName(it)).exists() }.size
+                if (exitCode != 0 || written == 0) {
+                    outputDir.deleteRecursively()
+                    return@withContext null
+                }
+                val sheetPaths = (0 until written).map { File(outputDir, sheetFileName(it)).absolutePath }
+                // The last frame can come before the last multiple of the interval, and with it the
+                // last sheet when that tile would have started one
+                Storyboard(index.takeSheets(written), interval, outputDir.absolutePath, sheetPaths)
+            }
+
+    private fun sheetFileName(sheet: Int) = "sheet_%03d.jpg".format(sheet)
+
+    internal fun buildCommand(inputPath: String, intervalSeconds: Double, tileWidth: Int, tileHeight: Int): List<String> =
+            listOf(
+                    FFmpegBinaryManager.ffmpegPath(),
+                    "-y",
+                    "-i",
+                    inputPath,
+                    "-an",
+                    "-vf",
+                    // selected_n counts the frames passed so far, so frame k is the first at k * interval
+                    "select='gte(t,selected_n*$intervalSeconds)'," +
+                            "scale=$tileWidth:$tileHeight," +
+                            "tile=${COLUMNS}x$ROWS",
+                    // One image per sheet as the tile filter emits them, not at the input frame rate
+                    "-fps_mode",
+                    "passthrough",
+                    "-q:v",
+                    JPEG_QUALITY.toString(),
+                    "-threads",
+                    FFmpegJobRunner.shared.threadsPerJob.toString(),
+                    "-start_number",
+                    "0",
+                    "sheet_%03d.jpg"
+            )
+}
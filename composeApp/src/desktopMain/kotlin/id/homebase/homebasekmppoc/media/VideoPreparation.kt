@@ -0,0 +1,140 @@
+package id.homebase.homebasekmppoc.media
+
+import java.io.File
+import java.util.UUID
+import kotlinx.coroutines.Dispatchers
+import kotlinx.coroutines.withContext
+
+/** Everything an upload needs, produced by [VideoPreparation.prepare] in one ffmpeg run. */
+data class PreparedVideo(
+        val probe: VideoProbe,
+        val outputDir: String,
+        /** Compressed MP4 rendition, rotation applied. */
+        val compressedPath: String,
+        /** HLS playlist and its single segment file, cut from the same encode as [compressedPath]. */
+        val playlistPath: String,
+        val segmentPath: String,
+        /** Poster frame, or null if the video has no frame at the poster time. */
+        val posterPath: String?
+)
+
+/**
+ * Prepares a video for upload with one probe and one decode.
+ *
+ * Calling [FFmpegUtils.getRotationFromFile], [FFmpegUtils.grabThumbnail],
+ * [FFmpegUtils.compressVideo] and [FFmpegUtils.segmentVideo] in turn decodes the source up to three
+ * times, and encodes it twice when it is rotated. Here a single filter graph splits the decoded
+ * frames into the scaled video and the poster frame; the video is encoded once and the tee muxer
+ * writes both the MP4 and the HLS segments from that encode. ffmpeg applies the rotation while
+ * decoding, so rotated sources take the same path.
+ */
+object VideoPreparation {
+
+    private const val MAX_WIDTH = 1280
+    private const val VIDEO_BITRATE = "3000k"
+    private const val AUDIO_BITRATE = "128k"
+    private const val SEGMENT_SECONDS = 6
+    private const val POSTER_SECONDS = 1.0
+
+    /** The probe of [inputPath], through [MediaProbeCache.shared]. */
+    suspend fun probe(inputPath: String): VideoProbe? = MediaProbeCache.shared.get(inputPath)?.toVideoProbe()
+
+    internal fun parseProbe(output: String): VideoProbe? = MediaInfo.parse(output)?.toVideoProbe()
+
+    /**
+     * Probes [inputPath] once, then decodes it once to produce the compressed MP4, the HLS playlist
+     * and segment, and the poster frame, reporting the share done to [onProgress]. Returns null if
+     * ffmpeg is unavailable or fails.
+     */
+    suspend fun prepare(inputPath: String, onProgress: ((Float) -> Unit)? = null): PreparedVideo? =
+            withContext(Dispatchers.IO) {
+                if (!FFmpegBinaryManager.isAvailable()) {
+                    println("FFmpeg binaries not available for this platform")
+                    return@withContext null
+                }
+
+                val probe = probe(inputPath) ?: return@withContext null
+
+                val outputDir = File(System.getProperty("java.io.tmpdir"), "prepare_${UUID.randomUUID()}")
+                outputDir.mkdirs()
+
+                val result =
+                        PreparedVideo(
+                                probe = probe,
+                                outputDir = outputDir.absolutePath,
+                                compressedPath = File(outputDir, "compressed.mp4").absolutePath,
+                                playlistPath = File(outputDir, "index.m3u8").absolutePath,
+                                segmentPath = File(outputDir, "index.ts").absolutePath,
+                                posterPath = File(outputDir, "poster.jpg").absolutePath
+                        )
+
+                // Output names are relative to outputDir, so nothing in the tee spec needs escaping
+                val command = buildCommand(inputPath, probe)
+                val exitCode =
+                        FFmpegUtils.runProcess(command, outputDir, probe.durationSeconds) { progress ->
+                            progress.fraction?.let { onProgress?.invoke(it) }
+                        }
+                when {
+                    exitCode != 0 || !File(result.compressedPath).exists() || !File(result.playlistPath).exists() -> {
+                        outputDir.deleteRecursively()
+                        null
+                    }
+                    !File(result.posterPath!!).exists() -> result.copy(posterPath = null)
+                    else -> result
+                }
+            }
+
+    internal fun buildCommand(inputPath: String, probe: VideoProbe): List<String> {
+        // A second in, like grabThumbnail, unless the video is shorter than that
+        val posterAt =
+                if (probe.durationSeconds > 0) minOf(POSTER_SECONDS, probe.durationSeconds / 2)
+                else 0.0
+
+        val command = mutableListOf(FFmpegBinaryManager.ffmpegPath(), "-y", "-i", inputPath)
+
+        command.add("-filter_complex")
+        command.add(
+                "[0:v]split=2[main][still];" +
+                        "[main]scale='min($MAX_WIDTH,iw)':-2[video];" +
+                        "[still]select='gte(t,$posterAt)'[poster]"
+        )
+
+        // One encode, muxed twice
+        command.addAll(listOf("-map", "[video]"))
+        if (probe.hasAudio) command.addAll(listOf("-map", "0:a:0"))
+        command.addAll(
+                listOf(
+                        "-c:v",
+                        "libx264",
+                        "-preset",
+                        "fast",
+                        "-b:v",
+                        VIDEO_BITRATE,
+                        "-pix_fmt",
+                        "yuv420p",
+                        "-threads",
+                        FFmpegJobRunner.shared.threadsPerJob.toString(),
+                        // HLS can only cut on keyframes
+                        "-force_key_frames",
+                        "expr:gte(t,n_forced*$SEGMENT_SECONDS)",
+                        // MP4 wants codec headers up front; the tee muxer does not set them per output
+                        "-flags",
+                        "+global_header"
+                )
+        )
+        if (probe.hasAudio) command.addAll(listOf("-c:a", "aac", "-b:a", AUDIO_BITRATE))
+        command.addAll(
+                listOf(
+                        "-f",
+                        "tee",
+                        "[f=mp4:movflags=+faststart]compressed.mp4|" +
+                                "[f=hls:hls_time=$SEGMENT_SECONDS:hls_list_size=0:hls_flags=single_file:" +
+                                "hls_segment_filename=index.ts]index.m3u8"
+                )
+        )
+
+        // The poster, from the same decoded frames
+        command.addAll(listOf("-map", "[poster]", "-frames:v", "1", "-update", "1", "poster.jpg"))
+        return command
+    }
+}
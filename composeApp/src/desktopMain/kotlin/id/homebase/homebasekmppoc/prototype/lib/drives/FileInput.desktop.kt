@@ -6,6 +6,8 @@ import kotlinx.coroutines.withContext
 import kotlinx.io.asSource
 import kotlinx.io.buffered
 import java.io.File
+import java.io.RandomAccessFile
+import java.nio.ByteBuffer
 
 actual fun openFileInput(path: String): InputProvider =
     InputProvider {
@@ -30,3 +32,15 @@ actual suspend fun writeBytesToTempFile(
         file.absolutePath
     }
 
+// androidMain / desktopMain
+actual class RandomAccessFileInput actual constructor(path: String) : AutoCloseable {
+    private val channel = RandomAccessFile(path, "r").channel
+
+    actual val length: Long get() = channel.size()
+
+    // FileChannel positional reads leave the channel position alone and are safe to run concurrently
+    actual fun read(position: Long, buffer: ByteArray, offset: Int, length: Int): Int =
+        channel.read(ByteBuffer.wrap(buffer, offset, length), position)
+
+    actual override fun close() = channel.close()
+}
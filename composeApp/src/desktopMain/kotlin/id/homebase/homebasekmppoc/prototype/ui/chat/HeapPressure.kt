@@ -0,0 +1,28 @@
+package id.homebase.homebasekmppoc.prototype.ui.chat
+
+import java.lang.management.ManagementFactory
+import java.lang.management.MemoryNotificationInfo
+import java.lang.management.MemoryType
+import javax.management.NotificationEmitter
+
+/** Share of the old generation that, still in use after a collection, counts as pressure */
+private const val HEAP_PRESSURE_THRESHOLD = 0.8
+
+/**
+ * The JVM has no low memory callback, so ask the heap pools that support it to notify when usage
+ * after a collection crosses HEAP_PRESSURE_THRESHOLD, and drop decoded bitmaps when it does.
+ */
+fun installHeapPressureHook(cache: ImageBitmapCache = ImageBitmapCache.shared) {
+    val pools = ManagementFactory.getMemoryPoolMXBeans().filter {
+        it.type == MemoryType.HEAP && it.isCollectionUsageThresholdSupported && it.usage.max > 0
+    }
+    if (pools.isEmpty()) return
+    pools.forEach { it.collectionUsageThreshold = (it.usage.max * HEAP_PRESSURE_THRESHOLD).toLong() }
+
+    val emitter = ManagementFactory.getMemoryMXBean() as NotificationEmitter
+    emitter.addNotificationListener({ notification, _ ->
+        if (notification.type == MemoryNotificationInfo.MEMORY_COLLECTION_THRESHOLD_EXCEEDED) {
+            cache.clear()
+        }
+    }, null, null)
+}
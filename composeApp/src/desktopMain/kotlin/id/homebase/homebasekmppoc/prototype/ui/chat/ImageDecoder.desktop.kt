@@ -3,12 +3,31 @@ package id.homebase.homebasekmppoc.prototype.ui.chat
 import androidx.compose.ui.graphics.ImageBitmap
 import androidx.compose.ui.graphics.toComposeImageBitmap
 import org.jetbrains.skia.Image
+import org.jetbrains.skia.Rect
+import org.jetbrains.skia.SamplingMode
+import org.jetbrains.skia.Surface
 
 /** Desktop (JVM) implementation: Decodes image bytes to ImageBitmap using Skia. */
-actual fun decodeImageBitmap(bytes: ByteArray): ImageBitmap? {
+actual fun decodeImageBitmap(bytes: ByteArray, targetWidth: Int, targetHeight: Int): ImageBitmap? {
     return try {
-        Image.makeFromEncoded(bytes).toComposeImageBitmap()
+        Image.makeFromEncoded(bytes).use { image -> image.scaledToCover(targetWidth, targetHeight) }
     } catch (e: Exception) {
         null
     }
 }
+
+internal fun Image.scaledToCover(targetWidth: Int, targetHeight: Int): ImageBitmap {
+    val (w, h) = coverSize(width, height, targetWidth, targetHeight) ?: return toComposeImageBitmap()
+    val surface = Surface.makeRasterN32Premul(w, h)
+    surface.canvas.drawImageRect(
+        this,
+        Rect.makeWH(width.toFloat(), height.toFloat()),
+        Rect.makeWH(w.toFloat(), h.toFloat()),
+        SamplingMode.MITCHELL,
+        null,
+        true
+    )
+    val scaled = surface.makeImageSnapshot()
+    surface.close()
+    return scaled.use { it.toComposeImageBitmap() }
+}
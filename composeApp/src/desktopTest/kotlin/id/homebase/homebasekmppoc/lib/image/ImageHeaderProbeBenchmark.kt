@@ -0,0 +1,41 @@
+package id.homebase.homebasekmppoc.lib.image
+
+import id.homebase.homebasekmppoc.testing.assumeBenchmarksEnabled
+import org.jetbrains.skia.Image
+import kotlin.test.Test
+import kotlin.test.assertTrue
+
+/**
+ * Per-file latency of ImageHeaderProbe against asking Skia, which getNaturalSize did before.
+ *
+ * Only runs with RUN_BENCHMARKS=1, e.g.
+ *   RUN_BENCHMARKS=1 ./gradlew :composeApp:desktopTest --tests '*ImageHeaderProbeBenchmark*'
+ */
+class ImageHeaderProbeBenchmark {
+
+    @Test
+    fun benchmarkProbeLatency() {
+        assumeBenchmarksEnabled()
+
+        val files = listOf("sample.jpg", "yummy.jpg", "sample.png", "sample.gif", "sample.webp", "sample.bmp")
+            .filter { TestImageLoader.testImageExists(it) }
+            .associateWith { TestImageLoader.loadTestImage(it) }
+
+        for ((name, bytes) in files) {
+            val probeMicros = microsPerCall(10_000) { ImageHeaderProbe.probe(bytes)!!.size.pixelWidth }
+            val skiaMicros = microsPerCall(200) { Image.makeFromEncoded(bytes).use { it.width } }
+            println("$name (${bytes.size / 1024} KB): probe %.2f µs, Skia %.1f µs".format(probeMicros, skiaMicros))
+            assertTrue(probeMicros < 50.0, "$name took $probeMicros µs")
+        }
+    }
+
+    private inline fun microsPerCall(iterations: Int, block: () -> Int): Double {
+        var sink = 0
+        repeat(iterations / 10) { sink += block() } // Warm up
+        val start = System.nanoTime()
+        repeat(iterations) { sink += block() }
+        val elapsed = System.nanoTime() - start
+        check(sink != 0)
+        return elapsed / 1000.0 / iterations
+    }
+}
@@ -0,0 +1,99 @@
+package id.homebase.homebasekmppoc.lib.image
+
+import org.jetbrains.skia.Color
+import org.jetbrains.skia.EncodedImageFormat
+import org.jetbrains.skia.Paint
+import org.jetbrains.skia.Rect
+import org.jetbrains.skia.Surface
+import java.lang.management.ManagementFactory
+import java.lang.management.MemoryType
+import kotlin.test.Test
+import kotlin.test.assertEquals
+import kotlin.test.assertTrue
+
+class SubsampledDecodeTest {
+
+    private fun jpeg(width: Int, height: Int): ByteArray {
+        val surface = Surface.makeRasterN32Premul(width, height)
+        val paint = Paint()
+        for (i in 0 until 64) {
+            paint.color = Color.makeRGB(i * 4, 255 - i * 4, (i * 37) % 256)
+            surface.canvas.drawRect(Rect.makeXYWH(i * width / 64f, 0f, width / 64f + 1, height.toFloat()), paint)
+        }
+        val image = surface.makeImageSnapshot()
+        val bytes = image.encodeToData(EncodedImageFormat.JPEG, 80)!!.bytes
+        image.close()
+        surface.close()
+        return bytes
+    }
+
+    /** Inserts an EXIF segment with only an orientation tag right after SOI. */
+    private fun withOrientation(jpeg: ByteArray, orientation: Int): ByteArray {
+        val tiff = byteArrayOf(
+            'M'.code.toByte(), 'M'.code.toByte(), 0, 42, 0, 0, 0, 8,
+            0, 1, 0x01, 0x12, 0, 3, 0, 0, 0, 1, 0, orientation.toByte(), 0, 0,
+            0, 0, 0, 0
+        )
+        val body = "Exif".encodeToByteArray() + byteArrayOf(0, 0) + tiff
+        val length = body.size + 2
+        val app1 = byteArrayOf(0xFF.toByte(), 0xE1.toByte(), (length shr 8).toByte(), length.toByte()) + body
+        return jpeg.copyOfRange(0, 2) + app1 + jpeg.copyOfRange(2, jpeg.size)
+    }
+
+    private fun heapPools() = ManagementFactory.getMemoryPoolMXBeans().filter { it.type == MemoryType.HEAP }
+
+    @Test
+    fun testSubsampleFactor() {
+        val panorama = ImageSize(20_000, 5_000)
+        assertEquals(1, ImageUtils.subsampleFactor(ImageSize(1200, 900), 640, 480))
+        assertEquals(2, ImageUtils.subsampleFactor(ImageSize(4000, 3000), 1000, 750))
+        // The long side limits it: 20000 / 32 = 625 no longer covers 2 x 320
+        assertEquals(16, ImageUtils.subsampleFactor(panorama, 320, 80))
+    }
+
+    @Test
+    fun testLargeImageIsDecodedReduced() {
+        val bytes = jpeg(10_000, 3_000)
+        val (natural, image) = ImageUtils.decodeForSize(bytes, 320, 320)
+
+        assertEquals(ImageSize(10_000, 3_000), natural)
+        // 320 x 96 is the target; the decode covers it twice over but is far from 30 MP
+        assertTrue(image.width in 640..1_280 && image.height >= 192, "${image.width}x${image.height}")
+        image.close()
+
+        val result = ImageUtils.resizePreserveAspect(bytes, 320, 320, ImageFormat.JPEG, 80)
+        assertEquals(ImageSize(320, 96), result.size)
+        assertEquals(natural, result.naturalSize)
+    }
+
+    @Test
+    fun testPeakHeapIsBoundedForLargeImage() {
+        val bytes = jpeg(10_000, 3_000)
+        ImageUtils.resizePreserveAspect(bytes, 320, 320, ImageFormat.JPEG, 80) // Warm up
+
+        System.gc()
+        val pools = heapPools()
+        val before = pools.sumOf { it.usage.used }
+        pools.forEach { it.resetPeakUsage() }
+
+        ImageUtils.resizePreserveAspect(bytes, 320, 320, ImageFormat.JPEG, 80)
+        val peak = pools.sumOf { it.peakUsage.used }
+
+        // A full size ARGB raster of this image alone would be 120 MB
+        val grownMb = (peak - before) / (1024 * 1024)
+        assertTrue(grownMb < 48, "Peak heap grew by $grownMb MB")
+    }
+
+    @Test
+    fun testExifOrientationAppliedToReducedDecode() {
+        val bytes = withOrientation(jpeg(6_000, 2_000), 6)
+        val (natural, image) = ImageUtils.decodeForSize(bytes, 200, 200)
+
+        assertEquals(ImageSize(2_000, 6_000), natural)
+        assertTrue(image.height > image.width, "${image.width}x${image.height}")
+        image.close()
+
+        assertEquals(ImageSize(2_000, 6_000), ImageUtils.getNaturalSize(bytes))
+        assertEquals(ImageSize(67, 200), ImageUtils.resizePreserveAspect(bytes, 200, 200, ImageFormat.JPEG, 80).size)
+    }
+}
@@ -0,0 +1,144 @@
+package id.homebase.homebasekmppoc.lib.image
+
+import id.homebase.homebasekmppoc.testing.assumeBenchmarksEnabled
+import kotlinx.coroutines.runBlocking
+import org.jetbrains.skia.Color
+import org.jetbrains.skia.EncodedImageFormat
+import org.jetbrains.skia.GradientStyle
+import org.jetbrains.skia.Paint
+import org.jetbrains.skia.Rect
+import org.jetbrains.skia.Shader
+import org.jetbrains.skia.Surface
+import java.io.File
+import java.util.concurrent.atomic.AtomicBoolean
+import java.util.concurrent.atomic.AtomicLong
+import kotlin.concurrent.thread
+import kotlin.math.max
+import kotlin.math.roundToInt
+import kotlin.random.Random
+import kotlin.test.Test
+import kotlin.test.assertEquals
+
+/**
+ * Compares createThumbnails (decode once, cascade, parallel encode) with the previous path, which
+ * decoded the source again for every preset and re-decoded its own output for every quality step.
+ *
+ * Slow, so it only runs with RUN_BENCHMARKS=1, e.g.
+ *   RUN_BENCHMARKS=1 ./gradlew :composeApp:desktopTest --tests '*ThumbnailPipelineBenchmark*'
+ */
+class ThumbnailPipelineBenchmark {
+
+    @Test
+    fun benchmark12_24_48MP() {
+        assumeBenchmarksEnabled()
+
+        // 4:3 photos
+        for ((w, h) in listOf(4000 to 3000, 5656 to 4242, 8000 to 6000)) {
+            val photo = syntheticPhoto(w, h)
+            val megapixels = w * h / 1_000_000
+
+            // Warm up the JIT and Skia before measuring
+            runBlocking { createThumbnails(photo, "bench") }
+            legacyThumbnails(photo)
+
+            val legacy = measure { legacyThumbnails(photo) }
+            val cascade = measure { runBlocking { createThumbnails(photo, "bench").third.size } }
+            assertEquals(legacy.outputs, cascade.outputs)
+
+            println(
+                "${megapixels}MP (${photo.size / 1024} KB jpeg): " +
+                    "legacy ${legacy.millis} ms, peak +${legacy.peakMb} MB | " +
+                    "cascade ${cascade.millis} ms, peak +${cascade.peakMb} MB"
+            )
+        }
+    }
+
+    private class Measurement(val millis: Long, val peakMb: Long, val outputs: Int)
+
+    private fun measure(block: () -> Int): Measurement {
+        System.gc()
+        val baseline = residentBytes()
+        val peak = AtomicLong(baseline)
+        val running = AtomicBoolean(true)
+        val sampler = thread(isDaemon = true) {
+            while (running.get()) {
+                peak.accumulateAndGet(residentBytes()) { a, b -> max(a, b) }
+                Thread.sleep(2)
+            }
+        }
+
+        val start = System.nanoTime()
+        val outputs = block()
+        val millis = (System.nanoTime() - start) / 1_000_000
+
+        running.set(false)
+        sampler.join()
+        peak.accumulateAndGet(residentBytes()) { a, b -> max(a, b) }
+        return Measurement(millis, (peak.get() - baseline) / (1024 * 1024), outputs)
+    }
+
+    /**
+     * Resident set size, which includes Skia's native pixel memory. Falls back to the JVM heap
+     * where /proc is not available.
+     */
+    private fun residentBytes(): Long {
+        val status = File("/proc/self/status")
+        if (status.exists()) {
+            val line = status.readLines().firstOrNull { it.startsWith("VmRSS:") }
+            if (line != null) return line.filter { it.isDigit() }.toLong() * 1024
+        }
+        val runtime = Runtime.getRuntime()
+        return runtime.totalMemory() - runtime.freeMemory()
+    }
+
+    /** The pre-cascade path: every preset and the tiny thumb decoded and resized from the source. */
+    private fun legacyThumbnails(imageBytes: ByteArray): Int {
+        val naturalSize = ImageUtils.getNaturalSize(imageBytes)
+        val presets = getRevisedThumbs(naturalSize, baseThumbSizes).map { it to false } + (tinyThumbSize to true)
+        for ((instruction, isTinyThumb) in presets) {
+            val format = if (isTinyThumb) ImageFormat.WEBP else instruction.type
+            var quality = instruction.quality
+            var result = ImageUtils.resizePreserveAspect(
+                imageBytes,
+                instruction.maxPixelDimension,
+                instruction.maxPixelDimension,
+                format,
+                quality
+            )
+            while (result.bytes.size > instruction.maxBytes && quality > 1) {
+                val excessRatio = result.bytes.size.toDouble() / instruction.maxBytes.toDouble()
+                quality = (quality - minOf(40, maxOf(5, (quality * excessRatio * 0.5).roundToInt()))).coerceAtLeast(1)
+                result = ImageUtils.compressOnly(result.bytes, format, quality)
+            }
+        }
+        return presets.size - 1
+    }
+
+    /** Gradients plus noise, so the encoders do realistic work instead of compressing flat colour. */
+    private fun syntheticPhoto(width: Int, height: Int): ByteArray {
+        val surface = Surface.makeRasterN32Premul(width, height)
+        val canvas = surface.canvas
+        val random = Random(width)
+        canvas.drawPaint(Paint().apply {
+            shader = Shader.makeLinearGradient(
+                0f, 0f, width.toFloat(), height.toFloat(),
+                intArrayOf(Color.makeRGB(30, 60, 120), Color.makeRGB(220, 180, 90), Color.makeRGB(40, 120, 60)),
+                null,
+                GradientStyle.DEFAULT
+            )
+        })
+        val paint = Paint()
+        repeat(20_000) {
+            paint.color = Color.makeARGB(random.nextInt(40, 160), random.nextInt(256), random.nextInt(256), random.nextInt(256))
+            val x = random.nextFloat() * width
+            val y = random.nextFloat() * height
+            val size = random.nextFloat() * 60f + 2f
+            canvas.drawRect(Rect.makeXYWH(x, y, size, size), paint)
+        }
+        val image = surface.makeImageSnapshot()
+        val bytes = image.encodeToData(EncodedImageFormat.JPEG, 90)!!.bytes
+        image.close()
+        surface.close()
+        return bytes
+    }
+}
@@ -0,0 +1,171 @@
+package id.homebase.homebasekmppoc.lib.image
+
+import org.jetbrains.skia.Bitmap
+import org.jetbrains.skia.Image
+import kotlin.math.max
+import kotlin.math.roundToInt
+import kotlin.test.Test
+import kotlin.test.assertEquals
+import kotlin.test.assertTrue
+
+/**
+ * encodeWithinBudget against the quality loop createImageThumbnail used to run, on the test
+ * images at three budgets each for JPEG and WebP. Both start from the same downscaled pixels.
+ */
+class ThumbnailQualitySearchTest {
+
+    private val corpus = listOf(
+        "sample.jpg",
+        "yummy.jpg",
+        "sample.png",
+        "sample.webp",
+        "sample1024x1024.webp",
+        "Sample800x400.webp"
+    )
+
+    private class Outcome(val bytes: ByteArray, val encodes: Int, val decodes: Int)
+
+    /** The previous loop: big quality drops, each re-decoding the previous lossy output. */
+    private fun legacy(level: DecodedImage, format: ImageFormat, startQuality: Int, maxBytes: Int): Outcome {
+        var quality = startQuality
+        var bytes = level.encode(format, quality)
+        var encodes = 1
+        var decodes = 0
+        var safetyCounter = 0
+        while (bytes.size > maxBytes && quality > 1 && safetyCounter < 20) {
+            safetyCounter++
+            val excessRatio = bytes.size.toDouble() / maxBytes.toDouble()
+            val qualityDrop = minOf(40, maxOf(5, (quality * excessRatio * 0.5).roundToInt()))
+            quality = (quality - qualityDrop).coerceAtLeast(1)
+            bytes = ImageUtils.compressOnly(bytes, format, quality).bytes
+            encodes++
+            decodes++
+        }
+        return Outcome(bytes, encodes, decodes)
+    }
+
+    @Test
+    fun testFewerCodecPassesAndNoWorseSsim() {
+        var legacyPasses = 0
+        var searchPasses = 0
+        var legacySsim = 0.0
+        var searchSsim = 0.0
+        var cases = 0
+
+        for (name in corpus) {
+            if (!TestImageLoader.testImageExists(name)) continue
+            ImageUtils.decode(TestImageLoader.loadTestImage(name)).use { source ->
+                val (w, h) = calculateTargetDimensions(source.width, source.height, 640, 640)
+                source.scale(w, h).use { level ->
+                    val reference = luma(level.encode(ImageFormat.PNG, 100))
+                    for (format in listOf(ImageFormat.JPEG, ImageFormat.WEBP)) {
+                        val full = level.encode(format, 84).size
+                        for (fraction in listOf(0.7, 0.45, 0.25)) {
+                            val maxBytes = (full * fraction).toInt()
+                            val old = legacy(level, format, 84, maxBytes)
+                            val new = encodeWithinBudget(level, format, 84, maxBytes) { _, _ -> null }
+
+                            assertTrue(new.bytes.size <= maxBytes, "$name $format $fraction over budget")
+                            val oldSsim = ssim(reference, luma(old.bytes))
+                            val newSsim = ssim(reference, luma(new.bytes))
+                            assertTrue(
+                                newSsim >= oldSsim - 0.005,
+                                "$name $format $fraction: SSIM $newSsim at q${new.quality} vs $oldSsim"
+                            )
+
+                            legacyPasses += old.encodes + old.decodes
+                            searchPasses += new.encodes
+                            legacySsim += oldSsim
+                            searchSsim += newSsim
+                            cases++
+                        }
+                    }
+                }
+            }
+        }
+
+        println("$cases cases: legacy $legacyPasses codec passes, mean SSIM ${legacySsim / cases}; " +
+            "search $searchPasses encodes, mean SSIM ${searchSsim / cases}")
+        if (cases == 0) return
+        assertTrue(searchPasses < legacyPasses, "search $searchPasses vs legacy $legacyPasses")
+        assertTrue(searchSsim >= legacySsim)
+    }
+
+    @Test
+    fun testShrinksOnlyAtQualityFloor() {
+        if (!TestImageLoader.testImageExists("sample.jpg")) return
+        ImageUtils.decode(TestImageLoader.loadTestImage("sample.jpg")).use { source ->
+            val (w, h) = calculateTargetDimensions(source.width, source.height, 20, 20)
+            source.scale(w, h).use { level ->
+                val atFloor = level.encode(ImageFormat.WEBP, 1).size
+                val asked = mutableListOf<Int>()
+                val result = encodeWithinBudget(level, ImageFormat.WEBP, 76, atFloor - 1) { dim, _ ->
+                    asked.add(dim)
+                    if (dim <= 5) null
+                    else calculateTargetDimensions(source.width, source.height, dim - 5, dim - 5)
+                        .let { (sw, sh) -> ImageSize(sw, sh) }
+                }
+
+                // Quality went all the way down before the size did
+                assertEquals(20, asked.first())
+                assertEquals(1, result.quality)
+                assertTrue(max(result.size.pixelWidth, result.size.pixelHeight) < 20)
+            }
+        }
+    }
+
+    private class Luma(val width: Int, val height: Int, val values: DoubleArray)
+
+    private fun luma(encoded: ByteArray): Luma {
+        Image.makeFromEncoded(encoded).use { image ->
+            val bitmap = Bitmap.makeFromImage(image)
+            val pixels = bitmap.readPixels() ?: error("Cannot read pixels")
+            val values = DoubleArray(image.width * image.height) { i ->
+                // N32 is BGRA on the platforms we test on; the weights only need to be consistent
+                val b = pixels[4 * i].toInt() and 0xFF
+                val g = pixels[4 * i + 1].toInt() and 0xFF
+                val r = pixels[4 * i + 2].toInt() and 0xFF
+                0.299 * r + 0.587 * g + 0.114 * b
+            }
+            bitmap.close()
+            return Luma(image.width, image.height, values)
+        }
+    }
+
+    /** Mean SSIM over 8x8 windows of the luma channel. */
+    private fun ssim(a: Luma, b: Luma): Double {
+        val c1 = (0.01 * 255) * (0.01 * 255)
+        val c2 = (0.03 * 255) * (0.03 * 255)
+        var total = 0.0
+        var windows = 0
+        for (y0 in 0 until a.height - 7 step 8) {
+            for (x0 in 0 until a.width - 7 step 8) {
+                var meanA = 0.0
+                var meanB = 0.0
+                for (y in y0 until y0 + 8) for (x in x0 until x0 + 8) {
+                    meanA += a.values[y * a.width + x]
+                    meanB += b.values[y * b.width + x]
+                }
+                meanA /= 64
+                meanB /= 64
+                var varA = 0.0
+                var varB = 0.0
+                var cov = 0.0
+                for (y in y0 until y0 + 8) for (x in x0 until x0 + 8) {
+                    val da = a.values[y * a.width + x] - meanA
+                    val db = b.values[y * b.width + x] - meanB
+                    varA += da * da
+                    varB += db * db
+                    cov += da * db
+                }
+                varA /= 63
+                varB /= 63
+                cov /= 63
+                total += ((2 * meanA * meanB + c1) * (2 * cov + c2)) /
+                    ((meanA * meanA + meanB * meanB + c1) * (varA + varB + c2))
+                windows++
+            }
+        }
+        return total / windows
+    }
+}
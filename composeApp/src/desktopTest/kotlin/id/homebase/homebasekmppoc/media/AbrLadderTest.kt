@@ -0,0 +1,178 @@
+package id.homebase.homebasekmppoc.media
+
+import id.homebase.homebasekmppoc.prototype.lib.video.HlsMasterPlaylist
+import id.homebase.homebasekmppoc.testing.assumeFFmpegAvailable
+import java.io.File
+import kotlin.io.path.createTempDirectory
+import kotlinx.coroutines.runBlocking
+import kotlin.test.AfterTest
+import kotlin.test.Test
+import kotlin.test.assertEquals
+import kotlin.test.assertNotNull
+import kotlin.test.assertTrue
+
+class AbrLadderTest {
+
+    private val workDir = createTempDirectory("abr-test").toFile()
+    private val outputs = mutableListOf<File>()
+
+    @AfterTest
+    fun cleanup() {
+        workDir.deleteRecursively()
+        outputs.forEach { it.deleteRecursively() }
+    }
+
+    private fun probe(width: Int, height: Int, rotation: Int = 0) =
+            VideoProbe(durationSeconds = 10.0, width = width, height = height, rotation = rotation, videoCodec = "h264", hasAudio = true)
+
+    // ========== Planning ==========
+
+    @Test
+    fun plansRungsUpToTheSource() {
+        val ladder = AbrLadder.plan(probe(1920, 1080))
+
+        assertEquals(listOf("360p", "720p", "1080p"), ladder.map { it.name })
+        assertEquals(listOf(640 to 360, 1280 to 720, 1920 to 1080), ladder.map { it.width to it.height })
+        assertEquals(listOf(800, 2800, 5000), ladder.map { it.videoBitrateKbps })
+
+        // Never upscaled
+        assertEquals(listOf("360p", "720p"), AbrLadder.plan(probe(1280, 720)).map { it.name })
+    }
+
+    @Test
+    fun plansPortraitFromTheDisplayedSize() {
+        val ladder = AbrLadder.plan(probe(1920, 1080, rotation = 90))
+
+        assertEquals(listOf(360 to 640, 720 to 1280, 1080 to 1920), ladder.map { it.width to it.height })
+    }
+
+    @Test
+    fun plansASmallSourceAtItsOwnSize() {
+        val ladder = AbrLadder.plan(probe(320, 240))
+
+        assertEquals(1, ladder.size)
+        assertEquals(320 to 240, ladder[0].width to ladder[0].height)
+        assertTrue(ladder[0].videoBitrateKbps < 800)
+    }
+
+    @Test
+    fun scalesBitratesByComplexityWithinBounds() {
+        val source = probe(1920, 1080)
+
+        assertEquals(listOf(400, 1400, 2500), AbrLadder.plan(source, complexity = 0.1).map { it.videoBitrateKbps })
+        assertEquals(listOf(1200, 4200, 7500), AbrLadder.plan(source, complexity = 10.0).map { it.videoBitrateKbps })
+    }
+
+    @Test
+    fun encodesEveryRenditionFromOneDecode() {
+        val renditions = AbrLadder.plan(probe(1280, 720))
+        val command = AbrLadder.buildCommand("in.mp4", probe(1280, 720), renditions)
+
+        assertEquals(1, command.count { it == "-i" })
+        assertTrue(command.contains("[0:v]split=2[s0][s1];[s0]scale=640:360[v0];[s1]scale=1280:720[v1]"))
+        assertEquals("800k", command[command.indexOf("-b:v:0") + 1])
+        assertEquals("2800k", command[command.indexOf("-b:v:1") + 1])
+        assertEquals("v:0,a:0,name:360p v:1,a:1,name:720p", command[command.indexOf("-var_stream_map") + 1])
+    }
+
+    @Test
+    fun namesRenditionsByPayloadKeyInTheUploadedMaster() {
+        val master = File(workDir, AbrLadder.MASTER_PLAYLIST)
+        master.writeText(
+                """
+                #EXTM3U
+                #EXT-X-STREAM-INF:BANDWIDTH=1240000,RESOLUTION=640x360
+                index_360p.m3u8
+                #EXT-X-STREAM-INF:BANDWIDTH=4360000,RESOLUTION=1280x720
+                index_720p.m3u8
+                """.trimIndent()
+        )
+        val renditions = AbrLadder.plan(probe(1280, 720))
+        val video =
+                AbrVideo(
+                        probe(1280, 720),
+                        workDir.absolutePath,
+                        master.absolutePath,
+                        renditions.map { EncodedRendition(it, File(workDir, "index_${it.name}.m3u8").absolutePath, "") }
+                )
+
+        val uploaded = AbrLadder.masterPlaylistFor(video) { "abr_${it.name}" }.lines()
+
+        assertEquals(listOf("abr_360p", "abr_720p"), HlsMasterPlaylist.variants(uploaded).map { it.uri })
+    }
+
+    // ========== Encoding ==========
+
+    @Test
+    fun measuresComplexityFromTheContent() = runBlocking {
+        assumeFFmpegAvailable()
+        val flat = TestClips.generate(workDir, "flat", seconds = 6, width = 1280, height = 720, pattern = "color=c=gray")
+        val noisy =
+                TestClips.generate(workDir, "noisy", seconds = 6, width = 1280, height = 720, filter = "noise=alls=40:allf=t+u")
+
+        val flatComplexity = AbrLadder.measureComplexity(flat.absolutePath, VideoPreparation.probe(flat.absolutePath)!!, workDir)
+        val noisyComplexity = AbrLadder.measureComplexity(noisy.absolutePath, VideoPreparation.probe(noisy.absolutePath)!!, workDir)
+
+        assertTrue(flatComplexity < 0.5, "Flat content is easy: $flatComplexity")
+        assertTrue(noisyComplexity > flatComplexity * 4, "Noise is hard: $noisyComplexity")
+    }
+
+    @Test
+    fun writesAValidMasterPlaylistAtTheLadderBitrates() = runBlocking {
+        assumeFFmpegAvailable()
+        // Noisy enough that every rendition uses the bitrate it is given
+        val clip =
+                TestClips.generate(workDir, "clip", seconds = 12, width = 1280, height = 720, filter = "noise=alls=40:allf=t+u")
+
+        val video = assertNotNull(AbrLadder.encode(clip.absolutePath))
+        outputs.add(File(video.outputDir))
+
+        val masterLines = File(video.masterPlaylistPath).readLines()
+        assertTrue(masterLines.first().startsWith("#EXTM3U"))
+        assertTrue(HlsMasterPlaylist.isMaster(masterLines))
+        val variants = HlsMasterPlaylist.variants(masterLines)
+        assertEquals(video.renditions.map { File(it.playlistPath).name }, variants.map { it.uri })
+        assertEquals(variants.sortedBy { it.bandwidth }, variants, "Lowest bandwidth first")
+        val uploaded = AbrLadder.masterPlaylistFor(video) { it.name }.lines()
+        assertEquals(video.renditions.map { it.rendition.name }, HlsMasterPlaylist.playlistUris(uploaded))
+
+        for ((variant, encoded) in variants.zip(video.renditions)) {
+            val rendition = encoded.rendition
+            assertEquals(rendition.width, variant.width)
+            assertEquals(rendition.height, variant.height)
+            assertTrue(variant.bandwidth >= rendition.videoBitrateKbps * 1000L, "${rendition.name} BANDWIDTH ${variant.bandwidth}")
+
+            // A single-file media playlist covering the whole clip
+            val media = File(video.outputDir, variant.uri).readLines()
+            assertTrue(media.first().startsWith("#EXTM3U"))
+            assertTrue(media.contains("#EXT-X-ENDLIST"))
+            assertTrue(media.any { it.startsWith("#EXT-X-BYTERANGE:") })
+            val duration = media.filter { it.startsWith("#EXTINF:") }.sumOf { it.substringAfter(':').substringBefore(',').toDouble() }
+            assertTrue(duration in 11.0..13.0, "${rendition.name} plays $duration s")
+
+            // The video stream alone, without the audio and transport stream overhead
+            val videoBytes =
+                    FFmpegUtils.runProcessWithOutput(
+                                    listOf(
+                                            FFmpegBinaryManager.ffprobePath(),
+                                            "-v",
+                                            "quiet",
+                                            "-select_streams",
+                                            "v:0",
+                                            "-show_entries",
+                                            "packet=size",
+                                            "-of",
+                                            "csv=p=0",
+                                            encoded.segmentPath
+                                    )
+                            )
+                            .lines()
+                            .sumOf { it.trim().toLongOrNull() ?: 0 }
+            val measuredKbps = videoBytes * 8 / 1000.0 / duration
+            assertTrue(
+                    measuredKbps in rendition.videoBitrateKbps * 0.6..rendition.maxRateKbps.toDouble(),
+                    "${rendition.name} at $measuredKbps kbps for a target of ${rendition.videoBitrateKbps}"
+            )
+        }
+    }
+}
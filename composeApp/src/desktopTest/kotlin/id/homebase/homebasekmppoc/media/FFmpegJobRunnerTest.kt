@@ -0,0 +1,184 @@
+package id.homebase.homebasekmppoc.media
+
+import id.homebase.homebasekmppoc.testing.assumeFFmpegAvailable
+import java.io.File
+import kotlin.io.path.createTempDirectory
+import kotlinx.coroutines.CompletableDeferred
+import kotlinx.coroutines.Dispatchers
+import kotlinx.coroutines.async
+import kotlinx.coroutines.awaitAll
+import kotlinx.coroutines.cancelAndJoin
+import kotlinx.coroutines.flow.toList
+import kotlinx.coroutines.launch
+import kotlinx.coroutines.runBlocking
+import kotlinx.coroutines.withTimeout
+import java.util.concurrent.atomic.AtomicInteger
+import kotlin.test.AfterTest
+import kotlin.test.Test
+import kotlin.test.assertEquals
+import kotlin.test.assertFailsWith
+import kotlin.test.assertFalse
+import kotlin.test.assertNotNull
+import kotlin.test.assertNull
+import kotlin.test.assertTrue
+
+class FFmpegJobRunnerTest {
+
+    private val workDir = createTempDirectory("ffmpeg-runner-test").toFile()
+
+    @AfterTest
+    fun cleanup() {
+        workDir.deleteRecursively()
+    }
+
+    // A synthetic encode of [seconds], slow enough at 1080p to cancel part way
+    private fun encode(seconds: Int, output: File) =
+            listOf(
+                    FFmpegBinaryManager.ffmpegPath(),
+                    "-y",
+                    "-f",
+                    "lavfi",
+                    "-i",
+                    "testsrc2=size=1920x1080:rate=30:duration=$seconds",
+                    "-c:v",
+                    "libx264",
+                    "-preset",
+                    "medium",
+                    "-threads",
+                    "2",
+                    output.absolutePath
+            )
+
+    private fun liveChildren() = ProcessHandle.current().descendants().filter { it.isAlive }.count()
+
+    // ========== Progress parsing ==========
+
+    @Test
+    fun parsesProgressBlocks() {
+        val parser = FFmpegProgressParser(durationMicros = 10_000_000)
+        val lines =
+                """
+                frame=0
+                fps=0.00
+                out_time_us=N/A
+                total_size=48
+                speed=N/A
+                progress=continue
+                frame=120
+                fps=59.9
+                out_time_us=4000000
+                total_size=1048576
+                speed=2.01x
+                progress=continue
+                frame=300
+                out_time_us=3990000
+                progress=end
+                """.trimIndent().lines()
+
+        val reports = lines.mapNotNull { parser.accept(it) }
+        assertEquals(3, reports.size)
+
+        assertEquals(0, reports[0].outTimeMicros)
+        assertNull(reports[0].speed)
+        assertEquals(0f, reports[0].fraction)
+
+        assertEquals(120, reports[1].frame)
+        assertEquals(2.01, reports[1].speed)
+        assertEquals(1_048_576, reports[1].totalSizeBytes)
+        assertEquals(0.4f, reports[1].fraction)
+
+        // An earlier time reported later does not move progress back
+        assertEquals(4_000_000, reports[2].outTimeMicros)
+        assertTrue(reports[2].isEnd)
+        assertEquals(1f, reports[2].fraction)
+    }
+
+    @Test
+    fun noFractionWithoutDuration() {
+        val parser = FFmpegProgressParser(durationMicros = null)
+        parser.accept("out_time_us=1000")
+        assertNull(parser.accept("progress=continue")!!.fraction)
+    }
+
+    // ========== Running ffmpeg ==========
+
+    @Test
+    fun progressIsMonotonic() = runBlocking {
+        assumeFFmpegAvailable()
+        val runner = FFmpegJobRunner()
+        val reports = runner.progress(encode(5, File(workDir, "out.mp4")), durationSeconds = 5.0).toList()
+
+        assertTrue(reports.size >= 2)
+        reports.zipWithNext().forEach { (a, b) ->
+            assertTrue(b.outTimeMicros >= a.outTimeMicros, "Progress went back: $a then $b")
+            assertTrue(b.frame >= a.frame)
+            assertTrue(b.fraction!! >= a.fraction!!)
+        }
+        assertTrue(reports.all { it.fraction!! in 0f..1f })
+        assertTrue(reports.last().isEnd)
+        assertEquals(150, reports.last().frame)
+    }
+
+    @Test
+    fun cancellingMidEncodeKillsTheProcess() = runBlocking {
+        assumeFFmpegAvailable()
+        val runner = FFmpegJobRunner()
+        val output = File(workDir, "long.mp4")
+        val started = CompletableDeferred<FFmpegProgress>()
+        val childrenBefore = liveChildren()
+
+        val job =
+                launch(Dispatchers.Default) {
+                    runner.run(encode(600, output), durationSeconds = 600.0) {
+                        if (it.outTimeMicros > 0) started.complete(it)
+                    }
+                }
+
+        val midway = withTimeout(30_000) { started.await() }
+        assertTrue(midway.fraction!! < 0.5f)
+        assertEquals(1, runner.activeJobs)
+
+        val start = System.nanoTime()
+        job.cancelAndJoin()
+        val millis = (System.nanoTime() - start) / 1_000_000
+
+        assertTrue(millis < 5_000, "Cancelling took $millis ms")
+        assertEquals(childrenBefore, liveChildren(), "ffmpeg outlived its job")
+        assertEquals(0, runner.activeJobs)
+    }
+
+    @Test
+    fun failureKeepsOnlyTheLogTail() = runBlocking {
+        assumeFFmpegAvailable()
+        val runner = FFmpegJobRunner(logTailLines = 5)
+        val command =
+                listOf(FFmpegBinaryManager.ffmpegPath(), "-v", "verbose", "-i", File(workDir, "missing.mp4").absolutePath, "out.mp4")
+
+        val result = runner.run(command)
+        assertFalse(result.isSuccess)
+        assertTrue(result.logTail.size in 1..5)
+        assertTrue(result.logTail.any { "missing.mp4" in it }, result.logTail.joinToString("\n"))
+
+        val error = assertFailsWith<FFmpegException> { runner.progress(command).toList() }
+        assertNotNull(error.message)
+    }
+
+    @Test
+    fun concurrentJobsStayWithinBudget() = runBlocking {
+        assumeFFmpegAvailable()
+        val runner = FFmpegJobRunner(cpuBudget = 4, threadsPerJob = 2)
+        assertEquals(2, runner.maxConcurrentJobs)
+        val peak = AtomicInteger()
+
+        (0 until 6).map { n ->
+            async(Dispatchers.Default) {
+                runner.run(encode(2, File(workDir, "job$n.mp4"))) {
+                    peak.accumulateAndGet(runner.activeJobs) { a, b -> maxOf(a, b) }
+                }
+            }
+        }.awaitAll().forEach { assertTrue(it.isSuccess) }
+
+        assertTrue(peak.get() in 1..2)
+        assertEquals(0, runner.activeJobs)
+    }
+}
@@ -0,0 +1,157 @@
+package id.homebase.homebasekmppoc.media
+
+import id.homebase.homebasekmppoc.prototype.lib.core.SecureByteArray
+import id.homebase.homebasekmppoc.prototype.lib.drives.upload.ChunkUploadTransport
+import id.homebase.homebasekmppoc.prototype.lib.drives.upload.ResumableUploader
+import id.homebase.homebasekmppoc.prototype.lib.drives.upload.UploadChunk
+import id.homebase.homebasekmppoc.testing.assumeFFmpegAvailable
+import io.ktor.client.HttpClient
+import io.ktor.client.request.post
+import io.ktor.client.request.put
+import io.ktor.client.request.setBody
+import io.ktor.client.statement.bodyAsText
+import io.ktor.http.HttpStatusCode
+import io.ktor.http.isSuccess
+import io.ktor.server.cio.CIO
+import io.ktor.server.engine.EmbeddedServer
+import io.ktor.server.engine.embeddedServer
+import io.ktor.server.request.receive
+import io.ktor.server.response.respond
+import io.ktor.server.response.respondText
+import io.ktor.server.routing.post
+import io.ktor.server.routing.put
+import io.ktor.server.routing.routing
+import java.io.File
+import java.util.concurrent.ConcurrentHashMap
+import java.util.concurrent.atomic.AtomicInteger
+import javax.crypto.Cipher
+import javax.crypto.spec.IvParameterSpec
+import javax.crypto.spec.SecretKeySpec
+import kotlin.io.path.createTempDirectory
+import kotlin.math.abs
+import kotlinx.coroutines.runBlocking
+import kotlin.test.AfterTest
+import kotlin.test.Test
+import kotlin.test.assertEquals
+import kotlin.test.assertNotNull
+import kotlin.test.assertTrue
+import org.junit.Assume.assumeTrue
+
+class HlsUploadPipelineTest {
+
+    private val workDir = createTempDirectory("hls-upload-test").toFile()
+
+    // The drive: chunks by upload id, in the order they arrive; the first try of chunk 1 of the
+    // second upload fails
+    private val uploads = ConcurrentHashMap<String, ConcurrentHashMap<Int, ByteArray>>()
+    private val completed = ConcurrentHashMap.newKeySet<String>()
+    private val beginCount = AtomicInteger()
+    private val failedOnce = AtomicInteger()
+
+    private val server: EmbeddedServer<*, *> =
+            embeddedServer(CIO, port = 0) {
+                routing {
+                    post("/uploads") {
+                        val id = "upload-${beginCount.incrementAndGet()}"
+                        uploads[id] = ConcurrentHashMap()
+                        call.respondText(id)
+                    }
+                    put("/uploads/{id}/chunks/{index}") {
+                        val id = call.parameters["id"]!!
+                        val index = call.parameters["index"]!!.toInt()
+                        val data = call.receive<ByteArray>()
+                        if (id == "upload-2" && index == 1 && failedOnce.compareAndSet(0, 1)) {
+                            call.respond(HttpStatusCode.ServiceUnavailable)
+                        } else {
+                            uploads.getValue(id)[index] = data
+                            call.respond(HttpStatusCode.OK)
+                        }
+                    }
+                    post("/uploads/{id}/complete") {
+                        completed.add(call.parameters["id"]!!)
+                        call.respond(HttpStatusCode.OK)
+                    }
+                }
+            }.start(wait = false)
+
+    private val client = HttpClient()
+
+    private val transport =
+            object : ChunkUploadTransport {
+                private suspend fun base() = "http://127.0.0.1:${server.engine.resolvedConnectors().first().port}"
+
+                override suspend fun begin(totalBytes: Long, chunkSize: Int): String =
+                        client.post("${base()}/uploads").bodyAsText()
+
+                override suspend fun putChunk(uploadId: String, chunk: UploadChunk, data: ByteArray) {
+                    val response = client.put("${base()}/uploads/$uploadId/chunks/${chunk.index}") { setBody(data) }
+                    check(response.status.isSuccess()) { "Chunk ${chunk.index} failed: ${response.status}" }
+                }
+
+                override suspend fun complete(uploadId: String) {
+                    client.post("${base()}/uploads/$uploadId/complete")
+                }
+            }
+
+    @AfterTest
+    fun cleanup() {
+        client.close()
+        server.stop(0, 0)
+        workDir.deleteRecursively()
+    }
+
+    private fun decrypt(cipherText: ByteArray, key: ByteArray, iv: ByteArray): ByteArray =
+            Cipher.getInstance("AES/CBC/PKCS5Padding")
+                    .apply { init(Cipher.DECRYPT_MODE, SecretKeySpec(key, "AES"), IvParameterSpec(iv)) }
+                    .doFinal(cipherText)
+
+    @Test
+    fun segmentsAreEncryptedAndUploadedWhileEncoding() = runBlocking {
+        assumeFFmpegAvailable()
+        // Rotated, so the segments are re-encoded and the encode takes long enough to overlap
+        val clip = TestClips.generate(workDir, "clip", seconds = 20, width = 1920, height = 1080, rotation = 90)
+        assumeTrue("This ffmpeg cannot tag rotation", VideoPreparation.probe(clip.absolutePath)!!.isRotatedSideways)
+
+        val keyBytes = ByteArray(16) { (it * 7 + 3).toByte() }
+        val runner = FFmpegJobRunner()
+        val pipeline = HlsUploadPipeline(ResumableUploader(transport, chunkSize = 64 * 1024), runner, segmentSeconds = 2)
+        val encoderRunningAtUpload = mutableListOf<Boolean>()
+
+        val result =
+                assertNotNull(
+                        pipeline.upload(clip.absolutePath, SecureByteArray(keyBytes.copyOf()), "https://keys/video") {
+                            encoderRunningAtUpload.add(runner.activeJobs > 0)
+                        }
+                )
+
+        val segments = result.segments
+        // Re-encoded with a keyframe a second: 2 second segments
+        assertTrue(segments.size >= 8)
+        assertTrue(encoderRunningAtUpload.any { it }, "No segment was uploaded while encoding")
+
+        // One upload per segment, each complete; the failed chunk was resent in the same upload
+        assertEquals(segments.size, beginCount.get())
+        assertEquals(1, failedOnce.get())
+        assertEquals(segments.map { it.uploadId }.toSet(), completed)
+        assertEquals(segments.size, segments.map { it.iv.toList() }.toSet().size, "IVs are per segment")
+
+        // Every segment decrypts with its IV, and together they play the whole clip
+        val decrypted = File(workDir, "decrypted.ts")
+        decrypted.outputStream().use { out ->
+            for (segment in segments) {
+                val chunks = uploads.getValue(segment.uploadId)
+                val cipherText = chunks.keys.sorted().fold(ByteArray(0)) { acc, i -> acc + chunks.getValue(i) }
+                assertEquals(segment.cipherBytes, cipherText.size.toLong())
+                val plain = decrypt(cipherText, keyBytes, segment.iv)
+                assertEquals(segment.plainBytes, plain.size.toLong())
+                out.write(plain)
+            }
+        }
+        val probe = assertNotNull(VideoPreparation.probe(decrypted.absolutePath))
+        assertTrue(abs(probe.durationSeconds - 20.0) < 1.0, "Decrypted segments play ${probe.durationSeconds} s")
+
+        val keyLines = result.playlist.lines().filter { it.startsWith("#EXT-X-KEY:METHOD=AES-128,URI=\"https://keys/video\",IV=0x") }
+        assertEquals(segments.size, keyLines.size)
+        assertTrue(result.playlist.trimEnd().endsWith("#EXT-X-ENDLIST"))
+    }
+}
@@ -0,0 +1,191 @@
+package id.homebase.homebasekmppoc.media
+
+import id.homebase.homebasekmppoc.testing.assumeFFmpegAvailable
+import java.io.File
+import kotlin.io.path.createTempDirectory
+import kotlinx.coroutines.runBlocking
+import kotlin.test.AfterTest
+import kotlin.test.Test
+import kotlin.test.assertEquals
+import kotlin.test.assertNotEquals
+import kotlin.test.assertNotNull
+import kotlin.test.assertNull
+import kotlin.test.assertTrue
+
+class MediaProbeCacheTest {
+
+    private val workDir = createTempDirectory("probe-cache-test").toFile()
+    private val cacheDir = File(workDir, "cache")
+
+    @AfterTest
+    fun cleanup() {
+        workDir.deleteRecursively()
+    }
+
+    private val probeJson =
+            """
+            {"streams":[
+              {"index":0,"codec_type":"video","codec_name":"h264","width":1920,"height":1080,"bit_rate":"4800000",
+               "side_data_list":[{"side_data_type":"Display Matrix","rotation":-90}]},
+              {"index":1,"codec_type":"audio","codec_name":"aac","sample_rate":"48000","channels":2,"bit_rate":"128000"}],
+             "format":{"format_name":"mov,mp4,m4a,3gp,3g2,mj2","duration":"12.500000","bit_rate":"4950000"}}
+            """
+
+    private var probes = 0
+
+    private fun cache(directory: File? = cacheDir) =
+            MediaProbeCache(directory) { _ ->
+                probes++
+                probeJson
+            }
+
+    private fun mediaFile(name: String = "video.mp4") = File(workDir, name).apply { writeBytes(ByteArray(1000)) }
+
+    @Test
+    fun parsesAFullProbe() {
+        val info = assertNotNull(MediaInfo.parse(probeJson))
+
+        assertEquals(12.5, info.durationSeconds)
+        assertEquals(4_950_000L, info.bitRate)
+        assertEquals(270, info.rotation)
+        assertEquals(2, info.streams.size)
+        assertEquals(MediaStreamInfo(0, "video", "h264", 1920, 1080, 4_800_000L), info.video)
+        assertEquals(48000, info.streams[1].sampleRate)
+        assertEquals(2, info.streams[1].channels)
+
+        val probe = assertNotNull(info.toVideoProbe())
+        assertEquals(1080, probe.displayWidth)
+        assertTrue(probe.hasAudio)
+    }
+
+    @Test
+    fun audioOnlyHasNoVideoProbe() {
+        val info = assertNotNull(MediaInfo.parse("""{"streams":[{"codec_type":"audio","codec_name":"aac"}],"format":{}}"""))
+        assertNull(info.toVideoProbe())
+        assertNull(MediaInfo.parse("""{"streams":[],"format":{}}"""))
+        assertNull(MediaInfo.parse("not json"))
+    }
+
+    @Test
+    fun probesAFileOnce() = runBlocking {
+        val file = mediaFile()
+        val cache = cache()
+
+        val first = cache.get(file.absolutePath)
+        val second = cache.get(file.absolutePath)
+
+        assertEquals(1, probes)
+        assertEquals(first, second)
+    }
+
+    @Test
+    fun survivesARestartOnDisk() = runBlocking {
+        val file = mediaFile()
+        cache().get(file.absolutePath)
+
+        // A new cache over the same directory, as after a restart
+        val restarted = cache()
+        assertNotNull(restarted.get(file.absolutePath))
+        assertEquals(1, probes)
+
+        // Without the disk tier it probes again
+        cache(directory = null).get(file.absolutePath)
+        assertEquals(2, probes)
+    }
+
+    @Test
+    fun probesAgainWhenTheFileChanges() = runBlocking {
+        val file = mediaFile()
+        val cache = cache()
+        cache.get(file.absolutePath)
+        val id = FFmpegUtils.getUniqueId(file.absolutePath)
+
+        // Rewritten in place at the same size: only the modification time tells
+        file.writeBytes(ByteArray(1000) { 1 })
+        file.setLastModified(file.lastModified() + 5_000)
+        assertNotEquals(id, FFmpegUtils.getUniqueId(file.absolutePath))
+        cache.get(file.absolutePath)
+        assertEquals(2, probes)
+
+        // Grown
+        file.appendBytes(ByteArray(10))
+        cache.get(file.absolutePath)
+        assertEquals(3, probes)
+
+        // Moved
+        val moved = File(workDir, "moved.mp4")
+        assertTrue(file.renameTo(moved))
+        cache.get(moved.absolutePath)
+        assertEquals(4, probes)
+
+        // And unchanged again
+        cache.get(moved.absolutePath)
+        assertEquals(4, probes)
+    }
+
+    @Test
+    fun ignoresACorruptDiskEntry() = runBlocking {
+        val file = mediaFile()
+        cache().get(file.absolutePath)
+        cacheDir.listFiles()!!.single().writeText("{ truncated")
+
+        assertNotNull(cache().get(file.absolutePath))
+        assertEquals(2, probes)
+    }
+
+    @Test
+    fun evictsTheLeastRecentlyUsedFromMemory() = runBlocking {
+        val cache = MediaProbeCache(directory = null, maxEntries = 2) { _ -> probes++; probeJson }
+        val a = mediaFile("a.mp4")
+        val b = mediaFile("b.mp4")
+        val c = mediaFile("c.mp4")
+
+        cache.get(a.absolutePath)
+        cache.get(b.absolutePath)
+        cache.get(a.absolutePath)
+        cache.get(c.absolutePath) // evicts b, used longest ago
+        assertEquals(3, probes)
+
+        cache.get(a.absolutePath)
+        assertEquals(3, probes)
+        cache.get(b.absolutePath)
+        assertEquals(4, probes)
+    }
+
+    @Test
+    fun missingFilesAreNotProbed() = runBlocking {
+        assertNull(cache().get(File(workDir, "missing.mp4").absolutePath))
+        assertEquals(0, probes)
+    }
+
+    @Test
+    fun probesARealVideo() = runBlocking {
+        assumeFFmpegAvailable()
+        val clip = TestClips.generate(workDir, "clip", seconds = 2, width = 320, height = 240)
+        val cache = MediaProbeCache(cacheDir)
+
+        val info = assertNotNull(cache.get(clip.absolutePath))
+        assertEquals(320, info.video?.width)
+        assertEquals("h264", info.video?.codecName)
+        assertTrue(info.hasAudio)
+        assertTrue((info.bitRate ?: 0) > 0)
+
+        // Served from memory: far quicker than a process
+        val start = System.nanoTime()
+        repeat(100) { cache.get(clip.absolutePath) }
+        val micros = (System.nanoTime() - start) / 1000 / 100
+        assertTrue(micros < 5_000, "Cached lookup took $micros µs")
+    }
+
+    @Test
+    fun failedThumbnailGrabLeavesNothingToReuse() = runBlocking {
+        assumeFFmpegAvailable()
+        val notAVideo = mediaFile("broken.mp4")
+        val uniqueId = FFmpegUtils.getUniqueId(notAVideo.absolutePath)
+
+        assertNull(FFmpegUtils.grabThumbnail(notAVideo.absolutePath))
+
+        val tmpDir = File(System.getProperty("java.io.tmpdir"))
+        assertEquals(emptyList(), tmpDir.listFiles { file -> file.name.startsWith("thumb_$uniqueId") }!!.toList())
+    }
+}
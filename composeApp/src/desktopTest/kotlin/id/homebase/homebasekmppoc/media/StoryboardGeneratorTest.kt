@@ -0,0 +1,127 @@
+package id.homebase.homebasekmppoc.media
+
+import id.homebase.homebasekmppoc.testing.assumeFFmpegAvailable
+import java.awt.image.BufferedImage
+import java.io.File
+import javax.imageio.ImageIO
+import kotlin.io.path.createTempDirectory
+import kotlin.math.abs
+import kotlinx.coroutines.runBlocking
+import kotlin.test.AfterTest
+import kotlin.test.Test
+import kotlin.test.assertEquals
+import kotlin.test.assertNotNull
+import kotlin.test.assertTrue
+
+class StoryboardGeneratorTest {
+
+    private val workDir = createTempDirectory("storyboard-test").toFile()
+    private val outputs = mutableListOf<File>()
+
+    @AfterTest
+    fun cleanup() {
+        workDir.deleteRecursively()
+        outputs.forEach { it.deleteRecursively() }
+    }
+
+    /** Mean brightness of the middle half of the [width] x [height] region at [x], [y]. */
+    private fun BufferedImage.meanLevel(x: Int = 0, y: Int = 0, width: Int = this.width, height: Int = this.height): Double {
+        var sum = 0L
+        var count = 0
+        for (py in y + height / 4 until y + height * 3 / 4) {
+            for (px in x + width / 4 until x + width * 3 / 4) {
+                val rgb = getRGB(px, py)
+                sum += ((rgb shr 16) and 0xff) + ((rgb shr 8) and 0xff) + (rgb and 0xff)
+                count += 3
+            }
+        }
+        return sum.toDouble() / count
+    }
+
+    private suspend fun frameAt(clip: File, seconds: Double, width: Int, height: Int): BufferedImage {
+        val out = File(workDir, "frame_$seconds.jpg")
+        val exitCode =
+                FFmpegUtils.runProcess(
+                        listOf(
+                                FFmpegBinaryManager.ffmpegPath(),
+                                "-y",
+                                "-i",
+                                clip.absolutePath,
+                                "-ss",
+                                seconds.toString(),
+                                "-frames:v",
+                                "1",
+                                "-vf",
+                                "scale=$width:$height",
+                                "-q:v",
+                                "5",
+                                out.absolutePath
+                        )
+                )
+        check(exitCode == 0) { "Could not extract the frame at $seconds s" }
+        return ImageIO.read(out)
+    }
+
+    @Test
+    fun framesAreTakenAtTheirInterval() = runBlocking {
+        assumeFFmpegAvailable()
+        // Brightness rises steadily with time, so a frame's brightness tells when it was taken
+        val clip =
+                TestClips.generate(
+                        workDir,
+                        "ramp",
+                        seconds = 10,
+                        width = 640,
+                        height = 360,
+                        pattern = "color=c=black",
+                        filter = "format=yuv420p,geq=lum='16+T*20':cb=128:cr=128"
+                )
+
+        val storyboard = assertNotNull(StoryboardGenerator.generate(clip.absolutePath, intervalSeconds = 1.0))
+        outputs.add(File(storyboard.outputDir))
+
+        val tiles = storyboard.index.tiles
+        assertEquals(10, tiles.size)
+        assertEquals(1, storyboard.sheetPaths.size)
+        val sheet = ImageIO.read(File(storyboard.sheetPaths[0]))
+        assertEquals(10 * 160, sheet.width)
+        assertEquals(10 * 90, sheet.height)
+
+        // Calibrated on frames seeked to independently, at either end of the clip
+        val start = frameAt(clip, 0.0, 160, 90).meanLevel()
+        val end = frameAt(clip, 9.0, 160, 90).meanLevel()
+        for ((k, tile) in tiles.withIndex()) {
+            val level = sheet.meanLevel(tile.x, tile.y, tile.width, tile.height)
+            val takenAt = (level - start) / (end - start) * 9.0
+            assertTrue(abs(takenAt - tile.startSeconds) < 0.1, "Tile $k was taken at $takenAt s")
+        }
+    }
+
+    @Test
+    fun longVideosSpreadOverSheets() = runBlocking {
+        assumeFFmpegAvailable()
+        val clip = TestClips.generate(workDir, "long", seconds = 30, width = 320, height = 180, rotation = 90)
+
+        // A frame every 0.25 s: 120 tiles, over two sheets
+        val storyboard = assertNotNull(StoryboardGenerator.generate(clip.absolutePath, intervalSeconds = 0.25, tileWidth = 40))
+        outputs.add(File(storyboard.outputDir))
+
+        val tiles = storyboard.index.tiles
+        assertTrue(tiles.size in 119..120, "${tiles.size} tiles")
+        assertEquals(2, storyboard.sheetPaths.size)
+        assertEquals(listOf("pst_sb00", "pst_sb01"), storyboard.index.sheets)
+
+        // Tiles keep the displayed shape of the rotated video
+        val tile = tiles.first()
+        assertEquals(40 to 72, tile.width to tile.height)
+        val sheet = ImageIO.read(File(storyboard.sheetPaths[1]))
+        assertEquals(400 to 720, sheet.width to sheet.height)
+
+        // Every time resolves to the tile covering it
+        for (seconds in listOf(0.0, 0.3, 12.5, 24.9, 25.0, 29.99)) {
+            val found = assertNotNull(storyboard.index.tileAt(seconds))
+            assertTrue(seconds >= found.startSeconds && (seconds < found.endSeconds || found == tiles.last()))
+        }
+        assertEquals("pst_sb01", storyboard.index.tileAt(26.0)!!.sheet)
+    }
+}
@@ -0,0 +1,106 @@
+package id.homebase.homebasekmppoc.media
+
+import id.homebase.homebasekmppoc.testing.assumeBenchmarksEnabled
+import id.homebase.homebasekmppoc.testing.assumeFFmpegAvailable
+import id.homebase.homebasekmppoc.testing.liveHeapAfterGc
+import java.io.File
+import java.security.MessageDigest
+import kotlin.io.path.createTempDirectory
+import kotlinx.coroutines.runBlocking
+import kotlinx.io.Buffer
+import kotlinx.io.RawSource
+import kotlinx.io.asSource
+import kotlin.test.AfterTest
+import kotlin.test.Test
+import kotlin.test.assertContentEquals
+import kotlin.test.assertEquals
+import kotlin.test.assertNotNull
+import kotlin.test.assertNull
+import kotlin.test.assertTrue
+import org.junit.Assume.assumeTrue
+
+class VideoIngestTest {
+
+    private val workDir = createTempDirectory("ingest-test").toFile()
+
+    @AfterTest
+    fun cleanup() {
+        workDir.deleteRecursively()
+    }
+
+    private fun sha256Hex(bytes: ByteArray) =
+            MessageDigest.getInstance("SHA-256").digest(bytes).joinToString("") { "%02x".format(it) }
+
+    /** [size] bytes of a repeating pattern, produced as they are read; calls [onEvery] each [interval]. */
+    private class SyntheticSource(
+            private val size: Long,
+            private val interval: Long = Long.MAX_VALUE,
+            private val onEvery: () -> Unit = {}
+    ) : RawSource {
+        private val block = ByteArray(64 * 1024) { (it * 31 + 7).toByte() }
+        private var position = 0L
+
+        override fun readAtMostTo(sink: Buffer, byteCount: Long): Long {
+            if (position == size) return -1
+            val n = minOf(byteCount, size - position, block.size.toLong()).toInt()
+            sink.write(block, 0, n)
+            if ((position + n) / interval != position / interval) onEvery()
+            position += n
+            return n.toLong()
+        }
+
+        override fun close() {}
+    }
+
+    @Test
+    fun spoolsAndHashesInOnePass() = runBlocking {
+        val data = ByteArray(1_000_003) { (it % 251).toByte() }
+        val target = File(workDir, "copy.bin")
+
+        val ingested = FFmpegUtils.ingest(data.inputStream().asSource(), target)
+
+        assertContentEquals(data, target.readBytes())
+        assertEquals(data.size.toLong(), ingested.sizeBytes)
+        assertEquals(sha256Hex(data), ingested.sha256)
+        // Not a video; ffprobe, if there is one, gives up without failing the copy
+        assertNull(ingested.probe)
+    }
+
+    @Test
+    fun probesFromTheSameStream() = runBlocking {
+        assumeFFmpegAvailable()
+        val clip = TestClips.generate(workDir, "clip", seconds = 3, width = 640, height = 360)
+        val target = File(workDir, "ingested.mp4")
+
+        val ingested = clip.inputStream().use { FFmpegUtils.ingest(it.asSource(), target) }
+
+        assertEquals(sha256Hex(clip.readBytes()), ingested.sha256)
+        assertEquals(clip.length(), target.length())
+        val probe = assertNotNull(ingested.probe)
+        assertEquals(640, probe.width)
+        assertEquals(360, probe.height)
+        assertTrue(probe.hasAudio)
+        assertTrue(probe.durationSeconds in 2.5..3.5, "Duration ${probe.durationSeconds}")
+    }
+
+    @Test
+    fun fourGigabytesInConstantHeap() = runBlocking {
+        assumeBenchmarksEnabled()
+        val devNull = File("/dev/null")
+        assumeTrue("No /dev/null", devNull.exists())
+        val size = 4L shl 30
+        val baselineHeap = liveHeapAfterGc()
+        var maxLiveGrowth = 0L
+        val source =
+                SyntheticSource(size, interval = 256L shl 20) {
+                    maxLiveGrowth = maxOf(maxLiveGrowth, liveHeapAfterGc() - baselineHeap)
+                }
+
+        // Written to /dev/null, so the test needs no disk; it goes through ffprobe like any video
+        val ingested = FFmpegUtils.ingest(source, devNull)
+
+        assertEquals(size, ingested.sizeBytes)
+        assertEquals(64, ingested.sha256.length)
+        assertTrue(maxLiveGrowth < 16L * 1024 * 1024, "Live heap grew by $maxLiveGrowth bytes")
+    }
+}
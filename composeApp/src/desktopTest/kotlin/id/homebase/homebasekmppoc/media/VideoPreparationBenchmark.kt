@@ -0,0 +1,93 @@
+package id.homebase.homebasekmppoc.media
+
+import id.homebase.homebasekmppoc.testing.assumeBenchmarksEnabled
+import id.homebase.homebasekmppoc.testing.assumeFFmpegAvailable
+import java.io.File
+import kotlin.io.path.createTempDirectory
+import kotlinx.coroutines.runBlocking
+import kotlin.test.AfterTest
+import kotlin.test.Test
+import kotlin.test.assertNotNull
+
+/**
+ * Compares VideoPreparation.prepare (probe once, decode once) with the sequence the upload path
+ * ran before: getRotationFromFile, grabThumbnail, compressVideo and segmentVideo.
+ *
+ * CPU time is that of the ffmpeg processes, read from /proc, so it is only reported on Linux.
+ *
+ * Slow, so it only runs with RUN_BENCHMARKS=1, e.g.
+ *   RUN_BENCHMARKS=1 ./gradlew :composeApp:desktopTest --tests '*VideoPreparationBenchmark*'
+ */
+class VideoPreparationBenchmark {
+
+    private val workDir = createTempDirectory("prepare-bench").toFile()
+    private val outputs = mutableListOf<File>()
+
+    @AfterTest
+    fun cleanup() {
+        workDir.deleteRecursively()
+        outputs.forEach { it.deleteRecursively() }
+    }
+
+    @Test
+    fun benchmarkUploadPreparation() = runBlocking {
+        assumeBenchmarksEnabled()
+        assumeFFmpegAvailable()
+
+        val clips =
+                listOf(
+                        "720p 20s" to TestClips.generate(workDir, "720p", 20, 1280, 720),
+                        "1080p 30s" to TestClips.generate(workDir, "1080p", 30, 1920, 1080),
+                        "1080p 30s rotated" to
+                                TestClips.generate(workDir, "1080p-rot", 30, 1920, 1080, rotation = 90)
+                )
+
+        for ((label, clip) in clips) {
+            val path = clip.absolutePath
+
+            val sequence = measure {
+                FFmpegUtils.getRotationFromFile(path)
+                val thumb = FFmpegUtils.grabThumbnail(path)
+                val compressed = FFmpegUtils.compressVideo(path)
+                val hls = assertNotNull(FFmpegUtils.segmentVideo(path))
+                listOfNotNull(thumb, compressed).forEach { File(it).delete() }
+                outputs.add(File(hls.first).parentFile)
+            }
+            val onePass = measure {
+                val prepared = assertNotNull(VideoPreparation.prepare(path))
+                outputs.add(File(prepared.outputDir))
+            }
+
+            println(
+                    "$label: sequence ${sequence.wallMillis} ms wall, ${sequence.cpu()} | " +
+                            "one pass ${onePass.wallMillis} ms wall, ${onePass.cpu()}"
+            )
+        }
+    }
+
+    private class Measurement(val wallMillis: Long, val cpuMillis: Long?) {
+        fun cpu() = cpuMillis?.let { "$it ms cpu" } ?: "cpu n/a"
+    }
+
+    private suspend fun measure(block: suspend () -> Unit): Measurement {
+        val cpuBefore = childCpuMillis()
+        val start = System.nanoTime()
+        block()
+        val wallMillis = (System.nanoTime() - start) / 1_000_000
+        val cpuAfter = childCpuMillis()
+        return Measurement(wallMillis, if (cpuBefore != null && cpuAfter != null) cpuAfter - cpuBefore else null)
+    }
+
+    /**
+     * User plus system time of this JVM's exited child processes: cutime and cstime, fields 16 and
+     * 17 of /proc/self/stat, in clock ticks of 10 ms.
+     */
+    private fun childCpuMillis(): Long? {
+        val stat = File("/proc/self/stat").takeIf { it.exists() }?.readText() ?: return null
+        // Fields after the command name, which is in parentheses and may contain spaces, start at 3
+        val fields = stat.substringAfterLast(')').trim().split(' ')
+        val cutime = fields.getOrNull(16 - 3)?.toLongOrNull() ?: return null
+        val cstime = fields.getOrNull(17 - 3)?.toLongOrNull() ?: return null
+        return (cutime + cstime) * 10
+    }
+}
@@ -0,0 +1,178 @@
+package id.homebase.homebasekmppoc.media
+
+import id.homebase.homebasekmppoc.testing.assumeFFmpegAvailable
+import java.io.File
+import kotlin.io.path.createTempDirectory
+import kotlin.math.abs
+import kotlinx.coroutines.runBlocking
+import kotlin.test.AfterTest
+import kotlin.test.Test
+import kotlin.test.assertEquals
+import kotlin.test.assertFalse
+import kotlin.test.assertNotNull
+import kotlin.test.assertNull
+import kotlin.test.assertTrue
+import org.junit.Assume.assumeTrue
+
+class VideoPreparationTest {
+
+    private val workDir = createTempDirectory("prepare-test").toFile()
+    private val outputs = mutableListOf<File>()
+
+    @AfterTest
+    fun cleanup() {
+        workDir.deleteRecursively()
+        outputs.forEach { it.deleteRecursively() }
+    }
+
+    // ========== Probe parsing ==========
+
+    @Test
+    fun parsesDisplayMatrixRotation() {
+        val probe =
+                VideoPreparation.parseProbe(
+                        """
+                        {"streams":[
+                          {"codec_type":"video","codec_name":"h264","width":1920,"height":1080,
+                           "side_data_list":[{"side_data_type":"Display Matrix","rotation":-90}]},
+                          {"codec_type":"audio","codec_name":"aac"}],
+                         "format":{"duration":"12.500000"}}
+                        """
+                )!!
+        assertEquals(270, probe.rotation)
+        assertEquals(1080, probe.displayWidth)
+        assertEquals(1920, probe.displayHeight)
+        assertEquals(12.5, probe.durationSeconds)
+        assertEquals("h264", probe.videoCodec)
+        assertTrue(probe.hasAudio)
+    }
+
+    @Test
+    fun parsesRotateTag_noAudio() {
+        val probe =
+                VideoPreparation.parseProbe(
+                        """{"streams":[{"codec_type":"video","width":640,"height":480,"duration":"3.0","tags":{"rotate":"180"}}]}"""
+                )!!
+        assertEquals(180, probe.rotation)
+        assertEquals(640, probe.displayWidth)
+        assertEquals(3.0, probe.durationSeconds)
+        assertFalse(probe.hasAudio)
+    }
+
+    @Test
+    fun noVideoStreamIsNotAVideo() {
+        assertNull(VideoPreparation.parseProbe("""{"streams":[{"codec_type":"audio"}]}"""))
+        assertNull(VideoPreparation.parseProbe("not json"))
+    }
+
+    // ========== One pass ==========
+
+    @Test
+    fun preparesAllOutputsInOnePass() = runBlocking {
+        assumeFFmpegAvailable()
+        val clip = TestClips.generate(workDir, "clip", seconds = 14, width = 1920, height = 1080)
+
+        val prepared = assertNotNull(VideoPreparation.prepare(clip.absolutePath))
+        outputs.add(File(prepared.outputDir))
+
+        assertEquals(0, prepared.probe.rotation)
+        assertTrue(prepared.probe.hasAudio)
+        assertTrue(File(prepared.compressedPath).length() > 0)
+        assertTrue(File(prepared.segmentPath).length() > 0)
+        assertNotNull(prepared.posterPath)
+        assertTrue(File(prepared.posterPath!!).length() > 0)
+
+        // 6 second segments, adding up to the source
+        val durations =
+                File(prepared.playlistPath).readLines()
+                        .filter { it.startsWith("#EXTINF:") }
+                        .map { it.removePrefix("#EXTINF:").substringBefore(',').toDouble() }
+        assertEquals(3, durations.size)
+        assertTrue(abs(durations.sum() - 14.0) < 0.5, "Segments add up to ${durations.sum()} s")
+
+        val compressed = assertNotNull(VideoPreparation.probe(prepared.compressedPath))
+        assertEquals(1280, compressed.width)
+        assertEquals(720, compressed.height)
+        assertTrue(compressed.hasAudio)
+    }
+
+    @Test
+    fun rotatedSourceIsRotatedInTheOutput() = runBlocking {
+        assumeFFmpegAvailable()
+        val clip = TestClips.generate(workDir, "rotated", seconds = 4, width = 1280, height = 720, rotation = 90)
+        val source = assertNotNull(VideoPreparation.probe(clip.absolutePath))
+        assumeTrue("This ffmpeg cannot tag rotation", source.rotation != 0)
+
+        val prepared = assertNotNull(VideoPreparation.prepare(clip.absolutePath))
+        outputs.add(File(prepared.outputDir))
+
+        val compressed = assertNotNull(VideoPreparation.probe(prepared.compressedPath))
+        assertEquals(0, compressed.rotation)
+        assertEquals(720, compressed.width)
+        assertEquals(1280, compressed.height)
+    }
+}
+
+/** Test clips generated with ffmpeg's lavfi sources: moving test pattern plus a tone. */
+internal object TestClips {
+
+    suspend fun generate(
+            dir: File,
+            name: String,
+            seconds: Int,
+            width: Int,
+            height: Int,
+            rotation: Int = 0,
+            /** A lavfi video source taking size, rate and duration, e.g. color=c=gray. */
+            pattern: String = "testsrc2",
+            /** Applied to the pattern, e.g. noise to make it hard to compress. */
+            filter: String? = null
+    ): File {
+        val plain = File(dir, "$name.mp4")
+        val exitCode =
+                FFmpegUtils.runProcess(
+                        listOf(
+                                FFmpegBinaryManager.ffmpegPath(),
+                                "-y",
+                                "-f",
+                                "lavfi",
+                                "-i",
+                                "$pattern${if ('=' in pattern) ':' else '='}size=${width}x$height:rate=30:duration=$seconds" +
+                                        (filter?.let { ",$it" } ?: ""),
+                                "-f",
+                                "lavfi",
+                                "-i",
+                                "sine=frequency=440:duration=$seconds",
+                                "-c:v",
+                                "libx264",
+                                "-preset",
+                                "ultrafast",
+                                "-pix_fmt",
+                                "yuv420p",
+                                "-c:a",
+                                "aac",
+                                "-shortest",
+                                plain.absolutePath
+                        )
+                )
+        check(exitCode == 0) { "Could not generate $name" }
+        if (rotation == 0) return plain
+
+        // Tag the display matrix without re-encoding, as a phone does
+        val rotated = File(dir, "$name-rotated.mp4")
+        FFmpegUtils.runProcess(
+                listOf(
+                        FFmpegBinaryManager.ffmpegPath(),
+                        "-y",
+                        "-display_rotation",
+                        "$rotation",
+                        "-i",
+                        plain.absolutePath,
+                        "-c",
+                        "copy",
+                        rotated.absolutePath
+                )
+        )
+        return if (rotated.exists()) rotated else plain
+    }
+}
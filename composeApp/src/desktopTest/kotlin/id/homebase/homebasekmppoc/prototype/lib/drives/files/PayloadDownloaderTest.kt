@@ -0,0 +1,237 @@
+package id.homebase.homebasekmppoc.prototype.lib.drives.files
+
+import id.homebase.homebasekmppoc.prototype.lib.core.SecureByteArray
+import id.homebase.homebasekmppoc.prototype.lib.crypto.AesCbc
+import id.homebase.homebasekmppoc.prototype.lib.video.FileRangeReader
+import id.homebase.homebasekmppoc.prototype.lib.video.LocalVideoServer
+import id.homebase.homebasekmppoc.prototype.lib.video.PlainRangeSource
+import id.homebase.homebasekmppoc.prototype.lib.video.RangeReader
+import id.homebase.homebasekmppoc.testing.assumeBenchmarksEnabled
+import id.homebase.homebasekmppoc.testing.liveHeapAfterGc
+import io.ktor.client.HttpClient
+import kotlinx.coroutines.CancellationException
+import kotlinx.coroutines.runBlocking
+import kotlinx.io.buffered
+import kotlinx.io.discardingSink
+import java.io.File
+import java.security.MessageDigest
+import javax.crypto.Cipher
+import javax.crypto.spec.IvParameterSpec
+import javax.crypto.spec.SecretKeySpec
+import kotlin.io.path.createTempDirectory
+import kotlin.random.Random
+import kotlin.test.AfterTest
+import kotlin.test.Test
+import kotlin.test.assertContentEquals
+import kotlin.test.assertEquals
+import kotlin.test.assertFailsWith
+import kotlin.test.assertFalse
+import kotlin.test.assertTrue
+
+class PayloadDownloaderTest {
+
+    private val root = createTempDirectory("payload-download-test").toFile()
+    private val server = LocalVideoServer()
+    private val client = HttpClient()
+
+    private val key = Random(1).nextBytes(16)
+    private val iv = Random(2).nextBytes(16)
+    private val decryption = PayloadDecryption(SecureByteArray(key), iv)
+
+    @AfterTest
+    fun cleanup() {
+        client.close()
+        server.stop()
+        root.deleteRecursively()
+    }
+
+    private fun sha256(bytes: ByteArray) =
+        MessageDigest.getInstance("SHA-256").digest(bytes).joinToString("") { "%02x".format(it) }
+
+    /** Serves the bytes of [file] as they are stored, as the drive does. */
+    private fun serve(id: String, file: File): String {
+        val reader = FileRangeReader(file.path)
+        server.registerContent(id, PlainRangeSource(reader.length, reader), "application/octet-stream")
+        return server.getContentUrl(id)
+    }
+
+    private suspend fun encryptedPayload(id: String, plain: ByteArray): String {
+        val file = File(root, "$id.enc").apply { writeBytes(AesCbc.encrypt(plain, key, iv)) }
+        return serve(id, file)
+    }
+
+    // ========== To a file, cancelled and resumed ==========
+
+    @Test
+    fun encryptedFile_cancelledThenResumed() = runBlocking {
+        server.start()
+        val plain = Random(3).nextBytes(3_000_007)
+        val url = encryptedPayload("enc", plain)
+        val target = File(root, "out.bin")
+        val part = File(root, "out.bin.part")
+        val downloader = PayloadDownloader(client, windowSize = 64 * 1024)
+
+        // Cancelled a third of the way in, as when the user backs out
+        assertFailsWith<CancellationException> {
+            downloader.downloadToFile(url, target.path, decryption = { decryption }) { received, _ ->
+                if (received > 1_000_000) throw CancellationException("Cancelled")
+            }
+        }
+        assertFalse(target.exists())
+        assertTrue(part.length() in 1..plain.size.toLong(), "${part.length()} bytes kept")
+        assertContentEquals(plain.copyOf(part.length().toInt()), part.readBytes())
+
+        // Off a block boundary, as after a crash mid-write
+        part.writeBytes(part.readBytes().copyOf(part.length().toInt() - 5))
+
+        val result = downloader.downloadToFile(
+            url,
+            target.path,
+            expectedStoredSize = plain.size / 16 * 16 + 16L,
+            expectedSha256 = sha256(plain),
+            decryption = { decryption }
+        )
+        assertFalse(part.exists())
+        assertContentEquals(plain, target.readBytes())
+        assertEquals(plain.size.toLong(), result.size)
+        assertEquals(sha256(plain), result.sha256)
+    }
+
+    @Test
+    fun encryptedFile_resumesFromEveryOffsetNearTheEnd() = runBlocking {
+        server.start()
+        for (length in listOf(1, 16, 33, 100)) {
+            val plain = Random(length).nextBytes(length)
+            val url = encryptedPayload("small-$length", plain)
+            for (resumeFrom in 0..length) {
+                val target = File(root, "small-$length-$resumeFrom.bin")
+                File(target.path + ".part").writeBytes(plain.copyOf(resumeFrom))
+
+                PayloadDownloader(client, windowSize = 16).downloadToFile(url, target.path, decryption = { decryption })
+                assertContentEquals(plain, target.readBytes(), "$length bytes from $resumeFrom")
+            }
+        }
+    }
+
+    @Test
+    fun plainFile_resumed() = runBlocking {
+        server.start()
+        val plain = Random(4).nextBytes(500_003)
+        val url = serve("plain", File(root, "plain.bin").apply { writeBytes(plain) })
+        val target = File(root, "plain-out.bin")
+        File(target.path + ".part").writeBytes(plain.copyOf(123_457))
+
+        val result = PayloadDownloader(client, windowSize = 4096).downloadToFile(url, target.path, decryption = { null })
+        assertContentEquals(plain, target.readBytes())
+        assertEquals(sha256(plain), result.sha256)
+    }
+
+    // ========== Integrity ==========
+
+    @Test
+    fun wrongKey_failsWithoutKeepingAnything() = runBlocking {
+        server.start()
+        val url = encryptedPayload("wrong-key", Random(5).nextBytes(100_000))
+        val target = File(root, "wrong.bin")
+        val wrongKey = PayloadDecryption(SecureByteArray(Random(6).nextBytes(16)), iv)
+
+        assertFailsWith<PayloadIntegrityException> {
+            PayloadDownloader(client).downloadToFile(url, target.path, decryption = { wrongKey })
+        }
+        assertFalse(target.exists())
+        assertFalse(File(target.path + ".part").exists())
+    }
+
+    @Test
+    fun unexpectedSizeOrHash_fails() = runBlocking {
+        server.start()
+        val plain = Random(7).nextBytes(10_000)
+        val url = encryptedPayload("checked", plain)
+        val target = File(root, "checked.bin")
+
+        assertFailsWith<PayloadIntegrityException> {
+            PayloadDownloader(client).downloadToFile(url, target.path, expectedStoredSize = 9_999, decryption = { decryption })
+        }
+        assertFailsWith<PayloadIntegrityException> {
+            PayloadDownloader(client).downloadToFile(url, target.path, expectedSha256 = sha256(ByteArray(1)), decryption = { decryption })
+        }
+        assertFalse(target.exists())
+        assertFalse(File(target.path + ".part").exists())
+    }
+
+    // ========== 2 GB with a fixed heap cap ==========
+
+    /**
+     * A 2 GB AES-CBC ciphertext made up on the fly: pseudo-random blocks and a final block that
+     * decrypts to a full block of padding, so the test needs neither the disk space nor the memory.
+     */
+    private inner class SyntheticCiphertext(val size: Long) : RangeReader {
+        private val finalBlock: ByteArray
+
+        init {
+            val ecb = Cipher.getInstance("AES/ECB/NoPadding").apply {
+                init(Cipher.ENCRYPT_MODE, SecretKeySpec(key, "AES"))
+            }
+            val previous = ByteArray(16) { raw(size - 32 + it) }
+            finalBlock = ecb.doFinal(ByteArray(16) { (previous[it].toInt() xor 16).toByte() })
+        }
+
+        private fun raw(position: Long) = ((position * -7046029254386353131L) ushr 56).toByte()
+
+        private fun byteAt(position: Long) =
+            if (position >= size - 16) finalBlock[(position - (size - 16)).toInt()] else raw(position)
+
+        override suspend fun read(offset: Long, length: Int) = ByteArray(length) { byteAt(offset + it) }
+
+        /** SHA-256 of the plaintext, from the JDK's own CBC rather than the code under test. */
+        suspend fun expectedSha256(): String {
+            val cipher = Cipher.getInstance("AES/CBC/PKCS5Padding").apply {
+                init(Cipher.DECRYPT_MODE, SecretKeySpec(key, "AES"), IvParameterSpec(iv))
+            }
+            val digest = MessageDigest.getInstance("SHA-256")
+            val chunk = 4 * 1024 * 1024
+            var position = 0L
+            while (position < size) {
+                val length = minOf(chunk.toLong(), size - position).toInt()
+                digest.update(cipher.update(read(position, length)))
+                position += length
+            }
+            digest.update(cipher.doFinal())
+            return digest.digest().joinToString("") { "%02x".format(it) }
+        }
+    }
+
+    @Test
+    fun twoGigabytes_streamedWithinHeapCap() = runBlocking {
+        assumeBenchmarksEnabled()
+        server.start()
+        val heapCap = 64L * 1024 * 1024
+        val cipherText = SyntheticCiphertext(2L shl 30)
+        server.registerContent(
+            "big",
+            PlainRangeSource(cipherText.size, cipherText, windowSize = 1024 * 1024),
+            "application/octet-stream"
+        )
+
+        val baselineHeap = liveHeapAfterGc()
+        var maxLiveGrowth = 0L
+        var nextCheck = 0L
+        val result = PayloadDownloader(client).download(
+            server.getContentUrl("big"),
+            discardingSink().buffered(),
+            expectedStoredSize = cipherText.size,
+            decryption = { decryption }
+        ) { received, _ ->
+            if (received >= nextCheck) {
+                maxLiveGrowth = maxOf(maxLiveGrowth, liveHeapAfterGc() - baselineHeap)
+                nextCheck += 256L * 1024 * 1024
+            }
+        }
+
+        println("2 GB synthetic: downloaded ${result.size / (1024 * 1024)} MB, max live heap growth ${maxLiveGrowth / 1024} KB")
+        // The final block is all padding
+        assertEquals(cipherText.size - 16, result.size)
+        assertEquals(cipherText.expectedSha256(), result.sha256)
+        assertTrue(maxLiveGrowth < heapCap, "Live heap grew by ${maxLiveGrowth / 1024} KB")
+    }
+}
@@ -0,0 +1,200 @@
+package id.homebase.homebasekmppoc.prototype.lib.video
+
+import id.homebase.homebasekmppoc.prototype.lib.core.SecureByteArray
+import io.ktor.client.HttpClient
+import io.ktor.client.request.get
+import io.ktor.client.request.header
+import io.ktor.client.statement.readRawBytes
+import io.ktor.http.HttpHeaders
+import io.ktor.http.HttpStatusCode
+import kotlinx.coroutines.Dispatchers
+import kotlinx.coroutines.async
+import kotlinx.coroutines.awaitAll
+import kotlinx.coroutines.runBlocking
+import java.util.concurrent.ConcurrentLinkedQueue
+import java.util.concurrent.atomic.AtomicInteger
+import java.util.concurrent.atomic.AtomicLong
+import kotlin.random.Random
+import kotlin.test.AfterTest
+import kotlin.test.Test
+import kotlin.test.assertEquals
+import kotlin.test.assertFalse
+import kotlin.test.assertNotNull
+import kotlin.test.assertNull
+import kotlin.test.assertTrue
+
+class ContentRegistryTest {
+
+    private val client = HttpClient()
+    private var server: LocalVideoServer? = null
+
+    @AfterTest
+    fun cleanup() {
+        client.close()
+        server?.stop()
+    }
+
+    // Never zero, and each byte one more than the last (1..255), so a wiped or shifted buffer shows
+    private fun content(seed: Int, size: Int) = SecureByteArray(ByteArray(size) { ((seed + it) % 255 + 1).toByte() })
+
+    private fun isIntact(bytes: ByteArray) =
+        bytes.indices.all { i -> bytes[i] != 0.toByte() && (i == 0 || (bytes[i - 1].toInt() and 0xFF) % 255 + 1 == (bytes[i].toInt() and 0xFF)) }
+
+    private fun isWiped(data: SecureByteArray) = data.unsafeBytes.all { it == 0.toByte() }
+
+    private fun entry(id: String, data: SecureByteArray) = ContentEntry(id, ByteArrayRangeSource(data), "video/mp4")
+
+    // ========== Budget and eviction ==========
+
+    @Test
+    fun evictsLeastRecentlyUsedOverBudget() {
+        val removed = mutableListOf<String>()
+        val registry = ContentRegistry(maxBytes = 250) { removed.add(it.id) }
+        val a = content(1, 100)
+        val b = content(2, 100)
+        registry.register(entry("a", a))
+        registry.register(entry("b", b))
+        registry.acquire("a")!!.close() // a is now the most recent
+
+        registry.register(entry("c", content(3, 100)))
+
+        assertEquals(listOf("b"), removed)
+        assertNull(registry.get("b"))
+        assertNotNull(registry.get("a"))
+        assertTrue(isWiped(b))
+        assertFalse(isWiped(a))
+        assertEquals(200, registry.residentBytes)
+        assertEquals(1, registry.evictionCount)
+    }
+
+    @Test
+    fun pausedVideoIsNotEvicted() {
+        val removed = mutableListOf<String>()
+        val registry = ContentRegistry(maxBytes = 250) { removed.add(it.id) }
+        // A video that was prepared and then paused: a manifest for its segments, and a source
+        // that reads ranges from the server, neither being streamed
+        val readerClosed = AtomicInteger()
+        val remote = object : RangeReader {
+            override suspend fun read(offset: Long, length: Int) = ByteArray(length)
+            override fun close() { readerClosed.incrementAndGet() }
+        }
+        val manifest = content(1, 50)
+        registry.register(ContentEntry("manifest", ByteArrayRangeSource(manifest), "application/vnd.apple.mpegurl", evictable = false))
+        registry.register(ContentEntry("remote", PlainRangeSource(1L shl 30, remote), "video/mp4"))
+
+        // Other content pushes the registry over budget
+        registry.register(entry("a", content(2, 100)))
+        registry.register(entry("b", content(3, 100)))
+        registry.register(entry("c", content(4, 100)))
+
+        assertEquals(listOf("a"), removed)
+        assertNotNull(registry.get("manifest"))
+        assertNotNull(registry.get("remote"))
+        assertFalse(isWiped(manifest))
+        assertEquals(0, readerClosed.get())
+        assertEquals(250, registry.residentBytes)
+
+        // Released once the video is no longer played
+        registry.unregister("manifest")
+        assertTrue(isWiped(manifest))
+    }
+
+    @Test
+    fun streamingEntryIsNotEvicted_wipedOnLastRelease() {
+        val registry = ContentRegistry(maxBytes = 150)
+        val a = content(1, 100)
+        registry.register(entry("a", a))
+        val first = registry.acquire("a")!!
+        val second = registry.acquire("a")!!
+
+        // Over budget, but a is being streamed: b is registered alongside
+        registry.register(entry("b", content(2, 100)))
+        assertNotNull(registry.get("a"))
+        assertEquals(200, registry.residentBytes)
+
+        registry.unregister("a")
+        assertNull(registry.acquire("a"))
+        first.close()
+        first.close() // Closing twice releases once
+        assertFalse(isWiped(a), "Still being streamed")
+        assertEquals(200, registry.residentBytes)
+
+        second.close()
+        assertTrue(isWiped(a))
+        assertEquals(100, registry.residentBytes)
+    }
+
+    @Test
+    fun replacingAnIdReleasesTheOldContent() {
+        val registry = ContentRegistry()
+        val old = content(1, 100)
+        registry.register(entry("a", old))
+        registry.register(entry("a", content(2, 50)))
+        assertTrue(isWiped(old))
+        assertEquals(50, registry.residentBytes)
+        assertEquals(1, registry.size)
+    }
+
+    // ========== Concurrency ==========
+
+    @Test
+    fun concurrentRegisterStreamAndEvict() = runBlocking {
+        val budget = 2L * 1024 * 1024
+        val maxContent = 300 * 1024
+        val workers = 8
+        val video = LocalVideoServer(maxContentBytes = budget).also { server = it }
+        video.start()
+        val registry = video.registry
+
+        val created = ConcurrentLinkedQueue<SecureByteArray>()
+        val seeds = AtomicInteger()
+        val served = AtomicLong()
+        val notFound = AtomicInteger()
+        val maxResident = AtomicLong()
+
+        (0 until workers).map { worker ->
+            async(Dispatchers.Default) {
+                val random = Random(worker)
+                repeat(300) {
+                    val id = "video-${random.nextInt(20)}"
+                    when (random.nextInt(10)) {
+                        in 0..2 -> {
+                            val data = content(seeds.incrementAndGet(), random.nextInt(1024, maxContent))
+                            created.add(data)
+                            video.registerContent(id, ByteArrayRangeSource(data), "video/mp4")
+                        }
+                        3 -> video.unregisterContent(id)
+                        else -> {
+                            val response = client.get(video.getContentUrl(id)) {
+                                if (random.nextBoolean()) header(HttpHeaders.Range, "bytes=${random.nextInt(1000)}-")
+                            }
+                            if (response.status == HttpStatusCode.NotFound) {
+                                notFound.incrementAndGet()
+                            } else {
+                                val body = response.readRawBytes()
+                                assertTrue(body.isNotEmpty() && isIntact(body), "$id was changed or wiped while it was being served")
+                                served.addAndGet(body.size.toLong())
+                            }
+                        }
+                    }
+                    maxResident.accumulateAndGet(registry.residentBytes) { a, b -> maxOf(a, b) }
+                }
+            }
+        }.awaitAll()
+
+        println(
+            "Served ${served.get() / 1024} KB (${notFound.get()} misses), ${registry.evictionCount} evictions, " +
+                "peak resident ${maxResident.get() / 1024} KB of a ${budget / 1024} KB budget"
+        )
+        // Over the budget only by what streams in progress pinned, plus the entry being registered
+        assertTrue(maxResident.get() <= budget + (workers + 1L) * maxContent)
+        assertTrue(registry.evictionCount > 0)
+        // With every stream finished, the next registration brings it back within budget
+        video.registerContent("last", ByteArrayRangeSource(content(0, 1024)), "video/mp4")
+        assertTrue(registry.residentBytes <= budget)
+
+        video.registry.clear()
+        assertEquals(0, registry.residentBytes)
+        assertTrue(created.all { isWiped(it) }, "Every buffer is wiped once it is no longer registered")
+    }
+}
@@ -0,0 +1,160 @@
+package id.homebase.homebasekmppoc.prototype.lib.video
+
+import io.ktor.client.HttpClient
+import io.ktor.client.request.get
+import io.ktor.client.statement.readRawBytes
+import io.ktor.http.ContentType
+import io.ktor.http.encodeURLParameter
+import io.ktor.server.cio.CIO
+import io.ktor.server.engine.EmbeddedServer
+import io.ktor.server.engine.embeddedServer
+import io.ktor.server.response.respondBytes
+import io.ktor.server.routing.get
+import io.ktor.server.routing.routing
+import kotlinx.coroutines.async
+import kotlinx.coroutines.delay
+import kotlinx.coroutines.runBlocking
+import java.util.concurrent.ConcurrentHashMap
+import java.util.concurrent.atomic.AtomicInteger
+import kotlin.test.AfterTest
+import kotlin.test.Test
+import kotlin.test.assertContentEquals
+import kotlin.test.assertEquals
+import kotlin.test.assertTrue
+
+class HlsSegmentPrefetcherTest {
+
+    private val segmentCount = 16
+    private val originLatencyMs = 300L
+    private val segmentDurationMs = 150L
+
+    private val originRequests = ConcurrentHashMap<Int, AtomicInteger>()
+    private val client = HttpClient()
+    private val servers = mutableListOf<LocalVideoServer>()
+
+    private fun segmentBytes(n: Int) = ByteArray(100_000) { (n * 31 + it).toByte() }
+
+    // The drive: every segment request takes originLatencyMs
+    private val origin: EmbeddedServer<*, *> = embeddedServer(CIO, port = 0) {
+        routing {
+            get("/segment/{n}") {
+                val n = call.parameters["n"]!!.toInt()
+                originRequests.getOrPut(n) { AtomicInteger() }.incrementAndGet()
+                delay(originLatencyMs)
+                call.respondBytes(segmentBytes(n), ContentType("video", "mp2t"))
+            }
+        }
+    }.start(wait = false)
+
+    @AfterTest
+    fun cleanup() {
+        servers.forEach { it.stop() }
+        client.close()
+        origin.stop(0, 0)
+    }
+
+    private suspend fun startServer(prefetchSegments: Int): Pair<LocalVideoServer, List<String>> {
+        val port = origin.engine.resolvedConnectors().first().port
+        val playlist = buildString {
+            appendLine("#EXTM3U")
+            appendLine("#EXT-X-TARGETDURATION:1")
+            repeat(segmentCount) {
+                appendLine("#EXTINF:1.0,")
+                appendLine("http://127.0.0.1:$port/segment/$it")
+            }
+            appendLine("#EXT-X-ENDLIST")
+        }
+
+        val server = LocalVideoServer(prefetchSegments).also { servers.add(it) }
+        val serverUrl = server.start()
+        server.registerContent("manifest.m3u8", playlist.encodeToByteArray(), "application/vnd.apple.mpegurl")
+        server.registerHlsPlaylist("manifest.m3u8", playlist)
+
+        val proxied = (0 until segmentCount).map {
+            "$serverUrl/proxy?url=${"http://127.0.0.1:$port/segment/$it".encodeURLParameter()}&manifestId=manifest.m3u8"
+        }
+        return server to proxied
+    }
+
+    private suspend fun get(url: String) = client.get(url).readRawBytes()
+
+    /**
+     * A player that asks for the next segment when it starts playing the current one, and stalls
+     * when that segment has not arrived by the time the current one has played out.
+     */
+    private suspend fun countRebuffers(segments: List<String>): Int = kotlinx.coroutines.coroutineScope {
+        assertContentEquals(segmentBytes(0), get(segments[0]))
+        var rebuffers = 0
+        for (i in 1 until segments.size) {
+            val next = async { get(segments[i]) }
+            delay(segmentDurationMs)
+            if (!next.isCompleted) rebuffers++
+            assertContentEquals(segmentBytes(i), next.await())
+        }
+        rebuffers
+    }
+
+    @Test
+    fun prefetchAvoidsRebuffering() = runBlocking {
+        val (_, direct) = startServer(prefetchSegments = 0)
+        val directRebuffers = countRebuffers(direct)
+
+        originRequests.clear()
+        val (server, prefetched) = startServer(prefetchSegments = 3)
+        val prefetchedRebuffers = countRebuffers(prefetched)
+
+        println(
+            "$segmentCount segments of $segmentDurationMs ms at $originLatencyMs ms latency: " +
+                "$directRebuffers rebuffers proxied directly, $prefetchedRebuffers with read-ahead"
+        )
+        assertTrue(directRebuffers >= segmentCount / 2, "Latency above segment length should stall the direct proxy")
+        assertTrue(prefetchedRebuffers <= 1, "Read-ahead still rebuffered $prefetchedRebuffers times")
+        // Every segment was fetched from the origin exactly once
+        assertEquals((0 until segmentCount).toSet(), originRequests.keys)
+        assertTrue(originRequests.values.all { it.get() == 1 })
+        assertEquals(segmentCount.toLong(), server.prefetcher!!.fetchCount)
+    }
+
+    @Test
+    fun seekBackIsServedFromCache_seekAheadCancelsPrefetches() = runBlocking {
+        val (server, segments) = startServer(prefetchSegments = 3)
+        val prefetcher = server.prefetcher!!
+
+        for (i in 0..5) assertContentEquals(segmentBytes(i), get(segments[i]))
+
+        // Back to 2: no new origin request
+        assertContentEquals(segmentBytes(2), get(segments[2]))
+        assertEquals(1, originRequests[2]!!.get())
+        assertTrue(prefetcher.hitCount >= 1)
+
+        // Ahead to 12 while 6..8 are still being read ahead
+        assertContentEquals(segmentBytes(5), get(segments[5]))
+        val cancelledBefore = prefetcher.cancelledCount
+        assertContentEquals(segmentBytes(12), get(segments[12]))
+        assertTrue(prefetcher.cancelledCount - cancelledBefore >= 1, "Seeking ahead should cancel stale prefetches")
+        assertTrue(prefetcher.cachedBytes <= prefetcher.maxCacheBytes)
+    }
+
+    @Test
+    fun cacheStaysWithinBudget() = runBlocking {
+        val fetched = ConcurrentHashMap<Int, AtomicInteger>()
+        val prefetcher = HlsSegmentPrefetcher(prefetchCount = 2, maxCacheBytes = 250_000) { url, _ ->
+            val n = url.substringAfterLast('/').toInt()
+            fetched.getOrPut(n) { AtomicInteger() }.incrementAndGet()
+            HlsSegment(segmentBytes(n), "video/mp2t")
+        }
+        val playlist = (0 until segmentCount).joinToString("\n") { "https://origin/segment/$it" }
+        prefetcher.register("m", playlist, emptyMap())
+
+        for (i in 0 until segmentCount) {
+            assertContentEquals(segmentBytes(i), prefetcher.segment("m", "https://origin/segment/$i"))
+            assertTrue(prefetcher.cachedBytes <= 250_000)
+        }
+
+        // Evicted long ago: fetched again
+        assertEquals(1, fetched[0]!!.get())
+        assertContentEquals(segmentBytes(0), prefetcher.segment("m", "https://origin/segment/0"))
+        assertEquals(2, fetched[0]!!.get())
+        prefetcher.close()
+    }
+}
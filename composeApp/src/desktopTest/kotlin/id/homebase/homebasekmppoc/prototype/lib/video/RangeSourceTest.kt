@@ -0,0 +1,294 @@
+package id.homebase.homebasekmppoc.prototype.lib.video
+
+import id.homebase.homebasekmppoc.prototype.lib.base.NotFoundException
+import id.homebase.homebasekmppoc.prototype.lib.core.SecureByteArray
+import id.homebase.homebasekmppoc.prototype.lib.crypto.AesCbc
+import id.homebase.homebasekmppoc.testing.assumeBenchmarksEnabled
+import id.homebase.homebasekmppoc.testing.liveHeapAfterGc
+import io.ktor.client.HttpClient
+import io.ktor.client.engine.mock.MockEngine
+import io.ktor.client.engine.mock.respond
+import io.ktor.client.request.header
+import io.ktor.client.request.prepareGet
+import io.ktor.client.statement.HttpResponse
+import io.ktor.client.statement.bodyAsChannel
+import io.ktor.client.statement.readRawBytes
+import io.ktor.http.HttpHeaders
+import io.ktor.http.HttpStatusCode
+import io.ktor.utils.io.readAvailable
+import kotlinx.coroutines.async
+import kotlinx.coroutines.awaitAll
+import kotlinx.coroutines.runBlocking
+import java.io.File
+import javax.crypto.Cipher
+import javax.crypto.spec.IvParameterSpec
+import javax.crypto.spec.SecretKeySpec
+import kotlin.io.path.createTempDirectory
+import kotlin.random.Random
+import kotlin.test.AfterTest
+import kotlin.test.Test
+import kotlin.test.assertContentEquals
+import kotlin.test.assertEquals
+import kotlin.test.assertFailsWith
+import kotlin.test.assertNull
+import kotlin.test.assertTrue
+
+class RangeSourceTest {
+
+    private val root = createTempDirectory("range-source-test").toFile()
+    private val server = LocalVideoServer()
+    private val client = HttpClient()
+
+    private val key = Random(1).nextBytes(16)
+    private val iv = Random(2).nextBytes(16)
+
+    @AfterTest
+    fun cleanup() {
+        client.close()
+        server.stop()
+        root.deleteRecursively()
+    }
+
+    private suspend fun fetch(id: String, range: String?, onResponse: suspend (HttpResponse) -> Unit) =
+        client.prepareGet(server.getContentUrl(id)) {
+            if (range != null) header(HttpHeaders.Range, range)
+        }.execute { onResponse(it) }
+
+    private suspend fun fetchBytes(id: String, range: String?): ByteArray {
+        var bytes = ByteArray(0)
+        fetch(id, range) { bytes = it.readRawBytes() }
+        return bytes
+    }
+
+    // ========== Range header ==========
+
+    @Test
+    fun parseByteRange_formsAndLimits() {
+        assertEquals(0L..99L, parseByteRange("bytes=0-99", 1000))
+        assertEquals(900L..999L, parseByteRange("bytes=900-", 1000))
+        assertEquals(900L..999L, parseByteRange("bytes=900-5000", 1000))
+        assertEquals(800L..999L, parseByteRange("bytes=-200", 1000))
+        assertEquals(0L..999L, parseByteRange("bytes=-5000", 1000))
+        assertTrue(parseByteRange("bytes=1000-", 1000)!!.isEmpty())
+        assertTrue(parseByteRange("bytes=50-10", 1000)!!.isEmpty())
+        assertNull(parseByteRange("bytes=0-1,5-9", 1000))
+        assertNull(parseByteRange("items=0-1", 1000))
+        assertNull(parseByteRange("bytes=abc-", 1000))
+    }
+
+    // ========== Encrypted file cache ==========
+
+    @Test
+    fun encryptedFile_anyRangeMatchesPlaintext() = runBlocking {
+        server.start()
+        val plain = Random(3).nextBytes(300_007)
+        val file = File(root, "cached.enc")
+        file.writeBytes(AesCbc.encrypt(plain, key, iv))
+
+        val source = CbcRangeSource.open(FileRangeReader(file.path), file.length(), SecureByteArray(key), iv, windowSize = 4096)
+        assertEquals(plain.size.toLong(), source.size)
+        server.registerContent("file", source, "video/mp4")
+
+        assertContentEquals(plain, fetchBytes("file", null))
+        val ranges = listOf(0L..0L, 0L..15L, 15L..16L, 4095L..4097L, 1000L..9999L, 299_990L..300_006L, 300_006L..300_006L)
+        for (range in ranges) {
+            assertContentEquals(
+                plain.copyOfRange(range.first.toInt(), range.last.toInt() + 1),
+                fetchBytes("file", "bytes=${range.first}-${range.last}"),
+                "bytes=$range"
+            )
+        }
+        assertContentEquals(plain.copyOfRange(plain.size - 100, plain.size), fetchBytes("file", "bytes=-100"))
+
+        fetch("file", "bytes=300007-") { response ->
+            assertEquals(HttpStatusCode.RequestedRangeNotSatisfiable, response.status)
+            assertEquals("bytes */300007", response.headers[HttpHeaders.ContentRange])
+        }
+        fetch("file", "bytes=10-20") { response ->
+            assertEquals(HttpStatusCode.PartialContent, response.status)
+            assertEquals("bytes 10-20/300007", response.headers[HttpHeaders.ContentRange])
+            assertEquals("11", response.headers[HttpHeaders.ContentLength])
+        }
+    }
+
+    @Test
+    fun encryptedFile_lastBlockAllPadding() = runBlocking {
+        server.start()
+        for (length in listOf(1, 15, 16, 17, 32)) {
+            val plain = Random(length).nextBytes(length)
+            val file = File(root, "small-$length.enc")
+            file.writeBytes(AesCbc.encrypt(plain, key, iv))
+            val source = CbcRangeSource.open(FileRangeReader(file.path), file.length(), SecureByteArray(key), iv)
+            server.registerContent("small-$length", source, "video/mp4")
+            assertEquals(length.toLong(), source.size)
+            assertContentEquals(plain, fetchBytes("small-$length", null))
+            assertContentEquals(plain.copyOfRange(length - 1, length), fetchBytes("small-$length", "bytes=-1"))
+        }
+    }
+
+    @Test
+    fun plainFile_rangesMatch() = runBlocking {
+        server.start()
+        val plain = Random(4).nextBytes(100_000)
+        val file = File(root, "plain.mp4").apply { writeBytes(plain) }
+        val reader = FileRangeReader(file.path)
+        server.registerContent("plain", PlainRangeSource(reader.length, reader, windowSize = 1000), "video/mp4")
+
+        assertContentEquals(plain.copyOfRange(999, 50_001), fetchBytes("plain", "bytes=999-50000"))
+        assertContentEquals(plain, fetchBytes("plain", null))
+    }
+
+    // ========== HttpRangeReader ==========
+
+    @Test
+    fun httpReader_readsRangesAndSize() = runBlocking {
+        server.start()
+        val plain = Random(5).nextBytes(10_000)
+        val file = File(root, "remote.mp4").apply { writeBytes(plain) }
+        val local = FileRangeReader(file.path)
+        server.registerContent("remote", PlainRangeSource(local.length, local), "video/mp4")
+
+        HttpRangeReader(HttpClient(), server.getContentUrl("remote")).use { reader ->
+            assertEquals(10_000L, reader.contentLength())
+            assertContentEquals(plain.copyOfRange(1234, 5678), reader.read(1234, 4444))
+        }
+    }
+
+    @Test
+    fun httpReader_rejectsAServerThatIgnoresTheRange() = runBlocking {
+        var requests = 0
+        val engine = MockEngine {
+            requests++
+            respond(ByteArray(1_000_000), HttpStatusCode.OK)
+        }
+
+        HttpRangeReader(HttpClient(engine), "https://example.com/payload").use { reader ->
+            assertFailsWith<IllegalStateException> { reader.read(0, 100) }
+            assertFailsWith<IllegalStateException> { reader.contentLength() }
+        }
+        assertEquals(2, requests)
+    }
+
+    @Test
+    fun httpReader_failureCarriesTheStatus() = runBlocking {
+        val engine = MockEngine { respond("", HttpStatusCode.NotFound) }
+
+        HttpRangeReader(HttpClient(engine), "https://example.com/payload").use { reader ->
+            assertFailsWith<NotFoundException> { reader.read(0, 100) }
+            assertFailsWith<NotFoundException> { reader.contentLength() }
+        }
+    }
+
+    // ========== 1 GB with a fixed heap cap ==========
+
+    /**
+     * A 1 GB AES-CBC ciphertext made up on the fly, so the test needs neither the disk space nor
+     * the memory for it: pseudo-random blocks and a final block that decrypts to a full block of
+     * padding. Expected plaintext comes from the JDK's own CBC, not from the code under test.
+     */
+    private inner class SyntheticCiphertext(val size: Long) : RangeReader {
+        private val finalBlock: ByteArray
+
+        init {
+            val ecb = Cipher.getInstance("AES/ECB/NoPadding").apply {
+                init(Cipher.ENCRYPT_MODE, SecretKeySpec(key, "AES"))
+            }
+            val previous = ByteArray(16) { raw(size - 32 + it) }
+            finalBlock = ecb.doFinal(ByteArray(16) { (previous[it].toInt() xor 16).toByte() })
+        }
+
+        private fun raw(position: Long) = ((position * -7046029254386353131L) ushr 56).toByte()
+
+        fun byteAt(position: Long) = if (position >= size - 16) finalBlock[(position - (size - 16)).toInt()] else raw(position)
+
+        override suspend fun read(offset: Long, length: Int) = ByteArray(length) { byteAt(offset + it) }
+
+        fun expectedCipher(start: Long): Cipher {
+            val blockStart = start / 16 * 16
+            val blockIv = if (blockStart == 0L) iv else ByteArray(16) { byteAt(blockStart - 16 + it) }
+            return Cipher.getInstance("AES/CBC/NoPadding").apply {
+                init(Cipher.DECRYPT_MODE, SecretKeySpec(key, "AES"), IvParameterSpec(blockIv))
+            }
+        }
+
+        fun expected(range: LongRange): ByteArray {
+            val blockStart = range.first / 16 * 16
+            val blockEnd = (range.last / 16 + 1) * 16
+            val cipherText = ByteArray((blockEnd - blockStart).toInt()) { byteAt(blockStart + it) }
+            val plain = expectedCipher(range.first).doFinal(cipherText)
+            val from = (range.first - blockStart).toInt()
+            return plain.copyOfRange(from, from + (range.last - range.first + 1).toInt())
+        }
+    }
+
+    @Test
+    fun oneGigabyte_randomSeeksWithinHeapCap() = runBlocking {
+        assumeBenchmarksEnabled()
+        server.start()
+        val heapCap = 64L * 1024 * 1024
+        val cipherText = SyntheticCiphertext(1L shl 30)
+        val source = CbcRangeSource.open(cipherText, cipherText.size, SecureByteArray(key), iv)
+        // The final block is all padding
+        assertEquals(cipherText.size - 16, source.size)
+        server.registerContent("big", source, "video/mp4")
+
+        val baselineHeap = liveHeapAfterGc()
+        var maxLiveGrowth = 0L
+        val random = Random(5)
+        var served = 0L
+
+        // What a player does while scrubbing: a few requests at a time, anywhere in the file
+        repeat(50) { round ->
+            val ranges = List(4) {
+                val start = random.nextLong(source.size)
+                start..minOf(source.size - 1, start + random.nextInt(1, 512 * 1024))
+            }
+            ranges.map { range ->
+                async {
+                    val body = fetchBytes("big", "bytes=${range.first}-${range.last}")
+                    assertContentEquals(cipherText.expected(range), body, "bytes=$range")
+                    body.size
+                }
+            }.awaitAll().forEach { served += it }
+            if (round % 10 == 0) maxLiveGrowth = maxOf(maxLiveGrowth, liveHeapAfterGc() - baselineHeap)
+        }
+
+        // A player that seeks near the end and keeps reading: 256 MB in one response, checked as
+        // it streams in. Starts on a block boundary so received bytes line up with the reference.
+        val tailStart = (source.size - 256L * 1024 * 1024) / 16 * 16
+        val expected = cipherText.expectedCipher(tailStart)
+        var position = tailStart
+        fetch("big", "bytes=$tailStart-") { response ->
+            assertEquals(HttpStatusCode.PartialContent, response.status)
+            val channel = response.bodyAsChannel()
+            val buffer = ByteArray(64 * 1024)
+            var pending = ByteArray(0)
+            var received = 0L
+            while (true) {
+                val n = channel.readAvailable(buffer)
+                if (n == -1) break
+                if (n == 0) continue
+                pending += buffer.copyOf(n)
+                val whole = pending.size / 16 * 16
+                if (whole > 0) {
+                    val cipherChunk = ByteArray(whole) { cipherText.byteAt(position + it) }
+                    val plainChunk = expected.update(cipherChunk)
+                    assertContentEquals(plainChunk, pending.copyOf(whole), "at $position")
+                    pending = pending.copyOfRange(whole, pending.size)
+                    position += whole
+                }
+                received += n
+                if (received % (64L * 1024 * 1024) < n) maxLiveGrowth = maxOf(maxLiveGrowth, liveHeapAfterGc() - baselineHeap)
+            }
+            assertEquals(source.size - tailStart, received)
+            served += received
+        }
+
+        println(
+            "1 GB synthetic: served ${served / (1024 * 1024)} MB across 201 requests, " +
+                "max live heap growth ${maxLiveGrowth / 1024} KB"
+        )
+        assertTrue(served > heapCap * 4, "The test should move much more than the cap")
+        assertTrue(maxLiveGrowth < heapCap, "Live heap grew by ${maxLiveGrowth / 1024} KB")
+    }
+}
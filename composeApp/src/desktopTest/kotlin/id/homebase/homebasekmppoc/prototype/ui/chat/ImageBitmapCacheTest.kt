@@ -0,0 +1,129 @@
+package id.homebase.homebasekmppoc.prototype.ui.chat
+
+import androidx.compose.ui.graphics.ImageBitmap
+import kotlinx.coroutines.CompletableDeferred
+import kotlinx.coroutines.async
+import kotlinx.coroutines.launch
+import kotlinx.coroutines.test.runTest
+import kotlinx.coroutines.yield
+import org.jetbrains.skia.EncodedImageFormat
+import org.jetbrains.skia.Surface
+import kotlin.test.Test
+import kotlin.test.assertEquals
+import kotlin.test.assertNotNull
+import kotlin.test.assertNull
+import kotlin.test.assertSame
+
+class ImageBitmapCacheTest {
+
+    // 16 x 16 x 4 bytes each
+    private fun bitmap() = ImageBitmap(16, 16)
+
+    private fun key(id: Int) = ImageBitmapKey("file-$id", PREVIEW_THUMBNAIL_KEY, 100, 100)
+
+    @Test
+    fun testEvictsLeastRecentlyUsedOverBudget() {
+        val cache = ImageBitmapCache(maxBytes = 3 * 1024L)
+        repeat(3) { cache.put(key(it), 0, bitmap()) }
+        assertEquals(3 * 1024L, cache.sizeBytes)
+
+        // Touch 0 so 1 is the oldest
+        assertNotNull(cache.get(key(0), 0))
+        cache.put(key(3), 0, bitmap())
+
+        assertNull(cache.get(key(1), 0))
+        assertNotNull(cache.get(key(0), 0))
+        assertNotNull(cache.get(key(2), 0))
+        assertNotNull(cache.get(key(3), 0))
+        assertEquals(3 * 1024L, cache.sizeBytes)
+    }
+
+    @Test
+    fun testTargetSizeAndFingerprintArePartOfTheIdentity() {
+        val cache = ImageBitmapCache()
+        cache.put(key(1), 7, bitmap())
+
+        assertNull(cache.get(key(1).copy(targetWidth = 200), 7))
+        assertNull(cache.get(ImageBitmapKey("file-1", "thumb-640"), 7))
+        // Same key, content changed since: a miss, and the stale bitmap is dropped
+        assertNull(cache.get(key(1), 8))
+        assertNull(cache.get(key(1), 7))
+        assertEquals(0L, cache.sizeBytes)
+    }
+
+    @Test
+    fun testBitmapOverBudgetIsNotCached() {
+        val cache = ImageBitmapCache(maxBytes = 2 * 1024L)
+        cache.put(key(1), 0, bitmap())
+        cache.put(key(2), 0, ImageBitmap(64, 64))
+
+        assertNull(cache.get(key(2), 0))
+        assertNotNull(cache.get(key(1), 0))
+    }
+
+    @Test
+    fun testMemoryPressureHooks() {
+        val cache = ImageBitmapCache()
+        repeat(4) { cache.put(key(it), 0, bitmap()) }
+
+        cache.trimToSize(2 * 1024L)
+        assertNull(cache.get(key(0), 0))
+        assertNotNull(cache.get(key(3), 0))
+
+        cache.clear()
+        assertEquals(0L, cache.sizeBytes)
+        assertNull(cache.get(key(3), 0))
+    }
+
+    @Test
+    fun testConcurrentRequestsShareOneDecode() = runTest {
+        val cache = ImageBitmapCache()
+        val release = CompletableDeferred<Unit>()
+        var decodes = 0
+        val decode: suspend () -> ImageBitmap? = {
+            decodes++
+            release.await()
+            bitmap()
+        }
+
+        val first = async { cache.getOrDecode(key(1), 0, decode) }
+        val second = async { cache.getOrDecode(key(1), 0, decode) }
+        yield()
+        release.complete(Unit)
+
+        assertSame(first.await(), second.await())
+        assertEquals(1, decodes)
+        assertSame(first.await(), cache.getOrDecode(key(1), 0, decode))
+        assertEquals(1, decodes)
+    }
+
+    @Test
+    fun testWaiterTakesOverWhenTheDecodingCallerIsCancelled() = runTest {
+        val cache = ImageBitmapCache()
+        var decodes = 0
+
+        val scrolledAway = launch { cache.getOrDecode(key(1), 0) { decodes++; CompletableDeferred<Unit>().await(); null } }
+        yield()
+        val stillVisible = async { cache.getOrDecode(key(1), 0) { decodes++; bitmap() } }
+        yield()
+        scrolledAway.cancel()
+
+        assertNotNull(stillVisible.await())
+        assertEquals(2, decodes)
+    }
+
+    @Test
+    fun testDecodeCoversTargetWithoutUpscaling() {
+        val surface = Surface.makeRasterN32Premul(400, 200)
+        val encoded = surface.makeImageSnapshot().encodeToData(EncodedImageFormat.PNG)!!.bytes
+        surface.close()
+
+        // Cropped into a 100 x 100 box, the short side decides
+        val cropped = decodeImageBitmap(encoded, 100, 100)!!
+        assertEquals(200 to 100, cropped.width to cropped.height)
+
+        val small = decodeImageBitmap(encoded, 800, 800)!!
+        assertEquals(400 to 200, small.width to small.height)
+        assertNull(coverSize(400, 200, 0, 100))
+    }
+}
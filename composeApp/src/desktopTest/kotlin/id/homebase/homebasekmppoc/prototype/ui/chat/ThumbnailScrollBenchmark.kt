@@ -0,0 +1,132 @@
+package id.homebase.homebasekmppoc.prototype.ui.chat
+
+import id.homebase.homebasekmppoc.testing.assumeBenchmarksEnabled
+import kotlinx.coroutines.Dispatchers
+import kotlinx.coroutines.Job
+import kotlinx.coroutines.joinAll
+import kotlinx.coroutines.launch
+import kotlinx.coroutines.runBlocking
+import org.jetbrains.skia.Color
+import org.jetbrains.skia.EncodedImageFormat
+import org.jetbrains.skia.Paint
+import org.jetbrains.skia.Rect
+import org.jetbrains.skia.Surface
+import java.util.concurrent.atomic.AtomicInteger
+import kotlin.io.encoding.Base64
+import kotlin.test.Test
+import kotlin.test.assertTrue
+
+/**
+ * Scrolls a simulated ConversationList up and down and times the work each frame does on the
+ * UI thread, as ThumbnailImage did it before the cache (base64 and decode in composition for
+ * every item that comes into view) and after (a cache lookup, with misses decoded on
+ * Dispatchers.Default).
+ *
+ * A LazyColumn forgets the remembered state of items that leave the viewport, which is what the
+ * window below models.
+ *
+ * Only runs with RUN_BENCHMARKS=1, e.g.
+ *   RUN_BENCHMARKS=1 ./gradlew :composeApp:desktopTest --tests '*ThumbnailScrollBenchmark*'
+ */
+class ThumbnailScrollBenchmark {
+
+    // 150 items at 200 x 200 fit the default 32 MB budget
+    private val itemCount = 150
+    private val visibleItems = 9
+    private val passes = 3
+
+    // 100.dp at 2x density
+    private val target = 200
+
+    private fun preview(seed: Int): String {
+        val surface = Surface.makeRasterN32Premul(320, 320)
+        val paint = Paint()
+        for (i in 0 until 16) {
+            paint.color = Color.makeRGB((seed * 31 + i * 16) % 256, (seed * 7) % 256, i * 16)
+            surface.canvas.drawRect(Rect.makeXYWH(i * 20f, 0f, 20f, 320f), paint)
+        }
+        val image = surface.makeImageSnapshot()
+        val bytes = image.encodeToData(EncodedImageFormat.JPEG, 70)!!.bytes
+        image.close()
+        surface.close()
+        return Base64.encode(bytes)
+    }
+
+    /** Item indices entering the viewport on each frame: down to the end and back, [passes] times */
+    private fun frames(): List<List<Int>> = buildList {
+        add((0 until visibleItems).toList())
+        repeat(passes) {
+            for (top in 1..itemCount - visibleItems) add(listOf(top + visibleItems - 1))
+            for (top in itemCount - visibleItems - 1 downTo 0) add(listOf(top))
+        }
+    }
+
+    private class Result(val frameNanos: LongArray, val decodes: Int) {
+        fun percentile(p: Double) = frameNanos.sorted()[((frameNanos.size - 1) * p).toInt()] / 1_000_000.0
+    }
+
+    private fun uncached(contents: List<String>): Result {
+        var decodes = 0
+        val frameNanos = frames().map { entering ->
+            val start = System.nanoTime()
+            for (i in entering) {
+                decodeImageBitmap(Base64.decode(contents[i]), target, target)
+                decodes++
+            }
+            System.nanoTime() - start
+        }
+        return Result(frameNanos.toLongArray(), decodes)
+    }
+
+    private fun cached(contents: List<String>): Result = runBlocking {
+        val cache = ImageBitmapCache()
+        val decodes = AtomicInteger()
+        val background = mutableListOf<Job>()
+        val frameNanos = frames().map { entering ->
+            val start = System.nanoTime()
+            for (i in entering) {
+                val key = ImageBitmapKey("file-$i", PREVIEW_THUMBNAIL_KEY, target, target)
+                val fingerprint = contents[i].hashCode()
+                if (cache.get(key, fingerprint) != null) continue
+                // Placeholder this frame; the bitmap arrives on a later one
+                background += launch(Dispatchers.Default) {
+                    cache.getOrDecode(key, fingerprint) {
+                        decodes.incrementAndGet()
+                        decodeImageBitmap(Base64.decode(contents[i]), target, target)
+                    }
+                }
+            }
+            val elapsed = System.nanoTime() - start
+            // Roughly a 120 Hz frame budget between frames
+            Thread.sleep(8)
+            elapsed
+        }
+        background.joinAll()
+        Result(frameNanos.toLongArray(), decodes.get())
+    }
+
+    @Test
+    fun benchmarkScrollFrameTimes() {
+        assumeBenchmarksEnabled()
+
+        val contents = (0 until itemCount).map { preview(it) }
+        uncached(contents.take(20)) // Warm up the codecs
+
+        val before = uncached(contents)
+        val after = cached(contents)
+
+        for ((name, result) in listOf("uncached" to before, "cached" to after)) {
+            println(
+                "$name: ${result.frameNanos.size} frames, ${result.decodes} decodes, UI thread per frame " +
+                    "p50 %.3f ms, p95 %.3f ms, max %.3f ms".format(
+                        result.percentile(0.5), result.percentile(0.95), result.percentile(1.0)
+                    )
+            )
+        }
+
+        // Every item decodes once, however many times it scrolls past
+        assertTrue(after.decodes == itemCount, "${after.decodes} decodes")
+        assertTrue(before.decodes > after.decodes * passes)
+        assertTrue(after.percentile(0.95) < before.percentile(0.95))
+    }
+}
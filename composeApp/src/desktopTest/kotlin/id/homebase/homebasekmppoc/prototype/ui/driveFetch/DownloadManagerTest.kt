@@ -0,0 +1,303 @@
+package id.homebase.homebasekmppoc.prototype.ui.driveFetch
+
+import app.cash.sqldelight.driver.jdbc.sqlite.JdbcSqliteDriver
+import id.homebase.homebasekmppoc.lib.database.Download
+import id.homebase.homebasekmppoc.prototype.lib.core.SecureByteArray
+import id.homebase.homebasekmppoc.prototype.lib.crypto.AesCbc
+import id.homebase.homebasekmppoc.prototype.lib.database.DatabaseManager
+import id.homebase.homebasekmppoc.prototype.lib.database.createInMemoryDatabase
+import id.homebase.homebasekmppoc.prototype.lib.drives.files.PayloadDecryption
+import id.homebase.homebasekmppoc.prototype.lib.drives.files.PayloadDownloadResult
+import id.homebase.homebasekmppoc.prototype.lib.drives.files.PayloadDownloader
+import id.homebase.homebasekmppoc.prototype.lib.drives.files.PayloadIntegrityException
+import id.homebase.homebasekmppoc.prototype.lib.eventbus.BackendEvent
+import id.homebase.homebasekmppoc.prototype.lib.eventbus.EventBus
+import id.homebase.homebasekmppoc.prototype.lib.video.FileRangeReader
+import id.homebase.homebasekmppoc.prototype.lib.video.LocalVideoServer
+import id.homebase.homebasekmppoc.prototype.lib.video.PlainRangeSource
+import io.ktor.client.HttpClient
+import kotlinx.coroutines.CoroutineScope
+import kotlinx.coroutines.CoroutineStart
+import kotlinx.coroutines.Dispatchers
+import kotlinx.coroutines.SupervisorJob
+import kotlinx.coroutines.async
+import kotlinx.coroutines.awaitCancellation
+import kotlinx.coroutines.cancelAndJoin
+import kotlinx.coroutines.channels.Channel
+import kotlinx.coroutines.delay
+import kotlinx.coroutines.flow.filter
+import kotlinx.coroutines.flow.filterIsInstance
+import kotlinx.coroutines.flow.take
+import kotlinx.coroutines.flow.toList
+import kotlinx.coroutines.job
+import kotlinx.coroutines.runBlocking
+import kotlinx.coroutines.withTimeout
+import kotlinx.io.IOException
+import java.io.File
+import java.security.MessageDigest
+import java.util.Collections
+import java.util.concurrent.ConcurrentHashMap
+import java.util.concurrent.atomic.AtomicInteger
+import kotlin.io.path.createTempDirectory
+import kotlin.random.Random
+import kotlin.test.AfterTest
+import kotlin.test.Test
+import kotlin.test.assertContentEquals
+import kotlin.test.assertEquals
+import kotlin.test.assertFalse
+import kotlin.test.assertIs
+import kotlin.test.assertNotNull
+import kotlin.test.assertTrue
+import kotlin.uuid.Uuid
+
+class DownloadManagerTest {
+
+    private val root = createTempDirectory("download-manager-test").toFile()
+    private val server = LocalVideoServer()
+    private val client = HttpClient()
+
+    private val key = Random(1).nextBytes(16)
+    private val iv = Random(2).nextBytes(16)
+    private val driveId = Uuid.random()
+
+    @AfterTest
+    fun cleanup() {
+        client.close()
+        server.stop()
+        root.deleteRecursively()
+    }
+
+    private fun sha256(bytes: ByteArray) =
+        MessageDigest.getInstance("SHA-256").digest(bytes).joinToString("") { "%02x".format(it) }
+
+    /** Serves [plain] encrypted as the drive stores it, under its payload key. */
+    private suspend fun servePayload(payloadKey: String, plain: ByteArray) {
+        val file = File(root, "$payloadKey.enc").apply { writeBytes(AesCbc.encrypt(plain, key, iv)) }
+        val reader = FileRangeReader(file.path)
+        server.registerContent(payloadKey, PlainRangeSource(reader.length, reader), "application/octet-stream")
+    }
+
+    /** Fetches from the local server what the drive would serve, stalling after [stallAfter] bytes if set. */
+    private inner class ServerFetcher(private val stallAfter: Long? = null) : DownloadFetcher {
+        val stalled = Channel<String>(Channel.UNLIMITED)
+        val resumedFrom = ConcurrentHashMap<String, Long>()
+        val attempts = ConcurrentHashMap<String, AtomicInteger>()
+
+        override suspend fun fetch(
+            download: Download,
+            onProgress: suspend (bytesReceived: Long, totalBytes: Long?) -> Unit
+        ): PayloadDownloadResult {
+            attempts.getOrPut(download.payloadKey) { AtomicInteger() }.incrementAndGet()
+            resumedFrom[download.payloadKey] = File(download.targetPath + ".part").length()
+            return PayloadDownloader(client, windowSize = 64 * 1024).downloadToFile(
+                server.getContentUrl(download.payloadKey),
+                download.targetPath,
+                expectedSha256 = download.expectedSha256,
+                decryption = { PayloadDecryption(SecureByteArray(key), iv) }
+            ) { received, total ->
+                onProgress(received, total)
+                if (stallAfter != null && received >= stallAfter) {
+                    stalled.send(download.payloadKey)
+                    awaitCancellation()
+                }
+            }
+        }
+    }
+
+    /** Writes the payload key as the file after [delayMs], recording order and concurrency. */
+    private class RecordingFetcher(private val delayMs: Long = 50) : DownloadFetcher {
+        val order: MutableList<String> = Collections.synchronizedList(mutableListOf())
+        val failures = ConcurrentHashMap<String, MutableList<Exception>>()
+        val attempts = ConcurrentHashMap<String, AtomicInteger>()
+        private val active = AtomicInteger()
+        private val activePerHost = ConcurrentHashMap<String, AtomicInteger>()
+        val maxActive = AtomicInteger()
+        val maxActivePerHost = ConcurrentHashMap<String, Int>()
+
+        override suspend fun fetch(
+            download: Download,
+            onProgress: suspend (bytesReceived: Long, totalBytes: Long?) -> Unit
+        ): PayloadDownloadResult {
+            attempts.getOrPut(download.payloadKey) { AtomicInteger() }.incrementAndGet()
+            val onHost = activePerHost.getOrPut(download.host) { AtomicInteger() }.incrementAndGet()
+            maxActivePerHost.merge(download.host, onHost) { a, b -> maxOf(a, b) }
+            maxActive.accumulateAndGet(active.incrementAndGet()) { a, b -> maxOf(a, b) }
+            try {
+                delay(delayMs)
+                failures[download.payloadKey]?.removeFirstOrNull()?.let { throw it }
+                File(download.targetPath).writeText(download.payloadKey)
+                order.add(download.payloadKey)
+                return PayloadDownloadResult(download.payloadKey.length.toLong(), "", "text/plain")
+            } finally {
+                active.decrementAndGet()
+                activePerHost.getValue(download.host).decrementAndGet()
+            }
+        }
+    }
+
+    // Completed and failed events, the ones each download ends with
+    private fun CoroutineScope.awaitFinished(eventBus: EventBus, count: Int) =
+        async(start = CoroutineStart.UNDISPATCHED) {
+            withTimeout(30_000) {
+                eventBus.events.filterIsInstance<BackendEvent.DownloadEvent>()
+                    .filter { it is BackendEvent.DownloadEvent.ItemCompleted || it is BackendEvent.DownloadEvent.ItemFailed }
+                    .take(count)
+                    .toList()
+            }
+        }
+
+    // ========== Killed and restarted ==========
+
+    @Test
+    fun killedMidDownload_resumesByteExactAfterRestart() = runBlocking {
+        server.start()
+        val dbFile = File(root, "downloads.db")
+        fun openDatabase() = DatabaseManager { JdbcSqliteDriver("jdbc:sqlite:${dbFile.path}") }
+
+        val payloads = mapOf(
+            "pst_one" to Random(3).nextBytes(3_000_007),
+            "pst_two" to Random(4).nextBytes(2_500_000)
+        )
+        payloads.forEach { (payloadKey, plain) -> servePayload(payloadKey, plain) }
+        val targets = payloads.keys.associateWith { File(root, "$it.bin") }
+
+        // First run, killed while both downloads are a third of the way in
+        val db1 = openDatabase()
+        val scope1 = CoroutineScope(SupervisorJob() + Dispatchers.IO)
+        val stalling = ServerFetcher(stallAfter = 1_000_000)
+        val manager1 = DownloadManager(db1, stalling, EventBus(), scope1, checkpointBytes = 256 * 1024)
+        payloads.forEach { (payloadKey, plain) ->
+            assertTrue(manager1.enqueue(driveId, Uuid.random(), payloadKey, "frodo.dotyou.cloud",
+                targets.getValue(payloadKey).path, expectedSha256 = sha256(plain)))
+        }
+        manager1.start()
+        withTimeout(30_000) { repeat(payloads.size) { stalling.stalled.receive() } }
+        scope1.coroutineContext.job.cancelAndJoin()
+        db1.close()
+
+        targets.values.forEach { target ->
+            assertFalse(target.exists())
+            assertTrue(File(target.path + ".part").length() > 0, "Part file of ${target.name} kept")
+        }
+
+        // Second run on the same database finds them still checked out, requeues and resumes them
+        val db2 = openDatabase()
+        db2.downloads.selectAll().forEach {
+            assertNotNull(it.checkOutStamp)
+            assertTrue(it.bytesReceived >= 256 * 1024, "Checkpointed ${it.bytesReceived} bytes")
+        }
+        val eventBus = EventBus()
+        val fetcher = ServerFetcher()
+        val manager2 = DownloadManager(db2, fetcher, eventBus)
+        val finished = awaitFinished(eventBus, payloads.size)
+        manager2.start()
+
+        val events = finished.await()
+        manager2.stop()
+        events.forEach { assertIs<BackendEvent.DownloadEvent.ItemCompleted>(it) }
+        payloads.forEach { (payloadKey, plain) ->
+            assertTrue(fetcher.resumedFrom.getValue(payloadKey) > 0, "$payloadKey resumed")
+            assertContentEquals(plain, targets.getValue(payloadKey).readBytes())
+            assertFalse(File(targets.getValue(payloadKey).path + ".part").exists())
+        }
+        assertEquals(0L, db2.downloads.count())
+        db2.close()
+    }
+
+    // ========== Scheduling ==========
+
+    @Test
+    fun runsMostUrgentFirst() = runBlocking {
+        val db = DatabaseManager { createInMemoryDatabase() }
+        val eventBus = EventBus()
+        val fetcher = RecordingFetcher()
+        val manager = DownloadManager(db, fetcher, eventBus, maxConcurrent = 1)
+
+        manager.enqueue(driveId, Uuid.random(), "low", "a", File(root, "low").path, priority = 5)
+        manager.enqueue(driveId, Uuid.random(), "urgent", "a", File(root, "urgent").path, priority = 0)
+        manager.enqueue(driveId, Uuid.random(), "normal", "a", File(root, "normal").path, priority = 1)
+        // Already queued to that path
+        assertFalse(manager.enqueue(driveId, Uuid.random(), "again", "a", File(root, "low").path))
+
+        val finished = awaitFinished(eventBus, 3)
+        manager.start()
+        finished.await()
+        manager.stop()
+
+        assertEquals(listOf("urgent", "normal", "low"), fetcher.order)
+        db.close()
+    }
+
+    @Test
+    fun limitsDownloadsPerHost() = runBlocking {
+        val db = DatabaseManager { createInMemoryDatabase() }
+        val eventBus = EventBus()
+        val fetcher = RecordingFetcher(delayMs = 100)
+        val manager = DownloadManager(db, fetcher, eventBus, maxConcurrent = 4, maxPerHost = 1)
+
+        for (host in listOf("a", "b")) {
+            repeat(3) { manager.enqueue(driveId, Uuid.random(), "$host$it", host, File(root, "$host$it").path) }
+        }
+
+        val finished = awaitFinished(eventBus, 6)
+        manager.start()
+        finished.await()
+        manager.stop()
+
+        assertEquals(mapOf("a" to 1, "b" to 1), fetcher.maxActivePerHost.toMap())
+        // One from each host at a time
+        assertEquals(2, fetcher.maxActive.get())
+        assertEquals(6, fetcher.order.size)
+        db.close()
+    }
+
+    @Test
+    fun retriesTransientFailuresAndDropsFatalOnes() = runBlocking {
+        val db = DatabaseManager { createInMemoryDatabase() }
+        val eventBus = EventBus()
+        val fetcher = RecordingFetcher(delayMs = 1)
+        fetcher.failures["flaky"] = mutableListOf(IOException("Connection reset"), IOException("Connection reset"))
+        fetcher.failures["corrupt"] = mutableListOf(PayloadIntegrityException("Final block did not decrypt"))
+        val manager = DownloadManager(db, fetcher, eventBus,
+            retryPolicy = OutboxRetryPolicy(baseDelayMs = 10, maxDelayMs = 20))
+
+        manager.enqueue(driveId, Uuid.random(), "flaky", "a", File(root, "flaky").path)
+        manager.enqueue(driveId, Uuid.random(), "corrupt", "a", File(root, "corrupt").path)
+
+        val finished = awaitFinished(eventBus, 2)
+        manager.start()
+        val events = finished.await().associateBy { File(it.targetPath).name }
+        manager.stop()
+
+        assertIs<BackendEvent.DownloadEvent.ItemCompleted>(events["flaky"])
+        assertIs<BackendEvent.DownloadEvent.ItemFailed>(events["corrupt"])
+        assertEquals(3, fetcher.attempts.getValue("flaky").get())
+        assertEquals(1, fetcher.attempts.getValue("corrupt").get())
+        assertEquals(0L, db.downloads.count())
+        db.close()
+    }
+
+    @Test
+    fun payloadThatIsGoneFailsOnTheFirstAttempt() = runBlocking {
+        server.start()
+        val db = DatabaseManager { createInMemoryDatabase() }
+        val eventBus = EventBus()
+        val fetcher = ServerFetcher()
+        val manager = DownloadManager(db, fetcher, eventBus,
+            retryPolicy = OutboxRetryPolicy(baseDelayMs = 10, maxDelayMs = 20))
+
+        // Never registered, so the server answers 404
+        manager.enqueue(driveId, Uuid.random(), "deleted", "a", File(root, "deleted").path)
+
+        val finished = awaitFinished(eventBus, 1)
+        manager.start()
+        val event = finished.await().single()
+        manager.stop()
+
+        assertIs<BackendEvent.DownloadEvent.ItemFailed>(event)
+        assertEquals(1, fetcher.attempts.getValue("deleted").get())
+        assertFalse(File(root, "deleted.part").exists())
+        assertEquals(0L, db.downloads.count())
+        db.close()
+    }
+}
@@ -0,0 +1,135 @@
+package id.homebase.homebasekmppoc.prototype.ui.driveFetch
+
+import id.homebase.homebasekmppoc.lib.database.Outbox
+import id.homebase.homebasekmppoc.lib.database.OutboxLane
+import id.homebase.homebasekmppoc.prototype.lib.core.time.UnixTimeUtc
+import id.homebase.homebasekmppoc.prototype.lib.database.DatabaseManager
+import id.homebase.homebasekmppoc.prototype.lib.database.createInMemoryDatabase
+import id.homebase.homebasekmppoc.prototype.lib.eventbus.EventBus
+import kotlinx.coroutines.ExperimentalCoroutinesApi
+import kotlinx.coroutines.delay
+import kotlinx.coroutines.test.StandardTestDispatcher
+import kotlinx.coroutines.test.TestScope
+import kotlinx.coroutines.test.advanceTimeBy
+import kotlinx.coroutines.test.advanceUntilIdle
+import kotlinx.coroutines.test.runTest
+import kotlin.math.ceil
+import kotlin.test.*
+import kotlin.uuid.Uuid
+
+/** Simulated link: upload time is proportional to the payload size. */
+class BandwidthUploader(private val now: () -> Long, private val bytesPerSecond: Long) : OutboxUploader {
+    val completedAt = mutableMapOf<Uuid, Long>()
+    var activeBulk = 0
+    var maxActiveBulk = 0
+
+    override suspend fun upload(outboxRecord: Outbox, eventBus: EventBus) {
+        val bulk = outboxRecord.lane == OutboxLane.Bulk.value
+        if (bulk) {
+            activeBulk++
+            maxActiveBulk = maxOf(maxActiveBulk, activeBulk)
+        }
+        delay(maxOf(50L, outboxRecord.payloadBytes * 1000 / bytesPerSecond))
+        if (bulk) activeBulk--
+        completedAt[outboxRecord.fileId] = now()
+    }
+}
+
+@OptIn(ExperimentalCoroutinesApi::class)
+class OutboxLaneTest {
+
+    private fun TestScope.createDatabase() =
+        DatabaseManager(StandardTestDispatcher(testScheduler)) { createInMemoryDatabase() }
+
+    private suspend fun DatabaseManager.insertItem(payloadBytes: Long, priority: Long = 0): Uuid {
+        val fileId = Uuid.random()
+        outbox.insert(
+            driveId = Uuid.random(),
+            fileId = fileId,
+            dependencyFileId = null,
+            priority = priority,
+            uploadType = 0,
+            json = byteArrayOf(),
+            files = null,
+            payloadBytes = payloadBytes
+        )
+        return fileId
+    }
+
+    private fun TestScope.createSync(db: DatabaseManager, uploader: OutboxUploader) = OutboxSync(
+        databaseManager = db,
+        uploader = uploader,
+        eventBus = EventBus(),
+        scope = this,
+        clock = { UnixTimeUtc(testScheduler.currentTime) },
+        interactiveThreads = 2,
+        bulkThreads = 2
+    )
+
+    @Test
+    fun testClassify() {
+        assertEquals(OutboxLane.Interactive, OutboxLane.classify(priority = 0, payloadBytes = 2_000))
+        assertEquals(OutboxLane.Bulk, OutboxLane.classify(priority = 0, payloadBytes = 50_000_000))
+        assertEquals(OutboxLane.Bulk, OutboxLane.classify(priority = OutboxLane.BULK_PRIORITY, payloadBytes = 0))
+    }
+
+    @Test
+    fun testLaneCheckout() = runTest {
+        val db = createDatabase()
+        val video = db.insertItem(payloadBytes = 100_000_000)
+        val chat = db.insertItem(payloadBytes = 300)
+
+        assertEquals(video, db.outbox.checkout(UnixTimeUtc(0), OutboxLane.Bulk)?.fileId)
+        assertNull(db.outbox.checkout(UnixTimeUtc(0), OutboxLane.Bulk))
+        assertEquals(chat, db.outbox.checkout(UnixTimeUtc(0), OutboxLane.Interactive)?.fileId)
+        assertNull(db.outbox.checkout(UnixTimeUtc(0)))
+        db.close()
+    }
+
+    @Test
+    fun testChatLatencyStaysLowWhileBulkSaturates() = runTest {
+        val db = createDatabase()
+        // 10 MB/s per connection: a 600 MB video takes a minute, a chat message 50 ms
+        val uploader = BandwidthUploader({ testScheduler.currentTime }, bytesPerSecond = 10_000_000)
+        val sync = createSync(db, uploader)
+
+        val videos = (1..8).map { db.insertItem(payloadBytes = 600_000_000) }
+        sync.send()
+
+        // A chat message every 3 seconds while the videos go out
+        val enqueuedAt = mutableMapOf<Uuid, Long>()
+        repeat(200) {
+            enqueuedAt[db.insertItem(payloadBytes = 400)] = testScheduler.currentTime
+            sync.send()
+            advanceTimeBy(3_000)
+        }
+        advanceUntilIdle()
+
+        val latencies = enqueuedAt.map { (fileId, t) -> uploader.completedAt.getValue(fileId) - t }.sorted()
+        val p99 = latencies[ceil(latencies.size * 0.99).toInt() - 1]
+        assertTrue(p99 <= 500, "Chat p99 latency was $p99 ms")
+
+        // Bulk fills its own lane plus every interactive slot but the reserved one
+        assertEquals(3, uploader.maxActiveBulk)
+        assertTrue(videos.all { it in uploader.completedAt })
+        assertEquals(0L, db.outbox.count())
+        db.close()
+    }
+
+    @Test
+    fun testBulkStealsIdleInteractiveSlots() = runTest {
+        val db = createDatabase()
+        val uploader = BandwidthUploader({ testScheduler.currentTime }, bytesPerSecond = 10_000_000)
+        val sync = createSync(db, uploader)
+
+        repeat(6) { db.insertItem(payloadBytes = 100_000_000) }
+        sync.send()
+        advanceUntilIdle()
+
+        // 6 ten-second uploads over 3 connections: two rounds
+        assertEquals(3, uploader.maxActiveBulk)
+        assertEquals(20_000L, uploader.completedAt.values.max())
+        assertEquals(0L, db.outbox.count())
+        db.close()
+    }
+}
@@ -0,0 +1,250 @@
+package id.homebase.homebasekmppoc.prototype.ui.driveFetch
+
+import id.homebase.homebasekmppoc.lib.database.Outbox
+import id.homebase.homebasekmppoc.prototype.lib.base.NotFoundException
+import id.homebase.homebasekmppoc.prototype.lib.base.ServerException
+import id.homebase.homebasekmppoc.prototype.lib.base.UnauthorizedException
+import id.homebase.homebasekmppoc.prototype.lib.core.time.UnixTimeUtc
+import id.homebase.homebasekmppoc.prototype.lib.database.DatabaseManager
+import id.homebase.homebasekmppoc.prototype.lib.database.createInMemoryDatabase
+import id.homebase.homebasekmppoc.prototype.lib.eventbus.BackendEvent
+import id.homebase.homebasekmppoc.prototype.lib.eventbus.EventBus
+import kotlinx.coroutines.ExperimentalCoroutinesApi
+import kotlinx.coroutines.delay
+import kotlinx.coroutines.flow.filterIsInstance
+import kotlinx.coroutines.flow.toList
+import kotlinx.coroutines.launch
+import kotlinx.coroutines.test.StandardTestDispatcher
+import kotlinx.coroutines.test.TestScope
+import kotlinx.coroutines.test.advanceTimeBy
+import kotlinx.coroutines.test.advanceUntilIdle
+import kotlinx.coroutines.test.runTest
+import kotlinx.io.IOException
+import kotlin.random.Random
+import kotlin.test.*
+import kotlin.uuid.Uuid
+
+/** Simulated host. Everything runs on the test scheduler, so timestamps are virtual. */
+class FlakyHostUploader(private val now: () -> Long) : OutboxUploader {
+    var hostDown = false
+    var rejected = setOf<Uuid>()                 // Permanently refused (404)
+    val transientFailures = mutableMapOf<Uuid, Int>() // Connection drops before success
+    val attempts = mutableListOf<Long>()
+    val uploaded = mutableListOf<Uuid>()
+
+    override suspend fun upload(outboxRecord: Outbox, eventBus: EventBus) {
+        attempts.add(now())
+        delay(100)
+
+        if (hostDown) throw ServerException(503, null, null)
+        if (outboxRecord.fileId in rejected) throw NotFoundException()
+
+        val left = transientFailures[outboxRecord.fileId] ?: 0
+        if (left > 0) {
+            transientFailures[outboxRecord.fileId] = left - 1
+            throw IOException("Connection reset")
+        }
+        uploaded.add(outboxRecord.fileId)
+    }
+}
+
+@OptIn(ExperimentalCoroutinesApi::class)
+class OutboxRetryPolicyTest {
+
+    private fun TestScope.createDatabase() =
+        DatabaseManager(StandardTestDispatcher(testScheduler)) { createInMemoryDatabase() }
+
+    private suspend fun DatabaseManager.insertItems(n: Int): List<Uuid> =
+        (1..n).map {
+            val fileId = Uuid.random()
+            outbox.insert(
+                driveId = Uuid.random(),
+                fileId = fileId,
+                dependencyFileId = null,
+                priority = 0,
+                uploadType = 0,
+                json = byteArrayOf(),
+                files = null
+            )
+            fileId
+        }
+
+    // ==================== POLICY ====================
+
+    @Test
+    fun testBackoffIsCappedExponentialWithFullJitter() {
+        val policy = OutboxRetryPolicy(baseDelayMs = 1_000, maxDelayMs = 60_000, random = Random(7))
+
+        for (attempt in 0..40) {
+            val ceiling = minOf(60_000L, 1_000L shl minOf(attempt, 30))
+            repeat(200) {
+                val d = policy.nextDelayMs(attempt)
+                assertTrue(d in 0..ceiling, "attempt $attempt gave $d, ceiling $ceiling")
+            }
+        }
+
+        // Jitter spreads retries over the whole window instead of synchronizing them
+        val samples = (1..1000).map { policy.nextDelayMs(10) }
+        assertTrue(samples.min() < 10_000)
+        assertTrue(samples.max() > 50_000)
+    }
+
+    @Test
+    fun testClassification() {
+        val policy = OutboxRetryPolicy()
+
+        assertEquals(FailureClass.Retryable, policy.classify(ServerException(503, null, null)))
+        assertEquals(FailureClass.Retryable, policy.classify(IOException("timeout")))
+        assertEquals(FailureClass.Retryable, policy.classify(UnauthorizedException()))
+        assertEquals(FailureClass.Retryable, policy.classifyStatus(429))
+        assertEquals(FailureClass.Fatal, policy.classify(NotFoundException()))
+        assertEquals(FailureClass.Fatal, policy.classifyStatus(400))
+        assertEquals(FailureClass.Fatal, policy.classify(IllegalArgumentException("bad input")))
+
+        assertTrue(policy.isHostFailure(ServerException(502, null, null)))
+        assertTrue(policy.isHostFailure(IOException("reset")))
+        assertFalse(policy.isHostFailure(NotFoundException()))
+
+        assertTrue(policy.shouldGiveUp(FailureClass.Fatal, 0))
+        assertFalse(policy.shouldGiveUp(FailureClass.Retryable, 0))
+        assertTrue(policy.shouldGiveUp(FailureClass.Retryable, policy.maxAttempts - 1))
+    }
+
+    @Test
+    fun testCircuitBreakerTripsProbesAndResets() = runTest {
+        val breaker = CircuitBreaker(failureThreshold = 3, openDurationMs = 1_000, maxOpenDurationMs = 3_000)
+
+        repeat(2) { breaker.recordFailure(0) }
+        assertEquals(CircuitBreaker.State.Closed, breaker.state())
+        breaker.recordFailure(0)
+        assertEquals(CircuitBreaker.State.Open, breaker.state())
+        assertFalse(breaker.tryAcquire(999))
+        assertEquals(1_000L, breaker.retryAt())
+
+        // One probe only while half-open
+        assertTrue(breaker.tryAcquire(1_000))
+        assertFalse(breaker.tryAcquire(1_000))
+
+        // A failing probe re-opens with a doubled, then capped, period
+        breaker.recordFailure(1_000)
+        assertEquals(3_000L, breaker.retryAt())
+        assertTrue(breaker.tryAcquire(3_000))
+        breaker.recordFailure(3_000)
+        assertEquals(6_000L, breaker.retryAt())
+
+        assertTrue(breaker.tryAcquire(6_000))
+        breaker.recordSuccess()
+        assertEquals(CircuitBreaker.State.Closed, breaker.state())
+        assertTrue(breaker.tryAcquire(6_000))
+        assertTrue(breaker.tryAcquire(6_000))
+    }
+
+    // ==================== SCENARIOS (virtual time) ====================
+
+    @Test
+    fun testOutagePausesCheckoutAndRecovers() = runTest {
+        val db = createDatabase()
+        val uploader = FlakyHostUploader { testScheduler.currentTime }
+        uploader.hostDown = true
+        val breaker = CircuitBreaker(failureThreshold = 3, openDurationMs = 30_000, maxOpenDurationMs = 120_000)
+
+        val sync = OutboxSync(
+            databaseManager = db,
+            uploader = uploader,
+            eventBus = EventBus(),
+            scope = this,
+            retryPolicy = OutboxRetryPolicy(random = Random(1)),
+            circuitBreaker = breaker,
+            clock = { UnixTimeUtc(testScheduler.currentTime) }
+        )
+
+        val fileIds = db.insertItems(10)
+        sync.start()
+
+        // Ten minutes of outage: three failures trip the breaker, then one probe per open
+        // period (30s, 60s, 120s, 120s, ...). Without it, every item would retry on its own.
+        advanceTimeBy(10 * 60_000L)
+        assertTrue(uploader.attempts.size <= 10, "Host was hit ${uploader.attempts.size} times")
+        assertNotEquals(CircuitBreaker.State.Closed, breaker.state())
+        assertEquals(10L, db.outbox.count())
+
+        // Probes are spaced by the open period, never back-to-back
+        val probeGaps = uploader.attempts.drop(3).zipWithNext { a, b -> b - a }
+        assertTrue(probeGaps.all { it >= 30_000 }, "Probe gaps: $probeGaps")
+
+        // Host comes back: the next probe closes the breaker and the backlog drains
+        uploader.hostDown = false
+        advanceUntilIdle()
+
+        assertEquals(CircuitBreaker.State.Closed, breaker.state())
+        assertEquals(fileIds.toSet(), uploader.uploaded.toSet())
+        assertEquals(0L, db.outbox.count())
+        sync.stop()
+        db.close()
+    }
+
+    @Test
+    fun testPartialFailure() = runTest {
+        val db = createDatabase()
+        val eventBus = EventBus()
+        val uploader = FlakyHostUploader { testScheduler.currentTime }
+        val breaker = CircuitBreaker(failureThreshold = 3)
+
+        val failed = mutableListOf<BackendEvent.OutboxEvent.ItemFailed>()
+        backgroundScope.launch {
+            eventBus.events.filterIsInstance<BackendEvent.OutboxEvent.ItemFailed>().toList(failed)
+        }
+
+        val sync = OutboxSync(
+            databaseManager = db,
+            uploader = uploader,
+            eventBus = eventBus,
+            scope = this,
+            retryPolicy = OutboxRetryPolicy(random = Random(2)),
+            circuitBreaker = breaker,
+            clock = { UnixTimeUtc(testScheduler.currentTime) }
+        )
+
+        val fileIds = db.insertItems(6)
+        uploader.rejected = setOf(fileIds[0], fileIds[1])
+        uploader.transientFailures[fileIds[2]] = 2
+
+        sync.start()
+        advanceUntilIdle()
+
+        // Fatal items are dropped after a single attempt, the flaky one gets through on retry
+        assertEquals(fileIds.drop(2).toSet(), uploader.uploaded.toSet())
+        assertEquals(setOf(fileIds[0], fileIds[1]), failed.map { it.fileId }.toSet())
+        assertEquals(uploader.uploaded.size + 2 + 2, uploader.attempts.size) // 2 rejected, 2 dropped
+        assertEquals(CircuitBreaker.State.Closed, breaker.state())
+        assertEquals(0L, db.outbox.count())
+        sync.stop()
+        db.close()
+    }
+
+    @Test
+    fun testRetriesGiveUpAfterMaxAttempts() = runTest {
+        val db = createDatabase()
+        val uploader = FlakyHostUploader { testScheduler.currentTime }
+        uploader.hostDown = true
+
+        val sync = OutboxSync(
+            databaseManager = db,
+            uploader = uploader,
+            eventBus = EventBus(),
+            scope = this,
+            retryPolicy = OutboxRetryPolicy(maxAttempts = 4, random = Random(3)),
+            circuitBreaker = CircuitBreaker(failureThreshold = 100),
+            clock = { UnixTimeUtc(testScheduler.currentTime) }
+        )
+
+        db.insertItems(1)
+        sync.start()
+        advanceUntilIdle()
+
+        assertEquals(4, uploader.attempts.size)
+        assertEquals(0L, db.outbox.count())
+        sync.stop()
+        db.close()
+    }
+}
@@ -0,0 +1,147 @@
+package id.homebase.homebasekmppoc.prototype.ui.driveFetch
+
+import id.homebase.homebasekmppoc.prototype.lib.core.time.UnixTimeUtc
+import id.homebase.homebasekmppoc.prototype.lib.database.DatabaseManager
+import id.homebase.homebasekmppoc.prototype.lib.database.createInMemoryDatabase
+import id.homebase.homebasekmppoc.prototype.lib.eventbus.EventBus
+import kotlinx.coroutines.ExperimentalCoroutinesApi
+import kotlinx.coroutines.test.StandardTestDispatcher
+import kotlinx.coroutines.test.TestScope
+import kotlinx.coroutines.test.advanceTimeBy
+import kotlinx.coroutines.test.advanceUntilIdle
+import kotlinx.coroutines.test.runCurrent
+import kotlinx.coroutines.test.runTest
+import kotlin.random.Random
+import kotlin.test.*
+import kotlin.uuid.Uuid
+
+@OptIn(ExperimentalCoroutinesApi::class)
+class OutboxSchedulerTest {
+
+    private fun TestScope.createDatabase() =
+        DatabaseManager(StandardTestDispatcher(testScheduler)) { createInMemoryDatabase() }
+
+    private suspend fun DatabaseManager.insertItem(): Uuid {
+        val fileId = Uuid.random()
+        outbox.insert(
+            driveId = Uuid.random(),
+            fileId = fileId,
+            dependencyFileId = null,
+            priority = 0,
+            uploadType = 0,
+            json = byteArrayOf(),
+            files = null
+        )
+        return fileId
+    }
+
+    private class CountingClock(private val scope: TestScope) {
+        var reads = 0
+        fun now(): UnixTimeUtc {
+            reads++
+            return UnixTimeUtc(scope.testScheduler.currentTime)
+        }
+    }
+
+    private fun TestScope.createSync(db: DatabaseManager, uploader: OutboxUploader, clock: CountingClock) =
+        OutboxSync(
+            databaseManager = db,
+            uploader = uploader,
+            eventBus = EventBus(),
+            scope = this,
+            retryPolicy = OutboxRetryPolicy(random = Random(5)),
+            circuitBreaker = CircuitBreaker(failureThreshold = 100),
+            clock = clock::now
+        )
+
+    @Test
+    fun testEnqueueWakesSchedulerImmediately() = runTest {
+        val db = createDatabase()
+        val uploader = FlakyHostUploader { testScheduler.currentTime }
+        val clock = CountingClock(this)
+        val sync = createSync(db, uploader, clock)
+
+        sync.start()
+        advanceUntilIdle()
+
+        // An idle outbox has no timer: an hour passes without the scheduler looking at the clock
+        val readsWhenIdle = clock.reads
+        advanceTimeBy(60 * 60_000L)
+        assertEquals(readsWhenIdle, clock.reads)
+        assertEquals(0, uploader.attempts.size)
+
+        val enqueuedAt = testScheduler.currentTime
+        db.insertItem()
+        runCurrent()
+
+        // Picked up at once, not at the end of some polling interval
+        assertEquals(listOf(enqueuedAt), uploader.attempts)
+        advanceUntilIdle()
+        assertEquals(1, uploader.uploaded.size)
+        sync.stop()
+        db.close()
+    }
+
+    @Test
+    fun testRescheduledItemRunsExactlyWhenDue() = runTest {
+        val db = createDatabase()
+        val uploader = FlakyHostUploader { testScheduler.currentTime }
+        val sync = createSync(db, uploader, CountingClock(this))
+
+        val fileId = db.insertItem()
+        uploader.transientFailures[fileId] = 1
+        sync.start()
+        runCurrent()
+        advanceTimeBy(100) // The failing attempt
+        runCurrent()
+
+        val due = assertNotNull(db.outbox.schedule.peek(), "Failed item should be rescheduled")
+        assertTrue(due > testScheduler.currentTime)
+        assertEquals(1, uploader.attempts.size)
+
+        advanceTimeBy(due - testScheduler.currentTime)
+        assertEquals(1, uploader.attempts.size, "Retried before it was due")
+        runCurrent()
+        assertEquals(listOf(due), uploader.attempts.drop(1))
+
+        advanceUntilIdle()
+        assertEquals(listOf(fileId), uploader.uploaded)
+        assertNull(db.outbox.schedule.peek())
+        sync.stop()
+        db.close()
+    }
+
+    @Test
+    fun testCrashRecovery() = runTest {
+        val db = createDatabase()
+        val uploader = FlakyHostUploader { testScheduler.currentTime }
+
+        // State left behind by a crash: one item checked out mid-upload, one waiting for a retry
+        advanceTimeBy(1_000)
+        val restartAt = testScheduler.currentTime
+        db.insertItem()
+        db.insertItem()
+        val interrupted = db.outbox.checkout(UnixTimeUtc(restartAt))!!.fileId
+        val second = db.outbox.checkout(UnixTimeUtc(restartAt))!!
+        val waiting = second.fileId
+        db.outbox.checkInFailed(second.checkOutStamp!!, restartAt + 5 * 60_000L)
+        db.outbox.schedule.clear() // The in-memory heap does not survive the restart
+
+        val sync = createSync(db, uploader, CountingClock(this))
+        sync.start()
+        runCurrent()
+
+        // The interrupted item goes out at once, the waiting one exactly when it is due
+        assertEquals(listOf(restartAt), uploader.attempts)
+        advanceTimeBy(restartAt + 5 * 60_000L - testScheduler.currentTime)
+        assertEquals(1, uploader.attempts.size)
+        runCurrent()
+        assertEquals(listOf(restartAt, restartAt + 5 * 60_000L), uploader.attempts)
+
+        advanceUntilIdle()
+        assertEquals(setOf(interrupted, waiting), uploader.uploaded.toSet())
+        assertEquals(0L, db.outbox.count())
+        sync.stop()
+        db.close()
+    }
+}
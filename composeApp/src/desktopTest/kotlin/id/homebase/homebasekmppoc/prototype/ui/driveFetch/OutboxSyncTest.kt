@@ -3,6 +3,7 @@ package id.homebase.homebasekmppoc.prototype.ui.driveFetch
 import co.touchlab.kermit.Logger
 import id.homebase.homebasekmppoc.lib.database.Outbox
 import id.homebase.homebasekmppoc.prototype.lib.database.DatabaseManager
+import id.homebase.homebasekmppoc.prototype.lib.database.OutboxSpool
 import id.homebase.homebasekmppoc.prototype.lib.database.createInMemoryDatabase
 import id.homebase.homebasekmppoc.prototype.lib.eventbus.BackendEvent
 import id.homebase.homebasekmppoc.prototype.lib.eventbus.EventBus
@@ -13,6 +14,10 @@ import kotlinx.coroutines.flow.filterIsInstance
 import kotlinx.coroutines.flow.first
 import kotlinx.coroutines.test.advanceUntilIdle
 import kotlinx.coroutines.test.runTest
+import kotlinx.io.buffered
+import kotlinx.io.files.Path
+import kotlinx.io.files.SystemFileSystem
+import kotlinx.io.files.SystemTemporaryDirectory
 import kotlin.test.*
 import kotlin.uuid.Uuid
 
@@ -157,7 +162,8 @@ class OutboxSyncTest {
             {
                 // It's meant to fail, snatch the exception without an error in the log
             }
-            advanceUntilIdle()
+            // No advanceUntilIdle() here: that would fast-forward through every backoff
+            // until the retry policy gives up and removes the item.
 
             // Wait for the final events too
             val completedCount = completedDeferred.await()
@@ -265,4 +271,55 @@ class OutboxSyncTest {
         }
         db.close()
     }
+
+    @Test
+    fun testRowWhoseSpooledPayloadIsGoneFailsAtStart()
+    {
+        val db = DatabaseManager { createInMemoryDatabase() }
+        val root = Path(SystemTemporaryDirectory, "outbox-sync-test-${Uuid.random()}")
+
+        runTest {
+            val eventBus = EventBus()
+            val uploader = TestUploader()
+            val spool = OutboxSpool(db, Path(root, "spool"))
+
+            val payload = Path(root, "a.bin")
+            SystemFileSystem.sink(payload).buffered().use { it.write(ByteArray(1_000) { i -> i.toByte() }) }
+            val driveId = Uuid.random()
+            val fileId = Uuid.random()
+            spool.enqueue(driveId, fileId, null, 0L, 0L, byteArrayOf(), listOf(payload))
+
+            // E.g. the OS cleared the app's storage while the app was not running
+            val hash = db.outbox.spoolHashes(db.outbox.checkout()!!.rowId).single()
+            db.outbox.clearCheckedOut()
+            SystemFileSystem.delete(spool.pathOf(hash))
+
+            val sync = OutboxSync(
+                databaseManager = db,
+                uploader = uploader,
+                eventBus = eventBus,
+                scope = this,
+                spool = spool
+            )
+            val failedDeferred = async {
+                eventBus.events.filterIsInstance<BackendEvent.OutboxEvent.ItemFailed>().first()
+            }
+            testScheduler.runCurrent() // Kick off the async collector
+
+            sync.start()
+            advanceUntilIdle()
+
+            val failed = failedDeferred.await()
+            assertEquals(driveId, failed.driveId)
+            assertEquals(fileId, failed.fileId)
+            assertEquals(0L, db.outbox.count(), "Dropped instead of retried")
+            assertEquals(0, uploader.uploaded.size)
+            sync.stop()
+        }
+        SystemFileSystem.list(Path(root, "spool")).forEach { SystemFileSystem.delete(it) }
+        SystemFileSystem.delete(Path(root, "spool"))
+        SystemFileSystem.delete(Path(root, "a.bin"))
+        SystemFileSystem.delete(root)
+        db.close()
+    }
 }
\ No newline at end of file
@@ -0,0 +1,128 @@
+package id.homebase.homebasekmppoc.prototype.ui.driveUpload
+
+import id.homebase.homebasekmppoc.lib.image.ImageSize
+import id.homebase.homebasekmppoc.lib.image.createThumbnails
+import id.homebase.homebasekmppoc.prototype.lib.drives.readFileBytes
+import id.homebase.homebasekmppoc.testing.assumeBenchmarksEnabled
+import id.homebase.homebasekmppoc.testing.liveHeapAfterGc
+import kotlinx.coroutines.flow.take
+import kotlinx.coroutines.flow.toList
+import kotlinx.coroutines.runBlocking
+import kotlinx.io.files.Path
+import org.jetbrains.skia.Color
+import org.jetbrains.skia.EncodedImageFormat
+import org.jetbrains.skia.Paint
+import org.jetbrains.skia.Rect
+import org.jetbrains.skia.Surface
+import java.io.File
+import kotlin.io.path.createTempDirectory
+import kotlin.test.AfterTest
+import kotlin.test.Test
+import kotlin.test.assertEquals
+import kotlin.test.assertIs
+import kotlin.test.assertTrue
+
+class BatchImageImporterTest {
+
+    private val root = createTempDirectory("batch-import-test").toFile()
+    private val spool = File(root, "spool")
+
+    @AfterTest
+    fun cleanup() {
+        root.deleteRecursively()
+    }
+
+    private fun writeJpeg(index: Int, width: Int = 400, height: Int = 300): String {
+        val surface = Surface.makeRasterN32Premul(width, height)
+        val paint = Paint()
+        for (i in 0 until 12) {
+            paint.color = Color.makeRGB((index * 13 + i * 20) % 256, (index * 5) % 256, i * 21)
+            surface.canvas.drawRect(Rect.makeXYWH(0f, i * height / 12f, width.toFloat(), height / 12f + 1), paint)
+        }
+        val image = surface.makeImageSnapshot()
+        val file = File(root, "img-$index.jpg")
+        file.writeBytes(image.encodeToData(EncodedImageFormat.JPEG, 90)!!.bytes)
+        image.close()
+        surface.close()
+        return file.absolutePath
+    }
+
+    @Test
+    fun testImports500InOrderWithinBudget() = runBlocking {
+        assumeBenchmarksEnabled()
+        val paths = (0 until 500).map { writeJpeg(it) }
+        // Room for three 400 x 300 images at a time, whatever the parallelism
+        val perImage = 400L * 300 * 4 + File(paths[0]).length()
+        val importer = BatchImageImporter(Path(spool.path), parallelism = 8, memoryBudgetBytes = perImage * 3 + 1024)
+
+        val baselineHeap = liveHeapAfterGc()
+        var maxLiveGrowth = 0L
+        val received = mutableListOf<ImportResult>()
+
+        val start = System.nanoTime()
+        importer.import(paths, "pst_mdi0").collect { result ->
+            received.add(result)
+            // The live set, not garbage: what the import keeps around while the uploader works
+            if (received.size % 50 == 0) maxLiveGrowth = maxOf(maxLiveGrowth, liveHeapAfterGc() - baselineHeap)
+            importer.discard(result)
+        }
+        val parallelMillis = (System.nanoTime() - start) / 1_000_000
+
+        val sequentialStart = System.nanoTime()
+        for (path in paths) createThumbnails(readFileBytes(path), "pst_mdi0")
+        val sequentialMillis = (System.nanoTime() - sequentialStart) / 1_000_000
+
+        println(
+            "500 images: batch ${parallelMillis} ms, one after another ${sequentialMillis} ms; " +
+                "peak reserved ${importer.peakReservedBytes / 1024} KB, max live heap growth ${maxLiveGrowth / 1024} KB"
+        )
+
+        assertEquals(paths.indices.toList(), received.map { it.index })
+        assertEquals(paths, received.map { it.sourcePath })
+        received.forEach {
+            val imported = assertIs<ImportResult.Imported>(it)
+            assertEquals(ImageSize(400, 300), imported.naturalSize)
+            assertTrue(imported.thumbnails.isNotEmpty())
+        }
+
+        assertTrue(importer.peakReservedBytes <= importer.memoryBudgetBytes)
+        assertTrue(importer.peakReservedBytes >= perImage * 2, "Never ran two at once")
+        // Holding every original and its decoded pixels would be about 240 MB
+        assertTrue(maxLiveGrowth < 64L * 1024 * 1024, "Live heap grew by ${maxLiveGrowth / 1024} KB")
+        assertEquals(0, spool.listFiles()?.size ?: 0)
+
+        if (Runtime.getRuntime().availableProcessors() >= 4) {
+            assertTrue(parallelMillis < sequentialMillis, "batch $parallelMillis ms vs $sequentialMillis ms")
+        }
+    }
+
+    @Test
+    fun testFailuresKeepTheirPlace() = runBlocking {
+        val notAnImage = File(root, "notes.jpg").apply { writeText("not an image") }.absolutePath
+        val paths = listOf(writeJpeg(0), File(root, "missing.jpg").absolutePath, notAnImage, writeJpeg(3))
+        val importer = BatchImageImporter(Path(spool.path), parallelism = 4)
+
+        val results = importer.import(paths, "pst_mdi0").toList()
+
+        assertEquals(listOf(0, 1, 2, 3), results.map { it.index })
+        assertIs<ImportResult.Imported>(results[0])
+        assertIs<ImportResult.Failed>(results[1])
+        assertIs<ImportResult.Failed>(results[2])
+        assertIs<ImportResult.Imported>(results[3])
+        // Only the two imported originals are spooled
+        assertEquals(2, spool.listFiles()?.size)
+    }
+
+    @Test
+    fun testStoppingEarlyCleansUpTheSpool() = runBlocking {
+        val paths = (0 until 40).map { writeJpeg(it) }
+        val importer = BatchImageImporter(Path(spool.path), parallelism = 4)
+
+        val firstThree = importer.import(paths, "pst_mdi0").take(3).toList()
+
+        // What was handed over is the caller's; nothing else is left behind
+        assertEquals(3, spool.listFiles()?.size)
+        firstThree.forEach { importer.discard(it) }
+        assertEquals(0, spool.listFiles()?.size)
+    }
+}
@@ -0,0 +1,26 @@
+package id.homebase.homebasekmppoc.testing
+
+import id.homebase.homebasekmppoc.media.FFmpegBinaryManager
+import java.lang.management.ManagementFactory
+import org.junit.Assume.assumeTrue
+
+// Shared conditions for desktop tests. A test whose condition does not hold is reported as
+// skipped rather than passed.
+
+/**
+ * Benchmarks and other slow runs, such as multi-gigabyte transfers, only run with
+ * RUN_BENCHMARKS=1, e.g.
+ *   RUN_BENCHMARKS=1 ./gradlew :composeApp:desktopTest --tests '*Benchmark*'
+ */
+fun assumeBenchmarksEnabled() =
+    assumeTrue("Slow; set RUN_BENCHMARKS=1 to run", System.getenv("RUN_BENCHMARKS") == "1")
+
+/** Media tests need the ffmpeg binaries, which not every machine has. */
+fun assumeFFmpegAvailable() =
+    assumeTrue("FFmpeg binaries not available", FFmpegBinaryManager.isAvailable())
+
+/** Heap in use after a full collection, to measure what a run keeps alive. */
+fun liveHeapAfterGc(): Long {
+    System.gc()
+    return ManagementFactory.getMemoryMXBean().heapMemoryUsage.used
+}
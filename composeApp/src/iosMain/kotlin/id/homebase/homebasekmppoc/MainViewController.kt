@@ -3,7 +3,11 @@ package id.homebase.homebasekmppoc
 import androidx.compose.ui.window.ComposeUIViewController
 import id.homebase.homebasekmppoc.prototype.lib.database.DatabaseDriverFactory
 import id.homebase.homebasekmppoc.prototype.lib.database.DatabaseManager
+import id.homebase.homebasekmppoc.prototype.ui.chat.ImageBitmapCache
 import kotlinx.coroutines.runBlocking
+import platform.Foundation.NSNotificationCenter
+import platform.Foundation.NSOperationQueue
+import platform.UIKit.UIApplicationDidReceiveMemoryWarningNotification
 import platform.UIKit.UIViewController
 import platform.darwin.NSObject
 
@@ -24,6 +28,13 @@ fun MainViewController(): UIViewController {
         DatabaseManager.initialize { DatabaseDriverFactory().createDriver() }
     }
 
+    // Decoded previews are cheap to rebuild; give them up on a memory warning
+    NSNotificationCenter.defaultCenter.addObserverForName(
+        UIApplicationDidReceiveMemoryWarningNotification,
+        null,
+        NSOperationQueue.mainQueue
+    ) { _ -> ImageBitmapCache.shared.clear() }
+
     val controller = ComposeUIViewController { App() }
     MainViewControllerRef.instance = controller
     return controller
@@ -10,6 +10,7 @@ import org.jetbrains.skia.Image
 import org.jetbrains.skia.EncodedImageFormat
 import org.jetbrains.skia.IRect
 import org.jetbrains.skia.Rect
+import org.jetbrains.skia.SamplingMode
 import org.jetbrains.skia.Surface
 
 /**
@@ -23,6 +24,37 @@ actual fun ByteArray.toImageBitmap(): ImageBitmap? {
     }
 }
 
+/**
+ * iOS implementation of DecodedImage backed by a Skia image
+ */
+actual class DecodedImage internal constructor(private val image: Image) : AutoCloseable {
+    actual val width: Int get() = image.width
+    actual val height: Int get() = image.height
+
+    actual fun scale(width: Int, height: Int): DecodedImage {
+        val surface = Surface.makeRasterN32Premul(width, height)
+        surface.canvas.drawImageRect(
+            image,
+            Rect.makeWH(image.width.toFloat(), image.height.toFloat()),
+            Rect.makeWH(width.toFloat(), height.toFloat()),
+            SamplingMode.MITCHELL,
+            null,
+            true
+        )
+        val scaled = surface.makeImageSnapshot()
+        surface.close()
+        return DecodedImage(scaled)
+    }
+
+    actual fun encode(format: ImageFormat, quality: Int): ByteArray =
+        image.encodeToData(ImageUtils.encodedFormatFor(format), quality)?.bytes
+            ?: throw IllegalStateException("Failed to encode image")
+
+    actual override fun close() {
+        image.close()
+    }
+}
+
 /**
  * iOS implementation of ImageUtils using Skia
  */
@@ -32,7 +64,7 @@ actual object ImageUtils {
         return Image.makeFromEncoded(bytes)
     }
 
-    private fun encodedFormatFor(format: ImageFormat): EncodedImageFormat = when (format) {
+    internal fun encodedFormatFor(format: ImageFormat): EncodedImageFormat = when (format) {
         ImageFormat.WEBP -> EncodedImageFormat.WEBP
         ImageFormat.JPEG -> EncodedImageFormat.JPEG
         ImageFormat.PNG -> EncodedImageFormat.PNG
@@ -206,8 +238,13 @@ actual object ImageUtils {
     }
 
     actual fun getNaturalSize(srcBytes: ByteArray): ImageSize {
+        // Skia applies EXIF orientation when decoding, so compare with the probe's display size
+        ImageHeaderProbe.probe(srcBytes)?.let { return it.displaySize }
         val img = decodeImage(srcBytes)
         return ImageSize(img.width, img.height)
     }
+
+    // Skia offers no reduced decode here; maxDimension is only a hint
+    actual fun decode(srcBytes: ByteArray, maxDimension: Int): DecodedImage = DecodedImage(decodeImage(srcBytes))
 }
 
@@ -8,17 +8,19 @@ import kotlinx.cinterop.*
 import kotlinx.coroutines.Dispatchers
 import kotlinx.coroutines.IO
 import kotlinx.coroutines.withContext
+import kotlinx.io.RawSource
+import kotlinx.io.files.Path
 import platform.Foundation.*
 
 @OptIn(ExperimentalForeignApi::class)
 actual object FFmpegUtils {
     actual fun getUniqueId(filePath: String): String {
-        // Match Android/Desktop: use file name + size for consistent ID generation
+        // Match Android/Desktop: path + size + modification time, so a changed file gets a new ID
         val fileManager = NSFileManager.defaultManager
         val attrs = fileManager.attributesOfItemAtPath(filePath, null)
         val fileSize = (attrs?.get(NSFileSize) as? NSNumber)?.longValue ?: 0L
-        val fileName = filePath.substringAfterLast("/")
-        return "${fileName}_${fileSize}".hashCode().toString()
+        val modified = (attrs?.get(NSFileModificationDate) as? NSDate)?.timeIntervalSince1970 ?: 0.0
+        return "${filePath}_${fileSize}_${modified}".hashCode().toString()
     }
 
     actual suspend fun grabThumbnail(inputPath: String): String? =
@@ -186,19 +188,11 @@ actual object FFmpegUtils {
         return paths.firstOrNull() as? String ?: NSTemporaryDirectory()
     }
 
-    actual suspend fun cacheInputVideo(fileName: String, data: ByteArray): String =
+    actual suspend fun ingestVideo(fileName: String, source: RawSource): IngestedVideo =
             withContext(Dispatchers.IO) {
-                val cacheDir = getCacheDirectory()
-                val outputPath = "$cacheDir/input_$fileName"
-
-                // Use memScoped to allocate buffer and copy bytes
-                memScoped {
-                    val buffer = allocArrayOf(data)
-                    // dataWithBytes expects CPointer and length
-                    val nsData = NSData.dataWithBytes(bytes = buffer, length = data.size.toULong())
-                    nsData.writeToFile(outputPath, true)
-                }
-
-                outputPath
+                val outputPath = "${getCacheDirectory()}/input_$fileName"
+                val (sha256, size) = VideoIngest.spool(source, Path(outputPath))
+                // FFmpegKit probes files, not our stream; the caller probes when it needs to
+                IngestedVideo(outputPath, size, sha256, probe = null)
             }
 }
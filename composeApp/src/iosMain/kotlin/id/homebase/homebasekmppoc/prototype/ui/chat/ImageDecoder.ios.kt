@@ -3,11 +3,29 @@ package id.homebase.homebasekmppoc.prototype.ui.chat
 import androidx.compose.ui.graphics.ImageBitmap
 import androidx.compose.ui.graphics.toComposeImageBitmap
 import org.jetbrains.skia.Image
+import org.jetbrains.skia.Rect
+import org.jetbrains.skia.SamplingMode
+import org.jetbrains.skia.Surface
 
 /** iOS implementation: Decodes image bytes to ImageBitmap using Skia. */
-actual fun decodeImageBitmap(bytes: ByteArray): ImageBitmap? {
+actual fun decodeImageBitmap(bytes: ByteArray, targetWidth: Int, targetHeight: Int): ImageBitmap? {
     return try {
-        Image.makeFromEncoded(bytes).toComposeImageBitmap()
+        val image = Image.makeFromEncoded(bytes)
+        val (w, h) = coverSize(image.width, image.height, targetWidth, targetHeight)
+            ?: return image.toComposeImageBitmap().also { image.close() }
+        val surface = Surface.makeRasterN32Premul(w, h)
+        surface.canvas.drawImageRect(
+            image,
+            Rect.makeWH(image.width.toFloat(), image.height.toFloat()),
+            Rect.makeWH(w.toFloat(), h.toFloat()),
+            SamplingMode.MITCHELL,
+            null,
+            true
+        )
+        image.close()
+        val scaled = surface.makeImageSnapshot()
+        surface.close()
+        scaled.toComposeImageBitmap().also { scaled.close() }
     } catch (e: Exception) {
         null
     }
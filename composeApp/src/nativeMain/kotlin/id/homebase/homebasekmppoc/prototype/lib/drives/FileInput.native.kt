@@ -3,11 +3,20 @@ package id.homebase.homebasekmppoc.prototype.lib.drives
 import io.ktor.client.request.forms.InputProvider
 import kotlinx.cinterop.ExperimentalForeignApi
 import kotlinx.cinterop.addressOf
+import kotlinx.cinterop.alloc
+import kotlinx.cinterop.convert
+import kotlinx.cinterop.memScoped
+import kotlinx.cinterop.ptr
 import kotlinx.cinterop.usePinned
 import kotlinx.io.Buffer
 import platform.Foundation.NSData
 import platform.Foundation.dataWithContentsOfFile
+import platform.posix.O_RDONLY
+import platform.posix.fstat
 import platform.posix.memcpy
+import platform.posix.open
+import platform.posix.pread
+import platform.posix.stat
 import platform.Foundation.*
 
 @OptIn(ExperimentalForeignApi::class, kotlinx.cinterop.BetaInteropApi::class)
@@ -58,4 +67,32 @@ actual suspend fun writeBytesToTempFile(
 
     data.writeToFile(filePath, atomically = true)
     return filePath
-}
\ No newline at end of file
+}
+
+@OptIn(ExperimentalForeignApi::class)
+actual class RandomAccessFileInput actual constructor(path: String) : AutoCloseable {
+    private val fd = open(path, O_RDONLY).also {
+        if (it < 0) error("Unable to open file at $path")
+    }
+
+    actual val length: Long
+        get() = memScoped {
+            val info = alloc<stat>()
+            if (fstat(fd, info.ptr) != 0) error("Unable to stat open file")
+            info.st_size
+        }
+
+    // pread does not move the file offset, so concurrent reads do not interfere
+    actual fun read(position: Long, buffer: ByteArray, offset: Int, length: Int): Int {
+        if (length == 0) return 0
+        val n = buffer.usePinned { pinned ->
+            pread(fd, pinned.addressOf(offset), length.convert(), position.convert())
+        }
+        if (n < 0) error("Unable to read at $position")
+        return if (n == 0L) -1 else n.toInt()
+    }
+
+    actual override fun close() {
+        platform.posix.close(fd)
+    }
+}